@@ -17,6 +17,7 @@ typedef NS_ENUM(NSInteger, XMPPStreamState) {
 	STATE_XMPP_POST_NEGOTIATION,
 	STATE_XMPP_REGISTERING,
 	STATE_XMPP_AUTH,
+	STATE_XMPP_COMPRESSING,
 	STATE_XMPP_BINDING,
 	STATE_XMPP_START_SESSION,
 	STATE_XMPP_CONNECTED,
@@ -12,11 +12,24 @@ enum XMPPJIDCompareOptions
 typedef enum XMPPJIDCompareOptions XMPPJIDCompareOptions;
 
 
+/**
+ * A JID is stored as a single string (the full JID), along with the lengths of its parts.
+ * So the full JID (and the bare JID, for JIDs without a resource) is available without creating a new string,
+ * and comparing two JIDs typically requires only a single string comparison.
+ * 
+ * The user, domain and resource are created from the full JID when requested.
+**/
 @interface XMPPJID : NSObject <NSSecureCoding, NSCopying>
 {
-	__strong NSString *user;
-	__strong NSString *domain;
-	__strong NSString *resource;
+	__strong NSString *jidStr;
+	
+	uint32_t userLength;
+	uint32_t domainLength;
+	BOOL hasUser;
+	BOOL hasResource;
+	
+	NSUInteger cachedHash;
+	void *cachedBareJID;
 }
 
 + (XMPPJID *)jidWithString:(NSString *)jidStr;
@@ -71,4 +84,26 @@ typedef enum XMPPJIDCompareOptions XMPPJIDCompareOptions;
 - (BOOL)isEqualToJID:(XMPPJID *)aJID;
 - (BOOL)isEqualToJID:(XMPPJID *)aJID options:(XMPPJIDCompareOptions)mask;
 
+/**
+ * Parsing a JID string requires running stringprep on each of its parts, which is relatively expensive.
+ * Yet most of the JIDs an application encounters (e.g. the 'to' and 'from' of incoming stanzas)
+ * are the same few hundred JIDs over and over again.
+ * 
+ * So jidWithString: keeps a bounded cache that maps raw JID strings to the (immutable) parsed XMPPJID instances.
+ * When the cache is full, the least recently used entries are evicted (using the CLOCK approximation).
+ * The cache is thread-safe.
+ * 
+ * The default capacity is 1024 entries.
+ * Setting the capacity removes all cached entries. Setting it to zero disables the cache.
+ * 
+ * The hit and miss counters are reset by removeAllCachedJIDs (and when the capacity is changed).
+**/
++ (NSUInteger)jidCacheCapacity;
++ (void)setJIDCacheCapacity:(NSUInteger)capacity;
+
++ (NSUInteger)jidCacheHitCount;
++ (NSUInteger)jidCacheMissCount;
+
++ (void)removeAllCachedJIDs;
+
 @end
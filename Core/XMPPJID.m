@@ -1,10 +1,254 @@
 #import "XMPPJID.h"
 #import "XMPPStringPrep.h"
+#import <pthread.h>
 
 #if ! __has_feature(objc_arc)
 #warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
 #endif
 
+#define XMPP_JID_CACHE_DEFAULT_CAPACITY 1024
+
+/**
+ * A bounded cache of parsed JIDs, keyed by the raw JID string.
+ * 
+ * Eviction uses the CLOCK algorithm (an approximation of LRU).
+ * Every slot has a reference bit, which is set whenever the entry is used.
+ * When a slot is needed, the clock hand sweeps the slots, clearing reference bits,
+ * and evicts the first entry it finds that hasn't been used since the last sweep.
+ * This means a cache hit only has to set a bit, rather than reordering a list.
+**/
+@interface XMPPJIDCache : NSObject
+{
+	pthread_mutex_t mutex;
+	
+	NSUInteger capacity;
+	NSUInteger hand;
+	
+	CFMutableDictionaryRef table; // jidStr -> slot index
+	NSMutableArray *slotKeys;
+	NSMutableArray *slotJIDs;
+	uint8_t *referenced;
+	
+	NSUInteger hitCount;
+	NSUInteger missCount;
+}
+
++ (XMPPJIDCache *)sharedInstance;
+
+- (NSUInteger)capacity;
+- (void)setCapacity:(NSUInteger)newCapacity;
+
+- (XMPPJID *)jidForString:(NSString *)jidStr;
+- (void)setJID:(XMPPJID *)jid forString:(NSString *)jidStr;
+
+- (NSUInteger)hitCount;
+- (NSUInteger)missCount;
+
+- (void)removeAllJIDs;
+
+@end
+
+@implementation XMPPJIDCache
+
++ (XMPPJIDCache *)sharedInstance
+{
+	static XMPPJIDCache *sharedInstance;
+	static dispatch_once_t onceToken;
+	
+	dispatch_once(&onceToken, ^{
+		
+		sharedInstance = [[XMPPJIDCache alloc] init];
+	});
+	
+	return sharedInstance;
+}
+
+- (id)init
+{
+	if ((self = [super init]))
+	{
+		pthread_mutex_init(&mutex, NULL);
+		
+		[self _allocateWithCapacity:XMPP_JID_CACHE_DEFAULT_CAPACITY];
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[self _deallocate];
+	
+	pthread_mutex_destroy(&mutex);
+}
+
+- (void)_allocateWithCapacity:(NSUInteger)newCapacity
+{
+	capacity = newCapacity;
+	hand = 0;
+	
+	table = CFDictionaryCreateMutable(NULL, newCapacity, &kCFTypeDictionaryKeyCallBacks, NULL);
+	slotKeys = [[NSMutableArray alloc] initWithCapacity:newCapacity];
+	slotJIDs = [[NSMutableArray alloc] initWithCapacity:newCapacity];
+	referenced = calloc(MAX(newCapacity, 1), sizeof(uint8_t));
+	
+	hitCount = 0;
+	missCount = 0;
+}
+
+- (void)_deallocate
+{
+	if (table) {
+		CFRelease(table);
+		table = NULL;
+	}
+	if (referenced) {
+		free(referenced);
+		referenced = NULL;
+	}
+	
+	slotKeys = nil;
+	slotJIDs = nil;
+}
+
+- (NSUInteger)capacity
+{
+	NSUInteger result;
+	
+	pthread_mutex_lock(&mutex);
+	result = capacity;
+	pthread_mutex_unlock(&mutex);
+	
+	return result;
+}
+
+- (void)setCapacity:(NSUInteger)newCapacity
+{
+	pthread_mutex_lock(&mutex);
+	
+	[self _deallocate];
+	[self _allocateWithCapacity:newCapacity];
+	
+	pthread_mutex_unlock(&mutex);
+}
+
+- (XMPPJID *)jidForString:(NSString *)jidStr
+{
+	XMPPJID *result = nil;
+	
+	pthread_mutex_lock(&mutex);
+	
+	if (capacity > 0)
+	{
+		const void *value = NULL;
+		
+		if (CFDictionaryGetValueIfPresent(table, (__bridge const void *)jidStr, &value))
+		{
+			NSUInteger slot = (NSUInteger)value;
+			
+			referenced[slot] = 1;
+			result = slotJIDs[slot];
+			
+			hitCount++;
+		}
+		else
+		{
+			missCount++;
+		}
+	}
+	
+	pthread_mutex_unlock(&mutex);
+	
+	return result;
+}
+
+- (void)setJID:(XMPPJID *)jid forString:(NSString *)jidStr
+{
+	// The key must be immutable, as it's stored in the table.
+	// This is a no-op for the (typical) immutable string.
+	NSString *key = [jidStr copy];
+	
+	pthread_mutex_lock(&mutex);
+	
+	if ((capacity > 0) && !CFDictionaryContainsKey(table, (__bridge const void *)key))
+	{
+		NSUInteger slot;
+		
+		if ([slotJIDs count] < capacity)
+		{
+			slot = [slotJIDs count];
+			
+			[slotKeys addObject:key];
+			[slotJIDs addObject:jid];
+		}
+		else
+		{
+			// Sweep until we find an entry that hasn't been referenced since the last sweep.
+			// This terminates within a single revolution, as every visited slot has its bit cleared.
+			
+			while (referenced[hand])
+			{
+				referenced[hand] = 0;
+				hand = (hand + 1) % capacity;
+			}
+			
+			slot = hand;
+			hand = (hand + 1) % capacity;
+			
+			CFDictionaryRemoveValue(table, (__bridge const void *)slotKeys[slot]);
+			
+			slotKeys[slot] = key;
+			slotJIDs[slot] = jid;
+		}
+		
+		// New entries start unreferenced, so a JID that is only ever seen once
+		// is evicted before the entries that are actually being reused.
+		referenced[slot] = 0;
+		
+		CFDictionarySetValue(table, (__bridge const void *)key, (const void *)slot);
+	}
+	
+	pthread_mutex_unlock(&mutex);
+}
+
+- (NSUInteger)hitCount
+{
+	NSUInteger result;
+	
+	pthread_mutex_lock(&mutex);
+	result = hitCount;
+	pthread_mutex_unlock(&mutex);
+	
+	return result;
+}
+
+- (NSUInteger)missCount
+{
+	NSUInteger result;
+	
+	pthread_mutex_lock(&mutex);
+	result = missCount;
+	pthread_mutex_unlock(&mutex);
+	
+	return result;
+}
+
+- (void)removeAllJIDs
+{
+	pthread_mutex_lock(&mutex);
+	
+	NSUInteger currentCapacity = capacity;
+	
+	[self _deallocate];
+	[self _allocateWithCapacity:currentCapacity];
+	
+	pthread_mutex_unlock(&mutex);
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 @implementation XMPPJID
 
@@ -110,16 +354,26 @@
 
 + (XMPPJID *)jidWithString:(NSString *)jidStr
 {
+	if (jidStr == nil) return nil;
+	
+	XMPPJIDCache *cache = [XMPPJIDCache sharedInstance];
+	
+	XMPPJID *cachedJID = [cache jidForString:jidStr];
+	if (cachedJID)
+	{
+		return cachedJID;
+	}
+	
 	NSString *user;
 	NSString *domain;
 	NSString *resource;
 	
 	if ([XMPPJID parse:jidStr outUser:&user outDomain:&domain outResource:&resource])
 	{
-		XMPPJID *jid = [[XMPPJID alloc] init];
-		jid->user = [user copy];
-		jid->domain = [domain copy];
-		jid->resource = [resource copy];
+		XMPPJID *jid = [[XMPPJID alloc] initWithPrevalidatedUser:user domain:domain resource:resource];
+		
+		// This class is immutable, so the same instance may safely be handed out again
+		[cache setJID:jid forString:jidStr];
 		
 		return jid;
 	}
@@ -137,12 +391,7 @@
 	
 	if ([XMPPJID parse:jidStr outUser:&user outDomain:&domain outResource:nil])
 	{
-		XMPPJID *jid = [[XMPPJID alloc] init];
-		jid->user = [user copy];
-		jid->domain = [domain copy];
-		jid->resource = [prepResource copy];
-		
-		return jid;
+		return [[XMPPJID alloc] initWithPrevalidatedUser:user domain:domain resource:prepResource];
 	}
 	
 	return nil;
@@ -156,27 +405,53 @@
 	
 	if ([XMPPJID validateUser:prepUser domain:prepDomain resource:prepResource])
 	{
-		XMPPJID *jid = [[XMPPJID alloc] init];
-		jid->user = [prepUser copy];
-		jid->domain = [prepDomain copy];
-		jid->resource = [prepResource copy];
-		
-		return jid;
+		return [[XMPPJID alloc] initWithPrevalidatedUser:prepUser domain:prepDomain resource:prepResource];
 	}
 	
 	return nil;
 }
 
+- (id)initWithPrevalidatedUser:(NSString *)user domain:(NSString *)domain resource:(NSString *)resource
+{
+	if ((self = [super init]))
+	{
+		hasUser = (user != nil);
+		hasResource = (resource != nil);
+		
+		userLength = (uint32_t)[user length];
+		domainLength = (uint32_t)[domain length];
+		
+		if (user)
+		{
+			if (resource)
+				jidStr = [[NSString alloc] initWithFormat:@"%@@%@/%@", user, domain, resource];
+			else
+				jidStr = [[NSString alloc] initWithFormat:@"%@@%@", user, domain];
+		}
+		else
+		{
+			if (resource)
+				jidStr = [[NSString alloc] initWithFormat:@"%@/%@", domain, resource];
+			else
+				jidStr = [domain copy];
+		}
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	if (cachedBareJID)
+	{
+		CFRelease(cachedBareJID);
+	}
+}
+
 + (XMPPJID *)jidWithPrevalidatedUser:(NSString *)user
                   prevalidatedDomain:(NSString *)domain
                 prevalidatedResource:(NSString *)resource
 {
-	XMPPJID *jid = [[XMPPJID alloc] init];
-	jid->user = [user copy];
-	jid->domain = [domain copy];
-	jid->resource = [resource copy];
-	
-	return jid;
+	return [[XMPPJID alloc] initWithPrevalidatedUser:user domain:domain resource:resource];
 }
 
 + (XMPPJID *)jidWithPrevalidatedUser:(NSString *)user
@@ -186,12 +461,36 @@
 	NSString *prepResource = [XMPPStringPrep prepResource:resource];
 	if (![self validateResource:prepResource]) return nil;
 	
-	XMPPJID *jid = [[XMPPJID alloc] init];
-	jid->user = [user copy];
-	jid->domain = [domain copy];
-	jid->resource = [prepResource copy];
-	
-	return jid;
+	return [[XMPPJID alloc] initWithPrevalidatedUser:user domain:domain resource:prepResource];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Cache:
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
++ (NSUInteger)jidCacheCapacity
+{
+	return [[XMPPJIDCache sharedInstance] capacity];
+}
+
++ (void)setJIDCacheCapacity:(NSUInteger)capacity
+{
+	[[XMPPJIDCache sharedInstance] setCapacity:capacity];
+}
+
++ (NSUInteger)jidCacheHitCount
+{
+	return [[XMPPJIDCache sharedInstance] hitCount];
+}
+
++ (NSUInteger)jidCacheMissCount
+{
+	return [[XMPPJIDCache sharedInstance] missCount];
+}
+
++ (void)removeAllCachedJIDs
+{
+	[[XMPPJIDCache sharedInstance] removeAllJIDs];
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -211,36 +510,44 @@
 
 - (id)initWithCoder:(NSCoder *)coder
 {
-	if ((self = [super init]))
+	// The parts are still encoded separately, so the archived format remains the same.
+	
+	NSString *user;
+	NSString *domain;
+	NSString *resource;
+	
+	if ([coder allowsKeyedCoding])
 	{
-		if ([coder allowsKeyedCoding])
-		{
-            if([coder respondsToSelector:@selector(requiresSecureCoding)] &&
-               [coder requiresSecureCoding])
-            {
-                user     = [[coder decodeObjectOfClass:[NSString class] forKey:@"user"] copy];
-                domain   = [[coder decodeObjectOfClass:[NSString class] forKey:@"domain"] copy];
-                resource = [[coder decodeObjectOfClass:[NSString class] forKey:@"resource"] copy];
-            }
-            else
-            {
-                user     = [[coder decodeObjectForKey:@"user"] copy];
-                domain   = [[coder decodeObjectForKey:@"domain"] copy];
-                resource = [[coder decodeObjectForKey:@"resource"] copy];
-            }
-		}
-		else
-		{
-			user     = [[coder decodeObject] copy];
-			domain   = [[coder decodeObject] copy];
-			resource = [[coder decodeObject] copy];
-		}
+        if([coder respondsToSelector:@selector(requiresSecureCoding)] &&
+           [coder requiresSecureCoding])
+        {
+            user     = [coder decodeObjectOfClass:[NSString class] forKey:@"user"];
+            domain   = [coder decodeObjectOfClass:[NSString class] forKey:@"domain"];
+            resource = [coder decodeObjectOfClass:[NSString class] forKey:@"resource"];
+        }
+        else
+        {
+            user     = [coder decodeObjectForKey:@"user"];
+            domain   = [coder decodeObjectForKey:@"domain"];
+            resource = [coder decodeObjectForKey:@"resource"];
+        }
 	}
-	return self;
+	else
+	{
+		user     = [coder decodeObject];
+		domain   = [coder decodeObject];
+		resource = [coder decodeObject];
+	}
+	
+	return [self initWithPrevalidatedUser:user domain:domain resource:resource];
 }
 
 - (void)encodeWithCoder:(NSCoder *)coder
 {
+	NSString *user = [self user];
+	NSString *domain = [self domain];
+	NSString *resource = [self resource];
+	
 	if ([coder allowsKeyedCoding])
 	{
 		[coder encodeObject:user     forKey:@"user"];
@@ -274,77 +581,86 @@
 #pragma mark Normal Methods:
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-// Why didn't we just synthesize these properties?
-// 
-// Since these variables are readonly within the class,
-// we want the synthesized methods to work like a nonatomic property.
-// In order to do this, we have to mark the properties as nonatomic in the header.
-// However we don't like marking the property as nonatomic in the header because
-// then people might think it's not thread-safe when in fact it is.
+- (NSUInteger)domainLocation
+{
+	return hasUser ? (userLength + 1) : 0;
+}
+
+- (NSUInteger)resourceLocation
+{
+	return [self domainLocation] + domainLength + 1;
+}
 
 - (NSString *)user
 {
-	return user; // Why didn't we just synthesize this? See comment above.
+	if (!hasUser) return nil;
+	
+	return [jidStr substringToIndex:userLength];
 }
 
 - (NSString *)domain
 {
-	return domain; // Why didn't we just synthesize this? See comment above.
+	if (!hasUser && !hasResource) return jidStr;
+	
+	return [jidStr substringWithRange:NSMakeRange([self domainLocation], domainLength)];
 }
 
 - (NSString *)resource
 {
-	return resource; // Why didn't we just synthesize this? See comment above.
+	if (!hasResource) return nil;
+	
+	return [jidStr substringFromIndex:[self resourceLocation]];
 }
 
 - (XMPPJID *)bareJID
 {
-	if (resource == nil)
+	if (!hasResource)
 	{
 		return self;
 	}
-	else
+	
+	// This class is immutable, so the bare JID only needs to be created once.
+	// If multiple threads create it concurrently, the first one to store it wins.
+	
+	void *bareJID = cachedBareJID;
+	if (bareJID == NULL)
 	{
-		return [XMPPJID jidWithPrevalidatedUser:user prevalidatedDomain:domain prevalidatedResource:nil];
+		XMPPJID *newBareJID = [[XMPPJID alloc] initWithPrevalidatedUser:[self user]
+		                                                         domain:[self domain]
+		                                                       resource:nil];
+		
+		bareJID = (__bridge_retained void *)newBareJID;
+		
+		if (!__sync_bool_compare_and_swap(&cachedBareJID, NULL, bareJID))
+		{
+			CFRelease(bareJID);
+			bareJID = cachedBareJID;
+		}
 	}
+	
+	return (__bridge XMPPJID *)bareJID;
 }
 
 - (XMPPJID *)domainJID
 {
-	if (user == nil && resource == nil)
+	if (!hasUser && !hasResource)
 	{
 		return self;
 	}
 	else
 	{
-		return [XMPPJID jidWithPrevalidatedUser:nil prevalidatedDomain:domain prevalidatedResource:nil];
+		return [XMPPJID jidWithPrevalidatedUser:nil prevalidatedDomain:[self domain] prevalidatedResource:nil];
 	}
 }
 
 - (NSString *)bare
 {
-	if (user)
-		return [NSString stringWithFormat:@"%@@%@", user, domain];
-	else
-		return domain;
+	return [[self bareJID] full];
 }
 
 - (NSString *)full
 {
-	if (user)
-	{
-		if (resource)
-			return [NSString stringWithFormat:@"%@@%@/%@", user, domain, resource];
-		else
-			return [NSString stringWithFormat:@"%@@%@", user, domain];
-	}
-	else
-	{
-		if (resource)
-			return [NSString stringWithFormat:@"%@/%@", domain, resource];
-		else
-			return domain;
-	}
+	return jidStr;
 }
 
 - (BOOL)isBare
@@ -354,12 +670,12 @@
 	// The term "bare JID" refers to an XMPP address of the form <localpart@domainpart> (for an account at a server)
 	// or of the form <domainpart> (for a server).
 	
-	return (resource == nil);
+	return !hasResource;
 }
 
 - (BOOL)isBareWithUser
 {
-	return (user != nil && resource == nil);
+	return (hasUser && !hasResource);
 }
 
 - (BOOL)isFull
@@ -370,22 +686,22 @@
 	// <localpart@domainpart/resourcepart> (for a particular authorized client or device associated with an account)
 	// or of the form <domainpart/resourcepart> (for a particular resource or script associated with a server).
 	
-	return (resource != nil);
+	return hasResource;
 }
 
 - (BOOL)isFullWithUser
 {
-	return (user != nil && resource != nil);
+	return (hasUser && hasResource);
 }
 
 - (BOOL)isServer
 {
-	return (user == nil);
+	return !hasUser;
 }
 
 - (XMPPJID *)jidWithNewResource:(NSString *)newResource
 {
-	return [XMPPJID jidWithPrevalidatedUser:user prevalidatedDomain:domain resource:newResource];
+	return [XMPPJID jidWithPrevalidatedUser:[self user] prevalidatedDomain:[self domain] resource:newResource];
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -394,153 +710,24 @@
 
 - (NSUInteger)hash
 {
-	// We used to do this:
-	// return [[self full] hash];
-	//
-	// It was functional but less than optimal because it required the creation of a new NSString everytime.
-	// Now the hashing of a string itself is extremely fast,
-	// so combining 3 hashes is much faster than creating a new string.
-	// To accomplish this we use the murmur hashing algorithm.
+	// We used to combine the hashes of the user, domain and resource (using MurmurHash2),
+	// since hashing the full JID required creating a new string every time.
+	// Now the full JID is what we store, so we can simply hash it.
 	// 
-	// MurmurHash2 was written by Austin Appleby, and is placed in the public domain.
-	// http://code.google.com/p/smhasher
-	
-	NSUInteger uhash = [user hash];
-	NSUInteger dhash = [domain hash];
-	NSUInteger rhash = [resource hash];
-	
-	if (NSUIntegerMax == UINT32_MAX) // Should be optimized out via compiler since these are constants
-	{
-		// MurmurHash2 (32-bit)
-		//
-		// uint32_t MurmurHash2 ( const void * key, int len, uint32_t seed )
-		// 
-		// Normally one would pass a chunk of data ('key') and associated data chunk length ('len').
-		// Instead we're going to use our 3 hashes.
-		// And we're going to randomly make up a 'seed'.
-		
-		const uint32_t seed = 0xa2f1b6f; // Some random value I made up
-		const uint32_t len = 12;         // 3 hashes, each 4 bytes = 12 bytes
-		
-		// 'm' and 'r' are mixing constants generated offline.
-		// They're not really 'magic', they just happen to work well.
-		
-		const uint32_t m = 0x5bd1e995;
-		const int r = 24;
-		
-		// Initialize the hash to a 'random' value
-		
-		uint32_t h = seed ^ len;
-		uint32_t k;
-		
-		// Mix uhash
-		
-		k = uhash;
-		
-		k *= m;
-		k ^= k >> r;
-		k *= m;
-		
-		h *= m;
-		h ^= k;
-		
-		// Mix dhash
-		
-		k = dhash;
-		
-		k *= m;
-		k ^= k >> r;
-		k *= m;
-		
-		h *= m;
-		h ^= k;
-		
-		// Mix rhash
-		
-		k = rhash;
-		
-		k *= m;
-		k ^= k >> r;
-		k *= m;
-		
-		h *= m;
-		h ^= k;
-		
-		// Do a few final mixes of the hash to ensure the last few
-		// bytes are well-incorporated.
-		
-		h ^= h >> 13;
-		h *= m;
-		h ^= h >> 15;
-		
-		return (NSUInteger)h;
-	}
-	else
+	// Two JIDs are equal if their full JIDs (and the lengths of their parts) are equal,
+	// so equal JIDs are guaranteed to have the same hash.
+	// 
+	// This class is immutable, so the hash only needs to be calculated once.
+	// Concurrent first invocations simply calculate (and store) the same value.
+	
+	NSUInteger result = cachedHash;
+	if (result == 0)
 	{
-		// MurmurHash2 (64-bit)
-		// 
-		// uint64_t MurmurHash64A ( const void * key, int len, uint64_t seed )
-		// 
-		// Normally one would pass a chunk of data ('key') and associated data chunk length ('len').
-		// Instead we're going to use our 3 hashes.
-		// And we're going to randomly make up a 'seed'.
-		
-		const uint32_t seed = 0xa2f1b6f; // Some random value I made up
-		const uint32_t len = 24;         // 3 hashes, each 8 bytes = 24 bytes
-		
-		// 'm' and 'r' are mixing constants generated offline.
-		// They're not really 'magic', they just happen to work well.
-		
-		const uint64_t m = 0xc6a4a7935bd1e995LLU;
-		const int r = 47;
-		
-		// Initialize the hash to a 'random' value
-		
-		uint64_t h = seed ^ (len * m);
-		uint64_t k;
-		
-		// Mix uhash
-		
-		k = uhash;
-		
-		k *= m; 
-		k ^= k >> r; 
-		k *= m; 
-		
-		h ^= k;
-		h *= m;
-		
-		// Mix dhash
-		
-		k = dhash;
-		
-		k *= m; 
-		k ^= k >> r; 
-		k *= m; 
-		
-		h ^= k;
-		h *= m;
-		
-		// Mix rhash
-		
-		k = rhash;
-		
-		k *= m; 
-		k ^= k >> r; 
-		k *= m; 
-		
-		h ^= k;
-		h *= m;
-		
-		// Do a few final mixes of the hash to ensure the last few
-		// bytes are well-incorporated.
-		
-		h ^= h >> r;
-		h *= m;
-		h ^= h >> r;
-		
-		return (NSUInteger)h;
+		result = [jidStr hash];
+		cachedHash = result;
 	}
+	
+	return result;
 }
 
 - (BOOL)isEqual:(id)anObject
@@ -557,38 +744,99 @@
 	return [self isEqualToJID:aJID options:XMPPJIDCompareFull];
 }
 
+/**
+ * Compares a part of one full JID with a part of another (of the same length),
+ * without creating substrings for them.
+**/
+static BOOL XMPPJIDPartsEqual(NSString *str1, NSUInteger location1, NSString *str2, NSUInteger location2, NSUInteger length)
+{
+	unichar buffer1[64];
+	unichar buffer2[64];
+	
+	while (length > 0)
+	{
+		NSUInteger chunkLength = MIN(length, (NSUInteger)64);
+		
+		[str1 getCharacters:buffer1 range:NSMakeRange(location1, chunkLength)];
+		[str2 getCharacters:buffer2 range:NSMakeRange(location2, chunkLength)];
+		
+		if (memcmp(buffer1, buffer2, chunkLength * sizeof(unichar)) != 0) return NO;
+		
+		location1 += chunkLength;
+		location2 += chunkLength;
+		length -= chunkLength;
+	}
+	
+	return YES;
+}
+
 - (BOOL)isEqualToJID:(XMPPJID *)aJID options:(XMPPJIDCompareOptions)mask
 {
 	if (aJID == nil) return NO;
+	if (aJID == self) return YES;
+	
+	BOOL compareUser     = (mask & XMPPJIDCompareUser) != 0;
+	BOOL compareDomain   = (mask & XMPPJIDCompareDomain) != 0;
+	BOOL compareResource = (mask & XMPPJIDCompareResource) != 0;
 	
-	if (mask & XMPPJIDCompareUser)
+	// First compare the structure (which parts are present, and their lengths).
+	// This rules out most unequal JIDs without looking at the strings.
+	
+	if (compareUser)
 	{
-		if (user) {
-			if (![user isEqualToString:aJID->user]) return NO;
-		}
-		else {
-			if (aJID->user) return NO;
-		}
+		if (hasUser != aJID->hasUser) return NO;
+		if (userLength != aJID->userLength) return NO;
 	}
 	
-	if (mask & XMPPJIDCompareDomain)
+	if (compareDomain)
 	{
-		if (domain) {
-			if (![domain isEqualToString:aJID->domain]) return NO;
-		}
-		else {
-			if (aJID->domain) return NO;
-		}
+		if (domainLength != aJID->domainLength) return NO;
 	}
 	
-	if (mask & XMPPJIDCompareResource)
+	if (compareResource)
 	{
-		if (resource) {
-			if (![resource isEqualToString:aJID->resource]) return NO;
-		}
-		else {
-			if (aJID->resource) return NO;
-		}
+		if (hasResource != aJID->hasResource) return NO;
+		if (hasResource && ([jidStr length] - [self resourceLocation]) !=
+		                   ([aJID->jidStr length] - [aJID resourceLocation])) return NO;
+	}
+	
+	// The full and bare comparisons (by far the most common) each require a single string comparison.
+	
+	if (compareUser && compareDomain && compareResource)
+	{
+		return [jidStr isEqualToString:aJID->jidStr];
+	}
+	
+	if (compareUser && compareDomain && !hasResource && !aJID->hasResource)
+	{
+		return [jidStr isEqualToString:aJID->jidStr];
+	}
+	
+	if (compareUser && compareDomain)
+	{
+		return [[self bare] isEqualToString:[aJID bare]];
+	}
+	
+	// Other combinations compare the parts individually.
+	// The parts may be at different locations within the two strings (e.g. comparing only the domain).
+	
+	if (compareUser && hasUser)
+	{
+		if (!XMPPJIDPartsEqual(jidStr, 0, aJID->jidStr, 0, userLength)) return NO;
+	}
+	
+	if (compareDomain)
+	{
+		if (!XMPPJIDPartsEqual(jidStr, [self domainLocation],
+		                       aJID->jidStr, [aJID domainLocation], domainLength)) return NO;
+	}
+	
+	if (compareResource && hasResource)
+	{
+		NSUInteger resourceLength = [jidStr length] - [self resourceLocation];
+		
+		if (!XMPPJIDPartsEqual(jidStr, [self resourceLocation],
+		                       aJID->jidStr, [aJID resourceLocation], resourceLength)) return NO;
 	}
 	
 	return YES;
@@ -4,6 +4,39 @@
   #import "DDXML.h"
 #endif
 
+/**
+ * The kind of a top-level element (a direct child of the stream's root element),
+ * as determined by the parser when it reads the element's start tag.
+**/
+typedef NS_ENUM(NSInteger, XMPPParserElementKind) {
+	XMPPParserElementKindOther = 0,
+	XMPPParserElementKindIQ,             // <iq/>
+	XMPPParserElementKindMessage,        // <message/>
+	XMPPParserElementKindPresence,       // <presence/>
+	XMPPParserElementKindStreamError,    // <stream:error/>
+	XMPPParserElementKindStreamFeatures, // <stream:features/>
+};
+
+/**
+ * Information about a top-level element, extracted while parsing its start tag.
+ * 
+ * This allows the delegate to route the element without having to
+ * compare element names, or walk the element's attributes again.
+**/
+@interface XMPPParserElementInfo : NSObject
+
+@property (nonatomic, readonly) XMPPParserElementKind kind;
+
+@property (nonatomic, readonly) NSString *type;      // The 'type' attribute, or nil
+@property (nonatomic, readonly) NSString *elementID; // The 'id' attribute, or nil
+@property (nonatomic, readonly) NSString *fromStr;   // The 'from' attribute, or nil
+@property (nonatomic, readonly) NSString *toStr;     // The 'to' attribute, or nil
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 @interface XMPPParser : NSObject
 
@@ -15,6 +48,9 @@
 /**
  * Asynchronously parses the given data.
  * The delegate methods will be dispatch_async'd as events occur.
+ * 
+ * If the delegate implements xmppParser:didReadElements:info:,
+ * the elements parsed from the given data are delivered in a single batch.
 **/
 - (void)parseData:(NSData *)data;
 
@@ -31,6 +67,25 @@
 
 - (void)xmppParser:(XMPPParser *)sender didReadElement:(NSXMLElement *)element;
 
+/**
+ * If implemented, this method is invoked instead of xmppParser:didReadElement:,
+ * and includes the information the parser extracted from the element's start tag.
+**/
+- (void)xmppParser:(XMPPParser *)sender didReadElement:(NSXMLElement *)element info:(XMPPParserElementInfo *)info;
+
+/**
+ * If implemented, this method is invoked instead of the methods above.
+ * 
+ * All the top-level elements parsed from a single invocation of parseData: are delivered together,
+ * in a single dispatch to the delegateQueue (followed immediately by xmppParserDidParseData:).
+ * This avoids dispatching a separate block for every element when a chunk of data contains many elements,
+ * such as a large roster push or a burst of presence.
+ * 
+ * The info array is parallel to the elements array.
+ * It contains the XMPPParserElementInfo for each element (or NSNull if unavailable).
+**/
+- (void)xmppParser:(XMPPParser *)sender didReadElements:(NSArray *)elements info:(NSArray *)infoArray;
+
 - (void)xmppParserDidEnd:(XMPPParser *)sender;
 
 - (void)xmppParser:(XMPPParser *)sender didFail:(NSError *)error;
@@ -20,10 +20,34 @@
         }                                           \
     } while(false)
 
+static void xmpp_xmlAbortDueToMemoryShortage(xmlParserCtxt *ctxt);
+
 #if !TARGET_OS_IPHONE
   static void xmpp_recursiveAddChild(NSXMLElement *parent, xmlNodePtr childNode);
 #endif
 
+// On Mac OS X the parser builds NSXMLElements directly from the SAX callbacks.
+// This avoids building every element twice (first as a libxml tree, and then again as an NSXMLElement tree).
+// 
+// Set this to 0 to fallback to building a libxml tree, and converting each element after it has been parsed.
+#ifndef XMPP_PARSER_DIRECT_NSXML
+  #define XMPP_PARSER_DIRECT_NSXML 1
+#endif
+
+// The maximum number of interned names (element names, attribute names, namespaces) cached by the parser.
+#define XMPP_PARSER_MAX_CACHED_STRINGS 1024
+
+@interface XMPPParserElementInfo ()
+
+@property (nonatomic, readwrite) XMPPParserElementKind kind;
+
+@property (nonatomic, readwrite) NSString *type;
+@property (nonatomic, readwrite) NSString *elementID;
+@property (nonatomic, readwrite) NSString *fromStr;
+@property (nonatomic, readwrite) NSString *toStr;
+
+@end
+
 @implementation XMPPParser
 {
 	#if __has_feature(objc_arc_weak)
@@ -40,6 +64,128 @@
 	unsigned depth;
 	
 	xmlParserCtxt *parserCtxt;
+	
+	XMPPParserElementInfo *elementInfo;
+	
+	NSMutableArray *pendingElements;
+	NSMutableArray *pendingElementInfo;
+	
+	#if !TARGET_OS_IPHONE
+	NSMutableArray *elementStack;
+	NSMutableString *pendingText;
+	CFMutableDictionaryRef stringCache;
+	#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Element Info
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Determines the kind of a top-level element from its start tag.
+**/
+static XMPPParserElementKind xmpp_elementKind(const xmlChar *localName, const xmlChar *prefix)
+{
+	if (localName == NULL) return XMPPParserElementKindOther;
+	
+	if (prefix == NULL)
+	{
+		if (xmlStrEqual(localName, BAD_CAST "iq"))       return XMPPParserElementKindIQ;
+		if (xmlStrEqual(localName, BAD_CAST "message"))  return XMPPParserElementKindMessage;
+		if (xmlStrEqual(localName, BAD_CAST "presence")) return XMPPParserElementKindPresence;
+	}
+	
+	if (prefix == NULL || xmlStrEqual(prefix, BAD_CAST "stream"))
+	{
+		if (xmlStrEqual(localName, BAD_CAST "error"))    return XMPPParserElementKindStreamError;
+		if (xmlStrEqual(localName, BAD_CAST "features")) return XMPPParserElementKindStreamFeatures;
+	}
+	
+	return XMPPParserElementKindOther;
+}
+
+/**
+ * Records the given (non-namespaced) attribute of a top-level element, if it's one we extract.
+**/
+static void xmpp_recordElementInfoAttribute(XMPPParserElementInfo *info, const xmlChar *name, const xmlChar *value)
+{
+	if (info == nil || name == NULL || value == NULL) return;
+	
+	// Remember: The NSString initWithUTF8String raises an exception if passed NULL
+	
+	if (xmlStrEqual(name, BAD_CAST "type"))
+		info.type = [[NSString alloc] initWithUTF8String:(const char *)value];
+	else if (xmlStrEqual(name, BAD_CAST "id"))
+		info.elementID = [[NSString alloc] initWithUTF8String:(const char *)value];
+	else if (xmlStrEqual(name, BAD_CAST "from"))
+		info.fromStr = [[NSString alloc] initWithUTF8String:(const char *)value];
+	else if (xmlStrEqual(name, BAD_CAST "to"))
+		info.toStr = [[NSString alloc] initWithUTF8String:(const char *)value];
+}
+
+/**
+ * Delivers a complete top-level element to the delegate,
+ * along with the info extracted from its start tag (if the delegate wants it).
+**/
+static void xmpp_dispatchDidReadElement(XMPPParser *parser, NSXMLElement *element)
+{
+	XMPPParserElementInfo *info = parser->elementInfo;
+	parser->elementInfo = nil;
+	
+	if (parser->pendingElements)
+	{
+		// The delegate supports batches.
+		// The element will be delivered along with the others parsed from the same chunk of data.
+		
+		[parser->pendingElements addObject:element];
+		[parser->pendingElementInfo addObject:(info ? info : [NSNull null])];
+		return;
+	}
+	
+	if (parser->delegateQueue == NULL) return;
+	
+	__strong id theDelegate = parser->delegate;
+	
+	if ([theDelegate respondsToSelector:@selector(xmppParser:didReadElement:info:)])
+	{
+		dispatch_async(parser->delegateQueue, ^{ @autoreleasepool {
+			
+			[theDelegate xmppParser:parser didReadElement:element info:info];
+		}});
+	}
+	else if ([theDelegate respondsToSelector:@selector(xmppParser:didReadElement:)])
+	{
+		dispatch_async(parser->delegateQueue, ^{ @autoreleasepool {
+			
+			[theDelegate xmppParser:parser didReadElement:element];
+		}});
+	}
+}
+
+/**
+ * Delivers any batched elements to the delegate.
+ * 
+ * This must be invoked prior to dispatching any other delegate method,
+ * in order to ensure the delegate receives everything in the order it was parsed.
+**/
+static void xmpp_flushPendingElements(XMPPParser *parser)
+{
+	if ([parser->pendingElements count] == 0) return;
+	
+	NSArray *elements = parser->pendingElements;
+	NSArray *infos = parser->pendingElementInfo;
+	
+	parser->pendingElements = [[NSMutableArray alloc] init];
+	parser->pendingElementInfo = [[NSMutableArray alloc] init];
+	
+	if (parser->delegateQueue == NULL) return;
+	
+	__strong id theDelegate = parser->delegate;
+	
+	dispatch_async(parser->delegateQueue, ^{ @autoreleasepool {
+		
+		[theDelegate xmppParser:parser didReadElements:elements info:infos];
+	}});
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -67,6 +213,8 @@ static void xmpp_onDidReadRoot(XMPPParser *parser, xmlNodePtr root)
 		xmlNodePtr rootCopy = xmlCopyNode(root, 2);
 		DDXMLElement *rootCopyWrapper = [DDXMLElement nodeWithElementPrimitive:rootCopy owner:nil];
 		
+		xmpp_flushPendingElements(parser);
+		
 		__strong id theDelegate = parser->delegate;
 		
 		dispatch_async(parser->delegateQueue, ^{ @autoreleasepool {
@@ -96,15 +244,7 @@ static void xmpp_onDidReadElement(XMPPParser *parser, xmlNodePtr child)
 	// Note: We want to detach the child from the root even if the delegate method isn't setup.
 	// This prevents the doc from growing infinitely large.
 	
-	if (parser->delegateQueue && [parser->delegate respondsToSelector:@selector(xmppParser:didReadElement:)])
-	{
-		__strong id theDelegate = parser->delegate;
-		
-		dispatch_async(parser->delegateQueue, ^{ @autoreleasepool {
-			
-			[theDelegate xmppParser:parser didReadElement:childWrapper];
-		}});
-	}
+	xmpp_dispatchDidReadElement(parser, childWrapper);
 	
 	// Note: DDXMLElement will properly free the child when it's deallocated.
 }
@@ -303,6 +443,8 @@ static void xmpp_onDidReadRoot(XMPPParser *parser, xmlNodePtr root)
 	{
 		NSXMLElement *nsRoot = xmpp_nsxmlFromLibxml(root);
 		
+		xmpp_flushPendingElements(parser);
+		
 		__strong id theDelegate = parser->delegate;
 		
 		dispatch_async(parser->delegateQueue, ^{ @autoreleasepool {
@@ -314,16 +456,17 @@ static void xmpp_onDidReadRoot(XMPPParser *parser, xmlNodePtr root)
 
 static void xmpp_onDidReadElement(XMPPParser *parser, xmlNodePtr child)
 {
-	if (parser->delegateQueue && [parser->delegate respondsToSelector:@selector(xmppParser:didReadElement:)])
+	if (parser->delegateQueue && (parser->pendingElements ||
+	                              [parser->delegate respondsToSelector:@selector(xmppParser:didReadElement:info:)] ||
+	                              [parser->delegate respondsToSelector:@selector(xmppParser:didReadElement:)]))
 	{
 		NSXMLElement *nsChild = xmpp_nsxmlFromLibxml(child);
 		
-		__strong id theDelegate = parser->delegate;
-		
-		dispatch_async(parser->delegateQueue, ^{ @autoreleasepool {
-		
-			[theDelegate xmppParser:parser didReadElement:nsChild];
-		}});
+		xmpp_dispatchDidReadElement(parser, nsChild);
+	}
+	else
+	{
+		parser->elementInfo = nil;
 	}
 	
 	// Note: We want to detach the child from the root even if the delegate method isn't setup.
@@ -334,6 +477,307 @@ static void xmpp_onDidReadElement(XMPPParser *parser, xmlNodePtr child)
 	xmlFreeNode(child);
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Mac (Direct)
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Returns an NSString for the given libxml string.
+ * 
+ * The names passed to the SAX2 callbacks (localname, prefix, URI, attribute names) are interned
+ * in the parser's dictionary, so the same pointer is handed to us every time we see the same name.
+ * We take advantage of this to avoid decoding the same handful of names (iq, message, presence, jabber:client, ...)
+ * over and over again.
+**/
+static NSString* xmpp_nsxmlString(XMPPParser *parser, xmlParserCtxt *ctxt, const xmlChar *str)
+{
+	if (str == NULL) return nil;
+	
+	NSString *result = (__bridge NSString *)CFDictionaryGetValue(parser->stringCache, str);
+	if (result) return result;
+	
+	// Remember: The NSString initWithUTF8String raises an exception if passed NULL
+	
+	result = [[NSString alloc] initWithUTF8String:(const char *)str];
+	
+	if (ctxt->dict && (xmlDictOwns(ctxt->dict, str) == 1) &&
+	    (CFDictionaryGetCount(parser->stringCache) < XMPP_PARSER_MAX_CACHED_STRINGS))
+	{
+		CFDictionarySetValue(parser->stringCache, str, (__bridge const void *)result);
+	}
+	
+	return result;
+}
+
+static NSString* xmpp_nsxmlQualifiedName(NSString *prefix, NSString *localName)
+{
+	if (prefix == nil) return localName;
+	
+	return [[NSString alloc] initWithFormat:@"%@:%@", prefix, localName];
+}
+
+/**
+ * Searches the ancestors of the element currently being parsed for a namespace declaration with the given prefix.
+ * 
+ * Just like xmpp_xmlSearchNs, we skip the root node,
+ * since elements are delivered detached from the root (and thus can't reference its namespaces).
+**/
+static BOOL xmpp_nsxmlSearchNs(XMPPParser *parser, NSString *prefix)
+{
+	NSString *nsName = prefix ? prefix : @"";
+	
+	NSUInteger count = [parser->elementStack count];
+	for (NSUInteger i = count; i > 1; i--)
+	{
+		NSXMLElement *ancestor = parser->elementStack[i - 1];
+		
+		for (NSXMLNode *ns in [ancestor namespaces])
+		{
+			if ([[ns name] isEqualToString:nsName])
+				return YES;
+		}
+	}
+	
+	return NO;
+}
+
+/**
+ * Adds any text collected since the last start/end tag to the element currently being parsed.
+**/
+static void xmpp_nsxmlFlushText(XMPPParser *parser)
+{
+	if (parser->pendingText == nil) return;
+	
+	// Text that isn't within an element (e.g. whitespace between stanzas) is discarded.
+	
+	if ([parser->elementStack count] > 1)
+	{
+		NSXMLElement *element = [parser->elementStack lastObject];
+		[element addChild:[NSXMLNode textWithStringValue:parser->pendingText]];
+	}
+	
+	parser->pendingText = nil;
+}
+
+/**
+ * SAX parser C-style callback.
+ * Invoked when a new node element is started.
+ * 
+ * This is the NSXMLElement equivalent of xmpp_xmlStartElement.
+**/
+static void xmpp_nsxmlStartElement(void *ctx, const xmlChar  *nodeName,
+                                              const xmlChar  *nodePrefix,
+                                              const xmlChar  *nodeUri,
+                                                        int   nb_namespaces,
+                                              const xmlChar **namespaces,
+                                                        int   nb_attributes,
+                                                        int   nb_defaulted,
+                                              const xmlChar **attributes)
+{
+	int i, j;
+	
+	xmlParserCtxt *ctxt = (xmlParserCtxt *)ctx;
+	XMPPParser *parser = (__bridge XMPPParser *)ctxt->_private;
+	
+	// Any text we've seen so far belongs to the parent, and comes before this element
+	xmpp_nsxmlFlushText(parser);
+	
+	NSString *prefix = xmpp_nsxmlString(parser, ctxt, nodePrefix);
+	NSString *localName = xmpp_nsxmlString(parser, ctxt, nodeName);
+	
+	NSXMLElement *element = [[NSXMLElement alloc] initWithName:xmpp_nsxmlQualifiedName(prefix, localName)];
+	
+	// Is this a top-level element (a direct child of the root)?
+	XMPPParserElementInfo *info = nil;
+	if (parser->depth == 1)
+	{
+		info = [[XMPPParserElementInfo alloc] init];
+		info.kind = xmpp_elementKind(nodeName, nodePrefix);
+		
+		parser->elementInfo = info;
+	}
+	
+	// Process the namespaces
+	BOOL foundNs = NO;
+	
+	for (i = 0, j = 0; j < nb_namespaces; j++)
+	{
+		const xmlChar *nsPrefix = namespaces[i++];
+		const xmlChar *nsUri    = namespaces[i++];
+		
+		if (nsUri == NULL)
+		{
+			// Namespace doesn't have a value!
+			continue;
+		}
+		
+		NSString *nsName = xmpp_nsxmlString(parser, ctxt, nsPrefix);
+		NSString *nsValue = xmpp_nsxmlString(parser, ctxt, nsUri);
+		
+		[element addNamespace:[NSXMLNode namespaceWithName:(nsName ? nsName : @"") stringValue:nsValue]];
+		
+		if (nodeUri && (nodePrefix == nsPrefix))
+		{
+			foundNs = YES;
+		}
+	}
+	
+	// If the element's namespace is declared outside the element (e.g. in the root),
+	// then declare it within the element, so the element is complete once it's detached from the stream.
+	
+	if (nodeUri && !foundNs && !xmpp_nsxmlSearchNs(parser, prefix))
+	{
+		NSString *nsValue = xmpp_nsxmlString(parser, ctxt, nodeUri);
+		
+		[element addNamespace:[NSXMLNode namespaceWithName:(prefix ? prefix : @"") stringValue:nsValue]];
+	}
+	
+	// Process all the attributes
+	for (i = 0, j = 0; j < nb_attributes; j++)
+	{
+		const xmlChar *attrName   = attributes[i++];
+		const xmlChar *attrPrefix = attributes[i++];
+		i++; // attrUri
+		const xmlChar *valueBegin = attributes[i++];
+		const xmlChar *valueEnd   = attributes[i++];
+		
+		if (attrName == NULL)
+		{
+			// Attribute doesn't have a name!
+			continue;
+		}
+		
+		// The attribute value might contain character references which need to be decoded.
+		// 
+		// "Franks &#38; Beans" -> "Franks & Beans"
+		
+		xmlChar *value = xmlStringLenDecodeEntities(ctxt,                    // the parser context
+		                                            valueBegin,              // the input string
+		                                      (int)(valueEnd - valueBegin),  // the input string length
+		                                           (XML_SUBSTITUTE_REF),     // what to substitue
+		                                            0, 0, 0);                // end markers, 0 if none
+		CHECK_FOR_NULL(value);
+		
+		NSString *name = xmpp_nsxmlQualifiedName(xmpp_nsxmlString(parser, ctxt, attrPrefix),
+		                                         xmpp_nsxmlString(parser, ctxt, attrName));
+		NSString *stringValue = [[NSString alloc] initWithUTF8String:(const char *)value];
+		
+		if (info && (attrPrefix == NULL))
+		{
+			xmpp_recordElementInfoAttribute(info, attrName, value);
+		}
+		
+		xmlFree(value);
+		
+		[element addAttribute:[NSXMLNode attributeWithName:name stringValue:stringValue]];
+	}
+	
+	// Add the element to the tree.
+	// Elements directly within the root are delivered detached, so they're never added to the root.
+	
+	if ([parser->elementStack count] > 1)
+	{
+		[[parser->elementStack lastObject] addChild:element];
+	}
+	
+	[parser->elementStack addObject:element];
+	parser->depth++;
+	
+	if (!(parser->hasReportedRoot) && (parser->depth == 1))
+	{
+		// We've received the full root - report it to the delegate
+		
+		if (parser->delegateQueue && [parser->delegate respondsToSelector:@selector(xmppParser:didReadRoot:)])
+		{
+			// We copy the root to allow the delegate to retain and make changes to it
+			// without affecting the underlying xmpp parser.
+			
+			NSXMLElement *rootCopy = [element copy];
+			
+			xmpp_flushPendingElements(parser);
+			
+			__strong id theDelegate = parser->delegate;
+			
+			dispatch_async(parser->delegateQueue, ^{ @autoreleasepool {
+				
+				[theDelegate xmppParser:parser didReadRoot:rootCopy];
+			}});
+		}
+		
+		parser->hasReportedRoot = YES;
+	}
+}
+
+/**
+ * SAX parser C-style callback.
+ * Invoked when characters are found within a node.
+ * 
+ * This is the NSXMLElement equivalent of xmpp_xmlCharacters.
+**/
+static void xmpp_nsxmlCharacters(void *ctx, const xmlChar *ch, int len)
+{
+	xmlParserCtxt *ctxt = (xmlParserCtxt *)ctx;
+	XMPPParser *parser = (__bridge XMPPParser *)ctxt->_private;
+	
+	// Ignore anything outside of a stanza (e.g. whitespace keep-alives)
+	if (parser->depth < 2) return;
+	
+	NSString *text = [[NSString alloc] initWithBytes:ch length:len encoding:NSUTF8StringEncoding];
+	if (text == nil) return;
+	
+	// Adjacent text is merged into a single text node (just like xmlAddChild does)
+	
+	if (parser->pendingText == nil)
+		parser->pendingText = [text mutableCopy];
+	else
+		[parser->pendingText appendString:text];
+}
+
+/**
+ * SAX parser C-style callback.
+ * Invoked when a new node element is ended.
+ * 
+ * This is the NSXMLElement equivalent of xmpp_xmlEndElement.
+**/
+static void xmpp_nsxmlEndElement(void *ctx, const xmlChar *localname,
+                                            const xmlChar *prefix,
+                                            const xmlChar *URI)
+{
+	xmlParserCtxt *ctxt = (xmlParserCtxt *)ctx;
+	XMPPParser *parser = (__bridge XMPPParser *)ctxt->_private;
+	
+	xmpp_nsxmlFlushText(parser);
+	
+	NSXMLElement *element = [parser->elementStack lastObject];
+	[parser->elementStack removeLastObject];
+	
+	parser->depth--;
+	
+	if (parser->depth == 1)
+	{
+		// End of full xmpp element.
+		// That is, a child of the root element.
+		
+		xmpp_dispatchDidReadElement(parser, element);
+	}
+	else if (parser->depth == 0)
+	{
+		// End of the root element
+		
+		if (parser->delegateQueue && [parser->delegate respondsToSelector:@selector(xmppParserDidEnd:)])
+		{
+			xmpp_flushPendingElements(parser);
+			
+			__strong id theDelegate = parser->delegate;
+			
+			dispatch_async(parser->delegateQueue, ^{ @autoreleasepool {
+				
+				[theDelegate xmppParserDidEnd:parser];
+			}});
+		}
+	}
+}
+
 #endif
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -404,6 +848,8 @@ static void xmpp_postEndElement(xmlParserCtxt *ctxt)
 		
 		if (parser->delegateQueue && [parser->delegate respondsToSelector:@selector(xmppParserDidEnd:)])
 		{
+			xmpp_flushPendingElements(parser);
+			
 			__strong id theDelegate = parser->delegate;
 			
 			dispatch_async(parser->delegateQueue, ^{ @autoreleasepool {
@@ -430,6 +876,8 @@ static void xmpp_xmlAbortDueToMemoryShortage(xmlParserCtxt *ctxt)
 		
 		NSError *error = [NSError errorWithDomain:@"libxmlErrorDomain" code:1001 userInfo:info];
 		
+		xmpp_flushPendingElements(parser);
+		
 		__strong id theDelegate = parser->delegate;
 		
 		dispatch_async(parser->delegateQueue, ^{ @autoreleasepool {
@@ -499,6 +947,18 @@ static void	xmpp_xmlStartElement(void *ctx, const xmlChar  *nodeName,
 	xmlNsPtr lastAddedNs = NULL;
 	
 	xmlParserCtxt *ctxt = (xmlParserCtxt *)ctx;
+	XMPPParser *parser = (__bridge XMPPParser *)ctxt->_private;
+	
+	// Is this a top-level element (a direct child of the root)?
+	// If so, classify it now, while we have the raw name and attributes at hand.
+	XMPPParserElementInfo *info = nil;
+	if (parser->depth == 1)
+	{
+		info = [[XMPPParserElementInfo alloc] init];
+		info.kind = xmpp_elementKind(nodeName, nodePrefix);
+		
+		parser->elementInfo = info;
+	}
 	
 	// We store the parent node in the context's node pointer.
 	// We keep this updated by "pushing" the node in the startElement method,
@@ -636,6 +1096,11 @@ static void	xmpp_xmlStartElement(void *ctx, const xmlChar  *nodeName,
 			}
 		}
 		
+		if (info && (attrPrefix == NULL))
+		{
+			xmpp_recordElementInfoAttribute(info, attrName, value);
+		}
+		
 		xmlFree(value);
 	}
 	
@@ -724,9 +1189,28 @@ static void xmpp_xmlEndElement(void *ctx, const xmlChar *localname,
 		memset(&saxHandler, 0, sizeof(xmlSAXHandler));
 		
 		saxHandler.initialized = XML_SAX2_MAGIC;
+		
+	#if TARGET_OS_IPHONE
 		saxHandler.startElementNs = xmpp_xmlStartElement;
 		saxHandler.characters = xmpp_xmlCharacters;
 		saxHandler.endElementNs = xmpp_xmlEndElement;
+	#else
+		if (XMPP_PARSER_DIRECT_NSXML)
+		{
+			saxHandler.startElementNs = xmpp_nsxmlStartElement;
+			saxHandler.characters = xmpp_nsxmlCharacters;
+			saxHandler.endElementNs = xmpp_nsxmlEndElement;
+		}
+		else
+		{
+			saxHandler.startElementNs = xmpp_xmlStartElement;
+			saxHandler.characters = xmpp_xmlCharacters;
+			saxHandler.endElementNs = xmpp_xmlEndElement;
+		}
+		
+		elementStack = [[NSMutableArray alloc] init];
+		stringCache = CFDictionaryCreateMutable(NULL, 0, NULL, &kCFTypeDictionaryValueCallBacks);
+	#endif
 		
 		// Create the push parser context
 		parserCtxt = xmlCreatePushParserCtxt(&saxHandler, NULL, NULL, 0, NULL);
@@ -760,6 +1244,11 @@ static void xmpp_xmlEndElement(void *ctx, const xmlChar *localname,
 		xmlFreeParserCtxt(parserCtxt);
 	}
 	
+	#if !TARGET_OS_IPHONE
+	if (stringCache)
+		CFRelease(stringCache);
+	#endif
+	
 	#if !OS_OBJECT_USE_OBJC
 	if (delegateQueue)
 		dispatch_release(delegateQueue);
@@ -796,23 +1285,55 @@ static void xmpp_xmlEndElement(void *ctx, const xmlChar *localname,
 - (void)parseData:(NSData *)data
 {
 	dispatch_block_t block = ^{ @autoreleasepool {
-	
+		
+		// If the delegate supports it, we deliver all the elements parsed from this chunk of data in a single batch.
+		// This means a single dispatch to the delegateQueue per chunk, rather than one per element.
+		
+		if (delegateQueue && [delegate respondsToSelector:@selector(xmppParser:didReadElements:info:)])
+		{
+			pendingElements = [[NSMutableArray alloc] init];
+			pendingElementInfo = [[NSMutableArray alloc] init];
+		}
+		
 		int result = xmlParseChunk(parserCtxt, (const char *)[data bytes], (int)[data length], 0);
 		
+		NSArray *elements = pendingElements;
+		NSArray *infos = pendingElementInfo;
+		
+		pendingElements = nil;
+		pendingElementInfo = nil;
+		
 		if (result == 0)
 		{
-			if (delegateQueue && [delegate respondsToSelector:@selector(xmppParserDidParseData:)])
+			BOOL notifyDidParseData = [delegate respondsToSelector:@selector(xmppParserDidParseData:)];
+			
+			if (delegateQueue && ([elements count] > 0 || notifyDidParseData))
 			{
 				__strong id theDelegate = delegate;
 				
 				dispatch_async(delegateQueue, ^{ @autoreleasepool {
 					
-					[theDelegate xmppParserDidParseData:self];
+					if ([elements count] > 0) {
+						[theDelegate xmppParser:self didReadElements:elements info:infos];
+					}
+					if (notifyDidParseData) {
+						[theDelegate xmppParserDidParseData:self];
+					}
 				}});
 			}
 		}
 		else
 		{
+			if (delegateQueue && [elements count] > 0)
+			{
+				__strong id theDelegate = delegate;
+				
+				dispatch_async(delegateQueue, ^{ @autoreleasepool {
+					
+					[theDelegate xmppParser:self didReadElements:elements info:infos];
+				}});
+			}
+			
 			if (delegateQueue && [delegate respondsToSelector:@selector(xmppParser:didFail:)])
 			{
 				NSError *error;
@@ -848,3 +1369,17 @@ static void xmpp_xmlEndElement(void *ctx, const xmlChar *localname,
 }
 
 @end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPParserElementInfo
+
+@synthesize kind;
+@synthesize type;
+@synthesize elementID;
+@synthesize fromStr;
+@synthesize toStr;
+
+@end
@@ -191,6 +191,56 @@ extern const NSTimeInterval XMPPStreamTimeoutNone;
 **/
 @property (readwrite, assign) char keepAliveWhitespaceCharacter;
 
+/**
+ * Write coalescing allows multiple outgoing stanzas to be combined into a single socket write.
+ * 
+ * By default every stanza is handed to the socket individually,
+ * which results in a separate write (and, on secure connections, a separate TLS record) per stanza.
+ * Bursty senders (e.g. MUC messages, presence broadcasts, stream management resends)
+ * can benefit greatly from combining these writes.
+ * 
+ * If the writeCoalescingInterval is greater than zero, stanzas sent while the stream is connected
+ * are buffered for up to the given interval, and then written to the socket together.
+ * If the buffered data reaches the writeCoalescingMaxLength, it is written immediately.
+ * 
+ * Element receipts (see sendElement:andGetReceipt:) are still signalled per stanza,
+ * as soon as the write containing the stanza has completed.
+ * 
+ * Stream negotiation, and the closing of the stream, are never delayed.
+ * 
+ * The default writeCoalescingInterval is zero (disabled).
+ * A reasonable value is on the order of a few milliseconds (e.g. 0.002).
+ * 
+ * The default writeCoalescingMaxLength is 16384, which corresponds to the maximum size of a TLS record.
+**/
+@property (readwrite, assign) NSTimeInterval writeCoalescingInterval;
+@property (readwrite, assign) NSUInteger writeCoalescingMaxLength;
+
+/**
+ * Delegates that implement the xmppStream:willReceiveX: methods are normally invoked one stanza at a time.
+ * That is, a received stanza passes through every filter before the next stanza enters the first filter.
+ * So a single slow filter stalls all inbound traffic, and the throughput is bounded by the sum of the filter latencies.
+ * 
+ * If enablePipelinedReceiveFilters is set, the filters are pipelined instead.
+ * Each stanza still passes through the filters one at a time (in the same order),
+ * and each filter is still invoked on its own delegate queue,
+ * but stanza N+1 may be in the first filter while stanza N is in the second.
+ * The results are reordered before delivery,
+ * so stanzas (and xmppStreamDidFilterStanza: notifications) are still delivered in the order they were received.
+ * 
+ * This means a filter may be invoked for one stanza while another filter is handling a different stanza.
+ * Filters that share state with each other (outside their own delegate queue) should leave this disabled.
+ * 
+ * As with the serial mode, the number of stanzas waiting on a slow filter is not limited;
+ * received stanzas are queued on the filters' delegate queues (and in the reorder buffer) until they catch up.
+ * Stanzas still in the filters when the stream disconnects are dropped.
+ * 
+ * This property should be set before connecting.
+ * 
+ * The default value is NO.
+**/
+@property (readwrite, assign) BOOL enablePipelinedReceiveFilters;
+
 /**
  * Represents the last sent presence element concerning the presence of myJID on the server.
  * In other words, it represents the presence as others see us.
@@ -547,11 +597,33 @@ extern const NSTimeInterval XMPPStreamTimeoutNone;
  * Returns whether or not the given compression method name was specified in the
  * server's list of supported compression methods.
  *
- * Note: The XMPPStream doesn't currently support any compression methods 
+ * Note: The XMPPStream currently supports only the "zlib" compression method.
+ * @see enableZlibCompression
 **/
 
 - (BOOL)supportsCompressionMethod:(NSString *)compressionMethod;
 
+/**
+ * If set, the stream will negotiate zlib stream compression (XEP-0138) if the server offers it.
+ * 
+ * Compression is negotiated after authentication and before resource binding,
+ * as recommended by XEP-0170 (Recommended Order of Stream Feature Negotiation).
+ * Once negotiated, all data sent and received on the stream is compressed,
+ * and numberOfBytesSent / numberOfBytesReceived reflect the compressed byte counts.
+ * 
+ * If the server refuses the compress request, the stream simply continues uncompressed.
+ * 
+ * This must be set before connecting (or at least before authentication completes).
+ * 
+ * The default value is NO.
+**/
+@property (readwrite, assign) BOOL enableZlibCompression;
+
+/**
+ * Returns YES if stream compression has been negotiated for the current stream.
+**/
+- (BOOL)isCompressed;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark Server Info
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -706,6 +778,33 @@ extern const NSTimeInterval XMPPStreamTimeoutNone;
 **/
 - (void)enumerateModulesOfClass:(Class)aClass withBlock:(void (^)(XMPPModule *module, NSUInteger idx, BOOL *stop))block;
 
+/**
+ * Registers the given module as the owner of the response to the given IQ request.
+ * 
+ * By default, every received IQ is offered to every module (via xmppStream:didReceiveIQ:),
+ * and each module checks whether or not it's a response to one of its own requests.
+ * When a module registers its outgoing requests here, the stream keeps an id -> module routing table,
+ * and the matching result/error IQ is delivered (via xmppStream:didReceiveIQ:, on the moduleQueue)
+ * to the owning module only, without being broadcast to the other delegates.
+ * The other delegates are instead notified via xmppStreamDidFilterStanza:,
+ * so extensions that track all received stanzas (such as XEP-0198 stream management) still account for it.
+ * 
+ * The module must implement xmppStream:didReceiveIQ:, otherwise the route isn't registered.
+ * 
+ * The response is validated against the request (see isValidResponseElement:forRequestElement:).
+ * Responses that fail validation, and responses to requests that weren't registered, are broadcast as usual.
+ * 
+ * The route is removed when the response arrives, when the timeout expires (if the timeout is positive),
+ * when removeResponseRouteForID: is invoked, or when the stream disconnects.
+ * 
+ * The IQ should be registered before it is sent.
+ * These methods are thread-safe, and may be invoked on any thread/queue.
+**/
+- (void)routeResponseToIQ:(XMPPIQ *)iq toModule:(XMPPModule *)module;
+- (void)routeResponseToIQ:(XMPPIQ *)iq toModule:(XMPPModule *)module timeout:(NSTimeInterval)timeout;
+
+- (void)removeResponseRouteForID:(NSString *)elementID;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark Utilities
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -929,6 +1028,8 @@ extern const NSTimeInterval XMPPStreamTimeoutNone;
  * 
  * Concerning thread-safety, delegates implementing the method are invoked one-at-a-time to
  * allow thread-safe modification of the given elements.
+ * (This also holds if enablePipelinedReceiveFilters is set, though different delegates may then be
+ * handling different stanzas at the same time.)
  *
  * You should NOT implement these methods unless you have good reason to do so.
  * For general processing and notification of received elements, please use xmppStream:didReceiveX: methods.
@@ -942,7 +1043,8 @@ extern const NSTimeInterval XMPPStreamTimeoutNone;
 - (XMPPPresence *)xmppStream:(XMPPStream *)sender willReceivePresence:(XMPPPresence *)presence;
 
 /**
- * This method is called if any of the xmppStream:willReceiveX: methods filter the incoming stanza.
+ * This method is called if any of the xmppStream:willReceiveX: methods filter the incoming stanza,
+ * or if an IQ response is delivered directly to the module that registered for it (see routeResponseToIQ:toModule:).
  * 
  * It may be useful for some extensions to know that something was received,
  * even if it was filtered for some reason.
@@ -4,6 +4,8 @@
 #import "XMPPInternal.h"
 #import "XMPPIDTracker.h"
 #import "XMPPSRVResolver.h"
+#import "XMPPZlibCompression.h"
+#import "XMPPElementSerializer.h"
 #import "NSData+XMPP.h"
 
 #import <objc/runtime.h>
@@ -37,6 +39,9 @@
 #define TIMEOUT_XMPP_READ_START    10
 #define TIMEOUT_XMPP_READ_STREAM   -1
 
+// Define the default maximum length of a coalesced write (the maximum size of a TLS record)
+#define DEFAULT_WRITE_COALESCING_MAX_LENGTH  16384
+
 // Define the tags we'll use to differentiate what it is we're currently reading or writing
 #define TAG_XMPP_READ_START         100
 #define TAG_XMPP_READ_STREAM        101
@@ -44,6 +49,7 @@
 #define TAG_XMPP_WRITE_STOP         201
 #define TAG_XMPP_WRITE_STREAM       202
 #define TAG_XMPP_WRITE_RECEIPT      203
+#define TAG_XMPP_WRITE_COALESCED    204
 
 // Define the timeouts (in seconds) for SRV
 #define TIMEOUT_SRV_RESOLUTION 30.0
@@ -59,6 +65,7 @@ enum XMPPStreamFlags
 	kIsSecure                     = 1 << 1,  // If set, connection has been secured via SSL/TLS
 	kIsAuthenticated              = 1 << 2,  // If set, authentication has succeeded
 	kDidStartNegotiation          = 1 << 3,  // If set, negotiation has started at least once
+	kIsCompressed                 = 1 << 4,  // If set, stream compression (XEP-0138) is active
 };
 
 enum XMPPStreamConfig
@@ -68,6 +75,7 @@ enum XMPPStreamConfig
 #if TARGET_OS_IPHONE
 	kEnableBackgroundingOnSocket  = 1 << 2,  // If set, the VoIP flag should be set on the socket
 #endif
+	kEnableZlibCompression        = 1 << 3,  // If set, zlib stream compression should be negotiated if available
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -85,6 +93,12 @@ enum XMPPStreamConfig
 	
 	dispatch_queue_t willReceiveStanzaQueue;
 	
+	BOOL enablePipelinedReceiveFilters;
+	uint64_t pipelinedReceiveGeneration;
+	uint64_t nextPipelinedReceiveSequence;
+	uint64_t nextPipelinedDeliverySequence;
+	NSMutableDictionary *pipelinedReceiveResults;
+	
 	dispatch_queue_t didReceiveIqQueue;
     
 	dispatch_source_t connectTimer;
@@ -94,6 +108,8 @@ enum XMPPStreamConfig
 	XMPPStreamState state;
 	
 	GCDAsyncSocket *asyncSocket;
+	XMPPZlibCompression *zlibCompression;
+	XMPPElementSerializer *elementSerializer;
 	
 	uint64_t numberOfBytesSent;
 	uint64_t numberOfBytesReceived;
@@ -128,6 +144,13 @@ enum XMPPStreamConfig
 	NSTimeInterval lastSendReceiveTime;
 	NSData *keepAliveData;
 	
+	NSTimeInterval writeCoalescingInterval;
+	NSUInteger writeCoalescingMaxLength;
+	dispatch_source_t writeCoalescingTimer;
+	NSMutableData *coalescedData;
+	NSUInteger coalescedReceiptCount;
+	NSMutableArray *coalescedWriteReceiptCounts;
+	
 	NSMutableArray *registeredModules;
 	NSMutableDictionary *autoDelegateDict;
 	
@@ -136,6 +159,7 @@ enum XMPPStreamConfig
 	NSUInteger srvResultsIndex;
     
     XMPPIDTracker *idTracker;
+	XMPPConcurrentIDTracker *iqResponseRouter;
 	
 	NSMutableArray *receipts;
 	NSCountedSet *customElementNames;
@@ -189,10 +213,15 @@ enum XMPPStreamConfig
 	keepAliveInterval = DEFAULT_KEEPALIVE_INTERVAL;
 	keepAliveData = [@" " dataUsingEncoding:NSUTF8StringEncoding];
 	
+	writeCoalescingInterval = 0.0;
+	writeCoalescingMaxLength = DEFAULT_WRITE_COALESCING_MAX_LENGTH;
+	coalescedWriteReceiptCounts = [[NSMutableArray alloc] init];
+	
 	registeredModules = [[NSMutableArray alloc] init];
 	autoDelegateDict = [[NSMutableDictionary alloc] init];
     
     idTracker = [[XMPPIDTracker alloc] initWithStream:self dispatchQueue:xmppQueue];
+	iqResponseRouter = [[XMPPConcurrentIDTracker alloc] initWithStream:self dispatchQueue:xmppQueue];
 	
 	receipts = [[NSMutableArray alloc] init];
 }
@@ -265,8 +294,14 @@ enum XMPPStreamConfig
 	{
 		dispatch_source_cancel(keepAliveTimer);
 	}
+	
+	if (writeCoalescingTimer)
+	{
+		dispatch_source_cancel(writeCoalescingTimer);
+	}
     
     [idTracker removeAllIDs];
+	[iqResponseRouter removeAllIDs];
     
 	for (XMPPElementReceipt *receipt in receipts)
 	{
@@ -588,6 +623,103 @@ enum XMPPStreamConfig
 		dispatch_async(xmppQueue, block);
 }
 
+- (NSTimeInterval)writeCoalescingInterval
+{
+	__block NSTimeInterval result = 0.0;
+	
+	dispatch_block_t block = ^{
+		result = writeCoalescingInterval;
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
+	
+	return result;
+}
+
+- (void)setWriteCoalescingInterval:(NSTimeInterval)interval
+{
+	dispatch_block_t block = ^{
+		
+		writeCoalescingInterval = MAX(interval, 0.0);
+		
+		if (writeCoalescingInterval == 0.0)
+		{
+			// Coalescing disabled - don't hold on to anything
+			[self flushCoalescedData];
+		}
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_async(xmppQueue, block);
+}
+
+- (NSUInteger)writeCoalescingMaxLength
+{
+	__block NSUInteger result = 0;
+	
+	dispatch_block_t block = ^{
+		result = writeCoalescingMaxLength;
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
+	
+	return result;
+}
+
+- (void)setWriteCoalescingMaxLength:(NSUInteger)maxLength
+{
+	dispatch_block_t block = ^{
+		
+		writeCoalescingMaxLength = maxLength;
+		
+		if ([coalescedData length] >= writeCoalescingMaxLength)
+		{
+			[self flushCoalescedData];
+		}
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_async(xmppQueue, block);
+}
+
+- (BOOL)enablePipelinedReceiveFilters
+{
+	__block BOOL result = NO;
+	
+	dispatch_block_t block = ^{
+		result = enablePipelinedReceiveFilters;
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
+	
+	return result;
+}
+
+- (void)setEnablePipelinedReceiveFilters:(BOOL)flag
+{
+	dispatch_block_t block = ^{
+		enablePipelinedReceiveFilters = flag;
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_async(xmppQueue, block);
+}
+
 - (uint64_t)numberOfBytesSent
 {
 	__block uint64_t result = 0;
@@ -670,6 +802,37 @@ enum XMPPStreamConfig
 		dispatch_async(xmppQueue, block);
 }
 
+- (BOOL)enableZlibCompression
+{
+	__block BOOL result = NO;
+	
+	dispatch_block_t block = ^{
+		result = (config & kEnableZlibCompression) ? YES : NO;
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_sync(xmppQueue, block);
+	
+	return result;
+}
+
+- (void)setEnableZlibCompression:(BOOL)flag
+{
+	dispatch_block_t block = ^{
+		if (flag)
+			config |= kEnableZlibCompression;
+		else
+			config &= ~kEnableZlibCompression;
+	};
+	
+	if (dispatch_get_specific(xmppQueueTag))
+		block();
+	else
+		dispatch_async(xmppQueue, block);
+}
+
 - (BOOL)skipStartSession
 {
     __block BOOL result = NO;
@@ -1439,9 +1602,7 @@ enum XMPPStreamConfig
 				NSData *termData = [termStr dataUsingEncoding:NSUTF8StringEncoding];
 				
 				XMPPLogSend(@"SEND: %@", termStr);
-				numberOfBytesSent += [termData length];
-				
-				[asyncSocket writeData:termData withTimeout:TIMEOUT_XMPP_WRITE tag:TAG_XMPP_WRITE_STOP];
+				[self writeData:termData withTag:TAG_XMPP_WRITE_STOP];
 				[asyncSocket disconnectAfterWriting];
 				
 				// Everthing will be handled in socketDidDisconnect:withError:
@@ -1532,11 +1693,7 @@ enum XMPPStreamConfig
 	NSData *outgoingData = [starttls dataUsingEncoding:NSUTF8StringEncoding];
 	
 	XMPPLogSend(@"SEND: %@", starttls);
-	numberOfBytesSent += [outgoingData length];
-	
-	[asyncSocket writeData:outgoingData
-			   withTimeout:TIMEOUT_XMPP_WRITE
-					   tag:TAG_XMPP_WRITE_STREAM];
+	[self writeData:outgoingData withTag:TAG_XMPP_WRITE_STREAM];
 }
 
 - (BOOL)secureConnection:(NSError **)errPtr
@@ -1684,15 +1841,7 @@ enum XMPPStreamConfig
 		XMPPIQ *iq = [XMPPIQ iqWithType:@"set"];
 		[iq addChild:queryElement];
 		
-		NSString *outgoingStr = [iq compactXMLString];
-		NSData *outgoingData = [outgoingStr dataUsingEncoding:NSUTF8StringEncoding];
-		
-		XMPPLogSend(@"SEND: %@", outgoingStr);
-		numberOfBytesSent += [outgoingData length];
-		
-		[asyncSocket writeData:outgoingData
-		           withTimeout:TIMEOUT_XMPP_WRITE
-		                   tag:TAG_XMPP_WRITE_STREAM];
+		[self writeElement:iq withTag:TAG_XMPP_WRITE_STREAM];
 		
 		// Update state
 		state = STATE_XMPP_REGISTERING;
@@ -2139,6 +2288,27 @@ enum XMPPStreamConfig
 	return result;
 }
 
+/**
+ * Returns YES if stream compression (XEP-0138) has been negotiated for the current stream.
+**/
+- (BOOL)isCompressed
+{
+	if (dispatch_get_specific(xmppQueueTag))
+	{
+		return (flags & kIsCompressed) ? YES : NO;
+	}
+	else
+	{
+		__block BOOL result;
+		
+		dispatch_sync(xmppQueue, ^{
+			result = (flags & kIsCompressed) ? YES : NO;
+		});
+		
+		return result;
+	}
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark General Methods
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -2192,6 +2362,176 @@ enum XMPPStreamConfig
 	}
 }
 
+/**
+ * Private method.
+ * All outgoing data is written to the socket through this method.
+ * 
+ * If write coalescing is enabled, stanzas are buffered and written together (see flushCoalescedData).
+ * Anything else (stream negotiation, closing the stream) first flushes the buffer,
+ * so the order of data on the wire always matches the order in which it was written.
+**/
+- (void)writeData:(NSData *)data withTag:(long)tag
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	BOOL canCoalesce = (writeCoalescingInterval > 0.0) &&
+	                   (state == STATE_XMPP_CONNECTED) &&
+	                   (tag == TAG_XMPP_WRITE_STREAM || tag == TAG_XMPP_WRITE_RECEIPT);
+	
+	if (!canCoalesce)
+	{
+		[self flushCoalescedData];
+		[self writeDataToSocket:data withTag:tag];
+		return;
+	}
+	
+	if (coalescedData == nil)
+	{
+		coalescedData = [[NSMutableData alloc] initWithCapacity:writeCoalescingMaxLength];
+	}
+	
+	BOOL wasEmpty = ([coalescedData length] == 0);
+	
+	[coalescedData appendData:data];
+	
+	if (tag == TAG_XMPP_WRITE_RECEIPT)
+	{
+		coalescedReceiptCount++;
+	}
+	
+	if ([coalescedData length] >= writeCoalescingMaxLength)
+	{
+		[self flushCoalescedData];
+	}
+	else if (wasEmpty)
+	{
+		[self startWriteCoalescingTimer];
+	}
+}
+
+/**
+ * Private method.
+ * Writes any coalesced data to the socket as a single write.
+ * 
+ * Element receipts are signalled in order, so we only need to remember
+ * how many receipts are pending for each coalesced write.
+**/
+- (void)flushCoalescedData
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	if (writeCoalescingTimer)
+	{
+		dispatch_source_cancel(writeCoalescingTimer);
+		writeCoalescingTimer = NULL;
+	}
+	
+	if ([coalescedData length] == 0) return;
+	
+	// Hand the buffer itself to the socket (no copy), and start a fresh one for the next batch.
+	NSData *data = coalescedData;
+	coalescedData = nil;
+	
+	if (coalescedReceiptCount > 0)
+	{
+		[coalescedWriteReceiptCounts addObject:@(coalescedReceiptCount)];
+		coalescedReceiptCount = 0;
+		
+		[self writeDataToSocket:data withTag:TAG_XMPP_WRITE_COALESCED];
+	}
+	else
+	{
+		[self writeDataToSocket:data withTag:TAG_XMPP_WRITE_STREAM];
+	}
+}
+
+- (void)startWriteCoalescingTimer
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	if (writeCoalescingTimer) return;
+	
+	writeCoalescingTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, xmppQueue);
+	
+	dispatch_source_set_event_handler(writeCoalescingTimer, ^{ @autoreleasepool {
+		
+		[self flushCoalescedData];
+	}});
+	
+	#if !OS_OBJECT_USE_OBJC
+	dispatch_source_t theWriteCoalescingTimer = writeCoalescingTimer;
+	
+	dispatch_source_set_cancel_handler(writeCoalescingTimer, ^{
+		XMPPLogVerbose(@"dispatch_release(writeCoalescingTimer)");
+		dispatch_release(theWriteCoalescingTimer);
+	});
+	#endif
+	
+	dispatch_time_t tt = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(writeCoalescingInterval * NSEC_PER_SEC));
+	
+	dispatch_source_set_timer(writeCoalescingTimer, tt, DISPATCH_TIME_FOREVER, 0);
+	dispatch_resume(writeCoalescingTimer);
+}
+
+/**
+ * Private method.
+ * 
+ * If stream compression has been negotiated, the data is compressed before being handed to the socket.
+ * The byte count reflects what actually goes over the wire.
+**/
+- (void)writeDataToSocket:(NSData *)data withTag:(long)tag
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	if (zlibCompression)
+	{
+		data = [zlibCompression compressData:data];
+		
+		if (data == nil)
+		{
+			NSString *errMsg = @"Unable to compress outgoing data.";
+			NSDictionary *info = @{NSLocalizedDescriptionKey : errMsg};
+			
+			otherError = [NSError errorWithDomain:XMPPZlibCompressionErrorDomain code:0 userInfo:info];
+			[asyncSocket disconnect];
+			
+			return;
+		}
+	}
+	
+	numberOfBytesSent += [data length];
+	
+	[asyncSocket writeData:data
+	           withTimeout:TIMEOUT_XMPP_WRITE
+	                   tag:tag];
+}
+
+/**
+ * Private method.
+ * Serializes the given element and writes it to the socket.
+ * 
+ * The element is serialized directly into UTF-8 data (see XMPPElementSerializer).
+ * An NSString representation is only created if send logging is enabled.
+**/
+- (void)writeElement:(NSXMLElement *)element withTag:(long)tag
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	if (elementSerializer == nil)
+	{
+		elementSerializer = [[XMPPElementSerializer alloc] init];
+	}
+	
+	NSData *outgoingData = [elementSerializer dataForElement:element];
+	if (outgoingData == nil)
+	{
+		outgoingData = [[element compactXMLString] dataUsingEncoding:NSUTF8StringEncoding];
+	}
+	
+	XMPPLogSend(@"SEND: %@", [[NSString alloc] initWithData:outgoingData encoding:NSUTF8StringEncoding]);
+	[self writeData:outgoingData withTag:tag];
+}
+
 - (void)sendIQ:(XMPPIQ *)iq withTag:(long)tag
 {
 	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
@@ -2414,17 +2754,9 @@ enum XMPPStreamConfig
 	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
 	NSAssert(state == STATE_XMPP_CONNECTED, @"Invoked with incorrect state");
 	
-	NSString *outgoingStr = [iq compactXMLString];
-	NSData *outgoingData = [outgoingStr dataUsingEncoding:NSUTF8StringEncoding];
+	[self writeElement:iq withTag:tag];
 	
-	XMPPLogSend(@"SEND: %@", outgoingStr);
-	numberOfBytesSent += [outgoingData length];
-	
-	[asyncSocket writeData:outgoingData
-	           withTimeout:TIMEOUT_XMPP_WRITE
-	                   tag:tag];
-	
-	[multicastDelegate xmppStream:self didSendIQ:iq];
+	[multicastDelegate invokeSelector:@selector(xmppStream:didSendIQ:) withObject:self withObject:iq];
 }
 
 - (void)continueSendMessage:(XMPPMessage *)message withTag:(long)tag
@@ -2432,21 +2764,13 @@ enum XMPPStreamConfig
 	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
 	NSAssert(state == STATE_XMPP_CONNECTED, @"Invoked with incorrect state");
 	
-	NSString *outgoingStr = [message compactXMLString];
-	NSData *outgoingData = [outgoingStr dataUsingEncoding:NSUTF8StringEncoding];
-	
-	XMPPLogSend(@"SEND: %@", outgoingStr);
-	numberOfBytesSent += [outgoingData length];
-	
-	[asyncSocket writeData:outgoingData
-	           withTimeout:TIMEOUT_XMPP_WRITE
-	                   tag:tag];
+	[self writeElement:message withTag:tag];
 	
-	[multicastDelegate xmppStream:self didSendMessage:message];
+	[multicastDelegate invokeSelector:@selector(xmppStream:didSendMessage:) withObject:self withObject:message];
 }
 
 - (void)callDidSendMessage:(XMPPMessage *)message {
-    [multicastDelegate xmppStream:self didSendMessage:message];
+    [multicastDelegate invokeSelector:@selector(xmppStream:didSendMessage:) withObject:self withObject:message];
 }
 
 - (void)continueSendPresence:(XMPPPresence *)presence withTag:(long)tag
@@ -2454,15 +2778,7 @@ enum XMPPStreamConfig
 	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
 	NSAssert(state == STATE_XMPP_CONNECTED, @"Invoked with incorrect state");
 	
-	NSString *outgoingStr = [presence compactXMLString];
-	NSData *outgoingData = [outgoingStr dataUsingEncoding:NSUTF8StringEncoding];
-	
-	XMPPLogSend(@"SEND: %@", outgoingStr);
-	numberOfBytesSent += [outgoingData length];
-	
-	[asyncSocket writeData:outgoingData
-	           withTimeout:TIMEOUT_XMPP_WRITE
-	                   tag:tag];
+	[self writeElement:presence withTag:tag];
 	
 	// Update myPresence if this is a normal presence element.
 	// In other words, ignore presence subscription stuff, MUC room stuff, etc.
@@ -2479,7 +2795,7 @@ enum XMPPStreamConfig
 		}
 	}
 	
-	[multicastDelegate xmppStream:self didSendPresence:presence];
+	[multicastDelegate invokeSelector:@selector(xmppStream:didSendPresence:) withObject:self withObject:presence];
 }
 
 - (void)continueSendElement:(NSXMLElement *)element withTag:(long)tag
@@ -2487,15 +2803,7 @@ enum XMPPStreamConfig
 	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
 	NSAssert(state == STATE_XMPP_CONNECTED, @"Invoked with incorrect state");
 	
-	NSString *outgoingStr = [element compactXMLString];
-	NSData *outgoingData = [outgoingStr dataUsingEncoding:NSUTF8StringEncoding];
-	
-	XMPPLogSend(@"SEND: %@", outgoingStr);
-	numberOfBytesSent += [outgoingData length];
-	
-	[asyncSocket writeData:outgoingData
-	           withTimeout:TIMEOUT_XMPP_WRITE
-	                   tag:tag];
+	[self writeElement:element withTag:tag];
 	
 	if ([customElementNames countForObject:[element name]])
 	{
@@ -2717,15 +3025,7 @@ enum XMPPStreamConfig
 		
 		if (state == STATE_XMPP_AUTH)
 		{
-			NSString *outgoingStr = [element compactXMLString];
-			NSData *outgoingData = [outgoingStr dataUsingEncoding:NSUTF8StringEncoding];
-			
-			XMPPLogSend(@"SEND: %@", outgoingStr);
-			numberOfBytesSent += [outgoingData length];
-			
-			[asyncSocket writeData:outgoingData
-			           withTimeout:TIMEOUT_XMPP_WRITE
-			                   tag:TAG_XMPP_WRITE_STREAM];
+			[self writeElement:element withTag:TAG_XMPP_WRITE_STREAM];
 		}
 		else
 		{
@@ -2752,15 +3052,7 @@ enum XMPPStreamConfig
 		
 		if (state == STATE_XMPP_BINDING)
 		{
-			NSString *outgoingStr = [element compactXMLString];
-			NSData *outgoingData = [outgoingStr dataUsingEncoding:NSUTF8StringEncoding];
-			
-			XMPPLogSend(@"SEND: %@", outgoingStr);
-			numberOfBytesSent += [outgoingData length];
-			
-			[asyncSocket writeData:outgoingData
-			           withTimeout:TIMEOUT_XMPP_WRITE
-			                   tag:TAG_XMPP_WRITE_STREAM];
+			[self writeElement:element withTag:TAG_XMPP_WRITE_STREAM];
 		}
 		else
 		{
@@ -2784,7 +3076,11 @@ enum XMPPStreamConfig
 	
 	SEL selector = @selector(xmppStream:willReceiveIQ:);
 	
-	if (![multicastDelegate hasDelegateThatRespondsToSelector:selector])
+	if (enablePipelinedReceiveFilters)
+	{
+		[self receiveElementThroughFilterPipeline:iq selector:selector];
+	}
+	else if (![multicastDelegate hasDelegateThatRespondsToSelector:selector])
 	{
 		// None of the delegates implement the method.
 		// Use a shortcut.
@@ -2858,7 +3154,11 @@ enum XMPPStreamConfig
 	
 	SEL selector = @selector(xmppStream:willReceiveMessage:);
 	
-	if (![multicastDelegate hasDelegateThatRespondsToSelector:selector])
+	if (enablePipelinedReceiveFilters)
+	{
+		[self receiveElementThroughFilterPipeline:message selector:selector];
+	}
+	else if (![multicastDelegate hasDelegateThatRespondsToSelector:selector])
 	{
 		// None of the delegates implement the method.
 		// Use a shortcut.
@@ -2933,7 +3233,11 @@ enum XMPPStreamConfig
 	
 	SEL selector = @selector(xmppStream:willReceivePresence:);
 	
-	if (![multicastDelegate hasDelegateThatRespondsToSelector:selector])
+	if (enablePipelinedReceiveFilters)
+	{
+		[self receiveElementThroughFilterPipeline:presence selector:selector];
+	}
+	else if (![multicastDelegate hasDelegateThatRespondsToSelector:selector])
 	{
 		// None of the delegates implement the method.
 		// Use a shortcut.
@@ -2998,6 +3302,132 @@ enum XMPPStreamConfig
 	}
 }
 
+/**
+ * Pipelined version of the willReceiveX: filter chain (see enablePipelinedReceiveFilters).
+ * 
+ * Every received stanza is assigned a sequence number.
+ * It then hops from one filter's delegate queue to the next (asynchronously),
+ * so the filters work on consecutive stanzas concurrently.
+ * Once a stanza has made it through every filter (or has been filtered),
+ * the result is handed back to the xmppQueue, where it waits until all prior stanzas have been delivered.
+ * 
+ * Stanzas are also tagged with the connection they were received on (pipelinedReceiveGeneration),
+ * so a stanza still in the filters when the stream disconnects is dropped, even if the stream has reconnected since.
+**/
+- (void)receiveElementThroughFilterPipeline:(XMPPElement *)element selector:(SEL)selector
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	uint64_t generation = pipelinedReceiveGeneration;
+	uint64_t sequence = nextPipelinedReceiveSequence++;
+	
+	GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumeratorForSelector:selector];
+	
+	[self continueFilterPipelineWithElement:element
+	                               selector:selector
+	                     delegateEnumerator:delegateEnumerator
+	                             generation:generation
+	                               sequence:sequence];
+}
+
+- (void)continueFilterPipelineWithElement:(XMPPElement *)element
+                                 selector:(SEL)selector
+                       delegateEnumerator:(GCDMulticastDelegateEnumerator *)delegateEnumerator
+                               generation:(uint64_t)generation
+                                 sequence:(uint64_t)sequence
+{
+	// This method may be invoked on the xmppQueue, or on the delegate queue of the previous filter.
+	// The enumerator is only ever used by one stage at a time, so it needs no extra synchronization.
+	
+	id del;
+	dispatch_queue_t dq;
+	
+	if (element && [delegateEnumerator getNextDelegate:&del delegateQueue:&dq forSelector:selector])
+	{
+		dispatch_async(dq, ^{ @autoreleasepool {
+			
+			XMPPElement *modifiedElement;
+			
+			if (selector == @selector(xmppStream:willReceiveIQ:))
+				modifiedElement = [del xmppStream:self willReceiveIQ:(XMPPIQ *)element];
+			else if (selector == @selector(xmppStream:willReceiveMessage:))
+				modifiedElement = [del xmppStream:self willReceiveMessage:(XMPPMessage *)element];
+			else
+				modifiedElement = [del xmppStream:self willReceivePresence:(XMPPPresence *)element];
+			
+			[self continueFilterPipelineWithElement:modifiedElement
+			                               selector:selector
+			                     delegateEnumerator:delegateEnumerator
+			                             generation:generation
+			                               sequence:sequence];
+		}});
+	}
+	else
+	{
+		dispatch_block_t block = ^{ @autoreleasepool {
+			
+			[self finishFilterPipelineWithElement:element generation:generation sequence:sequence];
+		}};
+		
+		if (dispatch_get_specific(xmppQueueTag))
+			block();
+		else
+			dispatch_async(xmppQueue, block);
+	}
+}
+
+- (void)finishFilterPipelineWithElement:(XMPPElement *)element generation:(uint64_t)generation sequence:(uint64_t)sequence
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	if (generation != pipelinedReceiveGeneration)
+	{
+		// Received on a previous connection, which has since been disconnected.
+		// The sequence numbers were reset at that point, so this stanza must not take part in the reordering.
+		
+		return;
+	}
+	
+	if (sequence != nextPipelinedDeliverySequence)
+	{
+		// A prior stanza is still making its way through the filters.
+		// Hold on to this one until it's our turn.
+		
+		if (pipelinedReceiveResults == nil)
+			pipelinedReceiveResults = [[NSMutableDictionary alloc] init];
+		
+		pipelinedReceiveResults[@(sequence)] = element ?: [NSNull null];
+		return;
+	}
+	
+	id result = element;
+	do
+	{
+		nextPipelinedDeliverySequence++;
+		
+		if (state == STATE_XMPP_CONNECTED)
+		{
+			if ([result isKindOfClass:[XMPPIQ class]])
+				[self continueReceiveIQ:result];
+			else if ([result isKindOfClass:[XMPPMessage class]])
+				[self continueReceiveMessage:result];
+			else if ([result isKindOfClass:[XMPPPresence class]])
+				[self continueReceivePresence:result];
+			else
+				[multicastDelegate xmppStreamDidFilterStanza:self];
+		}
+		
+		NSNumber *nextKey = @(nextPipelinedDeliverySequence);
+		
+		result = pipelinedReceiveResults[nextKey];
+		if (result)
+		{
+			[pipelinedReceiveResults removeObjectForKey:nextKey];
+		}
+		
+	} while (result);
+}
+
 - (void)continueReceiveIQ:(XMPPIQ *)iq
 {
 	if ([iq requiresResponse])
@@ -3009,13 +3439,13 @@ enum XMPPStreamConfig
 		// So we notifiy all interested delegates and modules about the received IQ,
 		// keeping track of whether or not any of them have handled it.
 		
-		GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumerator];
+		SEL selector = @selector(xmppStream:didReceiveIQ:);
+		
+		GCDMulticastDelegateEnumerator *delegateEnumerator = [multicastDelegate delegateEnumeratorForSelector:selector];
 		
 		id del;
 		dispatch_queue_t dq;
 		
-		SEL selector = @selector(xmppStream:didReceiveIQ:);
-		
 		dispatch_semaphore_t delSemaphore = dispatch_semaphore_create(0);
 		dispatch_group_t delGroup = dispatch_group_create();
 		
@@ -3092,20 +3522,33 @@ enum XMPPStreamConfig
 	else
 	{
 		// The IQ doesn't require a response.
-		// So we can just fire the delegate method and ignore the responses.
+		// 
+		// If it's the response to a request that a module registered with routeResponseToIQ:toModule:,
+		// then the router delivers it directly to that module.
+		// Otherwise we can just fire the delegate method and ignore the responses.
 		
-		[multicastDelegate xmppStream:self didReceiveIQ:iq];
+		if ([iqResponseRouter invokeForElement:iq withObject:iq])
+		{
+			// The other delegates don't see the IQ, but some of them (e.g. stream management, which counts
+			// the stanzas we've handled) still need to know that something was received.
+			
+			[multicastDelegate xmppStreamDidFilterStanza:self];
+		}
+		else
+		{
+			[multicastDelegate invokeSelector:@selector(xmppStream:didReceiveIQ:) withObject:self withObject:iq];
+		}
 	}
 }
 
 - (void)continueReceiveMessage:(XMPPMessage *)message
 {
-	[multicastDelegate xmppStream:self didReceiveMessage:message];
+	[multicastDelegate invokeSelector:@selector(xmppStream:didReceiveMessage:) withObject:self withObject:message];
 }
 
 - (void)continueReceivePresence:(XMPPPresence *)presence
 {
-	[multicastDelegate xmppStream:self didReceivePresence:presence];
+	[multicastDelegate invokeSelector:@selector(xmppStream:didReceivePresence:) withObject:self withObject:presence];
 }
 
 /**
@@ -3244,11 +3687,7 @@ enum XMPPStreamConfig
 		NSData *outgoingData = [s1 dataUsingEncoding:NSUTF8StringEncoding];
 		
 		XMPPLogSend(@"SEND: %@", s1);
-		numberOfBytesSent += [outgoingData length];
-		
-		[asyncSocket writeData:outgoingData
-				   withTimeout:TIMEOUT_XMPP_WRITE
-						   tag:TAG_XMPP_WRITE_START];
+		[self writeData:outgoingData withTag:TAG_XMPP_WRITE_START];
 		
 		[self setDidStartNegotiation:YES];
 	}
@@ -3317,11 +3756,7 @@ enum XMPPStreamConfig
 	NSData *outgoingData = [s2 dataUsingEncoding:NSUTF8StringEncoding];
 	
 	XMPPLogSend(@"SEND: %@", s2);
-	numberOfBytesSent += [outgoingData length];
-	
-	[asyncSocket writeData:outgoingData
-			   withTimeout:TIMEOUT_XMPP_WRITE
-					   tag:TAG_XMPP_WRITE_START];
+	[self writeData:outgoingData withTag:TAG_XMPP_WRITE_START];
 	
 	// Update status
 	state = STATE_XMPP_OPENING;
@@ -3486,6 +3921,43 @@ enum XMPPStreamConfig
 		return;
     }
 	
+	// Check to see if we should enable stream compression (XEP-0138).
+	// As recommended by XEP-0170, compression is negotiated after TLS and SASL, but before resource binding.
+	if ((config & kEnableZlibCompression) && [self isAuthenticated] && ![self isCompressed])
+	{
+		NSXMLElement *f_compression = [features elementForName:@"compression"
+		                                                 xmlns:@"http://jabber.org/features/compress"];
+		
+		for (NSXMLElement *method in [f_compression elementsForName:@"method"])
+		{
+			if ([[method stringValue] isEqualToString:@"zlib"])
+			{
+				// Update state
+				state = STATE_XMPP_COMPRESSING;
+				
+				// Send the compress request
+				[self sendCompressRequest];
+				
+				// We're already listening for the response...
+				return;
+			}
+		}
+	}
+	
+	[self continueHandleStreamFeatures];
+}
+
+/**
+ * Handles the remaining stream features, after TLS and compression have been dealt with.
+**/
+- (void)continueHandleStreamFeatures
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	XMPPLogTrace();
+	
+	NSXMLElement *features = [rootElement elementForName:@"stream:features"];
+	
 	// Check to see if resource binding is required
 	// Don't forget about that NSXMLElement bug you reported to apple (xmlns is required or element won't be found)
 	NSXMLElement *f_bind = [features elementForName:@"bind" xmlns:@"urn:ietf:params:xml:ns:xmpp-bind"];
@@ -3532,6 +4004,68 @@ enum XMPPStreamConfig
 	[self startTLS];
 }
 
+- (void)sendCompressRequest
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	XMPPLogTrace();
+	
+	NSString *compress = @"<compress xmlns='http://jabber.org/protocol/compress'><method>zlib</method></compress>";
+	
+	NSData *outgoingData = [compress dataUsingEncoding:NSUTF8StringEncoding];
+	
+	XMPPLogSend(@"SEND: %@", compress);
+	[self writeData:outgoingData withTag:TAG_XMPP_WRITE_STREAM];
+}
+
+- (void)handleCompressResponse:(NSXMLElement *)response
+{
+	NSAssert(dispatch_get_specific(xmppQueueTag), @"Invoked on incorrect queue");
+	
+	XMPPLogTrace();
+	
+	// We're expecting a compressed response.
+	// If we get a failure response instead, compression simply isn't used and we continue as normal.
+	if (![[response name] isEqualToString:@"compressed"])
+	{
+		XMPPLogWarn(@"%@: Server refused stream compression: %@", THIS_FILE, [response compactXMLString]);
+		
+		[self continueHandleStreamFeatures];
+		return;
+	}
+	
+	zlibCompression = [[XMPPZlibCompression alloc] init];
+	if (zlibCompression == nil)
+	{
+		NSString *errMsg = @"Unable to initialize zlib compression.";
+		NSDictionary *info = @{NSLocalizedDescriptionKey : errMsg};
+		
+		otherError = [NSError errorWithDomain:XMPPZlibCompressionErrorDomain code:0 userInfo:info];
+		
+		// Close the TCP connection.
+		[asyncSocket disconnect];
+		
+		// The socketDidDisconnect:withError: method will handle everything else
+		return;
+	}
+	
+	flags |= kIsCompressed;
+	
+	// From here on, everything we send and receive is compressed.
+	// Now we start our negotiation over again...
+	[self sendOpeningNegotiation];
+	
+	if (![self isSecure])
+	{
+		// Normally we requeue our read operation in xmppParserDidParseData:.
+		// But we just reset the parser, so that code path isn't going to happen.
+		// So start read request here.
+		// The state is STATE_XMPP_OPENING, set via sendOpeningNegotiation method.
+		
+		[asyncSocket readDataWithTimeout:TIMEOUT_XMPP_READ_START tag:TAG_XMPP_READ_START];
+	}
+}
+
 /**
  * After the registerUser:withPassword: method is invoked, a registration message is sent to the server.
  * We're waiting for the result from this registration request.
@@ -3793,15 +4327,7 @@ enum XMPPStreamConfig
 		XMPPIQ *iq = [XMPPIQ iqWithType:@"set" elementID:[self generateUUID]];
 		[iq addChild:bind];
 		
-		NSString *outgoingStr = [iq compactXMLString];
-		NSData *outgoingData = [outgoingStr dataUsingEncoding:NSUTF8StringEncoding];
-		
-		XMPPLogSend(@"SEND: %@", outgoingStr);
-		numberOfBytesSent += [outgoingData length];
-		
-		[asyncSocket writeData:outgoingData
-				   withTimeout:TIMEOUT_XMPP_WRITE
-						   tag:TAG_XMPP_WRITE_STREAM];
+		[self writeElement:iq withTag:TAG_XMPP_WRITE_STREAM];
         
 		[idTracker addElement:iq
 		               target:nil
@@ -3817,15 +4343,7 @@ enum XMPPStreamConfig
 		XMPPIQ *iq = [XMPPIQ iqWithType:@"set" elementID:[self generateUUID]];
 		[iq addChild:bind];
 		
-		NSString *outgoingStr = [iq compactXMLString];
-		NSData *outgoingData = [outgoingStr dataUsingEncoding:NSUTF8StringEncoding];
-		
-		XMPPLogSend(@"SEND: %@", outgoingStr);
-		numberOfBytesSent += [outgoingData length];
-		
-		[asyncSocket writeData:outgoingData
-				   withTimeout:TIMEOUT_XMPP_WRITE
-						   tag:TAG_XMPP_WRITE_STREAM];
+		[self writeElement:iq withTag:TAG_XMPP_WRITE_STREAM];
         
 		[idTracker addElement:iq
 		               target:nil
@@ -3946,15 +4464,7 @@ enum XMPPStreamConfig
 		XMPPIQ *iq = [XMPPIQ iqWithType:@"set"];
 		[iq addChild:bind];
 		
-		NSString *outgoingStr = [iq compactXMLString];
-		NSData *outgoingData = [outgoingStr dataUsingEncoding:NSUTF8StringEncoding];
-		
-		XMPPLogSend(@"SEND: %@", outgoingStr);
-		numberOfBytesSent += [outgoingData length];
-		
-		[asyncSocket writeData:outgoingData
-		           withTimeout:TIMEOUT_XMPP_WRITE
-		                   tag:TAG_XMPP_WRITE_STREAM];
+		[self writeElement:iq withTag:TAG_XMPP_WRITE_STREAM];
         
         [idTracker addElement:iq
                        target:nil
@@ -3972,15 +4482,7 @@ enum XMPPStreamConfig
 		XMPPIQ *iq = [XMPPIQ iqWithType:@"set"];
 		[iq addChild:bind];
 		
-		NSString *outgoingStr = [iq compactXMLString];
-		NSData *outgoingData = [outgoingStr dataUsingEncoding:NSUTF8StringEncoding];
-		
-		XMPPLogSend(@"SEND: %@", outgoingStr);
-		numberOfBytesSent += [outgoingData length];
-		
-		[asyncSocket writeData:outgoingData
-		           withTimeout:TIMEOUT_XMPP_WRITE
-		                   tag:TAG_XMPP_WRITE_STREAM];
+		[self writeElement:iq withTag:TAG_XMPP_WRITE_STREAM];
         
         [idTracker addElement:iq
                        target:nil
@@ -4010,15 +4512,7 @@ enum XMPPStreamConfig
 		XMPPIQ *iq = [XMPPIQ iqWithType:@"set" elementID:[self generateUUID]];
 		[iq addChild:session];
 		
-		NSString *outgoingStr = [iq compactXMLString];
-		NSData *outgoingData = [outgoingStr dataUsingEncoding:NSUTF8StringEncoding];
-		
-		XMPPLogSend(@"SEND: %@", outgoingStr);
-		numberOfBytesSent += [outgoingData length];
-		
-		[asyncSocket writeData:outgoingData
-				   withTimeout:TIMEOUT_XMPP_WRITE
-						   tag:TAG_XMPP_WRITE_STREAM];
+		[self writeElement:iq withTag:TAG_XMPP_WRITE_STREAM];
         
 		[idTracker addElement:iq
 		               target:nil
@@ -4252,6 +4746,20 @@ enum XMPPStreamConfig
 	lastSendReceiveTime = [NSDate timeIntervalSinceReferenceDate];
 	numberOfBytesReceived += [data length];
 	
+	if (zlibCompression)
+	{
+		NSError *error = nil;
+		data = [zlibCompression decompressData:data error:&error];
+		
+		if (data == nil)
+		{
+			otherError = error;
+			[asyncSocket disconnect];
+			
+			return;
+		}
+	}
+	
 	XMPPLogRecvPre(@"RECV: %@", [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding]);
 	
 	// Asynchronously parse the xml data
@@ -4299,6 +4807,25 @@ enum XMPPStreamConfig
 		[receipt signalSuccess];
 		[receipts removeObjectAtIndex:0];
 	}
+	else if (tag == TAG_XMPP_WRITE_COALESCED)
+	{
+		if ([coalescedWriteReceiptCounts count] == 0)
+		{
+			XMPPLogWarn(@"%@: Found TAG_XMPP_WRITE_COALESCED with no pending receipt count!", THIS_FILE);
+			return;
+		}
+		
+		NSUInteger receiptCount = [coalescedWriteReceiptCounts[0] unsignedIntegerValue];
+		[coalescedWriteReceiptCounts removeObjectAtIndex:0];
+		
+		receiptCount = MIN(receiptCount, [receipts count]);
+		
+		for (NSUInteger i = 0; i < receiptCount; i++)
+		{
+			[receipts[i] signalSuccess];
+		}
+		[receipts removeObjectsInRange:NSMakeRange(0, receiptCount)];
+	}
 	else if (tag == TAG_XMPP_WRITE_STOP)
 	{
 		[multicastDelegate xmppStreamDidSendClosingStreamStanza:self];
@@ -4332,6 +4859,9 @@ enum XMPPStreamConfig
 		// Clear any saved authentication information
 		auth = nil;
 		
+		// Release the compression streams (compression must be renegotiated on the next connection)
+		zlibCompression = nil;
+		
 		authenticationDate = nil;
 		
 		// Clear stored elements
@@ -4346,12 +4876,23 @@ enum XMPPStreamConfig
 			keepAliveTimer = NULL;
 		}
 		
+		// Discard any coalesced data that was never written
+		if (writeCoalescingTimer)
+		{
+			dispatch_source_cancel(writeCoalescingTimer);
+			writeCoalescingTimer = NULL;
+		}
+		coalescedData = nil;
+		coalescedReceiptCount = 0;
+		[coalescedWriteReceiptCounts removeAllObjects];
+		
 		// Clear srv results
 		srvResolver = nil;
 		srvResults = nil;
         
         // Stop tracking IDs
         [idTracker removeAllIDs];
+		[iqResponseRouter removeAllIDs];
 		
 		// Clear any pending receipts
 		for (XMPPElementReceipt *receipt in receipts)
@@ -4360,6 +4901,12 @@ enum XMPPStreamConfig
 		}
 		[receipts removeAllObjects];
 		
+		// Discard any stanzas still making their way through the pipelined receive filters
+		pipelinedReceiveGeneration++;
+		nextPipelinedReceiveSequence = 0;
+		nextPipelinedDeliverySequence = 0;
+		[pipelinedReceiveResults removeAllObjects];
+		
 		// Clear flags
 		flags = 0;
 		
@@ -4427,15 +4974,7 @@ enum XMPPStreamConfig
 			
 			[multicastDelegate xmppStream:self willSendP2PFeatures:streamFeatures];
 			
-			NSString *outgoingStr = [streamFeatures compactXMLString];
-			NSData *outgoingData = [outgoingStr dataUsingEncoding:NSUTF8StringEncoding];
-			
-			XMPPLogSend(@"SEND: %@", outgoingStr);
-			numberOfBytesSent += [outgoingData length];
-			
-			[asyncSocket writeData:outgoingData
-			           withTimeout:TIMEOUT_XMPP_WRITE
-			                   tag:TAG_XMPP_WRITE_STREAM];
+			[self writeElement:streamFeatures withTag:TAG_XMPP_WRITE_STREAM];
 		}
 		
 		// Make sure the delegate didn't disconnect us in the xmppStream:willSendP2PFeatures: method.
@@ -4470,15 +5009,7 @@ enum XMPPStreamConfig
             XMPPIQ *iq = [XMPPIQ iqWithType:@"get" elementID:[self generateUUID]];
 			[iq addChild:query];
 			
-			NSString *outgoingStr = [iq compactXMLString];
-			NSData *outgoingData = [outgoingStr dataUsingEncoding:NSUTF8StringEncoding];
-			
-			XMPPLogSend(@"SEND: %@", outgoingStr);
-			numberOfBytesSent += [outgoingData length];
-			
-			[asyncSocket writeData:outgoingData
-			           withTimeout:TIMEOUT_XMPP_WRITE
-			                   tag:TAG_XMPP_WRITE_STREAM];
+			[self writeElement:iq withTag:TAG_XMPP_WRITE_STREAM];
 			
 			// Now wait for the response IQ
 		}
@@ -4486,6 +5017,36 @@ enum XMPPStreamConfig
 }
 
 - (void)xmppParser:(XMPPParser *)sender didReadElement:(NSXMLElement *)element
+{
+	// This method is invoked on the xmppQueue.
+	
+	[self xmppParser:sender didReadElement:element info:nil];
+}
+
+- (void)xmppParser:(XMPPParser *)sender didReadElements:(NSArray *)elements info:(NSArray *)infoArray
+{
+	// This method is invoked on the xmppQueue.
+	
+	NSUInteger count = [elements count];
+	
+	for (NSUInteger i = 0; i < count; i++)
+	{
+		@autoreleasepool {
+			
+			// Note: If an element causes us to restart the stream (e.g. after authentication),
+			// we'll have a new parser, and the remaining elements will be properly ignored.
+			
+			XMPPParserElementInfo *info = infoArray[i];
+			if ((id)info == [NSNull null]) {
+				info = nil;
+			}
+			
+			[self xmppParser:sender didReadElement:elements[i] info:info];
+		}
+	}
+}
+
+- (void)xmppParser:(XMPPParser *)sender didReadElement:(NSXMLElement *)element info:(XMPPParserElementInfo *)info
 {
     // SCC: 20180821: Haven't looked where this NSLog came from yet; far too verbose and XMPPLogRecvPost is available instead..
     // NSLog(@"%@", element);
@@ -4496,10 +5057,14 @@ enum XMPPStreamConfig
 	
 	XMPPLogTrace();
 	XMPPLogRecvPost(@"RECV: %@", [element compactXMLString]);
-		
+	
+	// The parser classifies top-level elements as it reads their start tag.
+	// We only need to inspect the element name ourselves if that information isn't available.
+	
 	NSString *elementName = [element name];
+	XMPPParserElementKind kind = info ? info.kind : [self elementKindForName:elementName];
 	
-	if ([elementName isEqualToString:@"stream:error"] || [elementName isEqualToString:@"error"])
+	if (kind == XMPPParserElementKindStreamError)
 	{
 		[multicastDelegate xmppStream:self didReceiveError:element];
 		
@@ -4530,6 +5095,11 @@ enum XMPPStreamConfig
 		// Some response to the authentication process
 		[self handleAuth:element];
 	}
+	else if (state == STATE_XMPP_COMPRESSING)
+	{
+		// The response from our compress request
+		[self handleCompressResponse:element];
+	}
 	else if (state == STATE_XMPP_BINDING)
 	{
 		if (customBinding)
@@ -4542,7 +5112,7 @@ enum XMPPStreamConfig
 			if (validatesResponses)
 			{
 				XMPPIQ *iq = [XMPPIQ iqFromElement:element];
-				if (![idTracker invokeForElement:iq withObject:nil])
+				if (![idTracker invokeForElement:iq elementID:(info ? info.elementID : [iq elementID]) withObject:nil])
 				{
 					invalid = YES;
 				}
@@ -4560,7 +5130,7 @@ enum XMPPStreamConfig
 		if (validatesResponses)
 		{
 			XMPPIQ *iq = [XMPPIQ iqFromElement:element];
-			if (![idTracker invokeForElement:iq withObject:nil])
+			if (![idTracker invokeForElement:iq elementID:(info ? info.elementID : [iq elementID]) withObject:nil])
 			{
 				invalid = YES;
 			}
@@ -4573,34 +5143,67 @@ enum XMPPStreamConfig
 	}
 	else
 	{
-		if ([elementName isEqualToString:@"iq"])
-		{
-			[self receiveIQ:[XMPPIQ iqFromElement:element]];
-		}
-		else if ([elementName isEqualToString:@"message"])
-		{
-			[self receiveMessage:[XMPPMessage messageFromElement:element]];
-		}
-		else if ([elementName isEqualToString:@"presence"])
-		{
-			[self receivePresence:[XMPPPresence presenceFromElement:element]];
-		}
-		else if ([self isP2P] &&
-		        ([elementName isEqualToString:@"stream:features"] || [elementName isEqualToString:@"features"]))
-		{
-			[multicastDelegate xmppStream:self didReceiveP2PFeatures:element];
-		}
-		else if ([customElementNames countForObject:elementName])
+		switch (kind)
 		{
-			[multicastDelegate xmppStream:self didReceiveCustomElement:element];
-		}
-		else
-		{
-			[multicastDelegate xmppStream:self didReceiveError:element];
+			case XMPPParserElementKindIQ:
+			{
+				[self receiveIQ:[XMPPIQ iqFromElement:element]];
+				break;
+			}
+			case XMPPParserElementKindMessage:
+			{
+				[self receiveMessage:[XMPPMessage messageFromElement:element]];
+				break;
+			}
+			case XMPPParserElementKindPresence:
+			{
+				[self receivePresence:[XMPPPresence presenceFromElement:element]];
+				break;
+			}
+			default:
+			{
+				if ([self isP2P] && (kind == XMPPParserElementKindStreamFeatures))
+				{
+					[multicastDelegate xmppStream:self didReceiveP2PFeatures:element];
+				}
+				else if ([customElementNames countForObject:elementName])
+				{
+					[multicastDelegate xmppStream:self didReceiveCustomElement:element];
+				}
+				else
+				{
+					[multicastDelegate xmppStream:self didReceiveError:element];
+				}
+				break;
+			}
 		}
 	}
 }
 
+/**
+ * Classifies a top-level element by name.
+ * This is only used if the parser didn't supply an XMPPParserElementInfo.
+**/
+- (XMPPParserElementKind)elementKindForName:(NSString *)elementName
+{
+	if ([elementName isEqualToString:@"iq"])
+		return XMPPParserElementKindIQ;
+	
+	if ([elementName isEqualToString:@"message"])
+		return XMPPParserElementKindMessage;
+	
+	if ([elementName isEqualToString:@"presence"])
+		return XMPPParserElementKindPresence;
+	
+	if ([elementName isEqualToString:@"stream:error"] || [elementName isEqualToString:@"error"])
+		return XMPPParserElementKindStreamError;
+	
+	if ([elementName isEqualToString:@"stream:features"] || [elementName isEqualToString:@"features"])
+		return XMPPParserElementKindStreamFeatures;
+	
+	return XMPPParserElementKindOther;
+}
+
 - (void)xmppParserDidParseData:(XMPPParser *)sender
 {
 	// This method is invoked on the xmppQueue.
@@ -4708,11 +5311,7 @@ enum XMPPStreamConfig
 		
 		if (elapsed < 0 || elapsed >= keepAliveInterval)
 		{
-			numberOfBytesSent += [keepAliveData length];
-			
-			[asyncSocket writeData:keepAliveData
-			           withTimeout:TIMEOUT_XMPP_WRITE
-			                   tag:TAG_XMPP_WRITE_STREAM];
+			[self writeData:keepAliveData withTag:TAG_XMPP_WRITE_STREAM];
 			
 			// Force update the lastSendReceiveTime here just to be safe.
 			// 
@@ -4856,6 +5455,64 @@ enum XMPPStreamConfig
 		dispatch_sync(xmppQueue, block);
 }
 
+- (void)routeResponseToIQ:(XMPPIQ *)iq toModule:(XMPPModule *)module
+{
+	[self routeResponseToIQ:iq toModule:module timeout:XMPPIDTrackerTimeoutNone];
+}
+
+- (void)routeResponseToIQ:(XMPPIQ *)iq toModule:(XMPPModule *)module timeout:(NSTimeInterval)timeout
+{
+	// This is a public method.
+	// It may be invoked on any thread/queue.
+	
+	if (iq == nil || module == nil) return;
+	if (![iq requiresResponse]) return;
+	
+	if (![module respondsToSelector:@selector(xmppStream:didReceiveIQ:)])
+	{
+		// The response would be lost, so leave it to the regular broadcast.
+		
+		XMPPLogWarn(@"%@: %@ - %@ doesn't implement xmppStream:didReceiveIQ:", THIS_FILE, THIS_METHOD, module);
+		return;
+	}
+	
+	__weak XMPPModule *weakModule = module;
+	__weak XMPPStream *weakSelf = self;
+	
+	[iqResponseRouter addElement:iq block:^(id obj, id <XMPPTrackingInfo> info) {
+		
+		// Invoked on the xmppQueue.
+		// The obj is the response, or nil if the route timed out.
+		
+		XMPPIQ *responseIQ = (XMPPIQ *)obj;
+		XMPPModule *strongModule = weakModule;
+		
+		if (responseIQ == nil || strongModule == nil) return;
+		
+		dispatch_async(strongModule.moduleQueue, ^{ @autoreleasepool {
+			
+			XMPPStream *strongSelf = weakSelf;
+			
+			// Make sure the module wasn't deactivated in the meantime
+			
+			if (strongSelf && strongModule.xmppStream == strongSelf &&
+			    [strongModule respondsToSelector:@selector(xmppStream:didReceiveIQ:)])
+			{
+				[(id <XMPPStreamDelegate>)strongModule xmppStream:strongSelf didReceiveIQ:responseIQ];
+			}
+		}});
+		
+	} timeout:timeout];
+}
+
+- (void)removeResponseRouteForID:(NSString *)elementID
+{
+	// This is a public method.
+	// It may be invoked on any thread/queue.
+	
+	[iqResponseRouter removeID:elementID];
+}
+
 - (void)autoAddDelegate:(id)delegate delegateQueue:(dispatch_queue_t)delegateQueue toModulesOfClass:(Class)aClass
 {
 	if (delegate == nil) return;
@@ -21,6 +21,23 @@
 */
 @property (nonatomic, assign) BOOL autoAcceptFileTransfers;
 
+/**
+* (Optional)
+*
+* Specifies whether or not the received data should be handed to the delegate
+* as it arrives (see xmppIncomingFileTransfer:didReceiveDataChunk:), rather
+* than being collected in memory and handed over in its entirety once the
+* transfer has completed.
+*
+* If set to YES, the data passed to
+* xmppIncomingFileTransfer:didSucceedWithData:named:sender: will be nil. This
+* setting is ignored for transfers accepted with an output stream or file
+* descriptor.
+*
+* The default value is NO.
+*/
+@property (nonatomic, assign) BOOL deliverDataIncrementally;
+
 /**
 * Sends a response to the file transfer initiator accepting the Stream
 * Initiation offer. It will automatically determine the best transfer method
@@ -34,6 +51,35 @@
 */
 - (void)acceptSIOffer:(XMPPIQ *)offer;
 
+/**
+* Accepts the Stream Initiation offer, writing the received data to the provided
+* output stream as it arrives, instead of collecting it in memory.
+*
+* The stream is written to synchronously, so it should be backed by a file or a
+* buffer. It will be opened (if it isn't open already) and closed by the file
+* transfer. The data passed to
+* xmppIncomingFileTransfer:didSucceedWithData:named:sender: will be nil.
+*
+* @param offer IQ stanza representing the SI offer.
+* @param outputStream The stream the received data is written to.
+*/
+- (void)acceptSIOffer:(XMPPIQ *)offer outputStream:(NSOutputStream *)outputStream;
+
+/**
+* Accepts the Stream Initiation offer, writing the received data directly to
+* the provided file descriptor as it arrives, instead of collecting it in
+* memory. SOCKS5 data is read from the socket into a single preallocated
+* buffer, which is written straight to the file descriptor, so the data is
+* never copied in between.
+*
+* The file descriptor is not closed by the file transfer. The data passed to
+* xmppIncomingFileTransfer:didSucceedWithData:named:sender: will be nil.
+*
+* @param offer IQ stanza representing the SI offer.
+* @param fd An open, writable file descriptor.
+*/
+- (void)acceptSIOffer:(XMPPIQ *)offer fileDescriptor:(int)fd;
+
 @end
 
 
@@ -64,13 +110,39 @@
 - (void)xmppIncomingFileTransfer:(XMPPIncomingFileTransfer *)sender
                didReceiveSIOffer:(XMPPIQ *)offer;
 
+/**
+* Implement this method to receive the data of an incoming file transfer as it
+* arrives. It will only be invoked if deliverDataIncrementally is set to YES.
+* The chunks are delivered in order.
+*
+* @param sender XMPPIncomingFileTransfer object invoking this delegate method.
+* @param chunk The next chunk of the file being received.
+*/
+- (void)xmppIncomingFileTransfer:(XMPPIncomingFileTransfer *)sender
+             didReceiveDataChunk:(NSData *)chunk;
+
+/**
+* Implement this method to be notified of the progress of an incoming file
+* transfer.
+*
+* @param sender XMPPIncomingFileTransfer object invoking this delegate method.
+* @param receivedSize The number of bytes received so far.
+* @param totalSize The size of the file, as stated in the SI offer.
+*/
+- (void)xmppIncomingFileTransfer:(XMPPIncomingFileTransfer *)sender
+          didReceiveDataWithSize:(unsigned long long)receivedSize
+                       totalSize:(unsigned long long)totalSize;
+
 /**
 * Implement this method to receive notifications of a successful incoming file
 * transfer. It will only be invoked if all of the data is received
-* successfully.
+* successfully. If the SI offer included a hash of the file, the received data
+* has been verified against it.
 *
 * @param sender XMPPIncomingFileTransfer object invoking this delegate method.
-* @param data NSData for you to handle (probably save this or display it).
+* @param data NSData for you to handle (probably save this or display it). This
+*             is nil if the data was delivered incrementally, or written to an
+*             output stream or file descriptor.
 * @param named Name of the file you just received.
 */
 - (void)xmppIncomingFileTransfer:(XMPPIncomingFileTransfer *)sender
@@ -7,6 +7,8 @@
 #warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
 #endif
 
+#import <CommonCrypto/CommonDigest.h>
+#import <unistd.h>
 #import "XMPPIncomingFileTransfer.h"
 #import "XMPPConstants.h"
 #import "XMPPLogging.h"
@@ -32,6 +34,13 @@ static const int xmppLogLevel = XMPP_LOG_LEVEL_VERBOSE | XMPP_LOG_FLAG_TRACE;
 
 #define TIMEOUT_WRITE -1
 #define TIMEOUT_READ 5.0
+#define TIMEOUT_READ_DATA 30.0
+
+/**
+* SOCKS5 data is read from the socket in chunks of this size (Bytes), so the
+* timeout applies to each chunk rather than the whole file.
+*/
+#define SOCKS_READ_CHUNK_SIZE (64 * 1024)
 
 // XMPP Incoming File Transfer State
 typedef NS_ENUM(int, XMPPIFTState) {
@@ -56,8 +65,22 @@ NSString *const XMPPIncomingFileTransferErrorDomain = @"XMPPIncomingFileTransfer
 
   NSMutableData *_receivedData;
   NSString *_receivedFileName;
-  NSUInteger _totalDataSize;
-  NSUInteger _receivedDataSize;
+  unsigned long long _totalDataSize;
+  unsigned long long _receivedDataSize;
+
+  // Where the received data is written to, if it isn't collected in
+  // _receivedData (or handed to the delegate chunk by chunk).
+  NSOutputStream *_outputStream;
+  int _outputFileDescriptor;
+
+  // When writing to _outputStream or _outputFileDescriptor, SOCKS5 data is
+  // read into this buffer, one chunk at a time.
+  NSMutableData *_readBuffer;
+
+  // The hash of the received data is computed as it arrives, so it can be
+  // checked against the one provided in the SI offer (XEP-0096).
+  CC_MD5_CTX _md5Context;
+  NSString *_expectedHash;
 
   dispatch_source_t _ibbTimer;
 }
@@ -74,6 +97,7 @@ NSString *const XMPPIncomingFileTransferErrorDomain = @"XMPPIncomingFileTransfer
   self = [super initWithDispatchQueue:queue];
   if (self) {
     _transferState = XMPPIFTStateNone;
+    _outputFileDescriptor = -1;
   }
   return self;
 }
@@ -121,6 +145,24 @@ NSString *const XMPPIncomingFileTransferErrorDomain = @"XMPPIncomingFileTransfer
   }
 }
 
+- (void)acceptSIOffer:(XMPPIQ *)offer outputStream:(NSOutputStream *)outputStream
+{
+  XMPPLogTrace();
+
+  if (!_autoAcceptFileTransfers) {
+    [self sendSIOfferAcceptance:offer outputStream:outputStream fileDescriptor:-1];
+  }
+}
+
+- (void)acceptSIOffer:(XMPPIQ *)offer fileDescriptor:(int)fd
+{
+  XMPPLogTrace();
+
+  if (!_autoAcceptFileTransfers) {
+    [self sendSIOfferAcceptance:offer outputStream:nil fileDescriptor:fd];
+  }
+}
+
 
 #pragma mark - Private Methods
 
@@ -203,6 +245,17 @@ NSString *const XMPPIncomingFileTransferErrorDomain = @"XMPPIncomingFileTransfer
 * Take a look at XEP-0096 Examples 2 and 4 for more details.
 */
 - (void)sendSIOfferAcceptance:(XMPPIQ *)offer
+{
+  [self sendSIOfferAcceptance:offer outputStream:nil fileDescriptor:-1];
+}
+
+/**
+* As above, but the received data will be written to the provided output
+* stream or file descriptor (if any), rather than being collected in memory.
+*/
+- (void)sendSIOfferAcceptance:(XMPPIQ *)offer
+                 outputStream:(NSOutputStream *)outputStream
+               fileDescriptor:(int)fd
 {
   XMPPLogTrace();
 
@@ -217,11 +270,29 @@ NSString *const XMPPIncomingFileTransferErrorDomain = @"XMPPIncomingFileTransfer
 
         // Store the size of the incoming data for later use
         NSXMLElement *inFile = [inSi elementForName:@"file"];
-        self->_totalDataSize = [inFile attributeUnsignedIntegerValueForName:@"size"];
+        self->_totalDataSize =
+            (unsigned long long) [[inFile attributeStringValueForName:@"size"] longLongValue];
 
         // Store the name of the file for later use
         self->_receivedFileName = [inFile attributeStringValueForName:@"name"];
 
+        // Store the (optional) hash of the file, to verify the data against
+        self->_expectedHash = [inFile attributeStringValueForName:@"hash"];
+        CC_MD5_Init(&self->_md5Context);
+
+        // Prepare to receive data
+        self->_receivedDataSize = 0;
+        self->_outputStream = outputStream;
+        self->_outputFileDescriptor = fd;
+
+        if (outputStream) {
+          if ([outputStream streamStatus] == NSStreamStatusNotOpen) {
+            [outputStream open];
+          }
+        } else if (fd < 0 && !self->_deliverDataIncrementally) {
+          self->_receivedData = [NSMutableData new];
+        }
+
         // Outgoing
         XMPPIQ *iq = [XMPPIQ iqWithType:@"result"
                                      to:offer.from
@@ -283,9 +354,6 @@ NSString *const XMPPIncomingFileTransferErrorDomain = @"XMPPIncomingFileTransfer
                                      to:request.from
                               elementID:request.elementID];
         [self->xmppStream sendElement:iq];
-
-        // Prepare to receive data
-        self->_receivedData = [NSMutableData new];
       }
   };
 
@@ -314,22 +382,19 @@ NSString *const XMPPIncomingFileTransferErrorDomain = @"XMPPIncomingFileTransfer
         NSXMLElement *dataElem = received.childElement;
         NSData
             *temp = [[NSData alloc] initWithBase64EncodedString:dataElem.stringValue options:0];
-        [self->_receivedData appendData:temp];
 
-        // According the base64 encoding, it takes up 4/3 n bytes of space, so
-        // we need to find the size of the data before base64.
-        self->_receivedDataSize += (3 * dataElem.stringValue.length) / 4;
+        if (![self deliverReceivedData:temp]) return;
 
-        XMPPLogVerbose(@"Downloaded %lu/%lu bytes in IBB transfer.",
-                       (unsigned long) self->_receivedDataSize, (unsigned long) self->_totalDataSize);
+        XMPPLogVerbose(@"Downloaded %llu/%llu bytes in IBB transfer.",
+                       self->_receivedDataSize, self->_totalDataSize);
 
-        if (self->_receivedDataSize < self->_totalDataSize) {
-          // Send ack response
-          XMPPIQ *iq = [XMPPIQ iqWithType:@"result"
-                                       to:received.from
-                                elementID:received.elementID];
-          [self->xmppStream sendElement:iq];
-        } else {
+        // Send ack response
+        XMPPIQ *iq = [XMPPIQ iqWithType:@"result"
+                                     to:received.from
+                              elementID:received.elementID];
+        [self->xmppStream sendElement:iq];
+
+        if (self->_receivedDataSize >= self->_totalDataSize) {
           // We're finished!
           XMPPLogInfo(@"Finished downloading IBB data.");
           [self transferSuccess];
@@ -450,6 +515,77 @@ NSString *const XMPPIncomingFileTransferErrorDomain = @"XMPPIncomingFileTransfer
   return hash;
 }
 
+/**
+* Hands a chunk of received data over to wherever it's going (the output
+* stream, the file descriptor, the delegate or _receivedData), and updates the
+* hash and progress of the transfer.
+*
+* @return Returns NO if the data couldn't be written, in which case the transfer
+*         has failed; YES otherwise.
+*/
+- (BOOL)deliverReceivedData:(NSData *)data
+{
+  NSUInteger length = [data length];
+  if (length == 0) return YES;
+
+  const uint8_t *bytes = [data bytes];
+
+  if (_outputFileDescriptor >= 0) {
+    NSUInteger written = 0;
+    while (written < length) {
+      ssize_t result = write(_outputFileDescriptor, bytes + written, length - written);
+      if (result < 0) {
+        if (errno == EINTR) continue;
+
+        NSError *err = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+        [self failWithReason:@"Unable to write the received data." error:err];
+        return NO;
+      }
+      written += result;
+    }
+  } else if (_outputStream) {
+    NSUInteger written = 0;
+    while (written < length) {
+      NSInteger result = [_outputStream write:bytes + written maxLength:length - written];
+      if (result <= 0) {
+        [self failWithReason:@"Unable to write the received data." error:[_outputStream streamError]];
+        return NO;
+      }
+      written += result;
+    }
+  } else if (_deliverDataIncrementally) {
+    // The data is never backed by _readBuffer in this case, so it's safe to
+    // hand it over as is.
+    [multicastDelegate xmppIncomingFileTransfer:self didReceiveDataChunk:data];
+  } else {
+    [_receivedData appendData:data];
+  }
+
+  CC_MD5_Update(&_md5Context, bytes, (CC_LONG) length);
+  _receivedDataSize += length;
+
+  [multicastDelegate xmppIncomingFileTransfer:self
+                       didReceiveDataWithSize:_receivedDataSize
+                                    totalSize:_totalDataSize];
+  return YES;
+}
+
+/**
+* Checks the hash of the received data against the one provided by the sender
+* in the SI offer, if there was one. As per XEP-0096, this is the MD5 checksum
+* of the file, as a hex string.
+*/
+- (BOOL)verifyReceivedDataHash
+{
+  if ([_expectedHash length] == 0) return YES;
+
+  unsigned char digest[CC_MD5_DIGEST_LENGTH];
+  CC_MD5_Final(digest, &_md5Context);
+
+  NSString *hash = [[NSData dataWithBytes:digest length:CC_MD5_DIGEST_LENGTH] xmpp_hexStringValue];
+  return [hash caseInsensitiveCompare:_expectedHash] == NSOrderedSame;
+}
+
 /**
 * This method is called to clean up everything when the transfer fails.
 */
@@ -469,6 +605,9 @@ NSString *const XMPPIncomingFileTransferErrorDomain = @"XMPPIncomingFileTransfer
 
   _transferState = XMPPIFTStateNone;
   [multicastDelegate xmppIncomingFileTransfer:self didFailWithError:error];
+
+  [self cancelIBBTimer];
+  [self cleanUp];
 }
 
 /**
@@ -484,6 +623,16 @@ NSString *const XMPPIncomingFileTransferErrorDomain = @"XMPPIncomingFileTransfer
       @autoreleasepool {
         [self cancelIBBTimer];
 
+        if (![self verifyReceivedDataHash]) {
+          [self failWithReason:@"The received data doesn't match the hash provided by the sender."
+                         error:nil];
+          return;
+        }
+
+        // Make sure everything has been written before the delegate goes
+        // looking for it.
+        [self->_outputStream close];
+
         [self->multicastDelegate xmppIncomingFileTransfer:self
                                  didSucceedWithData:self->_receivedData
                                               named:self->_receivedFileName
@@ -520,6 +669,12 @@ NSString *const XMPPIncomingFileTransferErrorDomain = @"XMPPIncomingFileTransfer
   _receivedFileName = nil;
   _totalDataSize = 0;
   _receivedDataSize = 0;
+
+  [_outputStream close];
+  _outputStream = nil;
+  _outputFileDescriptor = -1;
+  _readBuffer = nil;
+  _expectedHash = nil;
 }
 
 
@@ -624,7 +779,8 @@ NSString *const XMPPIncomingFileTransferErrorDomain = @"XMPPIncomingFileTransfer
 
 - (void)socket:(GCDAsyncSocket *)sock didReadData:(NSData *)data withTag:(long)tag
 {
-  XMPPLogVerbose(@"%@: didReadData:%@ withTag:%ld", THIS_FILE, data, tag);
+  XMPPLogVerbose(@"%@: didReadData:(%lu bytes) withTag:%ld", THIS_FILE, (unsigned long) [data length],
+                 tag);
 
   switch (tag) {
     case SOCKS_TAG_READ_METHOD:
@@ -632,15 +788,15 @@ NSString *const XMPPIncomingFileTransferErrorDomain = @"XMPPIncomingFileTransfer
       break;
     case SOCKS_TAG_READ_REPLY:
       [self socks5ReadReply:data];
+      break;
     case SOCKS_TAG_READ_ADDRESS:
-      [_asyncSocket readDataToLength:_totalDataSize
-                         withTimeout:TIMEOUT_READ
-                                 tag:SOCKS_TAG_READ_DATA];
+      [self socks5ReadNextDataChunk];
       break;
     case SOCKS_TAG_READ_DATA:
-      // Success!
-      _receivedData = [data mutableCopy];
-      [self transferSuccess];
+      if ([self deliverReceivedData:data]) {
+        [self socks5ReadNextDataChunk];
+      }
+      break;
     default:
       break;
   }
@@ -958,4 +1114,42 @@ NSString *const XMPPIncomingFileTransferErrorDomain = @"XMPPIncomingFileTransfer
     dispatch_async(moduleQueue, block);
 }
 
+/**
+* Reads the next chunk of data from the bytestream, or finishes the transfer if
+* all the data has been received.
+*
+* When the data is being written to an output stream or file descriptor, it's
+* read into _readBuffer, which is allocated once and reused for every chunk.
+* A chunk never exceeds SOCKS_READ_CHUNK_SIZE, so GCDAsyncSocket never has to
+* grow it. Otherwise, each chunk gets its own buffer, since it's either handed
+* to the delegate or appended to _receivedData.
+*/
+- (void)socks5ReadNextDataChunk
+{
+  XMPPLogTrace();
+
+  if (_receivedDataSize >= _totalDataSize) {
+    XMPPLogInfo(@"Finished downloading SOCKS5 data.");
+    [self transferSuccess];
+    return;
+  }
+
+  NSUInteger length = (NSUInteger) MIN(_totalDataSize - _receivedDataSize,
+                                       (unsigned long long) SOCKS_READ_CHUNK_SIZE);
+
+  if (_outputStream || _outputFileDescriptor >= 0) {
+    if (!_readBuffer) {
+      _readBuffer = [[NSMutableData alloc] initWithLength:SOCKS_READ_CHUNK_SIZE];
+    }
+
+    [_asyncSocket readDataToLength:length
+                       withTimeout:TIMEOUT_READ_DATA
+                            buffer:_readBuffer
+                      bufferOffset:0
+                               tag:SOCKS_TAG_READ_DATA];
+  } else {
+    [_asyncSocket readDataToLength:length withTimeout:TIMEOUT_READ_DATA tag:SOCKS_TAG_READ_DATA];
+  }
+}
+
 @end
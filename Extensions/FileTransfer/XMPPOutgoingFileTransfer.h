@@ -18,6 +18,31 @@
 */
 @property (nonatomic, strong) NSData *outgoingData;
 
+/**
+* (Optional)
+*
+* An alternative to outgoingData. If set, the data being sent is read from
+* this stream on demand, a chunk at a time, instead of being held in memory.
+* This is the recommended way of sending large files.
+*
+* The stream is read synchronously, so it should be backed by a file or a
+* buffer (see sendFileAtPath:named:toRecipient:description:error:). It's
+* opened when the transfer begins, and closed when the transfer ends.
+*
+* If this is set, outgoingStreamLength must be set as well, and outgoingData
+* is ignored.
+*/
+@property (nonatomic, strong) NSInputStream *outgoingStream;
+
+/**
+* (Optional)
+*
+* The number of bytes that will be read from outgoingStream. This is required
+* when using outgoingStream, as the file size must be sent to the recipient
+* before the transfer begins.
+*/
+@property (nonatomic, assign) unsigned long long outgoingStreamLength;
+
 /**
 * (Required)
 *
@@ -64,12 +89,42 @@
 */
 @property (nonatomic, assign) int32_t blockSize;
 
+/**
+* (Optional)
+*
+* Specifies the maximum number of IBB data stanzas that may be in flight (sent,
+* but not yet acknowledged) at any given time. With the default value of 1, each
+* block is only sent once the previous one has been acknowledged, which limits
+* throughput to a single block per round trip. Larger values allow the blocks to
+* be pipelined, which can improve throughput considerably on high latency
+* connections.
+*
+* The default is 1.
+*/
+@property (nonatomic, assign) NSUInteger ibbWindowSize;
+
+/**
+* (Optional)
+*
+* Specifies whether or not IBB data should be sent in <message/> stanzas rather
+* than <iq/> stanzas (XEP-0047 Section 3). Message stanzas aren't acknowledged
+* by the recipient, so there is no round trip per block. Instead, a block is
+* considered sent once the stream has sent it, and ibbWindowSize limits the
+* number of blocks waiting to be sent.
+*
+* Note that there is no flow control (or confirmation of delivery) with message
+* stanzas, and servers may rate limit them.
+*
+* The default is NO.
+*/
+@property (nonatomic, assign) BOOL shouldUseMessageStanzasForIBB;
+
 
 #pragma mark - Public Methods
 
 /**
 * Starts the file transfer. This assumes that at a minimum a recipientJID and
-* outgoingData have already been provided.
+* outgoingData (or outgoingStream) have already been provided.
 *
 * @param errPtr The address of an error which will be contain a description of
 *               the problem if there is one (optional).
@@ -104,6 +159,47 @@
      description:(NSString *)description
            error:(NSError **)errPtr;
 
+/**
+* Sends the file at the provided path to the provided recipient. The file is
+* read from disk as it's being sent, so it's never loaded into memory in its
+* entirety. Pass nil for params you don't care about.
+*
+* @param path The path of the file you wish to send (required).
+* @param name The filename of the file you're sending (optional). If nil, the
+*             last path component of the path is used.
+* @param recipient The recipient of your file transfer (required). Note that a
+*                  resource must also be included in the JID.
+* @param description The description of the file you're sending (optional).
+* @param errPtr The address of an error which will contain a description of the
+*               problem if there is one (optional).
+*/
+- (BOOL)sendFileAtPath:(NSString *)path
+                 named:(NSString *)name
+           toRecipient:(XMPPJID *)recipient
+           description:(NSString *)description
+                 error:(NSError **)errPtr;
+
+/**
+* Sends the data read from the provided stream to the provided recipient. Pass
+* nil for params you don't care about.
+*
+* @param stream The (unopened) stream providing the data you wish to send
+*               (required). See outgoingStream.
+* @param length The number of bytes that will be read from the stream.
+* @param name The filename of the file you're sending (optional).
+* @param recipient The recipient of your file transfer (required). Note that a
+*                  resource must also be included in the JID.
+* @param description The description of the file you're sending (optional).
+* @param errPtr The address of an error which will contain a description of the
+*               problem if there is one (optional).
+*/
+- (BOOL)sendStream:(NSInputStream *)stream
+            length:(unsigned long long)length
+             named:(NSString *)name
+       toRecipient:(XMPPJID *)recipient
+       description:(NSString *)description
+             error:(NSError **)errPtr;
+
 @end
 
 
@@ -55,6 +55,14 @@ static const int xmppLogLevel = XMPP_LOG_LEVEL_VERBOSE | XMPP_LOG_FLAG_TRACE;
 #define TIMEOUT_WRITE -1
 #define TIMEOUT_READ 5.0
 
+/**
+* SOCKS5 transfers are written to the socket in chunks of this size (Bytes),
+* with at most SOCKS_WRITE_READ_AHEAD chunks queued up in the socket at any
+* given time. This keeps memory usage flat regardless of the file size.
+*/
+#define SOCKS_WRITE_CHUNK_SIZE (64 * 1024)
+#define SOCKS_WRITE_READ_AHEAD 4
+
 /**
 * Set the default timeout for requests to be 60 seconds.
 */
@@ -80,10 +88,31 @@ NSString *const XMPPOutgoingFileTransferErrorDomain = @"XMPPOutgoingFileTransfer
 
   GCDAsyncSocket *_outgoingSocket;
 
-  int32_t _outgoingDataBlockSeq;
-  NSUInteger _sentDataSize;
-  NSUInteger _totalDataSize;
-  NSString *_outgoingDataBase64;
+  uint16_t _outgoingDataBlockSeq; // wraps around to 0 after 65535 (XEP-0047)
+  unsigned long long _sentDataSize;
+  unsigned long long _totalDataSize;
+
+  // The stream the data being sent is read from (either outgoingStream, or a
+  // stream wrapping outgoingData), the number of bytes read from it so far,
+  // and whether it's been read to the end.
+  NSInputStream *_outgoingSource;
+  unsigned long long _readDataSize;
+  BOOL _outgoingSourceAtEnd;
+
+  // IBB: the buffer blocks are read into before being encoded, the data
+  // stanzas awaiting acknowledgement (in the order they were sent), the number
+  // of bytes each one carries, and those that have been acknowledged out of
+  // order.
+  NSMutableData *_ibbBlockBuffer;
+  NSMutableArray *_ibbPendingIDs;
+  NSMutableDictionary *_ibbPendingLengths;
+  NSMutableSet *_ibbAckedIDs;
+
+  // SOCKS5: the chunks queued up in _socksDataSocket, reused round-robin.
+  GCDAsyncSocket *_socksDataSocket;
+  NSMutableArray *_socksChunkBuffers;
+  NSUInteger _socksChunkIndex;
+  NSUInteger _pendingSOCKSWrites;
 
   XMPPOFTState _transferState;
 
@@ -108,6 +137,7 @@ NSString *const XMPPOutgoingFileTransferErrorDomain = @"XMPPOutgoingFileTransfer
 
     // define the default block-size in case we use IBB
     _blockSize = 4096;
+    _ibbWindowSize = 1;
 
     _transferState = XMPPOFTStateNone;
     _pastRecipients = [NSMutableDictionary new];
@@ -148,7 +178,7 @@ NSString *const XMPPOutgoingFileTransferErrorDomain = @"XMPPOutgoingFileTransfer
     return NO;
   }
 
-  if (!_outgoingData) {
+  if (!_outgoingData && !_outgoingStream) {
     if (errPtr) {
       NSString *errMsg = @"You must provide data to be sent.";
       *errPtr = [self localErrorWithMessage:errMsg code:-1];
@@ -243,6 +273,62 @@ NSString *const XMPPOutgoingFileTransferErrorDomain = @"XMPPOutgoingFileTransfer
   }
 
   self.outgoingData = data;
+  self.outgoingStream = nil;
+  self.outgoingStreamLength = 0;
+  self.outgoingFileName = name;
+  self.recipientJID = recipient;
+  self.outgoingFileDescription = description;
+
+  return [self startFileTransfer:errPtr];
+}
+
+- (BOOL)sendFileAtPath:(NSString *)path
+                 named:(NSString *)name
+           toRecipient:(XMPPJID *)recipient
+           description:(NSString *)description
+                 error:(NSError **)errPtr
+{
+  NSError *err = nil;
+  NSDictionary *attributes = path ? [[NSFileManager defaultManager] attributesOfItemAtPath:path
+                                                                                     error:&err] : nil;
+  NSInputStream *stream = attributes ? [NSInputStream inputStreamWithFileAtPath:path] : nil;
+
+  if (!stream) {
+    if (errPtr) {
+      NSString *errMsg = [NSString stringWithFormat:@"Unable to read the file at path: %@", path];
+      *errPtr = [self localErrorWithMessage:errMsg code:-1];
+    }
+
+    return NO;
+  }
+
+  return [self sendStream:stream
+                   length:[attributes fileSize]
+                    named:name ?: [path lastPathComponent]
+              toRecipient:recipient
+              description:description
+                    error:errPtr];
+}
+
+- (BOOL)sendStream:(NSInputStream *)stream
+            length:(unsigned long long)length
+             named:(NSString *)name
+       toRecipient:(XMPPJID *)recipient
+       description:(NSString *)description
+             error:(NSError **)errPtr
+{
+  if (_transferState != XMPPOFTStateNone) {
+    if (errPtr) {
+      NSString *errMsg = @"Transfer already in progress.";
+      *errPtr = [self localErrorWithMessage:errMsg code:-1];
+    }
+
+    return NO;
+  }
+
+  self.outgoingData = nil;
+  self.outgoingStream = stream;
+  self.outgoingStreamLength = length;
   self.outgoingFileName = name;
   self.recipientJID = recipient;
   self.outgoingFileDescription = description;
@@ -373,8 +459,8 @@ NSString *const XMPPOutgoingFileTransferErrorDomain = @"XMPPOutgoingFileTransfer
                                                      xmlns:XMPPSIProfileFileTransferNamespace];
         [file addAttributeWithName:@"name" stringValue:fileName];
         [file addAttributeWithName:@"size"
-                       stringValue:[[NSString alloc] initWithFormat:@"%lu",
-                                                                    (unsigned long) [_outgoingData length]]];//TODO
+                       stringValue:[[NSString alloc] initWithFormat:@"%llu",
+                                                                    [self outgoingDataLength]]];
         [si addChild:file];
 
         // Only include description if it's provided
@@ -684,7 +770,8 @@ NSString *const XMPPOutgoingFileTransferErrorDomain = @"XMPPOutgoingFileTransfer
         NSXMLElement *open = [NSXMLElement elementWithName:@"open" xmlns:XMPPIBBNamespace];
         [open addAttributeWithName:@"block-size" intValue:_blockSize];
         [open addAttributeWithName:@"sid" stringValue:self.sid];
-        [open addAttributeWithName:@"stanza" stringValue:@"iq"];
+        [open addAttributeWithName:@"stanza"
+                       stringValue:_shouldUseMessageStanzasForIBB ? @"message" : @"iq"];
         [iq addChild:open];
 
         [_idTracker addElement:iq
@@ -693,10 +780,6 @@ NSString *const XMPPOutgoingFileTransferErrorDomain = @"XMPPOutgoingFileTransfer
                        timeout:OUTGOING_DEFAULT_TIMEOUT];
 
         [xmppStream sendElement:iq];
-
-        // Convert our data to base64 for the IBB transmission
-        _outgoingDataBase64 = [_outgoingData base64EncodedStringWithOptions:0];
-        _totalDataSize = _outgoingDataBase64.length;
       }
   };
 
@@ -769,6 +852,10 @@ NSString *const XMPPOutgoingFileTransferErrorDomain = @"XMPPOutgoingFileTransfer
 * has verified that all the data has been sent, it fails, or receives an error
 * from the recipient. It will close the IBB stream upon completion.
 *
+* Up to ibbWindowSize data stanzas are kept in flight. This method is called
+* again each time one of them is acknowledged, at which point it tops up the
+* window with the next blocks.
+*
 * Example 6. Sending data in an IQ stanza (XEP-0047)
 *
 * <iq from='deckardcain@sanctuary.org/tristram'
@@ -784,7 +871,12 @@ NSString *const XMPPOutgoingFileTransferErrorDomain = @"XMPPOutgoingFileTransfer
 *   </data>
 * </iq>
 *
+* If shouldUseMessageStanzasForIBB is set, the <data/> element is sent inside a
+* <message/> stanza instead (XEP-0047 Example 10), and it's considered
+* acknowledged once the stream has sent it.
+*
 * @see handleIBBTransferQueryIQ:withInfo:
+* @see handleIBBMessageSent:withInfo:
 */
 - (void)sendIBBData
 {
@@ -792,33 +884,74 @@ NSString *const XMPPOutgoingFileTransferErrorDomain = @"XMPPOutgoingFileTransfer
 
   dispatch_block_t block = ^{
       @autoreleasepool {
-        if (_sentDataSize < _totalDataSize) {
-          XMPPIQ *iq = [XMPPIQ iqWithType:@"set"
-                                       to:_recipientJID
-                                elementID:[xmppStream generateUUID]];
+        if (![self openOutgoingSource]) {
+          [self failWithReason:@"Unable to open the outgoing data stream." error:nil];
+          return_from_block;
+        }
+
+        if (!_ibbBlockBuffer) {
+          _ibbBlockBuffer = [[NSMutableData alloc] init];
+          _ibbPendingIDs = [[NSMutableArray alloc] init];
+          _ibbPendingLengths = [[NSMutableDictionary alloc] init];
+          _ibbAckedIDs = [[NSMutableSet alloc] init];
+        }
+
+        // Each block is read from the source just before it's sent, so only a
+        // single block is ever held in memory. The block-size is the length
+        // of the base64 encoded data, so we read the largest multiple of 3
+        // bytes that will encode to fit within it.
+        NSUInteger rawBlockSize = MAX((NSUInteger) (_blockSize / 4) * 3, 3);
+        NSUInteger windowSize = MAX(_ibbWindowSize, 1);
+
+        while ([_ibbPendingIDs count] < windowSize && !_outgoingSourceAtEnd) {
+          NSError *readError = nil;
+          if (![self readOutgoingChunkIntoBuffer:_ibbBlockBuffer maxLength:rawBlockSize error:&readError]) {
+            [self failWithReason:@"Unable to read from the outgoing data stream." error:readError];
+            return_from_block;
+          }
+
+          if ([_ibbBlockBuffer length] == 0) break;
+
           NSXMLElement *data = [NSXMLElement elementWithName:@"data" xmlns:XMPPIBBNamespace];
           [data addAttributeWithName:@"sid" stringValue:self.sid];
           [data addAttributeWithName:@"seq" intValue:_outgoingDataBlockSeq++];
+          [data setStringValue:[_ibbBlockBuffer base64EncodedStringWithOptions:0]];
 
-          // Get the base64 data for our block
-          NSUInteger length = _sentDataSize + _blockSize > _totalDataSize ?
-              _totalDataSize - _sentDataSize : _blockSize;
-          NSRange range = NSMakeRange(_sentDataSize, length);
+          XMPPLogVerbose(@"Uploading %llu/%llu bytes in IBB transfer (%lu blocks in flight).",
+                         _sentDataSize, _totalDataSize, (unsigned long) [_ibbPendingIDs count]);
 
-          NSString *dataString = [_outgoingDataBase64 substringWithRange:range];
-          XMPPLogVerbose(@"Uploading %lu/%lu bytes in IBB transfer.", (unsigned long) _sentDataSize,
-                         (unsigned long) _totalDataSize);
+          NSString *elementID = [xmppStream generateUUID];
+          [_ibbPendingIDs addObject:elementID];
+          _ibbPendingLengths[elementID] = @([_ibbBlockBuffer length]);
 
-          [data setStringValue:dataString];
-          [iq addChild:data];
+          if (_shouldUseMessageStanzasForIBB) {
+            XMPPMessage *message = [XMPPMessage messageWithType:nil
+                                                             to:_recipientJID
+                                                      elementID:elementID
+                                                          child:data];
 
-          [_idTracker addElement:iq
-                          target:self
-                        selector:@selector(handleIBBTransferQueryIQ:withInfo:)
-                         timeout:OUTGOING_DEFAULT_TIMEOUT];
+            [_idTracker addID:elementID
+                       target:self
+                     selector:@selector(handleIBBMessageSent:withInfo:)
+                      timeout:OUTGOING_DEFAULT_TIMEOUT];
 
-          [xmppStream sendElement:iq];
-        } else {
+            [xmppStream sendElement:message];
+          } else {
+            XMPPIQ *iq = [XMPPIQ iqWithType:@"set"
+                                         to:_recipientJID
+                                  elementID:elementID
+                                      child:data];
+
+            [_idTracker addElement:iq
+                            target:self
+                          selector:@selector(handleIBBTransferQueryIQ:withInfo:)
+                           timeout:OUTGOING_DEFAULT_TIMEOUT];
+
+            [xmppStream sendElement:iq];
+          }
+        }
+
+        if (_outgoingSourceAtEnd && [_ibbPendingIDs count] == 0) {
           XMPPLogInfo(@"IBB file transfer complete. Closing stream...");
 
           // All the data has been sent. Alert the delegate that the transfer
@@ -835,11 +968,63 @@ NSString *const XMPPOutgoingFileTransferErrorDomain = @"XMPPOutgoingFileTransfer
     dispatch_async(moduleQueue, block);
 }
 
+/**
+* Marks the IBB data stanza with the given elementID as acknowledged. Blocks are
+* only counted as sent once every block sent before them has been acknowledged
+* as well, so the progress always reflects a contiguous prefix of the data.
+*
+* @return Returns NO if the elementID doesn't belong to a data stanza in flight
+*         (for example, a late response after the transfer has failed); YES
+*         otherwise.
+*/
+- (BOOL)acknowledgeIBBDataWithElementID:(NSString *)elementID
+{
+  if (!elementID || !_ibbPendingLengths[elementID]) return NO;
+
+  [_ibbAckedIDs addObject:elementID];
+
+  while ([_ibbPendingIDs count] > 0 && [_ibbAckedIDs containsObject:_ibbPendingIDs[0]]) {
+    NSString *firstID = _ibbPendingIDs[0];
+    _sentDataSize += [_ibbPendingLengths[firstID] unsignedLongLongValue];
+
+    [_ibbAckedIDs removeObject:firstID];
+    [_ibbPendingLengths removeObjectForKey:firstID];
+    [_ibbPendingIDs removeObjectAtIndex:0];
+  }
+
+  return YES;
+}
+
+/**
+* Called once the stream has sent an IBB data message (see
+* xmppStream:didSendMessage:), or with a nil message if it failed to send it
+* or didn't get to it within the timeout. Since the stream sends stanzas in
+* order, the messages are acknowledged in order too.
+*
+* This provides the flow control for message stanzas; without it, the entire
+* file would be queued up in the stream.
+*/
+- (void)handleIBBMessageSent:(XMPPMessage *)message withInfo:(id <XMPPTrackingInfo>)info
+{
+  XMPPLogTrace();
+
+  NSString *elementID = [info elementID];
+  if (!_ibbPendingLengths[elementID]) return;
+
+  if (!message) {
+    [self failWithReason:@"Unable to send IBB data message." error:nil];
+    return;
+  }
+
+  [self acknowledgeIBBDataWithElementID:elementID];
+  [self sendIBBData];
+}
+
 /**
 * Handles the response from the data recipient during an IBB file transfer. The
 * recipient should be sending back a childless result IQ confirming that they
-* received the data we sent. We will wait until receiving this IQ before
-* sending the next block of data.
+* received the data we sent. Once it does, the next block of data is sent to
+* keep the window full.
 *
 * Example 7. Acknowledging data received via IQ (XEP-0047)
 *
@@ -856,11 +1041,16 @@ NSString *const XMPPOutgoingFileTransferErrorDomain = @"XMPPOutgoingFileTransfer
 
   dispatch_block_t block = ^{
       @autoreleasepool {
+        // Ignore responses for blocks that are no longer in flight, such as
+        // those still outstanding when the transfer failed.
+        if (!_ibbPendingLengths[info.elementID]) return_from_block;
+
         if (!iq) {
           // If we're inside this block, it means that the timeout has been
           // fired and we need to force a failure
           NSString *errMsg = @"Timeout waiting for response to IBB sent data.";
           [self failWithReason:errMsg error:nil];
+          return_from_block;
         }
 
         NSXMLElement *errorElem = [iq elementForName:@"error"];
@@ -877,6 +1067,11 @@ NSString *const XMPPOutgoingFileTransferErrorDomain = @"XMPPOutgoingFileTransfer
           return;
         }
 
+        // At this point, we're assuming that we've received the stanza shown
+        // above and the recipient has successfully received the data we sent,
+        // so we should now send them the next block(s) of data.
+        [self acknowledgeIBBDataWithElementID:info.elementID];
+
         // Handle the scenario when the recipient closes the bytestream.
         NSXMLElement *close = [iq elementForName:@"close"];
         if (close) {
@@ -904,12 +1099,10 @@ NSString *const XMPPOutgoingFileTransferErrorDomain = @"XMPPOutgoingFileTransfer
             [self failWithReason:@"Recipient closed IBB stream." error:nil];
             [multicastDelegate xmppOutgoingFileTransferIBBClosed:self];
           }
+
+          return_from_block;
         }
 
-        // At this point, we're assuming that we've received the stanza shown
-        // above and the recipient has successfully received the data we sent,
-        // so we should now send them the next block of data.
-        _sentDataSize += _blockSize;
         [self sendIBBData];
 
         XMPPLogVerbose(
@@ -1369,9 +1562,7 @@ NSString *const XMPPOutgoingFileTransferErrorDomain = @"XMPPOutgoingFileTransfer
 
         if ([jid isEqualToString:xmppStream.myJID.full]) {
           XMPPLogVerbose(@"%@: writing data via direct connection.", THIS_FILE);
-          [_outgoingSocket writeData:_outgoingData
-                         withTimeout:TIMEOUT_WRITE
-                                 tag:SOCKS_TAG_WRITE_DATA];
+          [self beginSOCKS5DataTransferOnSocket:_outgoingSocket];
           return;
         }
 
@@ -1447,7 +1638,7 @@ NSString *const XMPPOutgoingFileTransferErrorDomain = @"XMPPOutgoingFileTransfer
         }
 
         XMPPLogVerbose(@"Receive response to activate. Starting the actual data transfer now...");
-        [_asyncSocket writeData:_outgoingData withTimeout:TIMEOUT_WRITE tag:SOCKS_TAG_WRITE_DATA];
+        [self beginSOCKS5DataTransferOnSocket:_asyncSocket];
       }
   };
 
@@ -1570,6 +1761,119 @@ NSString *const XMPPOutgoingFileTransferErrorDomain = @"XMPPOutgoingFileTransfer
   return hash;
 }
 
+/**
+* The number of bytes being sent, which is the length of either outgoingStream
+* or outgoingData.
+*/
+- (unsigned long long)outgoingDataLength
+{
+  return _outgoingStream ? _outgoingStreamLength : [_outgoingData length];
+}
+
+/**
+* Opens the stream the data being sent is read from, if it isn't open already.
+* This is either outgoingStream, or a stream wrapping outgoingData.
+*
+* @return Returns NO if the stream couldn't be opened; YES otherwise.
+*/
+- (BOOL)openOutgoingSource
+{
+  if (_outgoingSource) return YES;
+
+  if (_outgoingStream) {
+    _outgoingSource = _outgoingStream;
+  } else {
+    _outgoingSource = [NSInputStream inputStreamWithData:_outgoingData ?: [NSData data]];
+  }
+
+  _outgoingSourceAtEnd = NO;
+  _readDataSize = 0;
+  _sentDataSize = 0;
+  _totalDataSize = [self outgoingDataLength];
+
+  if ([_outgoingSource streamStatus] == NSStreamStatusNotOpen) {
+    [_outgoingSource open];
+  }
+
+  return [_outgoingSource streamStatus] != NSStreamStatusError;
+}
+
+/**
+* Reads up to maxLength bytes from the outgoing source into the buffer,
+* replacing its contents. The buffer is only shorter than maxLength (possibly
+* empty) once the declared length (outgoingDataLength) has been read.
+*
+* The source must contain exactly the declared length, since that's the size
+* offered to the recipient. A source that ends early, or that has more data
+* once the declared length has been read, is an error.
+*
+* @return Returns NO if there was an error reading from the source, or its
+*         length doesn't match the declared length; YES otherwise.
+*/
+- (BOOL)readOutgoingChunkIntoBuffer:(NSMutableData *)buffer
+                          maxLength:(NSUInteger)maxLength
+                              error:(NSError **)errPtr
+{
+  unsigned long long remaining = _totalDataSize - _readDataSize;
+  if (maxLength > remaining) maxLength = (NSUInteger) remaining;
+
+  [buffer setLength:maxLength];
+
+  NSUInteger length = 0;
+  while (length < maxLength) {
+    NSInteger result = [_outgoingSource read:(uint8_t *) [buffer mutableBytes] + length
+                                   maxLength:maxLength - length];
+    if (result <= 0) {
+      [buffer setLength:0];
+
+      if (errPtr) {
+        if (result < 0) {
+          *errPtr = [_outgoingSource streamError];
+        } else {
+          NSString *errMsg =
+              [NSString stringWithFormat:@"The outgoing data stream ended after %llu of %llu bytes.",
+                                         _readDataSize + length, _totalDataSize];
+          *errPtr = [self localErrorWithMessage:errMsg code:-1];
+        }
+      }
+
+      return NO;
+    }
+
+    length += result;
+  }
+
+  [buffer setLength:length];
+  _readDataSize += length;
+
+  if (_readDataSize == _totalDataSize) {
+    // Make sure the source doesn't hold more than it claimed to, as the rest
+    // would be silently cut off.
+    uint8_t extra;
+    NSInteger result = [_outgoingSource read:&extra maxLength:1];
+    if (result != 0) {
+      [buffer setLength:0];
+
+      if (errPtr) {
+        if (result < 0) {
+          *errPtr = [_outgoingSource streamError];
+        } else {
+          NSString *errMsg =
+              [NSString stringWithFormat:@"The outgoing data stream is longer than %llu bytes.",
+                                         _totalDataSize];
+          *errPtr = [self localErrorWithMessage:errMsg code:-1];
+        }
+      }
+
+      return NO;
+    }
+
+    _outgoingSourceAtEnd = YES;
+  }
+
+  return YES;
+}
+
 /**
 * This method is called to clean up everything if the transfer fails.
 */
@@ -1635,7 +1939,20 @@ NSString *const XMPPOutgoingFileTransferErrorDomain = @"XMPPOutgoingFileTransfer
   _totalDataSize = 0;
   _outgoingDataBlockSeq = 0;
   _sentDataSize = 0;
-  _outgoingDataBase64 = nil;
+  _readDataSize = 0;
+
+  [_outgoingSource close];
+  _outgoingSource = nil;
+  _outgoingSourceAtEnd = NO;
+  _ibbBlockBuffer = nil;
+  _ibbPendingIDs = nil;
+  _ibbPendingLengths = nil;
+  _ibbAckedIDs = nil;
+
+  _socksDataSocket = nil;
+  _socksChunkBuffers = nil;
+  _socksChunkIndex = 0;
+  _pendingSOCKSWrites = 0;
 }
 
 
@@ -1656,6 +1973,43 @@ NSString *const XMPPOutgoingFileTransferErrorDomain = @"XMPPOutgoingFileTransfer
   return NO;
 }
 
+/**
+* When sending IBB data in message stanzas, each one is acknowledged once the
+* stream has sent it.
+*/
+- (void)xmppStream:(XMPPStream *)sender didSendMessage:(XMPPMessage *)message
+{
+  if (!_shouldUseMessageStanzasForIBB || !_ibbPendingIDs) return;
+
+  [_idTracker invokeForID:[message elementID] withObject:message];
+}
+
+- (void)xmppStream:(XMPPStream *)sender didFailToSendMessage:(XMPPMessage *)message error:(NSError *)error
+{
+  if (!_shouldUseMessageStanzasForIBB || !_ibbPendingIDs) return;
+
+  [_idTracker invokeForID:[message elementID] withObject:nil];
+}
+
+/**
+* When sending IBB data in message stanzas, the recipient reports problems by
+* bouncing an error message back to us (XEP-0047 Section 3).
+*/
+- (void)xmppStream:(XMPPStream *)sender didReceiveMessage:(XMPPMessage *)message
+{
+  if (!_shouldUseMessageStanzasForIBB || !_ibbPendingIDs || ![message isErrorMessage]) return;
+
+  NSXMLElement *data = [message elementForName:@"data" xmlns:XMPPIBBNamespace];
+  if (![[data attributeStringValueForName:@"sid"] isEqualToString:self.sid]) return;
+
+  NSXMLElement *errorElem = [message elementForName:@"error"];
+  NSString *errMsg = [NSString stringWithFormat:@"Error transferring with IBB: %@",
+                                                [errorElem childAtIndex:0]];
+  NSError *err = [self localErrorWithMessage:errMsg code:-1];
+
+  [self failWithReason:@"The recipient rejected the IBB data message." error:err];
+}
+
 
 #pragma mark - GCDAsyncSocketDelegate
 
@@ -1716,7 +2070,7 @@ NSString *const XMPPOutgoingFileTransferErrorDomain = @"XMPPOutgoingFileTransfer
       [_asyncSocket readDataToLength:5 withTimeout:TIMEOUT_READ tag:SOCKS_TAG_READ_PROXY_REPLY];
       break;
     case SOCKS_TAG_WRITE_DATA:
-      [self transferSuccess];
+      [self socks5DidWriteDataChunk];
       break;
     default:
       break;
@@ -2188,4 +2542,99 @@ shouldTimeoutWriteWithTag:(long)tag
     dispatch_async(moduleQueue, block);
 }
 
+/**
+* Begins writing the data being sent to the provided socket, once the SOCKS5
+* bytestream has been established (either directly or through a proxy).
+*
+* The data is read from the outgoing source in chunks of
+* SOCKS_WRITE_CHUNK_SIZE, and at most SOCKS_WRITE_READ_AHEAD chunks are queued
+* up in the socket at once. As each chunk is written, the next one is read.
+*/
+- (void)beginSOCKS5DataTransferOnSocket:(GCDAsyncSocket *)socket
+{
+  XMPPLogTrace();
+
+  dispatch_block_t block = ^{
+      @autoreleasepool {
+        if (![self openOutgoingSource]) {
+          [self failWithReason:@"Unable to open the outgoing data stream." error:nil];
+          return_from_block;
+        }
+
+        _socksDataSocket = socket;
+        _socksChunkBuffers = [[NSMutableArray alloc] initWithCapacity:SOCKS_WRITE_READ_AHEAD];
+        _socksChunkIndex = 0;
+        _pendingSOCKSWrites = 0;
+
+        [self socks5WriteDataChunks];
+      }
+  };
+
+  if (dispatch_get_specific(moduleQueueTag))
+    block();
+  else
+    dispatch_async(moduleQueue, block);
+}
+
+/**
+* Tops up the chunks queued in the socket, or finishes the transfer if all the
+* data has been written.
+*
+* Since the socket completes writes in order, the buffer for a chunk is only
+* reused once the write SOCKS_WRITE_READ_AHEAD chunks before it has completed.
+*/
+- (void)socks5WriteDataChunks
+{
+  while (_pendingSOCKSWrites < SOCKS_WRITE_READ_AHEAD && !_outgoingSourceAtEnd) {
+    NSUInteger bufferIndex = _socksChunkIndex % SOCKS_WRITE_READ_AHEAD;
+    if (bufferIndex >= [_socksChunkBuffers count]) {
+      [_socksChunkBuffers addObject:[[NSMutableData alloc] initWithCapacity:SOCKS_WRITE_CHUNK_SIZE]];
+    }
+
+    NSMutableData *buffer = _socksChunkBuffers[bufferIndex];
+    NSError *readError = nil;
+    if (![self readOutgoingChunkIntoBuffer:buffer maxLength:SOCKS_WRITE_CHUNK_SIZE error:&readError]) {
+      [self failWithReason:@"Unable to read from the outgoing data stream." error:readError];
+      return;
+    }
+
+    if ([buffer length] == 0) break;
+
+    _socksChunkIndex++;
+    _pendingSOCKSWrites++;
+
+    [_socksDataSocket writeData:buffer withTimeout:TIMEOUT_WRITE tag:SOCKS_TAG_WRITE_DATA];
+  }
+
+  if (_outgoingSourceAtEnd && _pendingSOCKSWrites == 0) {
+    [self transferSuccess];
+  }
+}
+
+/**
+* Called each time a chunk of data has been written to the SOCKS5 socket.
+*/
+- (void)socks5DidWriteDataChunk
+{
+  dispatch_block_t block = ^{
+      @autoreleasepool {
+        if (_pendingSOCKSWrites == 0) return_from_block;
+
+        // The oldest chunk still queued in the socket is the one just written
+        NSUInteger bufferIndex = (_socksChunkIndex - _pendingSOCKSWrites) % SOCKS_WRITE_READ_AHEAD;
+        _sentDataSize += [_socksChunkBuffers[bufferIndex] length];
+        _pendingSOCKSWrites--;
+
+        XMPPLogVerbose(@"Uploaded %llu/%llu bytes in SOCKS5 transfer.", _sentDataSize, _totalDataSize);
+
+        [self socks5WriteDataChunks];
+      }
+  };
+
+  if (dispatch_get_specific(moduleQueueTag))
+    block();
+  else
+    dispatch_async(moduleQueue, block);
+}
+
 @end
@@ -10,6 +10,15 @@
 /**
  * This class is an example implementation of XMPPRosterStorage using core data.
  * You are free to substitute your own roster storage class.
+ * 
+ * This class supports roster versioning (RFC 6121, section 2.6).
+ * The version of the stored roster is kept in the metadata of the persistent store,
+ * and is updated as roster pushes are applied.
+ * If the server reports that the roster hasn't changed, the stored roster is used as is.
+ * 
+ * Note that roster versioning is only useful if the stored roster outlives the connection.
+ * That is, you'll want to disable autoRemovePreviousDatabaseFile (in this class),
+ * and autoClearAllUsersAndResources (in XMPPRoster).
 **/
 
 @interface XMPPRosterCoreDataStorage : XMPPCoreDataStorage <XMPPRosterStorage>
@@ -25,6 +34,8 @@
 	void *parentQueueTag;
     
 	NSMutableSet *rosterPopulationSet;
+	NSMutableDictionary *rosterPopulationVersions;
+	NSMutableDictionary *rosterPopulationJids;
 }
 
 /**
@@ -22,6 +22,9 @@
 #define AssertPrivateQueue() \
         NSAssert(dispatch_get_specific(storageQueueTag), @"Private method: MUST run on storageQueue");
 
+// Key within the persistent store metadata: (streamBareJidStr -> roster version)
+static NSString *const XMPPRosterVersionsMetadataKey = @"XMPPRosterVersions";
+
 
 @implementation XMPPRosterCoreDataStorage
 
@@ -52,6 +55,8 @@ static XMPPRosterCoreDataStorage *sharedInstance;
 	autoRecreateDatabaseFile = YES;
     
 	rosterPopulationSet = [[NSMutableSet alloc] init];
+	rosterPopulationVersions = [[NSMutableDictionary alloc] init];
+	rosterPopulationJids = [[NSMutableDictionary alloc] init];
 }
 
 - (BOOL)configureWithParent:(XMPPRoster *)aParent queue:(dispatch_queue_t)queue
@@ -132,6 +137,184 @@ static XMPPRosterCoreDataStorage *sharedInstance;
 	}
 }
 
+- (NSString *)_rosterVersionForStreamBareJidStr:(NSString *)streamBareJidStr
+{
+	AssertPrivateQueue();
+	
+	if (streamBareJidStr == nil) return nil;
+	
+	NSPersistentStoreCoordinator *psc = [self persistentStoreCoordinator];
+	NSPersistentStore *store = [[psc persistentStores] lastObject];
+	
+	if (store == nil) return nil;
+	
+	NSDictionary *versions = [psc metadataForPersistentStore:store][XMPPRosterVersionsMetadataKey];
+	
+	return versions[streamBareJidStr];
+}
+
+/**
+ * Stores the roster version for the given stream (or removes it if version is nil).
+ * If streamBareJidStr is nil, the versions for all streams are removed.
+ * 
+ * The metadata is written to disk along with the next save of the managed object context.
+**/
+- (void)_setRosterVersion:(NSString *)version forStreamBareJidStr:(NSString *)streamBareJidStr
+{
+	AssertPrivateQueue();
+	
+	if (streamBareJidStr == nil && version != nil) return;
+	
+	NSPersistentStoreCoordinator *psc = [self persistentStoreCoordinator];
+	NSPersistentStore *store = [[psc persistentStores] lastObject];
+	
+	if (store == nil) return;
+	
+	NSMutableDictionary *metadata = [[psc metadataForPersistentStore:store] mutableCopy];
+	NSMutableDictionary *versions = [metadata[XMPPRosterVersionsMetadataKey] mutableCopy];
+	
+	if (versions == nil)
+	{
+		if (version == nil) return;
+		versions = [NSMutableDictionary dictionaryWithCapacity:1];
+	}
+	
+	if (streamBareJidStr == nil)
+		[versions removeAllObjects];
+	else if (version)
+		versions[streamBareJidStr] = version;
+	else
+		[versions removeObjectForKey:streamBareJidStr];
+	
+	metadata[XMPPRosterVersionsMetadataKey] = versions;
+	[psc setMetadata:metadata forPersistentStore:store];
+}
+
+static BOOL XMPPRosterStringsEqual(NSString *str1, NSString *str2)
+{
+	return (str1 == str2) || [str1 isEqualToString:str2];
+}
+
+/**
+ * Returns whether the given user already reflects the given roster item.
+ * 
+ * Updating a managed object marks it as changed (even if the values are the same),
+ * which means it gets written to disk during the next save.
+ * For a (mostly) unchanged roster, skipping these updates avoids rewriting the entire table.
+**/
+static BOOL XMPPRosterUserMatchesItem(XMPPUserCoreDataStorageObject *user, NSXMLElement *item)
+{
+	if (!XMPPRosterStringsEqual(user.nickname, [item attributeStringValueForName:@"name"])) return NO;
+	if (!XMPPRosterStringsEqual(user.subscription, [item attributeStringValueForName:@"subscription"])) return NO;
+	if (!XMPPRosterStringsEqual(user.ask, [item attributeStringValueForName:@"ask"])) return NO;
+	
+	NSArray *groupElements = [item elementsForName:@"group"];
+	if ([groupElements count] != [user.groups count]) return NO;
+	
+	NSMutableSet *groupNames = [NSMutableSet setWithCapacity:[groupElements count]];
+	for (NSXMLElement *groupElement in groupElements)
+	{
+		[groupNames addObject:[groupElement stringValue]];
+	}
+	
+	return [groupNames isEqualToSet:[user.groups valueForKey:@"name"]];
+}
+
+/**
+ * Applies a batch of roster items (either from a roster result or a roster push).
+ * 
+ * The existing users for all the items are fetched with a single request,
+ * and the items are then applied as a diff (insert, update, delete, or nothing at all).
+ * Everything happens within a single block, so the changes are committed with a single save.
+**/
+- (void)_handleRosterItems:(NSArray *)items xmppStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	AssertPrivateQueue();
+	
+	// Index the items by bare jid.
+	// If the same jid is listed more than once, the last item wins.
+	
+	NSMutableDictionary *itemsByJidStr = [NSMutableDictionary dictionaryWithCapacity:[items count]];
+	
+	for (NSXMLElement *item in items)
+	{
+		NSString *jidStr = [[XMPPJID jidWithString:[item attributeStringValueForName:@"jid"]] bare];
+		if (jidStr)
+		{
+			itemsByJidStr[jidStr] = item;
+		}
+		else
+		{
+			XMPPLogVerbose(@"%@: Ignoring invalid roster item (missing or invalid jid): %@", THIS_FILE, item);
+		}
+	}
+	
+	if ([itemsByJidStr count] == 0) return;
+	
+	NSManagedObjectContext *moc = [self managedObjectContext];
+	NSString *streamBareJidStr = [[self myJIDForXMPPStream:stream] bare];
+	
+	NSEntityDescription *entity = [NSEntityDescription entityForName:@"XMPPUserCoreDataStorageObject"
+	                                          inManagedObjectContext:moc];
+	
+	NSPredicate *predicate;
+	if (stream == nil)
+		predicate = [NSPredicate predicateWithFormat:@"jidStr IN %@", [itemsByJidStr allKeys]];
+	else
+		predicate = [NSPredicate predicateWithFormat:@"jidStr IN %@ AND streamBareJidStr == %@",
+		                                             [itemsByJidStr allKeys], streamBareJidStr];
+	
+	NSFetchRequest *fetchRequest = [[NSFetchRequest alloc] init];
+	[fetchRequest setEntity:entity];
+	[fetchRequest setPredicate:predicate];
+	[fetchRequest setIncludesPendingChanges:YES];
+	[fetchRequest setReturnsObjectsAsFaults:NO];
+	[fetchRequest setRelationshipKeyPathsForPrefetching:@[@"groups"]];
+	
+	NSArray *existingUsers = [moc executeFetchRequest:fetchRequest error:nil];
+	
+	NSMutableDictionary *usersByJidStr = [NSMutableDictionary dictionaryWithCapacity:[existingUsers count]];
+	for (XMPPUserCoreDataStorageObject *user in existingUsers)
+	{
+		usersByJidStr[user.jidStr] = user;
+	}
+	
+	// During roster population, we keep track of every jid in the roster,
+	// so we can remove the users that are no longer in it once the population ends.
+	
+	NSMutableSet *populationJids = rosterPopulationJids[[NSNumber xmpp_numberWithPtr:(__bridge void *)stream]];
+	
+	[itemsByJidStr enumerateKeysAndObjectsUsingBlock:^(NSString *jidStr, NSXMLElement *item, BOOL *stop) {
+		
+		XMPPUserCoreDataStorageObject *user = usersByJidStr[jidStr];
+		
+		NSString *subscription = [item attributeStringValueForName:@"subscription"];
+		if ([subscription isEqualToString:@"remove"])
+		{
+			if (user)
+			{
+				[moc deleteObject:user];
+			}
+			[populationJids removeObject:jidStr];
+		}
+		else
+		{
+			if (user == nil)
+			{
+				[XMPPUserCoreDataStorageObject insertInManagedObjectContext:moc
+				                                                   withItem:item
+				                                           streamBareJidStr:streamBareJidStr];
+			}
+			else if (!XMPPRosterUserMatchesItem(user, item))
+			{
+				[user updateWithItem:item];
+			}
+			[populationJids addObject:jidStr];
+		}
+	}];
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark Overrides
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -266,49 +449,112 @@ static XMPPRosterCoreDataStorage *sharedInstance;
 	
 	[self scheduleBlock:^{
 		
-		[rosterPopulationSet addObject:[NSNumber xmpp_numberWithPtr:(__bridge void *)stream]];
-    
-		// Clear anything already in the roster core data store.
-		// 
-		// Note: Deleting a user will delete all associated resources
-		// because of the cascade rule in our core data model.
+		NSNumber *streamKey = [NSNumber xmpp_numberWithPtr:(__bridge void *)stream];
 		
-		NSManagedObjectContext *moc = [self managedObjectContext];
+		[rosterPopulationSet addObject:streamKey];
 		
-		NSEntityDescription *entity = [NSEntityDescription entityForName:@"XMPPUserCoreDataStorageObject"
-		                                          inManagedObjectContext:moc];
+		// The version only applies to the complete roster,
+		// so we don't store it until the population has finished.
 		
-		NSFetchRequest *fetchRequest = [[NSFetchRequest alloc] init];
-		[fetchRequest setEntity:entity];
-		[fetchRequest setFetchBatchSize:saveThreshold];
+		if (version)
+			rosterPopulationVersions[streamKey] = version;
+		else
+			[rosterPopulationVersions removeObjectForKey:streamKey];
 		
-		if (stream)
+		[self _setRosterVersion:nil forStreamBareJidStr:[[self myJIDForXMPPStream:stream] bare]];
+		
+		// Rather than deleting everything already in the roster core data store (and inserting it all again),
+		// we update the existing users in place as the roster items arrive.
+		// Once the population ends, any user that wasn't part of the roster is deleted.
+		
+		rosterPopulationJids[streamKey] = [NSMutableSet set];
+	}];
+}
+
+- (void)endRosterPopulationForXMPPStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	[self scheduleBlock:^{
+		
+		NSNumber *streamKey = [NSNumber xmpp_numberWithPtr:(__bridge void *)stream];
+		
+		[rosterPopulationSet removeObject:streamKey];
+		
+		NSSet *populationJids = rosterPopulationJids[streamKey];
+		if (populationJids)
 		{
+			// Delete the users that are no longer in our roster.
+			// 
+			// Note: Deleting a user will delete all associated resources
+			// because of the cascade rule in our core data model.
+			
+			NSManagedObjectContext *moc = [self managedObjectContext];
+			
+			NSEntityDescription *entity = [NSEntityDescription entityForName:@"XMPPUserCoreDataStorageObject"
+			                                          inManagedObjectContext:moc];
+			
 			NSPredicate *predicate;
-			predicate = [NSPredicate predicateWithFormat:@"streamBareJidStr == %@",
-			                                     [[self myJIDForXMPPStream:stream] bare]];
+			if (stream == nil)
+				predicate = [NSPredicate predicateWithFormat:@"NOT (jidStr IN %@)", populationJids];
+			else
+				predicate = [NSPredicate predicateWithFormat:@"NOT (jidStr IN %@) AND streamBareJidStr == %@",
+				                                     populationJids, [[self myJIDForXMPPStream:stream] bare]];
 			
+			NSFetchRequest *fetchRequest = [[NSFetchRequest alloc] init];
+			[fetchRequest setEntity:entity];
 			[fetchRequest setPredicate:predicate];
+			[fetchRequest setIncludesPendingChanges:YES];
+			
+			NSArray *removedUsers = [moc executeFetchRequest:fetchRequest error:nil];
+			
+			for (XMPPUserCoreDataStorageObject *user in removedUsers)
+			{
+				[moc deleteObject:user];
+			}
+			
+			[XMPPGroupCoreDataStorageObject clearEmptyGroupsInManagedObjectContext:moc];
+			
+			[rosterPopulationJids removeObjectForKey:streamKey];
 		}
 		
-		NSArray *allUsers = [moc executeFetchRequest:fetchRequest error:nil];
-		
-		for (XMPPUserCoreDataStorageObject *user in allUsers)
+		NSString *version = rosterPopulationVersions[streamKey];
+		if (version)
 		{
-			[moc deleteObject:user];
+			[self _setRosterVersion:version forStreamBareJidStr:[[self myJIDForXMPPStream:stream] bare]];
+			[rosterPopulationVersions removeObjectForKey:streamKey];
 		}
+	}];
+}
+
+- (NSString *)rosterVersionForXMPPStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	__block NSString *result = nil;
+	
+	[self executeBlock:^{
 		
-		[XMPPGroupCoreDataStorageObject clearEmptyGroupsInManagedObjectContext:moc];
+		result = [self _rosterVersionForStreamBareJidStr:[[self myJIDForXMPPStream:stream] bare]];
 	}];
+	
+	return result;
 }
 
-- (void)endRosterPopulationForXMPPStream:(XMPPStream *)stream
+- (void)setRosterVersion:(NSString *)version forXMPPStream:(XMPPStream *)stream
 {
 	XMPPLogTrace();
 	
 	[self scheduleBlock:^{
 		
-		[rosterPopulationSet removeObject:[NSNumber xmpp_numberWithPtr:(__bridge void *)stream]];
+		// While the roster is being populated, the version is stored when the population ends.
+		
+		NSNumber *streamKey = [NSNumber xmpp_numberWithPtr:(__bridge void *)stream];
+		
+		if ([rosterPopulationSet containsObject:streamKey])
+			rosterPopulationVersions[streamKey] = version;
+		else
+			[self _setRosterVersion:version forStreamBareJidStr:[[self myJIDForXMPPStream:stream] bare]];
 	}];
 }
 
@@ -322,47 +568,25 @@ static XMPPRosterCoreDataStorage *sharedInstance;
 	
 	[self scheduleBlock:^{
 		
-		NSManagedObjectContext *moc = [self managedObjectContext];
+		[self _handleRosterItems:@[item] xmppStream:stream];
+	}];
+}
+
+- (void)handleRosterItems:(NSArray *)itemSubElements xmppStream:(XMPPStream *)stream
+{
+	XMPPLogTrace();
+	
+	// Remember XML heirarchy memory management rules.
+	// The passed parameters are subnodes of the IQ, and we need to pass them to an asynchronous operation.
+	NSMutableArray *items = [NSMutableArray arrayWithCapacity:[itemSubElements count]];
+	for (NSXMLElement *itemSubElement in itemSubElements)
+	{
+		[items addObject:[itemSubElement copy]];
+	}
+	
+	[self scheduleBlock:^{
 		
-		if ([rosterPopulationSet containsObject:[NSNumber xmpp_numberWithPtr:(__bridge void *)stream]])
-		{
-			NSString *streamBareJidStr = [[self myJIDForXMPPStream:stream] bare];
-			
-			[XMPPUserCoreDataStorageObject insertInManagedObjectContext:moc
-			                                                   withItem:item
-			                                           streamBareJidStr:streamBareJidStr];
-		}
-		else
-		{
-			NSString *jidStr = [item attributeStringValueForName:@"jid"];
-			XMPPJID *jid = [[XMPPJID jidWithString:jidStr] bareJID];
-			
-			XMPPUserCoreDataStorageObject *user = [self userForJID:jid xmppStream:stream managedObjectContext:moc];
-			
-			NSString *subscription = [item attributeStringValueForName:@"subscription"];
-			if ([subscription isEqualToString:@"remove"])
-			{
-				if (user)
-				{
-					[moc deleteObject:user];
-				}
-			}
-			else
-			{
-				if (user)
-				{
-					[user updateWithItem:item];
-				}
-				else
-				{
-					NSString *streamBareJidStr = [[self myJIDForXMPPStream:stream] bare];
-					
-					[XMPPUserCoreDataStorageObject insertInManagedObjectContext:moc
-					                                                   withItem:item
-					                                           streamBareJidStr:streamBareJidStr];
-				}
-			}
-		}
+		[self _handleRosterItems:items xmppStream:stream];
 	}];
 }
 
@@ -484,6 +708,10 @@ static XMPPRosterCoreDataStorage *sharedInstance;
 		}
     
 		[XMPPGroupCoreDataStorageObject clearEmptyGroupsInManagedObjectContext:moc];
+		
+		// The stored roster is gone, so its version no longer applies.
+		
+		[self _setRosterVersion:nil forStreamBareJidStr:(stream ? [[self myJIDForXMPPStream:stream] bare] : nil)];
 	}];
 }
 
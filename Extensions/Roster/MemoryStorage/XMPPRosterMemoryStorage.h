@@ -27,6 +27,15 @@
 	BOOL isRosterPopulation;
 	NSMutableDictionary *roster;
 	
+	NSMutableArray *usersByName;
+	NSMutableArray *availableUsersByName;
+	NSMutableArray *unavailableUsersByName;
+	
+	NSMutableDictionary *pendingAddedUsers;
+	NSMutableDictionary *pendingUpdatedUsers;
+	NSMutableDictionary *pendingRemovedUsers;
+	BOOL isChangeFlushScheduled;
+	
 	XMPPJID *myJID;
 	XMPPUserMemoryStorageObject *myUser;
 }
@@ -42,6 +51,27 @@
 @property (readwrite, assign) Class userClass;
 @property (readwrite, assign) Class resourceClass;
 
+/**
+ * By default, every change to the roster is reported individually.
+ * That is, each roster item or presence triggers one of the precise delegate methods
+ * (such as xmppRoster:didUpdateUser: or xmppRoster:didAddResource:withUser:), followed by xmppRosterDidChange:.
+ * During a presence storm (e.g. right after logging in) this results in thousands of delegate invocations,
+ * and thousands of UI reloads.
+ * 
+ * If enableChangeCoalescing is set, the precise delegate methods are not invoked.
+ * Instead the changes are collected, and reported together via a single invocation of
+ * xmppRoster:didChangeWithAddedUsers:updatedUsers:removedUsers:, followed by a single xmppRosterDidChange:.
+ * 
+ * If the changeCoalescingInterval is zero, the changes are reported as soon as the roster
+ * has processed the stanzas currently queued for it (typically the end of the incoming chunk of data).
+ * Otherwise the changes are collected for up to the given interval.
+ * 
+ * The default value of enableChangeCoalescing is NO.
+ * The default value of changeCoalescingInterval is zero.
+**/
+@property (atomic, readwrite, assign) BOOL enableChangeCoalescing;
+@property (atomic, readwrite, assign) NSTimeInterval changeCoalescingInterval;
+
 /**
  * The methods below provide access to the roster data.
  * 
@@ -50,6 +80,9 @@
  * These snapshots provide a thread-safe version of the roster data.
  * The thread-safety comes from the fact that the copied data will not be altered,
  * so it can therefore be used from multiple threads/queues if needed.
+ * 
+ * The sorted methods are backed by indexes that are kept sorted as the roster changes,
+ * so they don't need to sort the entire roster each time they're invoked.
 **/
 
 - (XMPPUserMemoryStorageObject *)myUser;
@@ -110,6 +143,18 @@
 - (void)xmppRoster:(XMPPRosterMemoryStorage *)sender didUpdateUser:(XMPPUserMemoryStorageObject *)user;
 - (void)xmppRoster:(XMPPRosterMemoryStorage *)sender didRemoveUser:(XMPPUserMemoryStorageObject *)user;
 
+/**
+ * Coalesced change notification, invoked instead of the precise delegate methods when enableChangeCoalescing is set.
+ * 
+ * Each set contains XMPPUserMemoryStorageObject instances.
+ * A user appears in at most one of the sets.
+ * The updatedUsers set includes users whose resources went online / offline (or otherwise changed).
+ * A user that was added and then removed within the same batch is not reported at all.
+**/
+- (void)xmppRoster:(XMPPRosterMemoryStorage *)sender didChangeWithAddedUsers:(NSSet *)addedUsers
+                                                                updatedUsers:(NSSet *)updatedUsers
+                                                                removedUsers:(NSSet *)removedUsers;
+
 /**
  * Notifications when resources go online / offline.
 **/
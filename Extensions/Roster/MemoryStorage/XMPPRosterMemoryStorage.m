@@ -41,6 +41,14 @@
 		resourceClass = [XMPPResourceMemoryStorageObject class];
 		
 		roster = [[NSMutableDictionary alloc] init];
+		
+		usersByName = [[NSMutableArray alloc] init];
+		availableUsersByName = [[NSMutableArray alloc] init];
+		unavailableUsersByName = [[NSMutableArray alloc] init];
+		
+		pendingAddedUsers = [[NSMutableDictionary alloc] init];
+		pendingUpdatedUsers = [[NSMutableDictionary alloc] init];
+		pendingRemovedUsers = [[NSMutableDictionary alloc] init];
 	}
 	return self;
 }
@@ -84,6 +92,8 @@
 
 @synthesize userClass;
 @synthesize resourceClass;
+@synthesize enableChangeCoalescing;
+@synthesize changeCoalescingInterval;
 
 - (XMPPRoster *)parent
 {
@@ -109,6 +119,264 @@
 	return result;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Sorted Indexes
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The storage maintains the following sorted indexes of the roster:
+ * 
+ * - usersByName            : all the users, sorted via compareByName:
+ * - availableUsersByName   : the users that are online, sorted via compareByName:
+ * - unavailableUsersByName : the users that are offline, sorted via compareByName:
+ * 
+ * Since compareByAvailabilityName: sorts online users before offline users (and then by name),
+ * the availability index is simply the concatenation of the last two indexes.
+ * 
+ * The indexes are updated as users are added, updated or removed, and as they go online/offline.
+ * The position of a user within an index depends on its name and availability,
+ * so a user must be removed from the indexes BEFORE either of these change, and re-added afterwards.
+**/
+
+static NSComparator XMPPRosterMemoryStorageCompareByName = ^NSComparisonResult (id user1, id user2) {
+	
+	return [(XMPPUserMemoryStorageObject *)user1 compareByName:(XMPPUserMemoryStorageObject *)user2];
+};
+
+- (void)_insertUser:(XMPPUserMemoryStorageObject *)user intoSortedUsers:(NSMutableArray *)sortedUsers
+{
+	NSUInteger index = [sortedUsers indexOfObject:user
+	                                inSortedRange:NSMakeRange(0, [sortedUsers count])
+	                                      options:(NSBinarySearchingInsertionIndex | NSBinarySearchingLastEqual)
+	                              usingComparator:XMPPRosterMemoryStorageCompareByName];
+	
+	[sortedUsers insertObject:user atIndex:index];
+}
+
+- (void)_removeUser:(XMPPUserMemoryStorageObject *)user fromSortedUsers:(NSMutableArray *)sortedUsers
+{
+	NSUInteger count = [sortedUsers count];
+	NSUInteger index = [sortedUsers indexOfObject:user
+	                                inSortedRange:NSMakeRange(0, count)
+	                                      options:NSBinarySearchingFirstEqual
+	                              usingComparator:XMPPRosterMemoryStorageCompareByName];
+	
+	// Multiple users may have the same name,
+	// so we walk the range of equal names to find this particular user.
+	
+	while (index < count)
+	{
+		XMPPUserMemoryStorageObject *indexedUser = sortedUsers[index];
+		
+		if (indexedUser == user)
+		{
+			[sortedUsers removeObjectAtIndex:index];
+			return;
+		}
+		
+		if ([indexedUser compareByName:user] != NSOrderedSame) break;
+		
+		index++;
+	}
+	
+	// Not found where we expected it.
+	// This should never happen, but we can always fall back to a linear scan.
+	
+	XMPPLogWarn(@"%@: User not found in sorted index: %@", THIS_FILE, user);
+	
+	[sortedUsers removeObjectIdenticalTo:user];
+}
+
+- (void)_addUserToIndexes:(XMPPUserMemoryStorageObject *)user
+{
+	AssertPrivateQueue();
+	
+	if (isRosterPopulation) return; // Indexes are rebuilt when the population ends
+	
+	[self _insertUser:user intoSortedUsers:usersByName];
+	
+	if ([user isOnline])
+		[self _insertUser:user intoSortedUsers:availableUsersByName];
+	else
+		[self _insertUser:user intoSortedUsers:unavailableUsersByName];
+}
+
+- (void)_removeUserFromIndexes:(XMPPUserMemoryStorageObject *)user
+{
+	AssertPrivateQueue();
+	
+	if (isRosterPopulation) return; // Indexes are rebuilt when the population ends
+	
+	[self _removeUser:user fromSortedUsers:usersByName];
+	
+	if ([user isOnline])
+		[self _removeUser:user fromSortedUsers:availableUsersByName];
+	else
+		[self _removeUser:user fromSortedUsers:unavailableUsersByName];
+}
+
+- (void)_rebuildIndexes
+{
+	AssertPrivateQueue();
+	
+	[usersByName setArray:[roster allValues]];
+	[usersByName sortUsingComparator:XMPPRosterMemoryStorageCompareByName];
+	
+	[availableUsersByName removeAllObjects];
+	[unavailableUsersByName removeAllObjects];
+	
+	for (XMPPUserMemoryStorageObject *user in usersByName)
+	{
+		if ([user isOnline])
+			[availableUsersByName addObject:user];
+		else
+			[unavailableUsersByName addObject:user];
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Change Notifications
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)_scheduleChangeFlush
+{
+	AssertPrivateQueue();
+	
+	if (isChangeFlushScheduled) return;
+	isChangeFlushScheduled = YES;
+	
+	dispatch_block_t block = ^{ @autoreleasepool {
+		
+		[self _flushPendingChanges];
+	}};
+	
+	NSTimeInterval interval = self.changeCoalescingInterval;
+	if (interval > 0.0)
+	{
+		dispatch_time_t when = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(interval * NSEC_PER_SEC));
+		dispatch_after(when, parentQueue, block);
+	}
+	else
+	{
+		// Runs after everything already queued for the roster, such as the rest of the incoming chunk.
+		dispatch_async(parentQueue, block);
+	}
+}
+
+- (void)_flushPendingChanges
+{
+	AssertPrivateQueue();
+	
+	isChangeFlushScheduled = NO;
+	
+	if (([pendingAddedUsers count] == 0) &&
+	    ([pendingUpdatedUsers count] == 0) &&
+	    ([pendingRemovedUsers count] == 0))
+	{
+		return;
+	}
+	
+	NSSet *addedUsers = [NSSet setWithArray:[pendingAddedUsers allValues]];
+	NSSet *updatedUsers = [NSSet setWithArray:[pendingUpdatedUsers allValues]];
+	NSSet *removedUsers = [NSSet setWithArray:[pendingRemovedUsers allValues]];
+	
+	[pendingAddedUsers removeAllObjects];
+	[pendingUpdatedUsers removeAllObjects];
+	[pendingRemovedUsers removeAllObjects];
+	
+	[[self multicastDelegate] xmppRoster:self didChangeWithAddedUsers:addedUsers
+	                                                     updatedUsers:updatedUsers
+	                                                     removedUsers:removedUsers];
+	[[self multicastDelegate] xmppRosterDidChange:self];
+}
+
+- (void)_discardPendingChanges
+{
+	AssertPrivateQueue();
+	
+	[pendingAddedUsers removeAllObjects];
+	[pendingUpdatedUsers removeAllObjects];
+	[pendingRemovedUsers removeAllObjects];
+}
+
+- (void)_didAddUser:(XMPPUserMemoryStorageObject *)user
+{
+	AssertPrivateQueue();
+	
+	if (self.enableChangeCoalescing)
+	{
+		XMPPJID *jidKey = [user jid];
+		
+		if (pendingRemovedUsers[jidKey])
+		{
+			// Removed and re-added within the same batch
+			[pendingRemovedUsers removeObjectForKey:jidKey];
+			pendingUpdatedUsers[jidKey] = user;
+		}
+		else
+		{
+			pendingAddedUsers[jidKey] = user;
+		}
+		
+		[self _scheduleChangeFlush];
+	}
+	else
+	{
+		[[self multicastDelegate] xmppRoster:self didAddUser:user];
+		[[self multicastDelegate] xmppRosterDidChange:self];
+	}
+}
+
+- (void)_didUpdateUser:(XMPPUserMemoryStorageObject *)user
+{
+	AssertPrivateQueue();
+	
+	if (self.enableChangeCoalescing)
+	{
+		XMPPJID *jidKey = [user jid];
+		
+		if (pendingAddedUsers[jidKey] == nil)
+		{
+			pendingUpdatedUsers[jidKey] = user;
+		}
+		
+		[self _scheduleChangeFlush];
+	}
+	else
+	{
+		[[self multicastDelegate] xmppRoster:self didUpdateUser:user];
+		[[self multicastDelegate] xmppRosterDidChange:self];
+	}
+}
+
+- (void)_didRemoveUser:(XMPPUserMemoryStorageObject *)user
+{
+	AssertPrivateQueue();
+	
+	if (self.enableChangeCoalescing)
+	{
+		XMPPJID *jidKey = [user jid];
+		
+		if (pendingAddedUsers[jidKey])
+		{
+			// Added and removed within the same batch
+			[pendingAddedUsers removeObjectForKey:jidKey];
+		}
+		else
+		{
+			[pendingUpdatedUsers removeObjectForKey:jidKey];
+			pendingRemovedUsers[jidKey] = user;
+		}
+		
+		[self _scheduleChangeFlush];
+	}
+	else
+	{
+		[[self multicastDelegate] xmppRoster:self didRemoveUser:user];
+		[[self multicastDelegate] xmppRosterDidChange:self];
+	}
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark Internal API
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -197,28 +465,28 @@
 {
 	AssertPrivateQueue();
 	
-	return [[roster allValues] sortedArrayUsingSelector:@selector(compareByName:)];
+	return [usersByName copy];
 }
 
 - (NSArray *)_sortedUsersByAvailabilityName
 {
 	AssertPrivateQueue();
 	
-	return [[roster allValues] sortedArrayUsingSelector:@selector(compareByAvailabilityName:)];
+	return [availableUsersByName arrayByAddingObjectsFromArray:unavailableUsersByName];
 }
 
 - (NSArray *)_sortedAvailableUsersByName
 {
 	AssertPrivateQueue();
 	
-	return [[self _unsortedAvailableUsers] sortedArrayUsingSelector:@selector(compareByName:)];
+	return [availableUsersByName copy];
 }
 
 - (NSArray *)_sortedUnavailableUsersByName
 {
 	AssertPrivateQueue();
 	
-	return [[self _unsortedUnavailableUsers] sortedArrayUsingSelector:@selector(compareByName:)];
+	return [unavailableUsersByName copy];
 }
 
 - (NSArray *)_sortedResources:(BOOL)includeResourcesForMyUserExcludingMyself
@@ -629,6 +897,9 @@
 	
 	isRosterPopulation = NO;
 	
+	// Sorting the whole roster once is cheaper than inserting every item into the indexes.
+	[self _rebuildIndexes];
+	
 	[[self multicastDelegate] xmppRosterDidPopulate:self]; 
 	[[self multicastDelegate] xmppRosterDidChange:self];
 }
@@ -660,11 +931,11 @@
 			if (user)
 			{
 				[roster removeObjectForKey:jid];
+				[self _removeUserFromIndexes:user];
 				
 				XMPPLogVerbose(@"roster(%lu): %@", (unsigned long)[roster count], roster);
 				
-				[[self multicastDelegate] xmppRoster:self didRemoveUser:user];
-				[[self multicastDelegate] xmppRosterDidChange:self];
+				[self _didRemoveUser:user];
 			}
 		}
 		else
@@ -672,12 +943,13 @@
 			XMPPUserMemoryStorageObject *user = roster[jid];
 			if (user)
 			{
+				[self _removeUserFromIndexes:user];
 				[user updateWithItem:item];
+				[self _addUserToIndexes:user];
 				
 				XMPPLogVerbose(@"roster(%lu): %@", (unsigned long)[roster count], roster);
 				
-				[[self multicastDelegate] xmppRoster:self didUpdateUser:user];
-				[[self multicastDelegate] xmppRosterDidChange:self];
+				[self _didUpdateUser:user];
 			}
 			else
 			{
@@ -685,12 +957,11 @@
 				    (XMPPUserMemoryStorageObject *)[[self.userClass alloc] initWithItem:item];
 				
 				roster[jid] = newUser;
+				[self _addUserToIndexes:newUser];
 				
 				XMPPLogVerbose(@"roster(%lu): %@", (unsigned long)[roster count], roster);
 				
-				[[self multicastDelegate] xmppRoster:self didAddUser:newUser];
-				[[self multicastDelegate] xmppRosterDidChange:self];
-				
+				[self _didAddUser:newUser];
 			}
 		}
 	}
@@ -727,16 +998,43 @@
 			user = (XMPPUserMemoryStorageObject *)[[self.userClass alloc] initWithJID:jidKey];
 			
 			roster[jidKey] = user;
+			[self _addUserToIndexes:user];
 			
-			[[self multicastDelegate] xmppRoster:self didAddUser:user];
-			[[self multicastDelegate] xmppRosterDidChange:self];
+			[self _didAddUser:user];
 		}
 	}
 	
+	BOOL wasOnline = [user isOnline];
+	
 	change = [user updateWithPresence:presence resourceClass:self.resourceClass andGetResource:&resource];
 	
+	if ((wasOnline != [user isOnline]) && (user != myUser) && !isRosterPopulation)
+	{
+		// The user went online/offline, so it moves to the other availability index.
+		// Its name hasn't changed, so its position within usersByName remains the same.
+		
+		if (wasOnline)
+		{
+			[self _removeUser:user fromSortedUsers:availableUsersByName];
+			[self _insertUser:user intoSortedUsers:unavailableUsersByName];
+		}
+		else
+		{
+			[self _removeUser:user fromSortedUsers:unavailableUsersByName];
+			[self _insertUser:user intoSortedUsers:availableUsersByName];
+		}
+	}
+	
 	XMPPLogVerbose(@"roster(%lu): %@", (unsigned long)[roster count], roster);
 	
+	if (change == XMPP_USER_NO_CHANGE) return;
+	
+	if (self.enableChangeCoalescing)
+	{
+		[self _didUpdateUser:user];
+		return;
+	}
+	
 	if (change == XMPP_USER_ADDED_RESOURCE)
 		[[self multicastDelegate] xmppRoster:self didAddResource:resource withUser:user];
 	
@@ -746,8 +1044,7 @@
 	if (change == XMPP_USER_REMOVED_RESOURCE)
 		[[self multicastDelegate] xmppRoster:self didRemoveResource:resource withUser:user];
 	
-	if (change != XMPP_USER_NO_CHANGE)
-		[[self multicastDelegate] xmppRosterDidChange:self];
+	[[self multicastDelegate] xmppRosterDidChange:self];
 }
 
 - (BOOL)userExistsWithJID:(XMPPJID *)jid xmppStream:(XMPPStream *)stream
@@ -789,6 +1086,14 @@
 		[user clearAllResources];
 	}
 	
+	// Every user is now offline
+	
+	[availableUsersByName removeAllObjects];
+	[unavailableUsersByName setArray:usersByName];
+	
+	// Report any pending changes first, so they're not delivered after this (more recent) change
+	[self _flushPendingChanges];
+	
 	[[self multicastDelegate] xmppRosterDidChange:self];
 }
 
@@ -799,6 +1104,13 @@
 	
 	[roster removeAllObjects];
 	
+	[usersByName removeAllObjects];
+	[availableUsersByName removeAllObjects];
+	[unavailableUsersByName removeAllObjects];
+	
+	// The pending changes refer to users that no longer exist
+	[self _discardPendingChanges];
+	
 	myUser = nil;
 	
 	[[self multicastDelegate] xmppRosterDidChange:self];
@@ -170,6 +170,12 @@
 /**
  * Manually fetch the roster from the server.
  * Useful if you disable autoFetchRoster.
+ * 
+ * If the server supports roster versioning (RFC 6121, section 2.6),
+ * and the storage class keeps track of the roster version (rosterVersionForXMPPStream:),
+ * then the stored version is sent along with the request.
+ * If the server then reports the roster hasn't changed, the stored roster is used as is,
+ * and any changes are received as roster pushes.
 **/
 - (void)fetchRoster;
 - (void)fetchRosterVersion:(NSString *)version;
@@ -355,6 +361,32 @@
 - (void)setPhoto:(NSImage *)image forUserWithJID:(XMPPJID *)jid xmppStream:(XMPPStream *)stream;
 #endif
 
+/**
+ * Implement these methods to support roster versioning (RFC 6121, section 2.6).
+ * 
+ * The storage class should return the version of the roster it currently holds for the given stream,
+ * or nil if it doesn't hold a complete roster.
+ * 
+ * The version of a populated roster is passed to beginRosterPopulationForXMPPStream:withVersion:,
+ * and should only be considered valid once the population ends.
+ * The version included in a roster push is passed to setRosterVersion:forXMPPStream:,
+ * after the pushed items have been handed to the storage class.
+ * Clearing all users for a stream should also clear its version.
+**/
+- (NSString *)rosterVersionForXMPPStream:(XMPPStream *)stream;
+- (void)setRosterVersion:(NSString *)version forXMPPStream:(XMPPStream *)stream;
+
+/**
+ * Implement this method to receive all the items of a roster result (or roster push) as a single batch,
+ * rather than one at a time via handleRosterItem:xmppStream:.
+ * 
+ * A storage class that implements this method is expected to reconcile its users with a populated roster.
+ * That is, users that aren't part of the roster by the time the population ends should be removed.
+ * Thus XMPPRoster only clears the resources (not the users) before a roster population begins,
+ * which allows the storage class to update (or skip) existing users rather than recreating all of them.
+**/
+- (void)handleRosterItems:(NSArray *)items xmppStream:(XMPPStream *)stream;
+
 @end
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -392,6 +424,14 @@
 **/
 - (void)xmppRosterDidEndPopulating:(XMPPRoster *)sender;
 
+/**
+ * Sent when the initial roster couldn't be fetched.
+ * 
+ * The iq is the error response from the server, or nil if the request timed out.
+ * The roster is not populated in this case, and may be fetched again.
+**/
+- (void)xmppRoster:(XMPPRoster *)sender didNotReceiveRosterDueToError:(XMPPIQ *)iq;
+
 /**
  * Sent when the roster receives a roster item.
  *
@@ -404,3 +444,16 @@
 - (void)xmppRoster:(XMPPRoster *)sender didReceiveRosterItem:(NSXMLElement *)item;
 
 @end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@interface XMPPStream (XMPPRoster)
+
+/**
+ * Returns whether or not the server's <stream:features> includes <ver xmlns='urn:xmpp:features:rosterver'/>.
+**/
+- (BOOL)supportsRosterVersioning;
+
+@end
@@ -1,6 +1,7 @@
 #import "XMPPRoster.h"
 #import "XMPP.h"
 #import "XMPPIDTracker.h"
+#import "XMPPInternal.h"
 #import "XMPPLogging.h"
 #import "XMPPFramework.h"
 #import "DDList.h"
@@ -402,6 +403,9 @@ enum XMPPRosterFlags
     NSAssert(dispatch_get_specific(moduleQueueTag) , @"Invoked on incorrect queue");
     
     BOOL hasRoster = [self hasRoster];
+    BOOL batchItems = [xmppRosterStorage respondsToSelector:@selector(handleRosterItems:xmppStream:)];
+    
+    NSMutableArray *storageItems = batchItems ? [NSMutableArray arrayWithCapacity:[rosterItems count]] : nil;
     
     for (NSXMLElement *item in rosterItems)
     {
@@ -413,9 +417,17 @@ enum XMPPRosterFlags
         
         if (hasRoster || [self isRosterItem:item])
         {
-            [xmppRosterStorage handleRosterItem:item xmppStream:xmppStream];
+            if (batchItems)
+                [storageItems addObject:item];
+            else
+                [xmppRosterStorage handleRosterItem:item xmppStream:xmppStream];
         }
     }
+    
+    if ([storageItems count] > 0)
+    {
+        [xmppRosterStorage handleRosterItems:storageItems xmppStream:xmppStream];
+    }
 }
 
 /**
@@ -684,7 +696,17 @@ enum XMPPRosterFlags
 	
 	dispatch_block_t block = ^{ @autoreleasepool {
 		
-		[self fetchRosterVersion:nil];
+		NSString *version = nil;
+		
+		if ([xmppRosterStorage respondsToSelector:@selector(rosterVersionForXMPPStream:)] &&
+		    [xmppStream supportsRosterVersioning])
+		{
+			// An empty version tells the server we support versioning, but don't have a stored roster.
+			
+			version = [xmppRosterStorage rosterVersionForXMPPStream:xmppStream] ?: @"";
+		}
+		
+		[self fetchRosterVersion:version];
         
 	}};
 	
@@ -745,9 +767,59 @@ enum XMPPRosterFlags
         
 		BOOL hasRoster = [self hasRoster];
 		
+		if (iq == nil || [iq isErrorIQ])
+		{
+			// The request timed out, or the server returned an error.
+			// Our stored roster (if any) may be stale, so we don't mark the roster as populated.
+			// The roster may be requested again.
+			
+			[self _setRequestedRoster:NO];
+			[multicastDelegate xmppRoster:self didNotReceiveRosterDueToError:iq];
+			
+			return;
+		}
+		
+		NSXMLElement *requestQuery = [[basicTrackingInfo element] elementForName:@"query" xmlns:@"jabber:iq:roster"];
+		NSString *requestVersion = [requestQuery attributeStringValueForName:@"ver"];
+		
+		if ([iq isResultIQ] && query == nil && requestVersion)
+		{
+			// Roster versioning (RFC 6121, section 2.6.3):
+			// An empty result means the roster hasn't changed since the version we sent.
+			// So our stored roster is up-to-date, and any changes will be sent as roster pushes.
+			
+			if (!hasRoster)
+			{
+				version = requestVersion;
+				
+				[self _setPopulatingRoster:YES];
+				[multicastDelegate xmppRosterDidBeginPopulating:self withVersion:version];
+				
+				[self _setHasRoster:YES];
+				[self _setPopulatingRoster:NO];
+				[multicastDelegate xmppRosterDidEndPopulating:self];
+				
+				for (XMPPPresence *presence in earlyPresenceElements)
+				{
+					[self xmppStream:xmppStream didReceivePresence:presence];
+				}
+				
+				[earlyPresenceElements removeAllObjects];
+			}
+			
+			return;
+		}
+		
 		if (!hasRoster)
 		{
-            [xmppRosterStorage clearAllUsersAndResourcesForXMPPStream:xmppStream];
+            // A storage class that handles batches of roster items reconciles its users during the population,
+            // so we only need to clear the (now stale) resources.
+            
+            if ([xmppRosterStorage respondsToSelector:@selector(handleRosterItems:xmppStream:)])
+                [xmppRosterStorage clearAllResourcesForXMPPStream:xmppStream];
+            else
+                [xmppRosterStorage clearAllUsersAndResourcesForXMPPStream:xmppStream];
+            
             [self _setPopulatingRoster:YES];
             [multicastDelegate xmppRosterDidBeginPopulating:self withVersion:version];
 			[xmppRosterStorage beginRosterPopulationForXMPPStream:xmppStream withVersion:version];
@@ -820,14 +892,27 @@ enum XMPPRosterFlags
             
             NSArray *items = [query elementsForName:@"item"];
             [self _addRosterItems:items];
+            
+            NSString *version = [query attributeStringValueForName:@"ver"];
+            if (version && [xmppRosterStorage respondsToSelector:@selector(setRosterVersion:forXMPPStream:)])
+            {
+                [xmppRosterStorage setRosterVersion:version forXMPPStream:xmppStream];
+            }
         }
-        else if([iq isResultIQ])
+        else if([iq isResultIQ] || [iq isErrorIQ])
         {
             [xmppIDTracker invokeForElement:iq withObject:iq];
         }
 		
 		return YES;
 	}
+	else if ([iq isResultIQ] || [iq isErrorIQ])
+	{
+		// An empty result (the roster hasn't changed since the version we sent),
+		// or an error without the query, in response to our roster request.
+		
+		return [xmppIDTracker invokeForElement:iq withObject:iq];
+	}
 	
 	return NO;
 }
@@ -1002,3 +1087,37 @@ enum XMPPRosterFlags
 #endif
 
 @end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPStream (XMPPRoster)
+
+- (BOOL)supportsRosterVersioning
+{
+	__block BOOL result = NO;
+	
+	dispatch_block_t block = ^{ @autoreleasepool {
+		
+		// The root element can be properly queried anytime after the
+		// stream:features are received, and TLS has been setup (if required).
+		
+		if (self.state >= STATE_XMPP_POST_NEGOTIATION)
+		{
+			NSXMLElement *features = [self.rootElement elementForName:@"stream:features"];
+			NSXMLElement *ver = [features elementForName:@"ver" xmlns:@"urn:xmpp:features:rosterver"];
+			
+			result = (ver != nil);
+		}
+	}};
+	
+	if (dispatch_get_specific(self.xmppQueueTag))
+		block();
+	else
+		dispatch_sync(self.xmppQueue, block);
+	
+	return result;
+}
+
+@end
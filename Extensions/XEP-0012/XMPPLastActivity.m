@@ -144,6 +144,7 @@ static const NSTimeInterval XMPPLastActivityDefaultTimeout = 30.0;
 			}
 		} timeout:timeout];
         
+		[xmppStream routeResponseToIQ:query toModule:self timeout:timeout];
 		[xmppStream sendElement:query];
 	});
     
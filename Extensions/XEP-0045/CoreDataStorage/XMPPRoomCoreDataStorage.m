@@ -1,5 +1,6 @@
 #import "XMPPRoomCoreDataStorage.h"
 #import "XMPPCoreDataStorageProtected.h"
+#import "XMPPRoomMessageIndex.h"
 #import "NSXMLElement+XEP_0203.h"
 #import "XMPPLogging.h"
 
@@ -36,6 +37,9 @@
 	
 	NSMutableSet *pausedMessageDeletion;
 	
+	NSMutableDictionary *messageIndexes;
+	NSMutableArray *insertedMessageBatch;
+	
 	dispatch_time_t lastDeleteTime;
 	dispatch_source_t deleteTimer;
 }
@@ -48,6 +52,9 @@
 - (void)updateDeleteTimer;
 - (void)createAndStartDeleteTimer;
 
+- (XMPPRoomMessageIndex *)messageIndexForRoom:(XMPPJID *)roomJID stream:(XMPPStream *)xmppStream load:(BOOL)load;
+- (void)removeMessageIndexForRoom:(XMPPJID *)roomJID stream:(XMPPStream *)xmppStream;
+
 - (void)clearAllOccupantsFromRoom:(XMPPJID *)roomJID;
 
 @end
@@ -85,6 +92,8 @@ static XMPPRoomCoreDataStorage *sharedInstance;
 	deleteInterval = (60 * 5);           // 5 days
 	
 	pausedMessageDeletion = [[NSMutableSet alloc] init];
+	
+	messageIndexes = [[NSMutableDictionary alloc] init];
 }
 
 - (void)dealloc
@@ -384,6 +393,9 @@ static XMPPRoomCoreDataStorage *sharedInstance;
 	
 	for (XMPPRoomMessageCoreDataStorageObject *oldMessage in oldMessages)
 	{
+		NSDictionary *roomIndexes = messageIndexes[oldMessage.streamBareJidStr];
+		[roomIndexes[oldMessage.roomJIDStr] removeMessage:oldMessage];
+		
 		[moc deleteObject:oldMessage];
 		
 		if (++unsavedCount >= saveThreshold)
@@ -481,6 +493,66 @@ static XMPPRoomCoreDataStorage *sharedInstance;
 	}
 }
 
+/**
+ * Returns the index of messages stored for the given room, used for duplicate detection.
+ * 
+ * The index is loaded (with a single fetch) the first time it's needed,
+ * which is typically when we join the room and the server is about to send us the discussion history.
+ * If load is NO, and the index isn't loaded, this method returns nil.
+**/
+- (XMPPRoomMessageIndex *)messageIndexForRoom:(XMPPJID *)roomJID stream:(XMPPStream *)xmppStream load:(BOOL)load
+{
+	AssertPrivateQueue();
+	
+	NSString *streamBareJidStr = [[self myJIDForXMPPStream:xmppStream] bare];
+	NSString *roomJIDStr = [roomJID bare];
+	
+	if (streamBareJidStr == nil || roomJIDStr == nil) return nil;
+	
+	NSMutableDictionary *roomIndexes = messageIndexes[streamBareJidStr];
+	XMPPRoomMessageIndex *index = roomIndexes[roomJIDStr];
+	
+	if (index == nil && load)
+	{
+		NSManagedObjectContext *moc = [self managedObjectContext];
+		
+		NSPredicate *predicate = [NSPredicate predicateWithFormat:@"roomJIDStr == %@ AND streamBareJidStr == %@",
+		                                                             roomJIDStr, streamBareJidStr];
+		
+		index = [XMPPRoomMessageIndex indexWithMessagesMatchingPredicate:predicate
+		                                                          entity:[self messageEntity:moc]
+		                                                       inContext:moc];
+		
+		XMPPLogVerbose(@"%@: Loaded index of %lu messages for room %@",
+		               THIS_FILE, (unsigned long)index.count, roomJIDStr);
+		
+		if (roomIndexes == nil)
+		{
+			roomIndexes = [[NSMutableDictionary alloc] init];
+			messageIndexes[streamBareJidStr] = roomIndexes;
+		}
+		
+		roomIndexes[roomJIDStr] = index;
+	}
+	
+	return index;
+}
+
+- (void)removeMessageIndexForRoom:(XMPPJID *)roomJID stream:(XMPPStream *)xmppStream
+{
+	AssertPrivateQueue();
+	
+	NSString *streamBareJidStr = [[self myJIDForXMPPStream:xmppStream] bare];
+	
+	NSMutableDictionary *roomIndexes = messageIndexes[streamBareJidStr];
+	[roomIndexes removeObjectForKey:[roomJID bare]];
+	
+	if ([roomIndexes count] == 0 && streamBareJidStr)
+	{
+		[messageIndexes removeObjectForKey:streamBareJidStr];
+	}
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark Protected API
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -520,46 +592,21 @@ static XMPPRoomCoreDataStorage *sharedInstance;
 	// but it's localTimestamp is approximately the same as the remoteTimestamp,
 	// then this is enough evidence to consider the messages the same.
 	// 
-	// Note: Predicate order matters. Most unique key should be first, least unique should be last.
-	
-	NSManagedObjectContext *moc = [self managedObjectContext];
-	NSEntityDescription *messageEntity = [self messageEntity:moc];
+	// If the room assigned the message a XEP-0359 stanza-id, then that's an even better answer.
+	// 
+	// These checks are done against an in-memory index of the room's messages,
+	// as joining a room may replay dozens of history messages, and we don't want a fetch for each one.
 	
-	NSString *streamBareJidStr = [[self myJIDForXMPPStream:xmppStream] bare];
+	XMPPRoomMessageIndex *index = [self messageIndexForRoom:room.roomJID stream:xmppStream load:YES];
 	
-	XMPPJID *messageJID = [message from];
+	NSString *messageJIDStr = [[message from] full];
 	NSString *messageBody = [[message elementForName:@"body"] stringValue];
+	NSString *stanzaID = [XMPPRoomMessageIndex stanzaIDForMessage:message roomJID:room.roomJID];
 	
-	NSDate *minLocalTimestamp = [remoteTimestamp dateByAddingTimeInterval:-60];
-	NSDate *maxLocalTimestamp = [remoteTimestamp dateByAddingTimeInterval: 60];
-	
-	NSString *predicateFormat = @"    body == %@ "
-	                            @"AND jidStr == %@ "
-	                            @"AND streamBareJidStr == %@ "
-	                            @"AND "
-	                            @"("
-	                            @"     (remoteTimestamp == %@) "
-	                            @"  OR (remoteTimestamp == NIL && localTimestamp BETWEEN {%@, %@})"
-	                            @")";
-	
-	NSPredicate *predicate = [NSPredicate predicateWithFormat:predicateFormat,
-	                             messageBody, messageJID, streamBareJidStr,
-	                             remoteTimestamp, minLocalTimestamp, maxLocalTimestamp];
-	
-	NSFetchRequest *fetchRequest = [[NSFetchRequest alloc] init];
-	[fetchRequest setEntity:messageEntity];
-	[fetchRequest setPredicate:predicate];
-	[fetchRequest setFetchLimit:1];
-		
-	NSError *error = nil;
-	NSArray *results = [moc executeFetchRequest:fetchRequest error:&error];
-	
-	if (error)
-	{
-		XMPPLogError(@"%@: %@ - Fetch error: %@", THIS_FILE, THIS_METHOD, error);
-	}
-	
-	return ([results count] > 0);
+	return [index containsMessageWithJID:messageJIDStr
+	                                body:messageBody
+	                     remoteTimestamp:remoteTimestamp
+	                            stanzaID:stanzaID];
 }
 
 /**
@@ -576,6 +623,22 @@ static XMPPRoomCoreDataStorage *sharedInstance;
 	// So you can, for example, access the XMPPMessage via message.message.
 }
 
+/**
+ * Optional override hook for general extensions.
+ * 
+ * Invoked once for a batch of messages, such as the discussion history received when joining a room,
+ * after didInsertMessage: has been invoked for each of them.
+ * 
+ * @see handleIncomingMessages:room:
+**/
+- (void)didInsertMessages:(NSArray *)messages
+{
+	// Override me if you'd rather process the messages of a batch together.
+	// 
+	// The changes haven't been saved yet at this point.
+	// They will be saved together, after this method returns.
+}
+
 /**
  * Optional override hook for complete customization.
  * Override me if you need to do specific custom work when inserting a message in a room.
@@ -632,9 +695,16 @@ static XMPPRoomCoreDataStorage *sharedInstance;
 	roomMessage.remoteTimestamp = remoteTimestamp;
 	roomMessage.isFromMe = isOutgoing;
 	roomMessage.streamBareJidStr = streamBareJidStr;
+	roomMessage.stanzaID = [XMPPRoomMessageIndex stanzaIDForMessage:message roomJID:roomJID];
 	
 	[moc insertObject:roomMessage];      // Hook if subclassing XMPPRoomMessageCoreDataStorageObject (awakeFromInsert)
 	[self didInsertMessage:roomMessage]; // Hook if subclassing XMPPRoomCoreDataStorage
+	
+	// Keep the duplicate detection index up-to-date (if it has been loaded)
+	
+	[[self messageIndexForRoom:roomJID stream:xmppStream load:NO] addMessage:roomMessage];
+	
+	[insertedMessageBatch addObject:roomMessage];
 }
 
 /**
@@ -984,15 +1054,79 @@ static XMPPRoomCoreDataStorage *sharedInstance;
 	}];
 }
 
+- (void)handleIncomingMessages:(NSArray *)messages room:(XMPPRoom *)room
+{
+	XMPPLogTrace();
+	
+	XMPPJID *myRoomJID = room.myRoomJID;
+	XMPPStream *xmppStream = room.xmppStream;
+	
+	// The whole batch is handled within a single block.
+	// So the messages are inserted together, and saved together (with a single save once the block completes),
+	// as opposed to a block (and potential save) per message.
+	
+	[self scheduleBlock:^{
+		
+		insertedMessageBatch = [[NSMutableArray alloc] initWithCapacity:[messages count]];
+		
+		for (XMPPMessage *message in messages)
+		{
+			if ([myRoomJID isEqualToJID:[message from]] && ![message wasDelayed])
+			{
+				// Ignore - we already stored message in handleOutgoingMessage:room:
+				continue;
+			}
+			
+			if ([self existsMessage:message forRoom:room stream:xmppStream])
+			{
+				XMPPLogVerbose(@"%@: %@ - Duplicate message", THIS_FILE, THIS_METHOD);
+			}
+			else
+			{
+				[self insertMessage:message outgoing:NO forRoom:room stream:xmppStream];
+			}
+		}
+		
+		NSArray *batch = insertedMessageBatch;
+		insertedMessageBatch = nil;
+		
+		XMPPLogVerbose(@"%@: %@ - Inserted %lu of %lu messages",
+		               THIS_FILE, THIS_METHOD, (unsigned long)[batch count], (unsigned long)[messages count]);
+		
+		if ([batch count] > 0)
+		{
+			[self didInsertMessages:batch];
+		}
+	}];
+}
+
+- (void)handleDidJoinRoom:(XMPPRoom *)room withNickname:(NSString *)nickname
+{
+	XMPPLogTrace();
+	
+	XMPPJID *roomJID = room.roomJID;
+	XMPPStream *xmppStream = room.xmppStream;
+	
+	[self scheduleBlock:^{
+		
+		// The server sends the discussion history right after our own presence (which is what got us here).
+		// Load the duplicate detection index now, so it's ready before the history messages arrive.
+		
+		[self messageIndexForRoom:roomJID stream:xmppStream load:YES];
+	}];
+}
+
 - (void)handleDidLeaveRoom:(XMPPRoom *)room
 {
 	XMPPLogTrace();
 	
 	XMPPJID *roomJID = room.roomJID;
+	XMPPStream *xmppStream = room.xmppStream;
 	
 	[self scheduleBlock:^{
 		
 		[self clearAllOccupantsFromRoom:roomJID];
+		[self removeMessageIndexForRoom:roomJID stream:xmppStream];
 	}];
 }
 
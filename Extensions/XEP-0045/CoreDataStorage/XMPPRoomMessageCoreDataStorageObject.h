@@ -44,4 +44,10 @@
 **/
 @property (nonatomic, strong) NSString *streamBareJidStr;
 
+/**
+ * The XEP-0359 stanza-id the room assigned to the message, if any.
+ * Stored separately so duplicate detection doesn't have to parse messageStr.
+**/
+@property (nonatomic, strong) NSString *stanzaID;
+
 @end
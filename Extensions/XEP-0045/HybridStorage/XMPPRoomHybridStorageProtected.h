@@ -14,6 +14,10 @@
 /**
  * Returns whether or not the given message already exists in storage.
  * If YES, then the message is ignored. Otherwise it is passed to the insert routines.
+ * 
+ * The default implementation checks an in-memory index of the room's messages (loaded once per room).
+ * The index is updated by insertMessage:outgoing:forRoom:stream:,
+ * so if you override that method without invoking super, you should override this method as well.
 **/
 - (BOOL)existsMessage:(XMPPMessage *)message forRoom:(XMPPRoom *)room stream:(XMPPStream *)xmppStream;
 
@@ -26,6 +30,15 @@
 **/
 - (void)didInsertMessage:(XMPPRoomMessageHybridCoreDataStorageObject *)message;
 
+/**
+ * Override me if you'd rather process a batch of inserted messages together,
+ * such as the discussion history received when joining a room.
+ * 
+ * This method is invoked once per batch, after didInsertMessage: has been invoked for each message.
+ * The changes are saved together, after this method returns.
+**/
+- (void)didInsertMessages:(NSArray *)messages;
+
 /**
  * Optional override hook for complete customization.
  * Override me if you need to do specific custom work when inserting a message in a room.
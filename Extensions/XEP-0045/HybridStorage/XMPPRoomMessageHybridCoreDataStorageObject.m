@@ -44,6 +44,8 @@
 
 @dynamic streamBareJidStr;
 
+@dynamic stanzaID;
+
 @dynamic primitiveMessage;
 @dynamic primitiveMessageStr;
 
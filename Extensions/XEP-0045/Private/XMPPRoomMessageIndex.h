@@ -0,0 +1,70 @@
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+@class XMPPJID;
+@class XMPPMessage;
+
+/**
+ * An in-memory index of the messages stored for a single room,
+ * used by XMPPRoomCoreDataStorage and XMPPRoomHybridStorage to detect duplicate messages.
+ *
+ * When joining a room, the server replays the discussion history,
+ * and every delayed message must be checked against the messages we already have.
+ * Doing a fetch per message means one database query per history message (per room).
+ * Instead the index is loaded with a single fetch, and each check is then a hash lookup.
+ *
+ * Messages are fingerprinted by a digest of their jid and body:
+ *
+ * - Messages with a remote timestamp (delayed messages) are matched by fingerprint
+ *   plus the exact same remote timestamp.
+ * - Messages without a remote timestamp (received in "real time") are matched by fingerprint
+ *   plus a local timestamp within 60 seconds of the remote timestamp.
+ * - Messages carrying a XEP-0359 stanza-id assigned by the room are also matched by that id.
+ *
+ * Apart from the stanza-id, these are the same rules the storage classes previously expressed as a fetch predicate.
+ * In particular, a nil body only matches a nil body, not an empty one.
+ *
+ * This class is not thread-safe.
+ * It's designed to be used only within the storageQueue of the room storage class.
+**/
+@interface XMPPRoomMessageIndex : NSObject
+
+/**
+ * Creates an index of the messages matching the given predicate.
+ *
+ * The entity must have the standard room message attributes
+ * (jidStr, body, localTimestamp, remoteTimestamp, stanzaID and roomJIDStr),
+ * and the predicate should select the messages of a single room.
+ *
+ * Unsaved changes within the given context are taken into account.
+**/
++ (instancetype)indexWithMessagesMatchingPredicate:(NSPredicate *)predicate
+                                            entity:(NSEntityDescription *)entity
+                                         inContext:(NSManagedObjectContext *)moc;
+
+/**
+ * Returns the XEP-0359 stanza-id the given room assigned to the message, if any.
+ *
+ * A stanza-id is only trusted if it was assigned by the room itself ('by' attribute equals the room JID),
+ * as occupants could otherwise spoof ids to suppress other messages.
+**/
++ (NSString *)stanzaIDForMessage:(XMPPMessage *)message roomJID:(XMPPJID *)roomJID;
+
+/**
+ * Adds/removes a stored message to/from the index.
+ * The message should be an instance of the entity's class, or any object with the same (key-value coding) properties.
+**/
+- (void)addMessage:(id)roomMessage;
+- (void)removeMessage:(id)roomMessage;
+
+/**
+ * Returns whether the index contains a message matching the given (delayed) message.
+**/
+- (BOOL)containsMessageWithJID:(NSString *)jidStr
+                          body:(NSString *)body
+               remoteTimestamp:(NSDate *)remoteTimestamp
+                      stanzaID:(NSString *)stanzaID;
+
+@property (nonatomic, readonly) NSUInteger count;
+
+@end
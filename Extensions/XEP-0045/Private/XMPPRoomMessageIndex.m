@@ -0,0 +1,277 @@
+#import "XMPPRoomMessageIndex.h"
+#import "XMPPMessage.h"
+#import "XMPPJID.h"
+#import "NSXMLElement+XMPP.h"
+#import "XMPPLogging.h"
+
+#import <CommonCrypto/CommonDigest.h>
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+// Log levels: off, error, warn, info, verbose
+#if DEBUG
+  static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN;
+#else
+  static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN;
+#endif
+
+#define XMPPStanzaIDNamespace @"urn:xmpp:sid:0"
+
+// A message received in "real time" is considered the same as a delayed message
+// if its local timestamp is within this many seconds of the delayed message's remote timestamp.
+#define LOCAL_TIMESTAMP_TOLERANCE 60.0
+
+
+@implementation XMPPRoomMessageIndex
+{
+	// Fingerprints of messages with a remote timestamp (digest of jid, body & remote timestamp).
+	// Counted, as the same message may be stored more than once.
+	NSCountedSet *remoteFingerprints;
+	
+	// Messages without a remote timestamp.
+	// Maps the digest of jid & body to the local timestamps (NSNumber) of those messages.
+	NSMutableDictionary *localTimestamps;
+	
+	NSCountedSet *stanzaIDs;
+	
+	NSUInteger count;
+}
+
+@synthesize count = count;
+
+- (id)init
+{
+	if ((self = [super init]))
+	{
+		remoteFingerprints = [[NSCountedSet alloc] init];
+		localTimestamps = [[NSMutableDictionary alloc] init];
+		stanzaIDs = [[NSCountedSet alloc] init];
+	}
+	return self;
+}
+
++ (instancetype)indexWithMessagesMatchingPredicate:(NSPredicate *)predicate
+                                            entity:(NSEntityDescription *)entity
+                                         inContext:(NSManagedObjectContext *)moc
+{
+	XMPPRoomMessageIndex *index = [[XMPPRoomMessageIndex alloc] init];
+	
+	// A dictionary fetch avoids instantiating (and registering) a managed object per message.
+	// But it only returns what's in the persistent store, so unsaved changes are merged in below.
+	
+	NSArray *propertiesToFetch = @[@"jidStr", @"body", @"localTimestamp", @"remoteTimestamp", @"stanzaID"];
+	
+	NSFetchRequest *fetchRequest = [[NSFetchRequest alloc] init];
+	[fetchRequest setEntity:entity];
+	[fetchRequest setPredicate:predicate];
+	[fetchRequest setResultType:NSDictionaryResultType];
+	[fetchRequest setPropertiesToFetch:propertiesToFetch];
+	
+	NSError *error = nil;
+	NSArray *results = [moc executeFetchRequest:fetchRequest error:&error];
+	
+	if (error)
+	{
+		XMPPLogError(@"%@: %@ - Fetch error: %@", THIS_FILE, THIS_METHOD, error);
+	}
+	
+	for (NSDictionary *result in results)
+	{
+		[index addMessage:result];
+	}
+	
+	for (NSManagedObject *object in [moc insertedObjects])
+	{
+		if ([[object entity] isKindOfEntity:entity] && [predicate evaluateWithObject:object])
+		{
+			[index addMessage:object];
+		}
+	}
+	
+	for (NSManagedObject *object in [moc deletedObjects])
+	{
+		if ([[object entity] isKindOfEntity:entity] && [predicate evaluateWithObject:object])
+		{
+			[index removeMessage:object];
+		}
+	}
+	
+	return index;
+}
+
++ (NSString *)stanzaIDForMessage:(XMPPMessage *)message roomJID:(XMPPJID *)roomJID
+{
+	NSString *roomJIDStr = [roomJID bare];
+	
+	for (NSXMLElement *stanzaID in [message elementsForLocalName:@"stanza-id" URI:XMPPStanzaIDNamespace])
+	{
+		if ([[stanzaID attributeStringValueForName:@"by"] isEqualToString:roomJIDStr])
+		{
+			return [stanzaID attributeStringValueForName:@"id"];
+		}
+	}
+	
+	return nil;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Fingerprints
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void XMPPRoomMessageIndexUpdateString(CC_SHA1_CTX *ctx, NSString *str)
+{
+	// A leading marker keeps a nil string distinct from an empty one (as "body == nil" is in a predicate),
+	// and the terminating NULL separates the fields (so "ab" + "c" differs from "a" + "bc").
+	
+	const char marker = str ? 1 : 0;
+	CC_SHA1_Update(ctx, &marker, 1);
+	
+	if (str)
+	{
+		const char *utf8 = [str UTF8String];
+		CC_SHA1_Update(ctx, utf8, (CC_LONG)(strlen(utf8) + 1));
+	}
+}
+
+- (NSData *)fingerprintForJID:(NSString *)jidStr body:(NSString *)body remoteTimestamp:(NSDate *)remoteTimestamp
+{
+	CC_SHA1_CTX ctx;
+	CC_SHA1_Init(&ctx);
+	
+	XMPPRoomMessageIndexUpdateString(&ctx, jidStr);
+	XMPPRoomMessageIndexUpdateString(&ctx, body);
+	
+	if (remoteTimestamp)
+	{
+		// Core Data stores dates as their timeIntervalSinceReferenceDate,
+		// so this matches exactly what "remoteTimestamp == %@" would.
+		
+		NSTimeInterval interval = [remoteTimestamp timeIntervalSinceReferenceDate];
+		CC_SHA1_Update(&ctx, &interval, sizeof(interval));
+	}
+	
+	unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+	CC_SHA1_Final(digest, &ctx);
+	
+	return [NSData dataWithBytes:digest length:CC_SHA1_DIGEST_LENGTH];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Public API
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)addMessage:(id)roomMessage
+{
+	NSString *jidStr = [roomMessage valueForKey:@"jidStr"];
+	NSString *body = [roomMessage valueForKey:@"body"];
+	NSDate *remoteTimestamp = [roomMessage valueForKey:@"remoteTimestamp"];
+	
+	if (remoteTimestamp)
+	{
+		[remoteFingerprints addObject:[self fingerprintForJID:jidStr body:body remoteTimestamp:remoteTimestamp]];
+	}
+	else
+	{
+		NSDate *localTimestamp = [roomMessage valueForKey:@"localTimestamp"];
+		NSData *fingerprint = [self fingerprintForJID:jidStr body:body remoteTimestamp:nil];
+		
+		NSMutableArray *timestamps = localTimestamps[fingerprint];
+		if (timestamps == nil)
+		{
+			timestamps = [[NSMutableArray alloc] initWithCapacity:1];
+			localTimestamps[fingerprint] = timestamps;
+		}
+		
+		[timestamps addObject:@([localTimestamp timeIntervalSinceReferenceDate])];
+	}
+	
+	NSString *stanzaID = [roomMessage valueForKey:@"stanzaID"];
+	if (stanzaID)
+	{
+		[stanzaIDs addObject:stanzaID];
+	}
+	
+	count++;
+}
+
+- (void)removeMessage:(id)roomMessage
+{
+	NSString *jidStr = [roomMessage valueForKey:@"jidStr"];
+	NSString *body = [roomMessage valueForKey:@"body"];
+	NSDate *remoteTimestamp = [roomMessage valueForKey:@"remoteTimestamp"];
+	
+	if (remoteTimestamp)
+	{
+		NSData *fingerprint = [self fingerprintForJID:jidStr body:body remoteTimestamp:remoteTimestamp];
+		if ([remoteFingerprints countForObject:fingerprint] == 0) return;
+		
+		[remoteFingerprints removeObject:fingerprint];
+	}
+	else
+	{
+		NSDate *localTimestamp = [roomMessage valueForKey:@"localTimestamp"];
+		NSData *fingerprint = [self fingerprintForJID:jidStr body:body remoteTimestamp:nil];
+		
+		NSMutableArray *timestamps = localTimestamps[fingerprint];
+		if (timestamps == nil) return;
+		
+		NSUInteger i = [timestamps indexOfObject:@([localTimestamp timeIntervalSinceReferenceDate])];
+		if (i == NSNotFound) return;
+		
+		[timestamps removeObjectAtIndex:i];
+		if ([timestamps count] == 0)
+		{
+			[localTimestamps removeObjectForKey:fingerprint];
+		}
+	}
+	
+	NSString *stanzaID = [roomMessage valueForKey:@"stanzaID"];
+	if (stanzaID)
+	{
+		[stanzaIDs removeObject:stanzaID];
+	}
+	
+	count--;
+}
+
+- (BOOL)containsMessageWithJID:(NSString *)jidStr
+                          body:(NSString *)body
+               remoteTimestamp:(NSDate *)remoteTimestamp
+                      stanzaID:(NSString *)stanzaID
+{
+	if (stanzaID && [stanzaIDs countForObject:stanzaID] > 0)
+	{
+		return YES;
+	}
+	
+	// Messages stored without a stanza-id (e.g. received before the room supported XEP-0359)
+	// can still be matched by their fingerprint, so we continue even if the message has a stanza-id.
+	
+	if (remoteTimestamp == nil)
+	{
+		return NO;
+	}
+	
+	NSData *remoteFingerprint = [self fingerprintForJID:jidStr body:body remoteTimestamp:remoteTimestamp];
+	if ([remoteFingerprints countForObject:remoteFingerprint] > 0)
+	{
+		return YES;
+	}
+	
+	NSData *localFingerprint = [self fingerprintForJID:jidStr body:body remoteTimestamp:nil];
+	NSTimeInterval remote = [remoteTimestamp timeIntervalSinceReferenceDate];
+	
+	for (NSNumber *local in localTimestamps[localFingerprint])
+	{
+		if (fabs([local doubleValue] - remote) <= LOCAL_TIMESTAMP_TOLERANCE)
+		{
+			return YES;
+		}
+	}
+	
+	return NO;
+}
+
+@end
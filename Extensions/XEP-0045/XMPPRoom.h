@@ -248,6 +248,18 @@ static NSString *const XMPPMUCDiscoItems = @"http://jabber.org/protocol/disco#it
 **/
 - (void)handleDidJoinRoom:(XMPPRoom *)room withNickname:(NSString *)nickname;
 
+/**
+ * Stores or otherwise handles the given messages, which were received as a group.
+ * 
+ * When joining a room, the server sends us the discussion history, which may be dozens of messages.
+ * If the storage class implements this method, the history is passed to it in a single call,
+ * instead of invoking handleIncomingMessage:room: for each message.
+ * This allows the storage class to process the history in one go (e.g. a single database transaction).
+ * 
+ * The messages are in the order they were received.
+**/
+- (void)handleIncomingMessages:(NSArray *)messages room:(XMPPRoom *)room;
+
 
 @end
 
@@ -312,6 +324,17 @@ static NSString *const XMPPMUCDiscoItems = @"http://jabber.org/protocol/disco#it
 **/
 - (void)xmppRoom:(XMPPRoom *)sender didReceiveMessage:(XMPPMessage *)message fromOccupant:(XMPPJID *)occupantJID;
 
+/**
+ * Invoked when a batch of the discussion history has been passed to the storage class.
+ * 
+ * This is only used if the storage class implements handleIncomingMessages:room:.
+ * The xmppRoom:didReceiveMessage:fromOccupant: method is still invoked for each message as it arrives.
+ * This method may be used to wait for the history to be stored, e.g. to refresh the UI once instead of per message.
+ * 
+ * The messages are in the order they were received.
+**/
+- (void)xmppRoom:(XMPPRoom *)sender didReceiveHistoryMessages:(NSArray *)messages;
+
 - (void)xmppRoom:(XMPPRoom *)sender didFetchBanList:(NSArray *)items;
 - (void)xmppRoom:(XMPPRoom *)sender didNotFetchBanList:(XMPPIQ *)iqError;
 
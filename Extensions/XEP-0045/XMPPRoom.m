@@ -2,6 +2,7 @@
 #import "XMPPRoom.h"
 #import "XMPPIDTracker.h"
 #import "XMPPMessage+XEP0045.h"
+#import "NSXMLElement+XEP_0203.h"
 #import "XMPPLogging.h"
 
 
@@ -13,6 +14,10 @@
   static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN;
 #endif
 
+// If the discussion history stops arriving for this long (without the room subject to mark the end of it),
+// we stop waiting, and hand what we have to the storage class.
+#define HISTORY_BATCH_TIMEOUT 1.0
+
 enum XMPPRoomState
 {
 	kXMPPRoomStateNone        = 0,
@@ -23,8 +28,18 @@ enum XMPPRoomState
 };
 
 @interface XMPPRoom ()
+{
+	// When joining a room, the server sends us the discussion history.
+	// If the storage class supports it, we collect these messages and pass them to the storage class as a batch.
+	
+	BOOL isReceivingHistory;
+	NSMutableArray *historyMessages;
+	dispatch_source_t historyTimer;
+}
 
-// List private methods here
+- (void)addHistoryMessage:(XMPPMessage *)message;
+- (void)flushHistoryMessages;
+- (void)endHistory;
 
 @end
 
@@ -102,6 +117,8 @@ enum XMPPRoomState
 		[responseTracker removeAllIDs];
 		responseTracker = nil;
 		
+		[self endHistory];
+		
 	}};
 	
 	if (dispatch_get_specific(moduleQueueTag))
@@ -1195,6 +1212,91 @@ enum XMPPRoomState
 	[self sendMessage:message];
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Discussion History
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Buffers a message of the discussion history.
+ * 
+ * Passing the history to the storage class one message at a time means one storage operation per message.
+ * Instead we collect the history, and pass it to the storage class in one go,
+ * when the room subject arrives (which always follows the history), or when the history stops arriving.
+**/
+- (void)addHistoryMessage:(XMPPMessage *)message
+{
+	NSAssert(dispatch_get_specific(moduleQueueTag), @"Invoked on incorrect queue");
+	
+	if (historyMessages == nil)
+	{
+		historyMessages = [[NSMutableArray alloc] init];
+	}
+	
+	[historyMessages addObject:message];
+	
+	if (historyTimer == NULL)
+	{
+		historyTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, moduleQueue);
+		
+		dispatch_source_set_event_handler(historyTimer, ^{ @autoreleasepool {
+			
+			XMPPLogVerbose(@"%@[%@] - Timed out waiting for end of discussion history", THIS_FILE, roomJID);
+			
+			[self endHistory];
+			
+		}});
+		
+		dispatch_resume(historyTimer);
+	}
+	
+	// (Re)start the timeout
+	
+	dispatch_time_t tt = dispatch_time(DISPATCH_TIME_NOW, (HISTORY_BATCH_TIMEOUT * NSEC_PER_SEC));
+	dispatch_source_set_timer(historyTimer, tt, DISPATCH_TIME_FOREVER, (0.1 * NSEC_PER_SEC));
+}
+
+/**
+ * Passes any buffered history messages to the storage class.
+**/
+- (void)flushHistoryMessages
+{
+	NSAssert(dispatch_get_specific(moduleQueueTag), @"Invoked on incorrect queue");
+	
+	if ([historyMessages count] > 0)
+	{
+		XMPPLogVerbose(@"%@[%@] - Storing %lu history messages",
+		               THIS_FILE, roomJID, (unsigned long)[historyMessages count]);
+		
+		NSArray *messages = [historyMessages copy];
+		
+		[xmppRoomStorage handleIncomingMessages:messages room:self];
+		[multicastDelegate xmppRoom:self didReceiveHistoryMessages:messages];
+	}
+	
+	historyMessages = nil;
+}
+
+/**
+ * Flushes any buffered history messages, and stops buffering.
+**/
+- (void)endHistory
+{
+	NSAssert(dispatch_get_specific(moduleQueueTag), @"Invoked on incorrect queue");
+	
+	[self flushHistoryMessages];
+	
+	if (historyTimer)
+	{
+		dispatch_source_cancel(historyTimer);
+		#if !OS_OBJECT_USE_OBJC
+		dispatch_release(historyTimer);
+		#endif
+		historyTimer = NULL;
+	}
+	
+	isReceivingHistory = NO;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark XMPPStream Delegate
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1334,6 +1436,9 @@ enum XMPPRoomState
 				
 				if ([xmppRoomStorage respondsToSelector:@selector(handleDidJoinRoom:withNickname:)])
 					[xmppRoomStorage handleDidJoinRoom:self withNickname:myNickname];
+				
+				// The discussion history (if any) immediately follows our own presence.
+				isReceivingHistory = [xmppRoomStorage respondsToSelector:@selector(handleIncomingMessages:room:)];
 				[multicastDelegate xmppRoomDidJoin:self];
 			}
 		}
@@ -1342,6 +1447,8 @@ enum XMPPRoomState
 			state = kXMPPRoomStateNone;
 			[responseTracker removeAllIDs];
 			
+			[self endHistory];
+			
 			[xmppRoomStorage handleDidLeaveRoom:self];
 			[multicastDelegate xmppRoomDidLeave:self];
 		}
@@ -1386,11 +1493,26 @@ enum XMPPRoomState
 	
 	if (isChatMessage)
 	{
-		[xmppRoomStorage handleIncomingMessage:message room:self];
+		if (isReceivingHistory && [message wasDelayed])
+		{
+			[self addHistoryMessage:message];
+		}
+		else
+		{
+			// A "live" message means the discussion history is over.
+			// Either way, the history must be stored before any message that follows it.
+			
+			[self endHistory];
+			[xmppRoomStorage handleIncomingMessage:message room:self];
+		}
+		
 		[multicastDelegate xmppRoom:self didReceiveMessage:message fromOccupant:from];
 	}
     else if ([message isGroupChatMessageWithSubject])
     {
+        // The room subject is always sent after the discussion history.
+        [self endHistory];
+        
         roomSubject = [message subject];
         [multicastDelegate xmppRoom:self roomSubjectDidChange:roomSubject];
     }
@@ -1427,6 +1549,7 @@ enum XMPPRoomState
 	
 	if (isChatMessage)
 	{
+		[self flushHistoryMessages];
 		[xmppRoomStorage handleOutgoingMessage:message room:self];	
 	}
 }
@@ -1440,6 +1563,8 @@ enum XMPPRoomState
 	state = kXMPPRoomStateNone;
 	[responseTracker removeAllIDs];
 	
+	[self endHistory];
+	
 	[xmppRoomStorage handleDidLeaveRoom:self];
 	[multicastDelegate xmppRoomDidLeave:self];
 }
@@ -1,4 +1,6 @@
 #import "XMPPStreamManagementMemoryStorage.h"
+#import "XMPPStreamManagementStanzas.h"
+#import "XMPPStreamManagementStanzaQueue.h"
 #import <libkern/OSAtomic.h>
 
 
@@ -19,10 +21,29 @@
 	NSDate *lastDisconnect;
 	uint32_t lastHandledByClient;
 	uint32_t lastHandledByServer;
-	NSArray *pendingOutgoingStanzas;
+	XMPPStreamManagementStanzaQueue *pendingOutgoingStanzas;
 	
 }
 
+- (instancetype)init
+{
+	if ((self = [super init]))
+	{
+		pendingOutgoingStanzas = [[XMPPStreamManagementStanzaQueue alloc] init];
+	}
+	return self;
+}
+
+- (void)setPendingOutgoingStanzas:(NSArray *)inPendingOutgoingStanzas
+{
+	[pendingOutgoingStanzas removeAllObjects];
+	
+	for (id stanza in inPendingOutgoingStanzas)
+	{
+		[pendingOutgoingStanzas addObject:stanza];
+	}
+}
+
 - (BOOL)configureWithParent:(XMPPStreamManagement *)parent queue:(dispatch_queue_t)queue
 {
 	// This implementation only supports a single xmppStream.
@@ -66,7 +87,7 @@
 	
 	lastHandledByClient = 0;
 	lastHandledByServer = 0;
-	pendingOutgoingStanzas = nil;
+	[pendingOutgoingStanzas removeAllObjects];
 }
 
 /**
@@ -120,7 +141,7 @@
 {
 	lastDisconnect = inLastDisconnect;
 	lastHandledByServer = inLastHandledByServer;
-	pendingOutgoingStanzas = inPendingOutgoingStanzas;
+	[self setPendingOutgoingStanzas:inPendingOutgoingStanzas];
 }
 
 /**
@@ -161,7 +182,55 @@
 	lastDisconnect = inLastDisconnect;
 	lastHandledByClient = inLastHandledByClient;
 	lastHandledByServer = inLastHandledByServer;
-	pendingOutgoingStanzas = inPendingOutgoingStanzas;
+	[self setPendingOutgoingStanzas:inPendingOutgoingStanzas];
+}
+
+/**
+ * Incremental alternative to setLastDisconnect:lastHandledByServer:pendingOutgoingStanzas:forStream:.
+ * Appends the given stanzas to the end of the pendingOutgoingStanzas.
+**/
+- (void)setLastDisconnect:(NSDate *)inLastDisconnect
+      lastHandledByServer:(uint32_t)inLastHandledByServer
+    appendPendingOutgoingStanzas:(NSArray *)inPendingOutgoingStanzas
+                forStream:(XMPPStream *)stream
+{
+	lastDisconnect = inLastDisconnect;
+	lastHandledByServer = inLastHandledByServer;
+	
+	for (id stanza in inPendingOutgoingStanzas)
+	{
+		[pendingOutgoingStanzas addObject:stanza];
+	}
+}
+
+/**
+ * Incremental alternative to setLastDisconnect:lastHandledByServer:pendingOutgoingStanzas:forStream:.
+ * Removes the given number of stanzas from the front of the pendingOutgoingStanzas (they've been acked).
+**/
+- (void)setLastDisconnect:(NSDate *)inLastDisconnect
+      lastHandledByServer:(uint32_t)inLastHandledByServer
+    removeFirstPendingOutgoingStanzas:(NSUInteger)count
+                forStream:(XMPPStream *)stream
+{
+	lastDisconnect = inLastDisconnect;
+	lastHandledByServer = inLastHandledByServer;
+	
+	[pendingOutgoingStanzas removeFirstObjects:count];
+}
+
+/**
+ * Replaces the stanza at the given index of the pendingOutgoingStanzas (its stanzaId has been determined).
+**/
+- (void)replacePendingOutgoingStanzaAtIndex:(NSUInteger)index
+                                 withStanza:(XMPPStreamManagementOutgoingStanza *)pendingOutgoingStanza
+                                  forStream:(XMPPStream *)stream
+{
+	if (index >= [pendingOutgoingStanzas count]) return;
+	
+	XMPPStreamManagementOutgoingStanza *storedStanza = pendingOutgoingStanzas[index];
+	
+	storedStanza.stanzaId = pendingOutgoingStanza.stanzaId;
+	storedStanza.awaitingStanzaId = pendingOutgoingStanza.awaitingStanzaId;
 }
 
 /**
@@ -189,7 +258,7 @@
 {
 	if (lastHandledByClientPtr)    *lastHandledByClientPtr    = lastHandledByClient;
 	if (lastHandledByServerPtr)    *lastHandledByServerPtr    = lastHandledByServer;
-	if (pendingOutgoingStanzasPtr) *pendingOutgoingStanzasPtr = pendingOutgoingStanzas;
+	if (pendingOutgoingStanzasPtr) *pendingOutgoingStanzasPtr = [pendingOutgoingStanzas allObjects];
 }
 
 /**
@@ -205,7 +274,7 @@
 	lastDisconnect = nil;
 	lastHandledByClient = 0;
 	lastHandledByServer = 0;
-	pendingOutgoingStanzas = nil;
+	[pendingOutgoingStanzas removeAllObjects];
 }
 
 @end
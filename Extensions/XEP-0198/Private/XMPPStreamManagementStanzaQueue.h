@@ -0,0 +1,60 @@
+#import <Foundation/Foundation.h>
+
+/**
+ * A FIFO queue of stanzas (XMPPStreamManagementOutgoingStanza or XMPPStreamManagementIncomingStanza objects),
+ * implemented as a ring buffer.
+ *
+ * Stream management only ever appends stanzas to the end of the queue,
+ * and removes them from the front (as acks arrive), which is O(1) per stanza with a ring buffer.
+ * (As opposed to an NSMutableArray, where removing a range from the front may shift all the remaining items.)
+ *
+ * Every stanza that passes through the queue has a sequence number, which starts at zero and never decreases.
+ * That is, the sequence number of the object at index i is (firstSequence + i).
+ * This allows a stanza to be found again (in O(1)) after stanzas before it have been removed from the queue.
+ *
+ * This class is not thread-safe.
+ * It's designed to be used only within the moduleQueue of XMPPStreamManagement.
+**/
+@interface XMPPStreamManagementStanzaQueue : NSObject <NSFastEnumeration>
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity;
+
+@property (nonatomic, readonly) NSUInteger count;
+
+/**
+ * The sequence number of the object at the front of the queue.
+ * That is, the number of objects that have been removed from the front of the queue.
+**/
+@property (nonatomic, readonly) uint64_t firstSequence;
+
+- (id)objectAtIndex:(NSUInteger)index;
+- (id)objectAtIndexedSubscript:(NSUInteger)index;
+
+/**
+ * Returns the object with the given sequence number,
+ * or nil if it's no longer (or not yet) in the queue.
+**/
+- (id)objectWithSequence:(uint64_t)sequence;
+
+/**
+ * Appends the object to the end of the queue, and returns its sequence number.
+**/
+- (uint64_t)addObject:(id)object;
+
+/**
+ * Removes the given number of objects from the front of the queue.
+**/
+- (void)removeFirstObjects:(NSUInteger)count;
+
+/**
+ * Removes all objects from the queue.
+ * The sequence numbers are not reset.
+**/
+- (void)removeAllObjects;
+
+/**
+ * Returns a (shallow) snapshot of the queue.
+**/
+- (NSArray *)allObjects;
+
+@end
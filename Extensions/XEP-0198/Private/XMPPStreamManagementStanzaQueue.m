@@ -0,0 +1,177 @@
+#import "XMPPStreamManagementStanzaQueue.h"
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+#define DEFAULT_CAPACITY 16
+
+
+@implementation XMPPStreamManagementStanzaQueue
+{
+	__strong id *buffer;
+	NSUInteger capacity; // always a power of 2
+	NSUInteger head;     // index (within buffer) of the object at the front of the queue
+	NSUInteger count;
+	
+	uint64_t firstSequence;
+	unsigned long mutations;
+}
+
+@synthesize count = count;
+@synthesize firstSequence = firstSequence;
+
+- (instancetype)init
+{
+	return [self initWithCapacity:DEFAULT_CAPACITY];
+}
+
+- (instancetype)initWithCapacity:(NSUInteger)inCapacity
+{
+	if ((self = [super init]))
+	{
+		capacity = DEFAULT_CAPACITY;
+		while (capacity < inCapacity) {
+			capacity <<= 1;
+		}
+		
+		buffer = (__strong id *)calloc(capacity, sizeof(id));
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	// Release all the objects (ARC doesn't do this for us with a malloc'd buffer)
+	[self removeAllObjects];
+	
+	free(buffer);
+}
+
+- (void)grow
+{
+	NSUInteger newCapacity = capacity << 1;
+	__strong id *newBuffer = (__strong id *)calloc(newCapacity, sizeof(id));
+	
+	for (NSUInteger i = 0; i < count; i++)
+	{
+		NSUInteger index = (head + i) & (capacity - 1);
+		
+		newBuffer[i] = buffer[index];
+		buffer[index] = nil;
+	}
+	
+	free(buffer);
+	
+	buffer = newBuffer;
+	capacity = newCapacity;
+	head = 0;
+}
+
+- (id)objectAtIndex:(NSUInteger)index
+{
+	if (index >= count)
+	{
+		[NSException raise:NSRangeException
+		            format:@"%@: index (%lu) beyond bounds (%lu)",
+		                   NSStringFromClass([self class]), (unsigned long)index, (unsigned long)count];
+	}
+	
+	return buffer[(head + index) & (capacity - 1)];
+}
+
+- (id)objectAtIndexedSubscript:(NSUInteger)index
+{
+	return [self objectAtIndex:index];
+}
+
+- (id)objectWithSequence:(uint64_t)sequence
+{
+	if (sequence < firstSequence) return nil;
+	if (sequence - firstSequence >= count) return nil;
+	
+	return buffer[(head + (NSUInteger)(sequence - firstSequence)) & (capacity - 1)];
+}
+
+- (uint64_t)addObject:(id)object
+{
+	NSParameterAssert(object != nil);
+	
+	if (count == capacity) {
+		[self grow];
+	}
+	
+	buffer[(head + count) & (capacity - 1)] = object;
+	count++;
+	mutations++;
+	
+	return firstSequence + count - 1;
+}
+
+- (void)removeFirstObjects:(NSUInteger)n
+{
+	if (n > count) {
+		n = count;
+	}
+	
+	for (NSUInteger i = 0; i < n; i++)
+	{
+		buffer[head] = nil;
+		head = (head + 1) & (capacity - 1);
+	}
+	
+	count -= n;
+	firstSequence += n;
+	mutations++;
+	
+	if (count == 0) {
+		head = 0;
+	}
+}
+
+- (void)removeAllObjects
+{
+	[self removeFirstObjects:count];
+}
+
+- (NSArray *)allObjects
+{
+	NSMutableArray *objects = [NSMutableArray arrayWithCapacity:count];
+	
+	for (NSUInteger i = 0; i < count; i++)
+	{
+		[objects addObject:buffer[(head + i) & (capacity - 1)]];
+	}
+	
+	return objects;
+}
+
+- (NSUInteger)countByEnumeratingWithState:(NSFastEnumerationState *)state
+                                  objects:(id __unsafe_unretained [])stackbuf
+                                    count:(NSUInteger)len
+{
+	// The objects are stored in (at most) 2 contiguous segments of the buffer.
+	// We hand out pointers into the buffer directly, one segment at a time.
+	//
+	// state->extra[0] is the number of objects enumerated so far.
+	
+	if (state->state == 0)
+	{
+		state->state = 1;
+		state->mutationsPtr = &mutations;
+		state->extra[0] = 0;
+	}
+	
+	NSUInteger enumerated = state->extra[0];
+	if (enumerated >= count) return 0;
+	
+	NSUInteger start = (head + enumerated) & (capacity - 1);
+	NSUInteger segmentLength = MIN(count - enumerated, capacity - start);
+	
+	state->itemsPtr = (__unsafe_unretained id *)(void *)(buffer + start);
+	state->extra[0] = enumerated + segmentLength;
+	
+	return segmentLength;
+}
+
+@end
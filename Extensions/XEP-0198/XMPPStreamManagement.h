@@ -4,6 +4,7 @@
 #define _XMPP_STREAM_MANAGEMENT_H
 
 @protocol XMPPStreamManagementStorage;
+@class XMPPStreamManagementOutgoingStanza;
 
 
 @interface XMPPStreamManagement : XMPPModule <XMPPCustomBinding>
@@ -601,6 +602,51 @@
 **/
 - (void)removeAllForStream:(XMPPStream *)stream;
 
+@optional
+
+/// ***** Incremental updates of pendingOutgoingStanzas *****
+///
+/// The pendingOutgoingStanzas array only ever grows at the end (as stanzas are sent),
+/// and shrinks at the front (as acks arrive from the server).
+/// Passing the full array to the storage layer on every change is quadratic for large queues,
+/// which is exactly the situation on a flaky connection with thousands of unacked stanzas.
+///
+/// If the storage layer implements ALL 3 of the methods below,
+/// then during active stream usage the extension will describe changes to the pendingOutgoingStanzas
+/// using these incremental operations instead of passing the full array to
+/// setLastDisconnect:lastHandledByServer:pendingOutgoingStanzas:forStream:.
+///
+/// The full array is still passed to the required methods whenever the extension (re)establishes the baseline
+/// (e.g. after <enabled/>, after resuming, or after a disconnect).
+/// The incremental operations always apply to the most recently passed full array.
+
+/**
+ * Appends the given XMPPStreamManagementOutgoingStanza objects to the end of the stored pendingOutgoingStanzas.
+**/
+- (void)setLastDisconnect:(NSDate *)date
+      lastHandledByServer:(uint32_t)lastHandledByServer
+    appendPendingOutgoingStanzas:(NSArray *)pendingOutgoingStanzas
+                forStream:(XMPPStream *)stream;
+
+/**
+ * Removes the given number of items from the front of the stored pendingOutgoingStanzas.
+ * This happens when the server acks stanzas.
+**/
+- (void)setLastDisconnect:(NSDate *)date
+      lastHandledByServer:(uint32_t)lastHandledByServer
+    removeFirstPendingOutgoingStanzas:(NSUInteger)count
+                forStream:(XMPPStream *)stream;
+
+/**
+ * Replaces the item at the given index of the stored pendingOutgoingStanzas.
+ * 
+ * This happens when the stanzaId for a sent element is determined (asynchronously, by the delegate(s))
+ * after the stanza was already appended.
+**/
+- (void)replacePendingOutgoingStanzaAtIndex:(NSUInteger)index
+                                 withStanza:(XMPPStreamManagementOutgoingStanza *)pendingOutgoingStanza
+                                  forStream:(XMPPStream *)stream;
+
 @end
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
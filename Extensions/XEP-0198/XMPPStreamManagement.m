@@ -1,5 +1,6 @@
 #import "XMPPStreamManagement.h"
 #import "XMPPStreamManagementStanzas.h"
+#import "XMPPStreamManagementStanzaQueue.h"
 #import "XMPPInternal.h"
 #import "XMPPTimer.h"
 #import "XMPPLogging.h"
@@ -72,8 +73,11 @@
 	
 	uint32_t lastHandledByServer; // last h value received from server
 	
-	NSMutableArray *unackedByServer;              // array of XMPPStreamManagementOutgoingStanza objects
-	NSUInteger unackedByServer_lastRequestOffset; // represents point at which we last sent a request
+	XMPPStreamManagementStanzaQueue *unackedByServer; // queue of XMPPStreamManagementOutgoingStanza objects
+	NSUInteger unackedByServer_lastRequestOffset;     // represents point at which we last sent a request
+	
+	BOOL storageSupportsIncrementalUpdates;           // storage implements the incremental pendingOutgoingStanzas ops
+	BOOL storedPendingOutgoingStanzasInSync;          // storage's pendingOutgoingStanzas matches unackedByServer
 	
 	NSArray *prev_unackedByServer;                // from previous connection, used when resuming session
 	
@@ -85,7 +89,7 @@
 	
 	uint32_t lastHandledByClient; // latest h value we can send to the server
 	
-	NSMutableArray *unackedByClient;          // array of XMPPStreamManagementIncomingStanza objects
+	XMPPStreamManagementStanzaQueue *unackedByClient; // queue of XMPPStreamManagementIncomingStanza objects
 	NSUInteger unackedByClient_lastAckOffset; // number of items removed from array, but ack not sent to server
 	
 	NSMutableArray *pendingHandledStanzaIds;// edge case handling
@@ -129,8 +133,13 @@
 			XMPPLogError(@"%@: %@ - Unable to configure storage!", THIS_FILE, THIS_METHOD);
 		}
 		
-		unackedByServer = [[NSMutableArray alloc] init];
-		unackedByClient = [[NSMutableArray alloc] init];
+		unackedByServer = [[XMPPStreamManagementStanzaQueue alloc] init];
+		unackedByClient = [[XMPPStreamManagementStanzaQueue alloc] init];
+		
+		storageSupportsIncrementalUpdates =
+		  [storage respondsToSelector:@selector(setLastDisconnect:lastHandledByServer:appendPendingOutgoingStanzas:forStream:)] &&
+		  [storage respondsToSelector:@selector(setLastDisconnect:lastHandledByServer:removeFirstPendingOutgoingStanzas:forStream:)] &&
+		  [storage respondsToSelector:@selector(replacePendingOutgoingStanzaAtIndex:withStanza:forStream:)];
 	}
 	return self;
 }
@@ -356,6 +365,7 @@
 		
 		[unackedByServer removeAllObjects];
 		unackedByServer_lastRequestOffset = 0;
+		storedPendingOutgoingStanzasInSync = NO;
 		
 		[unackedByClient removeAllObjects];
 		unackedByClient_lastAckOffset = 0;
@@ -479,6 +489,7 @@
 		
 		[unackedByServer removeAllObjects];
 		unackedByServer_lastRequestOffset = 0;
+		storedPendingOutgoingStanzasInSync = NO;
 		
 		[unackedByClient removeAllObjects];
 		unackedByClient_lastAckOffset = 0;
@@ -589,6 +600,8 @@
 		    pendingOutgoingStanzas:nil
 		                 forStream:xmppStream];
 		
+		storedPendingOutgoingStanzasInSync = ([unackedByServer count] == 0);
+		
 		// Notify delegate
 		
 		[multicastDelegate xmppStreamManagement:self didReceiveAckForStanzaIds:stanzaIds];
@@ -896,7 +909,7 @@
 		  [[XMPPStreamManagementOutgoingStanza alloc] initWithStanzaId:elementId];
 		[unackedByServer addObject:stanza];
 		
-		[self updateStoredPendingOutgoingStanzas];
+		[self updateStoredPendingOutgoingStanzasWithAppendedStanza:stanza];
 		
 		// At bottom of this method:
 		// [self maybeRequestAck];
@@ -908,7 +921,15 @@
 		
 		XMPPStreamManagementOutgoingStanza *stanza =
 		  [[XMPPStreamManagementOutgoingStanza alloc] initAwaitingStanzaId];
-		[unackedByServer addObject:stanza];
+		uint64_t sequence = [unackedByServer addObject:stanza];
+		
+		// When using incremental updates, the placeholder is stored too (so the stored indexes line up).
+		// It gets replaced once we know its stanzaId.
+		
+		if ([self canUpdateStoredPendingOutgoingStanzasIncrementally])
+		{
+			[self updateStoredPendingOutgoingStanzasWithAppendedStanza:stanza];
+		}
 		
 		// Start the asynchronous process to find the proper stanzaId
 		
@@ -964,7 +985,11 @@
 					}
 				}
 				
-				if (!dequeuedPendingAck)
+				if ([self canUpdateStoredPendingOutgoingStanzasIncrementally])
+				{
+					[self updateStoredPendingOutgoingStanza:stanza withSequence:sequence];
+				}
+				else if (!dequeuedPendingAck)
 				{
 					[self updateStoredPendingOutgoingStanzas];
 				}
@@ -1028,6 +1053,7 @@
 	
 	BOOL canProcessEntireAck = YES;
 	NSUInteger processed = 0;
+	NSUInteger removed = 0;
 	
 	NSMutableArray *stanzaIds = [NSMutableArray arrayWithCapacity:(NSUInteger)diff];
 	
@@ -1053,7 +1079,8 @@
 	{
 		if (canProcessEntireAck)
 		{
-			[unackedByServer removeObjectsInRange:NSMakeRange(0, (NSUInteger)diff)];
+			[unackedByServer removeFirstObjects:(NSUInteger)diff];
+			removed = (NSUInteger)diff;
 			if (unackedByServer_lastRequestOffset > diff)
 				unackedByServer_lastRequestOffset -= diff;
 			else
@@ -1066,7 +1093,8 @@
 		}
 		else // if (processed > 0)
 		{
-			[unackedByServer removeObjectsInRange:NSMakeRange(0, processed)];
+			[unackedByServer removeFirstObjects:processed];
+			removed = processed;
 			if (unackedByServer_lastRequestOffset > processed)
 				unackedByServer_lastRequestOffset -= processed;
 			else
@@ -1080,22 +1108,16 @@
 		
 		// Update storage
 		
-		NSArray *pending = [[NSArray alloc] initWithArray:unackedByServer copyItems:YES];
-		
-		if (isStarted)
+		if ([self canUpdateStoredPendingOutgoingStanzasIncrementally])
 		{
 			[storage setLastDisconnect:[NSDate date]
 			       lastHandledByServer:lastHandledByServer
-			    pendingOutgoingStanzas:pending
+			    removeFirstPendingOutgoingStanzas:removed
 			                 forStream:xmppStream];
 		}
-		else // edge case
+		else
 		{
-			[storage setLastDisconnect:disconnectDate
-			       lastHandledByClient:lastHandledByClient
-			       lastHandledByServer:lastHandledByServer
-			    pendingOutgoingStanzas:pending
-			                 forStream:xmppStream];
+			[self updateStoredPendingOutgoingStanzas];
 		}
 		
 		// Notify delegate
@@ -1159,7 +1181,7 @@
 	
 	if (pending > 0)
 	{
-		[unackedByClient removeObjectsInRange:NSMakeRange(0, pending)];
+		[unackedByClient removeFirstObjects:pending];
 		unackedByClient_lastAckOffset += pending;
 		lastHandledByClient += pending;
 		
@@ -1180,13 +1202,15 @@
 		{
 			// An incoming stanza got markedAsHandled post-disconnect
 			
-			NSArray *pending = [[NSArray alloc] initWithArray:unackedByServer copyItems:YES];
+			NSArray *pending = [self pendingOutgoingStanzasSnapshot];
 			
 			[storage setLastDisconnect:disconnectDate
 				   lastHandledByClient:lastHandledByClient
 				   lastHandledByServer:lastHandledByServer
 				pendingOutgoingStanzas:pending
 							 forStream:xmppStream];
+			
+			storedPendingOutgoingStanzasInSync = YES;
 		}
 	}
 	
@@ -1518,7 +1542,7 @@
 {
 	XMPPLogTrace();
 	
-	NSArray *pending = [[NSArray alloc] initWithArray:unackedByServer copyItems:YES];
+	NSArray *pending = [self pendingOutgoingStanzasSnapshot];
 	
 	if (isStarted)
 	{
@@ -1535,6 +1559,74 @@
 		    pendingOutgoingStanzas:pending
 		                 forStream:xmppStream];
 	}
+	
+	storedPendingOutgoingStanzasInSync = YES;
+}
+
+/**
+ * Returns a copy of the unackedByServer queue, suitable for passing to the storage layer.
+**/
+- (NSArray *)pendingOutgoingStanzasSnapshot
+{
+	return [[NSArray alloc] initWithArray:[unackedByServer allObjects] copyItems:YES];
+}
+
+/**
+ * Returns YES if changes to the unackedByServer queue can be passed to the storage layer
+ * as incremental operations (rather than a full snapshot).
+ * 
+ * This requires storage support, and that the stored array currently matches the unackedByServer queue.
+ * Whenever it doesn't (e.g. after <enabled/> or <resumed/>), the next update stores a full snapshot,
+ * which re-establishes the baseline.
+**/
+- (BOOL)canUpdateStoredPendingOutgoingStanzasIncrementally
+{
+	return isStarted && storageSupportsIncrementalUpdates && storedPendingOutgoingStanzasInSync;
+}
+
+/**
+ * This method is used when a stanza has been appended to the unackedByServer queue.
+**/
+- (void)updateStoredPendingOutgoingStanzasWithAppendedStanza:(XMPPStreamManagementOutgoingStanza *)stanza
+{
+	XMPPLogTrace();
+	
+	if ([self canUpdateStoredPendingOutgoingStanzasIncrementally])
+	{
+		[storage setLastDisconnect:[NSDate date]
+		       lastHandledByServer:lastHandledByServer
+		    appendPendingOutgoingStanzas:@[[stanza copy]]
+		                 forStream:xmppStream];
+	}
+	else
+	{
+		[self updateStoredPendingOutgoingStanzas];
+	}
+}
+
+/**
+ * This method is used when the stanzaId of a stanza in the unackedByServer queue has been determined.
+**/
+- (void)updateStoredPendingOutgoingStanza:(XMPPStreamManagementOutgoingStanza *)stanza withSequence:(uint64_t)sequence
+{
+	XMPPLogTrace();
+	
+	if ([self canUpdateStoredPendingOutgoingStanzasIncrementally])
+	{
+		// If the stanza is no longer in the queue (it's already been acked),
+		// then it's no longer in storage either, and there's nothing to update.
+		
+		if ([unackedByServer objectWithSequence:sequence] == stanza)
+		{
+			NSUInteger index = (NSUInteger)(sequence - [unackedByServer firstSequence]);
+			
+			[storage replacePendingOutgoingStanzaAtIndex:index withStanza:[stanza copy] forStream:xmppStream];
+		}
+	}
+	else
+	{
+		[self updateStoredPendingOutgoingStanzas];
+	}
 }
 
 /**
@@ -1568,7 +1660,7 @@
 	
 	if (pending > 0)
 	{
-		[unackedByClient removeObjectsInRange:NSMakeRange(0, pending)];
+		[unackedByClient removeFirstObjects:pending];
 		unackedByClient_lastAckOffset += pending;
 		lastHandledByClient += pending;
 		
@@ -1587,13 +1679,15 @@
 		{
 			// An incoming stanza got markedAsHandled post-disconnect
 			
-			NSArray *pending = [[NSArray alloc] initWithArray:unackedByServer copyItems:YES];
+			NSArray *pending = [self pendingOutgoingStanzasSnapshot];
 		
 			[storage setLastDisconnect:disconnectDate
 			       lastHandledByClient:lastHandledByClient
 			       lastHandledByServer:lastHandledByServer
 			    pendingOutgoingStanzas:pending
 			                 forStream:xmppStream];
+			
+			storedPendingOutgoingStanzasInSync = YES;
 		}
 	}
 }
@@ -1804,6 +1898,8 @@
 			          lastDisconnect:[NSDate date]
 			               forStream:xmppStream];
 			
+			storedPendingOutgoingStanzasInSync = ([unackedByServer count] == 0);
+			
 			[multicastDelegate xmppStreamManagement:self wasEnabled:element];
 			
 			isStarted = YES;
@@ -1824,6 +1920,7 @@
 		if (enableSent)
 		{
 			[storage removeAllForStream:xmppStream];
+			storedPendingOutgoingStanzasInSync = NO;
 			
 			[multicastDelegate xmppStreamManagement:self wasNotEnabled:element];
 			
@@ -1851,17 +1948,20 @@
 	{
 		disconnectDate = nil;
 		[storage removeAllForStream:xmppStream];
+		storedPendingOutgoingStanzasInSync = NO;
 	}
 	else
 	{
 		disconnectDate = [NSDate date];
-		NSArray *pending = [[NSArray alloc] initWithArray:unackedByServer copyItems:YES];
+		NSArray *pending = [self pendingOutgoingStanzasSnapshot];
 		
 		[storage setLastDisconnect:disconnectDate
 		       lastHandledByClient:lastHandledByClient
 		       lastHandledByServer:lastHandledByServer
 		    pendingOutgoingStanzas:pending
 		                 forStream:xmppStream];
+		
+		storedPendingOutgoingStanzasInSync = YES;
 	}
 	
 	// Reset temporary state variables
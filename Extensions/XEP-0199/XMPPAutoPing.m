@@ -355,7 +355,12 @@
 {
 	XMPPLogTrace();
 	
+	// The pong is routed directly to the XMPPPing module (it doesn't reach xmppStream:didReceiveIQ:),
+	// so it has to be accounted for here.
+	
+	lastReceiveTime = [NSDate timeIntervalSinceReferenceDate];
 	awaitingPingResponse = NO;
+	
 	[multicastDelegate xmppAutoPingDidReceivePong:self];
 }
 
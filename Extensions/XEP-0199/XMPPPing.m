@@ -169,6 +169,9 @@
 	
 	XMPPIQ *iq = [XMPPIQ iqWithType:@"get" to:nil elementID:pingID child:ping];
 	
+	// Have the response delivered to us directly, rather than broadcast to every module
+	[xmppStream routeResponseToIQ:iq toModule:self timeout:timeout];
+	
 	[xmppStream sendElement:iq];
 	
 	return pingID;
@@ -199,6 +202,9 @@
 	
 	XMPPIQ *iq = [XMPPIQ iqWithType:@"get" to:jid elementID:pingID child:ping];
 	
+	// Have the response delivered to us directly, rather than broadcast to every module
+	[xmppStream routeResponseToIQ:iq toModule:self timeout:timeout];
+	
 	[xmppStream sendElement:iq];
 	
 	return pingID;
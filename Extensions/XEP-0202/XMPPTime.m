@@ -173,6 +173,9 @@
 	
 	XMPPIQ *iq = [XMPPIQ iqWithType:@"get" to:domainJID elementID:queryID child:time];
 	
+	// Have the response delivered to us directly, rather than broadcast to every module
+	[xmppStream routeResponseToIQ:iq toModule:self timeout:timeout];
+	
 	[xmppStream sendElement:iq];
 	
 	return queryID;
@@ -203,6 +206,9 @@
 	
 	XMPPIQ *iq = [XMPPIQ iqWithType:@"get" to:jid elementID:queryID child:time];
 	
+	// Have the response delivered to us directly, rather than broadcast to every module
+	[xmppStream routeResponseToIQ:iq toModule:self timeout:timeout];
+	
 	[xmppStream sendElement:iq];
 	
 	return queryID;
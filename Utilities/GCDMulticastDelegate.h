@@ -40,6 +40,31 @@
 
 - (GCDMulticastDelegateEnumerator *)delegateEnumerator;
 
+/**
+ * Returns an enumerator that only contains the delegates that respond to the given selector.
+ * 
+ * This is equivalent to using delegateEnumerator along with getNextDelegate:delegateQueue:forSelector:,
+ * but avoids walking (and querying) delegates that don't implement the method.
+**/
+- (GCDMulticastDelegateEnumerator *)delegateEnumeratorForSelector:(SEL)aSelector;
+
+/**
+ * Fast path for frequently invoked delegate methods.
+ * 
+ * Invokes the given method on every delegate that implements it (each on its own delegate queue),
+ * just like sending the message to the multicast delegate directly.
+ * However, instead of building and duplicating an NSInvocation for each delegate,
+ * the method implementation is called directly.
+ * 
+ * The method must take exactly two object parameters, and return either void or BOOL.
+ * For example: xmppStream:didReceiveMessage:
+ * If the method returns a value, it is ignored.
+ * 
+ * The list of delegates that respond to a selector is cached,
+ * and the cache is invalidated whenever a delegate is added or removed.
+**/
+- (void)invokeSelector:(SEL)aSelector withObject:(id)object1 withObject:(id)object2;
+
 @end
 
 
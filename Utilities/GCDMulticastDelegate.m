@@ -1,5 +1,6 @@
 #import "GCDMulticastDelegate.h"
 #import <libkern/OSAtomic.h>
+#import <objc/runtime.h>
 
 #if __has_feature(objc_arc_weak) && !TARGET_OS_IPHONE
 #import <AppKit/AppKit.h>
@@ -55,11 +56,37 @@
 @end
 
 
+/**
+ * An entry in the responder cache.
+ * 
+ * The generation is compared against the generation of the multicast delegate,
+ * which is incremented every time the delegate list changes.
+ * Stale entries are rebuilt lazily, the next time the selector is queried.
+**/
+@interface GCDMulticastDelegateResponders : NSObject {
+@public
+	
+	NSUInteger generation;
+	NSArray *nodes;
+}
+@end
+
+@implementation GCDMulticastDelegateResponders
+@end
+
+
 @interface GCDMulticastDelegate ()
 {
 	NSMutableArray *delegateNodes;
+	
+	NSUInteger generation;
+	CFMutableDictionaryRef responderCache; // SEL -> GCDMulticastDelegateResponders
 }
 
+- (NSArray *)respondersForSelector:(SEL)aSelector;
+- (void)invalidateResponderCache;
+- (void)removeNilDelegateNodes;
+
 - (NSInvocation *)duplicateInvocation:(NSInvocation *)origInvocation;
 
 @end
@@ -72,7 +99,7 @@
 	NSArray *delegateNodes;
 }
 
-- (id)initFromDelegateNodes:(NSMutableArray *)inDelegateNodes;
+- (id)initFromDelegateNodes:(NSArray *)inDelegateNodes;
 
 @end
 
@@ -87,6 +114,9 @@
 	if ((self = [super init]))
 	{
 		delegateNodes = [[NSMutableArray alloc] init];
+		
+		// The keys are selectors, which are unique pointers that need no retain/release or equality checks.
+		responderCache = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, NULL, &kCFTypeDictionaryValueCallBacks);
 	}
 	return self;
 }
@@ -100,6 +130,8 @@
 	    [[GCDMulticastDelegateNode alloc] initWithDelegate:delegate delegateQueue:delegateQueue];
 	
 	[delegateNodes addObject:node];
+	
+	[self invalidateResponderCache];
 }
 
 - (void)removeDelegate:(id)delegate delegateQueue:(dispatch_queue_t)delegateQueue
@@ -136,6 +168,8 @@
 				#endif
 				
 				[delegateNodes removeObjectAtIndex:(i-1)];
+				
+				[self invalidateResponderCache];
 			}
 		}
 	}
@@ -157,6 +191,8 @@
 	}
 	
 	[delegateNodes removeAllObjects];
+	
+	[self invalidateResponderCache];
 }
 
 - (NSUInteger)count
@@ -189,7 +225,7 @@
 {
 	NSUInteger count = 0;
 	
-	for (GCDMulticastDelegateNode *node in delegateNodes)
+	for (GCDMulticastDelegateNode *node in [self respondersForSelector:aSelector])
 	{
 		id nodeDelegate = node.delegate;
 		#if __has_feature(objc_arc_weak) && !TARGET_OS_IPHONE
@@ -197,7 +233,7 @@
 			nodeDelegate = node.unsafeDelegate;
 		#endif
 		
-		if ([nodeDelegate respondsToSelector:aSelector])
+		if (nodeDelegate)
 		{
 			count++;
 		}
@@ -208,7 +244,10 @@
 
 - (BOOL)hasDelegateThatRespondsToSelector:(SEL)aSelector
 {
-	for (GCDMulticastDelegateNode *node in delegateNodes)
+	// The cached list only contains responders.
+	// So unless a weak delegate has disappeared, the first node settles it.
+	
+	for (GCDMulticastDelegateNode *node in [self respondersForSelector:aSelector])
 	{
 		id nodeDelegate = node.delegate;
 		#if __has_feature(objc_arc_weak) && !TARGET_OS_IPHONE
@@ -216,7 +255,7 @@
 			nodeDelegate = node.unsafeDelegate;
 		#endif
 		
-		if ([nodeDelegate respondsToSelector:aSelector])
+		if (nodeDelegate)
 		{
 			return YES;
 		}
@@ -230,6 +269,11 @@
 	return [[GCDMulticastDelegateEnumerator alloc] initFromDelegateNodes:delegateNodes];
 }
 
+- (GCDMulticastDelegateEnumerator *)delegateEnumeratorForSelector:(SEL)aSelector
+{
+	return [[GCDMulticastDelegateEnumerator alloc] initFromDelegateNodes:[self respondersForSelector:aSelector]];
+}
+
 - (NSMethodSignature *)methodSignatureForSelector:(SEL)aSelector
 {
 	for (GCDMulticastDelegateNode *node in delegateNodes)
@@ -290,15 +334,73 @@
 	
 	if (foundNilDelegate)
 	{
-		// At lease one weak delegate reference disappeared.
-		// Remove nil delegate nodes from the list.
-		// 
-		// This is expected to happen very infrequently.
-		// This is why we handle it separately (as it requires allocating an indexSet).
+		[self removeNilDelegateNodes];
+	}
+}
+
+- (void)invokeSelector:(SEL)aSelector withObject:(id)object1 withObject:(id)object2
+{
+	BOOL foundNilDelegate = NO;
+	
+	for (GCDMulticastDelegateNode *node in [self respondersForSelector:aSelector])
+	{
+		id nodeDelegate = node.delegate;
+		#if __has_feature(objc_arc_weak) && !TARGET_OS_IPHONE
+		if (nodeDelegate == [NSNull null])
+			nodeDelegate = node.unsafeDelegate;
+		#endif
 		
-		NSMutableIndexSet *indexSet = [[NSMutableIndexSet alloc] init];
+		if (nodeDelegate)
+		{
+			// All delegates MUST be invoked ASYNCHRONOUSLY.
+			// 
+			// We look up the implementation via the class (rather than methodForSelector:),
+			// as this also works for proxies, in which case it returns the forwarding implementation.
+			
+			IMP imp = class_getMethodImplementation(object_getClass(nodeDelegate), aSelector);
+			
+			dispatch_async(node.delegateQueue, ^{ @autoreleasepool {
+				
+				((void (*)(id, SEL, id, id))imp)(nodeDelegate, aSelector, object1, object2);
+				
+			}});
+		}
+		else
+		{
+			foundNilDelegate = YES;
+		}
+	}
+	
+	if (foundNilDelegate)
+	{
+		[self removeNilDelegateNodes];
+	}
+}
+
+/**
+ * Returns the list of nodes whose delegate responds to the given selector.
+ * 
+ * The list is built on first use, and cached until the delegate list changes (see generation).
+ * Nodes whose (weak) delegate has since disappeared may still be in the list,
+ * so callers must still check for a nil delegate.
+**/
+- (NSArray *)respondersForSelector:(SEL)aSelector
+{
+	GCDMulticastDelegateResponders *responders =
+	    (__bridge GCDMulticastDelegateResponders *)CFDictionaryGetValue(responderCache, (const void *)aSelector);
+	
+	if (responders == nil)
+	{
+		responders = [[GCDMulticastDelegateResponders alloc] init];
+		responders->generation = generation - 1;
+		
+		CFDictionarySetValue(responderCache, (const void *)aSelector, (__bridge const void *)responders);
+	}
+	
+	if (responders->generation != generation)
+	{
+		NSMutableArray *result = [NSMutableArray arrayWithCapacity:[delegateNodes count]];
 		
-		NSUInteger i = 0;
 		for (GCDMulticastDelegateNode *node in delegateNodes)
 		{
 			id nodeDelegate = node.delegate;
@@ -307,14 +409,56 @@
 				nodeDelegate = node.unsafeDelegate;
 			#endif
 			
-			if (nodeDelegate == nil)
+			if ([nodeDelegate respondsToSelector:aSelector])
 			{
-				[indexSet addIndex:i];
+				[result addObject:node];
 			}
-			i++;
 		}
 		
+		responders->nodes = [result copy];
+		responders->generation = generation;
+	}
+	
+	return responders->nodes;
+}
+
+- (void)invalidateResponderCache
+{
+	// Every cached entry is now stale, and will be rebuilt the next time it's needed.
+	generation++;
+}
+
+- (void)removeNilDelegateNodes
+{
+	// At lease one weak delegate reference disappeared.
+	// Remove nil delegate nodes from the list.
+	// 
+	// This is expected to happen very infrequently.
+	// This is why we handle it separately (as it requires allocating an indexSet).
+	
+	NSMutableIndexSet *indexSet = [[NSMutableIndexSet alloc] init];
+	
+	NSUInteger i = 0;
+	for (GCDMulticastDelegateNode *node in delegateNodes)
+	{
+		id nodeDelegate = node.delegate;
+		#if __has_feature(objc_arc_weak) && !TARGET_OS_IPHONE
+		if (nodeDelegate == [NSNull null])
+			nodeDelegate = node.unsafeDelegate;
+		#endif
+		
+		if (nodeDelegate == nil)
+		{
+			[indexSet addIndex:i];
+		}
+		i++;
+	}
+	
+	if ([indexSet count] > 0)
+	{
 		[delegateNodes removeObjectsAtIndexes:indexSet];
+		
+		[self invalidateResponderCache];
 	}
 }
 
@@ -328,6 +472,9 @@
 - (void)dealloc
 {
 	[self removeAllDelegates];
+	
+	if (responderCache)
+		CFRelease(responderCache);
 }
 
 - (NSInvocation *)duplicateInvocation:(NSInvocation *)origInvocation
@@ -517,7 +664,7 @@ static BOOL SupportsWeakReferences(id delegate)
 
 @implementation GCDMulticastDelegateEnumerator
 
-- (id)initFromDelegateNodes:(NSMutableArray *)inDelegateNodes
+- (id)initFromDelegateNodes:(NSArray *)inDelegateNodes
 {
 	if ((self = [super init]))
 	{
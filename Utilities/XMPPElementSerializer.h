@@ -0,0 +1,36 @@
+#import <Foundation/Foundation.h>
+
+#if TARGET_OS_IPHONE
+  #import "DDXML.h"
+#endif
+
+/**
+ * This class serializes outgoing elements into UTF-8 data, ready to be written to the socket.
+ * 
+ * The traditional approach, [[element compactXMLString] dataUsingEncoding:NSUTF8StringEncoding],
+ * has libxml serialize the element into a temporary buffer, which is then transcoded into an NSString,
+ * trimmed (another copy), and finally transcoded back into UTF-8 data.
+ * 
+ * On iOS (KissXML) this class instead has libxml serialize the underlying node tree directly into
+ * a reusable output buffer, which retains its capacity from stanza to stanza.
+ * The result is then copied (once) into an exactly-sized NSData object, and no NSString is ever created.
+ * 
+ * On Mac OS X (NSXMLElement) there is no access to the underlying tree,
+ * so the class falls back to the traditional approach.
+ * 
+ * This class is not thread-safe.
+ * It is designed to be used by XMPPStream, within its xmppQueue.
+**/
+@interface XMPPElementSerializer : NSObject
+
+- (instancetype)init;
+
+/**
+ * Returns the compact UTF-8 serialization of the given element.
+ * The result is byte-for-byte identical to the UTF-8 encoding of [element compactXMLString].
+ * 
+ * Returns nil if the element could not be serialized.
+**/
+- (NSData *)dataForElement:(NSXMLElement *)element;
+
+@end
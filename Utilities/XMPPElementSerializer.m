@@ -0,0 +1,139 @@
+#import "XMPPElementSerializer.h"
+#import "XMPPLogging.h"
+#import "NSXMLElement+XMPP.h"
+
+#if TARGET_OS_IPHONE
+  #import "DDXMLPrivate.h"
+  #import <libxml/tree.h>
+  #import <libxml/globals.h>
+#endif
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+// Log levels: off, error, warn, info, verbose
+// Log flags: trace
+#if DEBUG
+  static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN;
+#else
+  static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN;
+#endif
+
+// The output buffer grows as needed, and keeps its capacity between stanzas.
+// But we don't want a single huge stanza (e.g. an inline avatar) to pin a large buffer forever.
+#define INITIAL_BUFFER_SIZE  1024
+#define MAX_RETAINED_SIZE    (64 * 1024)
+
+#if TARGET_OS_IPHONE
+
+/**
+ * DDXMLNode doesn't publicly expose its underlying libxml node.
+ * But a category is allowed to access the (protected) genericPtr ivar.
+**/
+@interface DDXMLNode (XMPPElementSerializer)
+- (xmlNodePtr)xmpp_primitiveNode;
+@end
+
+@implementation DDXMLNode (XMPPElementSerializer)
+
+- (xmlNodePtr)xmpp_primitiveNode
+{
+	return (xmlNodePtr)genericPtr;
+}
+
+@end
+
+#endif
+
+@implementation XMPPElementSerializer
+{
+#if TARGET_OS_IPHONE
+	xmlBufferPtr buffer;
+#endif
+}
+
+- (instancetype)init
+{
+	if ((self = [super init]))
+	{
+	#if TARGET_OS_IPHONE
+		buffer = xmlBufferCreateSize(INITIAL_BUFFER_SIZE);
+		if (buffer == NULL)
+		{
+			XMPPLogError(@"%@: Unable to create output buffer", THIS_FILE);
+			return nil;
+		}
+		xmlBufferSetAllocationScheme(buffer, XML_BUFFER_ALLOC_DOUBLEIT);
+	#endif
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+#if TARGET_OS_IPHONE
+	if (buffer) {
+		xmlBufferFree(buffer);
+	}
+#endif
+}
+
+- (NSData *)dataForElement:(NSXMLElement *)element
+{
+	if (element == nil) return nil;
+	
+#if TARGET_OS_IPHONE
+	
+	if (buffer == NULL)
+	{
+		buffer = xmlBufferCreateSize(INITIAL_BUFFER_SIZE);
+		if (buffer) {
+			xmlBufferSetAllocationScheme(buffer, XML_BUFFER_ALLOC_DOUBLEIT);
+		}
+	}
+	
+	xmlNodePtr node = [element xmpp_primitiveNode];
+	if (buffer == NULL || node == NULL || node->type != XML_ELEMENT_NODE)
+	{
+		return [[element compactXMLString] dataUsingEncoding:NSUTF8StringEncoding];
+	}
+	
+	// Mirror the options used by [DDXMLNode compactXMLString]:
+	// empty elements are output as <empty/>, and no formatting is applied.
+	// Since no formatting is applied there is no surrounding whitespace to trim.
+	
+	xmlSaveNoEmptyTags = 0;
+	
+	int dumpCnt = xmlNodeDump(buffer, node->doc, node, 0, 0);
+	if (dumpCnt < 0)
+	{
+		XMPPLogError(@"%@: Unable to serialize element <%@>", THIS_FILE, [element name]);
+		
+		xmlBufferEmpty(buffer);
+		return nil;
+	}
+	
+	NSData *result = [NSData dataWithBytes:xmlBufferContent(buffer) length:(NSUInteger)xmlBufferLength(buffer)];
+	
+	if (buffer->size > MAX_RETAINED_SIZE)
+	{
+		// Release the oversized buffer. A fresh one is created lazily on the next invocation.
+		xmlBufferFree(buffer);
+		buffer = NULL;
+	}
+	else
+	{
+		xmlBufferEmpty(buffer);
+	}
+	
+	return result;
+	
+#else
+	
+	return [[element compactXMLString] dataUsingEncoding:NSUTF8StringEncoding];
+	
+#endif
+}
+
+@end
@@ -149,6 +149,81 @@ extern const NSTimeInterval XMPPIDTrackerTimeoutNone;
 
 - (BOOL)invokeForElement:(XMPPElement *)element withObject:(id)obj;
 
+/**
+ * Same as invokeForElement:withObject:, but uses the given elementID instead of extracting it from the element.
+ * Use this if the elementID is already known (e.g. it was extracted by the parser).
+**/
+- (BOOL)invokeForElement:(XMPPElement *)element elementID:(NSString *)elementID withObject:(id)obj;
+
+- (NSUInteger)numberOfIDs;
+
+- (void)removeID:(NSString *)elementID;
+- (void)removeAllIDs;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * A thread-safe variant of XMPPIDTracker.
+ * 
+ * The methods of this class may be invoked from any thread/queue.
+ * For example, responses may be matched directly within the xmppQueue (without first hopping to the module's queue),
+ * while requests continue to be added from within the module's queue.
+ * 
+ * The tracked IDs are spread over a number of shards, each with its own lock,
+ * so concurrent operations on different IDs rarely contend with one another.
+ * 
+ * Every tracked ID is claimed exactly once.
+ * Whichever comes first (a matching invoke, the timeout, or a removal) removes the tracking info,
+ * and the others find nothing to do.
+ * 
+ * The handlers (block, target/selector, or the tracking info's invokeWithObject:) are always invoked
+ * on the dispatch queue given at initialization.
+ * If the invoke method is called from within that queue, the handler is invoked synchronously,
+ * otherwise it's dispatched asynchronously to the queue.
+ * 
+ * Timeouts are handled by the tracker itself (the createTimerWithDispatchQueue: method of the tracking info isn't used).
+**/
+@interface XMPPConcurrentIDTracker : NSObject
+
+- (id)initWithDispatchQueue:(dispatch_queue_t)queue;
+
+- (id)initWithStream:(XMPPStream *)stream dispatchQueue:(dispatch_queue_t)queue;
+
+- (void)addID:(NSString *)elementID target:(id)target selector:(SEL)selector timeout:(NSTimeInterval)timeout;
+
+- (void)addElement:(XMPPElement *)element target:(id)target selector:(SEL)selector timeout:(NSTimeInterval)timeout;
+
+- (void)addID:(NSString *)elementID
+        block:(void (^)(id obj, id <XMPPTrackingInfo> info))block
+      timeout:(NSTimeInterval)timeout;
+
+- (void)addElement:(XMPPElement *)element
+             block:(void (^)(id obj, id <XMPPTrackingInfo> info))block
+           timeout:(NSTimeInterval)timeout;
+
+- (void)addID:(NSString *)elementID trackingInfo:(id <XMPPTrackingInfo>)trackingInfo;
+
+- (void)addElement:(XMPPElement *)element trackingInfo:(id <XMPPTrackingInfo>)trackingInfo;
+
+/**
+ * Returns YES if the ID was being tracked (and has now been claimed by this invocation).
+**/
+- (BOOL)invokeForID:(NSString *)elementID withObject:(id)obj;
+
+- (BOOL)invokeForElement:(XMPPElement *)element withObject:(id)obj;
+
+- (BOOL)invokeForElement:(XMPPElement *)element elementID:(NSString *)elementID withObject:(id)obj;
+
+/**
+ * Returns whether the given ID is currently being tracked.
+ * Since other threads may claim the ID at any time, this is only a hint.
+**/
+- (BOOL)isTrackingID:(NSString *)elementID;
+
 - (NSUInteger)numberOfIDs;
 
 - (void)removeID:(NSString *)elementID;
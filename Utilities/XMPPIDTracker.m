@@ -1,6 +1,8 @@
 #import "XMPPIDTracker.h"
 #import "XMPP.h"
 #import "XMPPLogging.h"
+#import <objc/runtime.h>
+#import <pthread.h>
 
 #if ! __has_feature(objc_arc)
 #warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
@@ -16,8 +18,19 @@ static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN;
 
 #define AssertProperQueue() NSAssert(dispatch_get_specific(queueTag), @"Invoked on incorrect queue")
 
+// Timeouts are tracked in a hashed timing wheel, driven by a single dispatch timer.
+// The resolution is the duration of a single tick (timeouts are rounded up to the next tick).
+// Timeouts longer than (slots * resolution) simply wrap around the wheel.
+#define TIMER_WHEEL_SLOTS       512
+#define TIMER_WHEEL_RESOLUTION  0.1
+
+// The number of shards used by XMPPConcurrentIDTracker (must be a power of 2)
+#define CONCURRENT_TRACKER_SHARDS 16
+
 const NSTimeInterval XMPPIDTrackerTimeoutNone = -1;
 
+@class XMPPIDTrackerTimerWheel;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark -
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -25,6 +38,51 @@ const NSTimeInterval XMPPIDTrackerTimeoutNone = -1;
 @interface XMPPIDTracker ()
 {
 	void *queueTag;
+	
+	XMPPIDTrackerTimerWheel *timerWheel;
+}
+
+@end
+
+/**
+ * Rather than creating a dispatch timer per tracking info,
+ * the tracker schedules the timeouts of all its XMPPBasicTrackingInfo objects in a timing wheel.
+ * 
+ * Each slot of the wheel is an intrusive doubly-linked list of tracking infos,
+ * so adding and cancelling a timeout are both O(1).
+ * The wheel holds a strong reference to every scheduled info (just like the dispatch timer used to).
+ * 
+ * The wheel is only used from within the tracker's queue.
+**/
+@interface XMPPIDTrackerTimerWheel : NSObject
+{
+	dispatch_source_t timer;
+	BOOL timerArmed;
+	
+	__strong XMPPBasicTrackingInfo *slots[TIMER_WHEEL_SLOTS];
+	NSUInteger count;
+	
+	uint64_t processedTick;
+}
+
+- (id)initWithDispatchQueue:(dispatch_queue_t)queue;
+
+- (void)addTrackingInfo:(XMPPBasicTrackingInfo *)info;
+- (void)removeTrackingInfo:(XMPPBasicTrackingInfo *)info;
+
+- (void)advance;
+
+@end
+
+@interface XMPPBasicTrackingInfo ()
+{
+@public
+	
+	// Timer wheel bookkeeping (only valid while timerWheel is non-nil)
+	__unsafe_unretained XMPPIDTrackerTimerWheel *timerWheel;
+	uint64_t expirationTick;
+	XMPPBasicTrackingInfo *wheelNext;
+	__unsafe_unretained XMPPBasicTrackingInfo *wheelPrev;
 }
 
 @end
@@ -131,7 +189,7 @@ const NSTimeInterval XMPPIDTrackerTimeoutNone = -1;
 	dict[elementID] = trackingInfo;
 	
 	[trackingInfo setElementID:elementID];
-	[trackingInfo createTimerWithDispatchQueue:queue];
+	[self scheduleTimeoutForTrackingInfo:trackingInfo];
 }
 
 - (void)addElement:(XMPPElement *)element trackingInfo:(id <XMPPTrackingInfo>)trackingInfo
@@ -144,7 +202,44 @@ const NSTimeInterval XMPPIDTrackerTimeoutNone = -1;
 	
 	[trackingInfo setElementID:[element elementID]];
     [trackingInfo setElement:element];
-	[trackingInfo createTimerWithDispatchQueue:queue];
+	[self scheduleTimeoutForTrackingInfo:trackingInfo];
+}
+
+- (void)scheduleTimeoutForTrackingInfo:(id <XMPPTrackingInfo>)trackingInfo
+{
+	// XMPPBasicTrackingInfo (and subclasses that don't provide their own timer) go into the timer wheel.
+	// Anything else is asked to create its own timer, as it always has been.
+	
+	static IMP basicCreateTimerIMP;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		basicCreateTimerIMP = class_getMethodImplementation([XMPPBasicTrackingInfo class],
+		                                                     @selector(createTimerWithDispatchQueue:));
+	});
+	
+	BOOL usesTimerWheel = NO;
+	
+	if ([trackingInfo timeout] > 0.0 && [trackingInfo isKindOfClass:[XMPPBasicTrackingInfo class]])
+	{
+		IMP createTimerIMP = class_getMethodImplementation(object_getClass(trackingInfo),
+		                                                   @selector(createTimerWithDispatchQueue:));
+		
+		usesTimerWheel = (createTimerIMP == basicCreateTimerIMP);
+	}
+	
+	if (usesTimerWheel)
+	{
+		if (timerWheel == nil)
+		{
+			timerWheel = [[XMPPIDTrackerTimerWheel alloc] initWithDispatchQueue:queue];
+		}
+		
+		[timerWheel addTrackingInfo:(XMPPBasicTrackingInfo *)trackingInfo];
+	}
+	else
+	{
+		[trackingInfo createTimerWithDispatchQueue:queue];
+	}
 }
 
 - (BOOL)invokeForID:(NSString *)elementID withObject:(id)obj
@@ -168,10 +263,13 @@ const NSTimeInterval XMPPIDTrackerTimeoutNone = -1;
 }
 
 - (BOOL)invokeForElement:(XMPPElement *)element withObject:(id)obj
+{
+	return [self invokeForElement:element elementID:[element elementID] withObject:obj];
+}
+
+- (BOOL)invokeForElement:(XMPPElement *)element elementID:(NSString *)elementID withObject:(id)obj
 {
     AssertProperQueue();
-    
-	NSString *elementID = [element elementID];
 	
 	if ([elementID length] == 0) return NO;
 	
@@ -192,14 +290,14 @@ const NSTimeInterval XMPPIDTrackerTimeoutNone = -1;
         
         if(!valid)
         {
-            XMPPLogError(@"%s: Element with ID %@ cannot be validated.", __FILE__ , [element elementID]);
+            XMPPLogError(@"%s: Element with ID %@ cannot be validated.", __FILE__ , elementID);
         }
         
         if (valid)
         {
             [info invokeWithObject:obj];
             [info cancelTimer];
-            [dict removeObjectForKey:[element elementID]];
+            [dict removeObjectForKey:elementID];
             
             return YES;
         }
@@ -319,6 +417,11 @@ const NSTimeInterval XMPPIDTrackerTimeoutNone = -1;
 
 - (void)cancelTimer
 {
+	if (timerWheel)
+	{
+		[timerWheel removeTrackingInfo:self];
+	}
+	
 	if (timer)
 	{
 		dispatch_source_cancel(timer);
@@ -345,3 +448,519 @@ const NSTimeInterval XMPPIDTrackerTimeoutNone = -1;
 }
 
 @end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPIDTrackerTimerWheel
+
+static uint64_t XMPPIDTrackerCurrentTick(void)
+{
+	// The systemUptime isn't affected by changes to the system clock.
+	return (uint64_t)([[NSProcessInfo processInfo] systemUptime] / TIMER_WHEEL_RESOLUTION);
+}
+
+- (id)initWithDispatchQueue:(dispatch_queue_t)queue
+{
+	if ((self = [super init]))
+	{
+		timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, queue);
+		
+		__weak id weakSelf = self;
+		dispatch_source_set_event_handler(timer, ^{ @autoreleasepool {
+			
+			[weakSelf advance];
+		}});
+		
+		dispatch_source_set_timer(timer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+		dispatch_resume(timer);
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	dispatch_source_cancel(timer);
+	#if !OS_OBJECT_USE_OBJC
+	dispatch_release(timer);
+	#endif
+	
+	// Unlink the lists iteratively (releasing a long chain recursively could exhaust the stack).
+	
+	for (NSUInteger i = 0; i < TIMER_WHEEL_SLOTS; i++)
+	{
+		XMPPBasicTrackingInfo *info = slots[i];
+		slots[i] = nil;
+		
+		while (info)
+		{
+			XMPPBasicTrackingInfo *next = info->wheelNext;
+			
+			info->timerWheel = nil;
+			info->wheelNext = nil;
+			info->wheelPrev = nil;
+			
+			info = next;
+		}
+	}
+}
+
+- (void)armTimer
+{
+	// Catch up to the present (nothing is scheduled, so there's nothing to fire).
+	processedTick = XMPPIDTrackerCurrentTick();
+	
+	uint64_t interval = (uint64_t)(TIMER_WHEEL_RESOLUTION * NSEC_PER_SEC);
+	dispatch_time_t tt = dispatch_time(DISPATCH_TIME_NOW, interval);
+	
+	dispatch_source_set_timer(timer, tt, interval, interval / 10);
+	timerArmed = YES;
+}
+
+- (void)disarmTimer
+{
+	dispatch_source_set_timer(timer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+	timerArmed = NO;
+}
+
+- (void)addTrackingInfo:(XMPPBasicTrackingInfo *)info
+{
+	NSAssert(info->timerWheel == nil, @"Tracking info is already scheduled");
+	
+	if (!timerArmed)
+	{
+		[self armTimer];
+	}
+	
+	// Round up, so a timeout never fires early.
+	
+	NSTimeInterval expiration = [[NSProcessInfo processInfo] systemUptime] + [info timeout];
+	uint64_t tick = (uint64_t)ceil(expiration / TIMER_WHEEL_RESOLUTION);
+	
+	info->expirationTick = MAX(tick, processedTick + 1);
+	info->timerWheel = self;
+	
+	NSUInteger slot = (NSUInteger)(info->expirationTick % TIMER_WHEEL_SLOTS);
+	
+	info->wheelPrev = nil;
+	info->wheelNext = slots[slot];
+	
+	if (slots[slot])
+		slots[slot]->wheelPrev = info;
+	
+	slots[slot] = info;
+	count++;
+}
+
+- (void)removeTrackingInfo:(XMPPBasicTrackingInfo *)info
+{
+	if (info->timerWheel != self) return;
+	
+	// The info may be released as a result of unlinking it.
+	XMPPBasicTrackingInfo *strongInfo = info;
+	
+	NSUInteger slot = (NSUInteger)(strongInfo->expirationTick % TIMER_WHEEL_SLOTS);
+	
+	if (strongInfo->wheelPrev)
+		strongInfo->wheelPrev->wheelNext = strongInfo->wheelNext;
+	else
+		slots[slot] = strongInfo->wheelNext;
+	
+	if (strongInfo->wheelNext)
+		strongInfo->wheelNext->wheelPrev = strongInfo->wheelPrev;
+	
+	strongInfo->timerWheel = nil;
+	strongInfo->wheelNext = nil;
+	strongInfo->wheelPrev = nil;
+	
+	count--;
+	
+	if (count == 0 && timerArmed)
+	{
+		[self disarmTimer];
+	}
+}
+
+- (void)advance
+{
+	uint64_t currentTick = XMPPIDTrackerCurrentTick();
+	if (currentTick <= processedTick) return;
+	
+	// Visit every slot that has passed since the last time we were here.
+	// If the timer was delayed by more than an entire revolution, that's simply every slot.
+	
+	uint64_t numTicks = MIN(currentTick - processedTick, (uint64_t)TIMER_WHEEL_SLOTS);
+	
+	NSMutableArray *expired = nil;
+	
+	for (uint64_t i = 1; i <= numTicks; i++)
+	{
+		NSUInteger slot = (NSUInteger)((processedTick + i) % TIMER_WHEEL_SLOTS);
+		
+		for (XMPPBasicTrackingInfo *info = slots[slot]; info; info = info->wheelNext)
+		{
+			if (info->expirationTick <= currentTick)
+			{
+				if (expired == nil)
+					expired = [NSMutableArray array];
+				
+				[expired addObject:info];
+			}
+		}
+	}
+	
+	processedTick = currentTick;
+	
+	// Invoking a tracking info may cancel others (e.g. via removeID: or removeAllIDs),
+	// so check each one is still scheduled before firing it.
+	
+	for (XMPPBasicTrackingInfo *info in expired)
+	{
+		if (info->timerWheel == self)
+		{
+			[self removeTrackingInfo:info];
+			[info invokeWithObject:nil];
+		}
+	}
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark -
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+@implementation XMPPConcurrentIDTracker
+{
+	__weak XMPPStream *xmppStream;
+	dispatch_queue_t queue;
+	void *queueTag;
+	
+	pthread_mutex_t shardLocks[CONCURRENT_TRACKER_SHARDS];
+	CFMutableDictionaryRef shards[CONCURRENT_TRACKER_SHARDS]; // elementID -> trackingInfo
+}
+
+- (id)init
+{
+	// You must use initWithDispatchQueue or initWithStream:dispatchQueue:
+	return nil;
+}
+
+- (id)initWithDispatchQueue:(dispatch_queue_t)aQueue
+{
+	return [self initWithStream:nil dispatchQueue:aQueue];
+}
+
+- (id)initWithStream:(XMPPStream *)stream dispatchQueue:(dispatch_queue_t)aQueue
+{
+	NSParameterAssert(aQueue != NULL);
+	
+	if ((self = [super init]))
+	{
+		xmppStream = stream;
+		
+		queue = aQueue;
+		
+		queueTag = &queueTag;
+		dispatch_queue_set_specific(queue, queueTag, queueTag, NULL);
+		
+#if !OS_OBJECT_USE_OBJC
+		dispatch_retain(queue);
+#endif
+		
+		for (NSUInteger i = 0; i < CONCURRENT_TRACKER_SHARDS; i++)
+		{
+			pthread_mutex_init(&shardLocks[i], NULL);
+			shards[i] = CFDictionaryCreateMutable(NULL, 0, &kCFTypeDictionaryKeyCallBacks,
+			                                               &kCFTypeDictionaryValueCallBacks);
+		}
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	for (NSUInteger i = 0; i < CONCURRENT_TRACKER_SHARDS; i++)
+	{
+		CFRelease(shards[i]);
+		pthread_mutex_destroy(&shardLocks[i]);
+	}
+	
+	// The queue belongs to the caller, and may outlive us.
+	// Remove our key, so a later object allocated at this address doesn't appear to be on its own queue.
+	dispatch_queue_set_specific(queue, queueTag, NULL, NULL);
+	
+	#if !OS_OBJECT_USE_OBJC
+	dispatch_release(queue);
+	#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Shards
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline NSUInteger XMPPConcurrentIDTrackerShardIndex(NSString *elementID)
+{
+	// Mix the bits a little, as string hashes aren't necessarily well distributed in the low bits
+	NSUInteger hash = [elementID hash];
+	hash ^= (hash >> 16);
+	hash ^= (hash >> 7);
+	
+	return hash & (CONCURRENT_TRACKER_SHARDS - 1);
+}
+
+- (void)setTrackingInfo:(id <XMPPTrackingInfo>)trackingInfo forID:(NSString *)elementID
+{
+	NSUInteger index = XMPPConcurrentIDTrackerShardIndex(elementID);
+	
+	pthread_mutex_lock(&shardLocks[index]);
+	CFDictionarySetValue(shards[index], (__bridge const void *)elementID, (__bridge const void *)trackingInfo);
+	pthread_mutex_unlock(&shardLocks[index]);
+}
+
+- (id <XMPPTrackingInfo>)trackingInfoForID:(NSString *)elementID
+{
+	NSUInteger index = XMPPConcurrentIDTrackerShardIndex(elementID);
+	
+	pthread_mutex_lock(&shardLocks[index]);
+	id <XMPPTrackingInfo> info = (__bridge id <XMPPTrackingInfo>)CFDictionaryGetValue(shards[index],
+	                                                                                  (__bridge const void *)elementID);
+	pthread_mutex_unlock(&shardLocks[index]);
+	
+	return info;
+}
+
+/**
+ * Atomically removes the tracking info for the given ID, and returns it.
+ * 
+ * If expectedInfo is non-nil, the tracking info is only removed if it's the expected one.
+ * This prevents a stale claim (e.g. a timeout) from removing a newer tracking info that reused the same ID.
+**/
+- (id <XMPPTrackingInfo>)claimTrackingInfoForID:(NSString *)elementID expectedInfo:(id <XMPPTrackingInfo>)expectedInfo
+{
+	NSUInteger index = XMPPConcurrentIDTrackerShardIndex(elementID);
+	id <XMPPTrackingInfo> info = nil;
+	
+	pthread_mutex_lock(&shardLocks[index]);
+	{
+		const void *value = CFDictionaryGetValue(shards[index], (__bridge const void *)elementID);
+		
+		if (value && (expectedInfo == nil || value == (__bridge const void *)expectedInfo))
+		{
+			info = (__bridge id <XMPPTrackingInfo>)value; // Retained (strong local) before removal
+			CFDictionaryRemoveValue(shards[index], (__bridge const void *)elementID);
+		}
+	}
+	pthread_mutex_unlock(&shardLocks[index]);
+	
+	return info;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Adding
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)addID:(NSString *)elementID target:(id)target selector:(SEL)selector timeout:(NSTimeInterval)timeout
+{
+	XMPPBasicTrackingInfo *trackingInfo;
+	trackingInfo = [[XMPPBasicTrackingInfo alloc] initWithTarget:target selector:selector timeout:timeout];
+	
+	[self addID:elementID trackingInfo:trackingInfo];
+}
+
+- (void)addElement:(XMPPElement *)element target:(id)target selector:(SEL)selector timeout:(NSTimeInterval)timeout
+{
+	XMPPBasicTrackingInfo *trackingInfo;
+	trackingInfo = [[XMPPBasicTrackingInfo alloc] initWithTarget:target selector:selector timeout:timeout];
+	
+	[self addElement:element trackingInfo:trackingInfo];
+}
+
+- (void)addID:(NSString *)elementID
+        block:(void (^)(id obj, id <XMPPTrackingInfo> info))block
+      timeout:(NSTimeInterval)timeout
+{
+	XMPPBasicTrackingInfo *trackingInfo;
+	trackingInfo = [[XMPPBasicTrackingInfo alloc] initWithBlock:block timeout:timeout];
+	
+	[self addID:elementID trackingInfo:trackingInfo];
+}
+
+- (void)addElement:(XMPPElement *)element
+             block:(void (^)(id obj, id <XMPPTrackingInfo> info))block
+           timeout:(NSTimeInterval)timeout
+{
+	XMPPBasicTrackingInfo *trackingInfo;
+	trackingInfo = [[XMPPBasicTrackingInfo alloc] initWithBlock:block timeout:timeout];
+	
+	[self addElement:element trackingInfo:trackingInfo];
+}
+
+- (void)addID:(NSString *)elementID trackingInfo:(id <XMPPTrackingInfo>)trackingInfo
+{
+	if ([elementID length] == 0) return;
+	
+	elementID = [elementID copy];
+	
+	[trackingInfo setElementID:elementID];
+	[self setTrackingInfo:trackingInfo forID:elementID];
+	[self scheduleTimeoutForTrackingInfo:trackingInfo];
+}
+
+- (void)addElement:(XMPPElement *)element trackingInfo:(id <XMPPTrackingInfo>)trackingInfo
+{
+	NSString *elementID = [[element elementID] copy];
+	
+	if ([elementID length] == 0) return;
+	
+	[trackingInfo setElementID:elementID];
+	[trackingInfo setElement:element];
+	[self setTrackingInfo:trackingInfo forID:elementID];
+	[self scheduleTimeoutForTrackingInfo:trackingInfo];
+}
+
+- (void)scheduleTimeoutForTrackingInfo:(id <XMPPTrackingInfo>)trackingInfo
+{
+	NSTimeInterval timeout = [trackingInfo timeout];
+	if (timeout <= 0.0) return;
+	
+	// The timeout can't be cancelled, but that's fine.
+	// If the ID has already been claimed by then, the claim below simply fails.
+	// And since we only hold weak references, the tracking info isn't kept alive until then.
+	
+	NSString *elementID = [trackingInfo elementID];
+	
+	__weak XMPPConcurrentIDTracker *weakSelf = self;
+	__weak id <XMPPTrackingInfo> weakInfo = trackingInfo;
+	
+	dispatch_time_t when = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(timeout * NSEC_PER_SEC));
+	dispatch_after(when, queue, ^{ @autoreleasepool {
+		
+		XMPPConcurrentIDTracker *strongSelf = weakSelf;
+		id <XMPPTrackingInfo> expectedInfo = weakInfo;
+		
+		if (strongSelf == nil || expectedInfo == nil) return;
+		
+		id <XMPPTrackingInfo> info = [strongSelf claimTrackingInfoForID:elementID expectedInfo:expectedInfo];
+		
+		[info invokeWithObject:nil];
+	}});
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Invoking
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (void)invokeTrackingInfo:(id <XMPPTrackingInfo>)info withObject:(id)obj
+{
+	if (dispatch_get_specific(queueTag))
+	{
+		[info invokeWithObject:obj];
+	}
+	else
+	{
+		dispatch_async(queue, ^{ @autoreleasepool {
+			
+			[info invokeWithObject:obj];
+		}});
+	}
+}
+
+- (BOOL)invokeForID:(NSString *)elementID withObject:(id)obj
+{
+	if ([elementID length] == 0) return NO;
+	
+	id <XMPPTrackingInfo> info = [self claimTrackingInfoForID:elementID expectedInfo:nil];
+	if (info == nil) return NO;
+	
+	[self invokeTrackingInfo:info withObject:obj];
+	return YES;
+}
+
+- (BOOL)invokeForElement:(XMPPElement *)element withObject:(id)obj
+{
+	return [self invokeForElement:element elementID:[element elementID] withObject:obj];
+}
+
+- (BOOL)invokeForElement:(XMPPElement *)element elementID:(NSString *)elementID withObject:(id)obj
+{
+	if ([elementID length] == 0) return NO;
+	
+	id <XMPPTrackingInfo> info = [self trackingInfoForID:elementID];
+	if (info == nil) return NO;
+	
+	XMPPStream *stream = xmppStream;
+	
+	if (stream && [element isKindOfClass:[XMPPIQ class]] && [[info element] isKindOfClass:[XMPPIQ class]])
+	{
+		XMPPIQ *iq = (XMPPIQ *)element;
+		
+		if ([iq isResultIQ] || [iq isErrorIQ])
+		{
+			if (![stream isValidResponseElement:iq forRequestElement:[info element]])
+			{
+				XMPPLogError(@"%s: Element with ID %@ cannot be validated.", __FILE__ , elementID);
+				return NO;
+			}
+		}
+	}
+	
+	// The validation happened outside the lock, so only claim the tracking info we actually validated.
+	
+	if ([self claimTrackingInfoForID:elementID expectedInfo:info] == nil) return NO;
+	
+	[self invokeTrackingInfo:info withObject:obj];
+	return YES;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Management
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)isTrackingID:(NSString *)elementID
+{
+	if ([elementID length] == 0) return NO;
+	
+	return ([self trackingInfoForID:elementID] != nil);
+}
+
+- (NSUInteger)numberOfIDs
+{
+	NSUInteger count = 0;
+	
+	for (NSUInteger i = 0; i < CONCURRENT_TRACKER_SHARDS; i++)
+	{
+		pthread_mutex_lock(&shardLocks[i]);
+		count += CFDictionaryGetCount(shards[i]);
+		pthread_mutex_unlock(&shardLocks[i]);
+	}
+	
+	return count;
+}
+
+- (void)removeID:(NSString *)elementID
+{
+	if ([elementID length] == 0) return;
+	
+	[self claimTrackingInfoForID:elementID expectedInfo:nil];
+}
+
+- (void)removeAllIDs
+{
+	for (NSUInteger i = 0; i < CONCURRENT_TRACKER_SHARDS; i++)
+	{
+		pthread_mutex_lock(&shardLocks[i]);
+		
+		// Release the tracking infos outside the lock,
+		// in case releasing one triggers something (e.g. a dealloc) that calls back into the tracker.
+		CFDictionaryRef removed = CFDictionaryCreateCopy(NULL, shards[i]);
+		CFDictionaryRemoveAllValues(shards[i]);
+		
+		pthread_mutex_unlock(&shardLocks[i]);
+		
+		CFRelease(removed);
+	}
+}
+
+@end
@@ -1,6 +1,185 @@
 #import "XMPPStringPrep.h"
 #import "stringprep.h"
 
+#if defined(__SSE2__)
+  #import <emmintrin.h>
+  #define XMPP_STRINGPREP_SSE2 1
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+  #import <arm_neon.h>
+  #define XMPP_STRINGPREP_NEON 1
+#endif
+
+/**
+ * Almost every JID we encounter is plain ASCII, for which the stringprep profiles are trivial:
+ * 
+ * - Printable ASCII characters are all assigned, are unaffected by NFKC, and have no bidi concerns.
+ * - Nodeprep and nameprep case fold 'A'-'Z' to 'a'-'z'. Resourceprep doesn't map them at all.
+ * - Nodeprep additionally prohibits the characters: " & ' / : < > @
+ * 
+ * So for input consisting solely of these characters, we can skip libidn (and its table walks) entirely.
+ * Anything else (spaces, control characters, non-ASCII characters, prohibited characters)
+ * is handed to libidn, which remains the authority on what's valid.
+**/
+
+#define XMPP_STRINGPREP_ASCII_MAX_LENGTH 1023
+
+static inline BOOL XMPPStringPrepIsNodeProhibited(char c)
+{
+	return (c == '"') || (c == '&') || (c == '\'') || (c == '/') ||
+	       (c == ':') || (c == '<') || (c == '>')  || (c == '@');
+}
+
+/**
+ * Copies the given ASCII bytes to dst, case folding them if requested.
+ * 
+ * Returns NO if the input contains anything other than printable ASCII characters (excluding space),
+ * or contains characters prohibited by nodeprep (if requested).
+ * In this case the input must be prepped by libidn.
+**/
+static BOOL XMPPStringPrepASCII(const char *src, char *dst, NSUInteger length,
+                                BOOL foldCase, BOOL nodeprep, BOOL *changedPtr)
+{
+	BOOL changed = NO;
+	NSUInteger i = 0;
+	
+#if XMPP_STRINGPREP_SSE2
+	
+	const __m128i printableMin = _mm_set1_epi8(0x21);
+	const __m128i del          = _mm_set1_epi8(0x7F);
+	const __m128i upperMin     = _mm_set1_epi8('A' - 1);
+	const __m128i upperMax     = _mm_set1_epi8('Z' + 1);
+	const __m128i caseBit      = _mm_set1_epi8(0x20);
+	
+	for (; i + 16 <= length; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		
+		// Signed comparison, so bytes >= 0x80 (non-ASCII) are also less than 0x21
+		__m128i special = _mm_or_si128(_mm_cmplt_epi8(v, printableMin), _mm_cmpeq_epi8(v, del));
+		
+		if (nodeprep)
+		{
+			special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+			special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8('&')));
+			special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+			special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+			special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8(':')));
+			special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8('<')));
+			special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8('>')));
+			special = _mm_or_si128(special, _mm_cmpeq_epi8(v, _mm_set1_epi8('@')));
+		}
+		
+		if (_mm_movemask_epi8(special) != 0) return NO;
+		
+		if (foldCase)
+		{
+			__m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, upperMin), _mm_cmplt_epi8(v, upperMax));
+			
+			if (_mm_movemask_epi8(upper) != 0)
+			{
+				v = _mm_or_si128(v, _mm_and_si128(upper, caseBit));
+				changed = YES;
+			}
+		}
+		
+		_mm_storeu_si128((__m128i *)(dst + i), v);
+	}
+	
+#elif XMPP_STRINGPREP_NEON
+	
+	const uint8x16_t printableMin = vdupq_n_u8(0x21);
+	const uint8x16_t del          = vdupq_n_u8(0x7F);
+	const uint8x16_t upperMin     = vdupq_n_u8('A');
+	const uint8x16_t upperCount   = vdupq_n_u8(26);
+	const uint8x16_t caseBit      = vdupq_n_u8(0x20);
+	
+	for (; i + 16 <= length; i += 16)
+	{
+		uint8x16_t v = vld1q_u8((const uint8_t *)(src + i));
+		
+		uint8x16_t special = vorrq_u8(vcltq_u8(v, printableMin), vcgeq_u8(v, del));
+		
+		if (nodeprep)
+		{
+			special = vorrq_u8(special, vceqq_u8(v, vdupq_n_u8('"')));
+			special = vorrq_u8(special, vceqq_u8(v, vdupq_n_u8('&')));
+			special = vorrq_u8(special, vceqq_u8(v, vdupq_n_u8('\'')));
+			special = vorrq_u8(special, vceqq_u8(v, vdupq_n_u8('/')));
+			special = vorrq_u8(special, vceqq_u8(v, vdupq_n_u8(':')));
+			special = vorrq_u8(special, vceqq_u8(v, vdupq_n_u8('<')));
+			special = vorrq_u8(special, vceqq_u8(v, vdupq_n_u8('>')));
+			special = vorrq_u8(special, vceqq_u8(v, vdupq_n_u8('@')));
+		}
+		
+		uint8x8_t specialAny = vorr_u8(vget_low_u8(special), vget_high_u8(special));
+		if (vget_lane_u64(vreinterpret_u64_u8(specialAny), 0) != 0) return NO;
+		
+		if (foldCase)
+		{
+			uint8x16_t upper = vcltq_u8(vsubq_u8(v, upperMin), upperCount);
+			
+			uint8x8_t upperAny = vorr_u8(vget_low_u8(upper), vget_high_u8(upper));
+			if (vget_lane_u64(vreinterpret_u64_u8(upperAny), 0) != 0)
+			{
+				v = vorrq_u8(v, vandq_u8(upper, caseBit));
+				changed = YES;
+			}
+		}
+		
+		vst1q_u8((uint8_t *)(dst + i), v);
+	}
+	
+#endif
+	
+	for (; i < length; i++)
+	{
+		char c = src[i];
+		
+		if ((c < 0x21) || (c == 0x7F)) return NO; // Includes non-ASCII, as char may be signed
+		if ((unsigned char)c > 0x7F) return NO;    // ...or it may not be
+		
+		if (nodeprep && XMPPStringPrepIsNodeProhibited(c)) return NO;
+		
+		if (foldCase && (c >= 'A') && (c <= 'Z'))
+		{
+			c |= 0x20;
+			changed = YES;
+		}
+		
+		dst[i] = c;
+	}
+	
+	*changedPtr = changed;
+	return YES;
+}
+
+/**
+ * Attempts to prep the given string without libidn.
+ * 
+ * Returns YES, and sets the result, if the string was handled.
+ * Returns NO if the string must be prepped by libidn.
+**/
+static BOOL XMPPStringPrepFastPath(NSString *str, BOOL foldCase, BOOL nodeprep, NSString **resultPtr)
+{
+	NSUInteger length = [str length];
+	if (length > XMPP_STRINGPREP_ASCII_MAX_LENGTH) return NO;
+	
+	char src[XMPP_STRINGPREP_ASCII_MAX_LENGTH + 1];
+	char dst[XMPP_STRINGPREP_ASCII_MAX_LENGTH + 1];
+	
+	// This fails if the string contains any non-ASCII characters
+	if (![str getCString:src maxLength:sizeof(src) encoding:NSASCIIStringEncoding]) return NO;
+	
+	BOOL changed = NO;
+	if (!XMPPStringPrepASCII(src, dst, length, foldCase, nodeprep, &changed)) return NO;
+	
+	if (changed)
+		*resultPtr = [[NSString alloc] initWithBytes:dst length:length encoding:NSASCIIStringEncoding];
+	else
+		*resultPtr = [str copy];
+	
+	return YES;
+}
 
 @implementation XMPPStringPrep
 
@@ -8,6 +187,9 @@
 {
 	if(node == nil) return nil;
 	
+	NSString *result = nil;
+	if (XMPPStringPrepFastPath(node, YES, YES, &result)) return result;
+	
 	// Each allowable portion of a JID MUST NOT be more than 1023 bytes in length.
 	// We make the buffer just big enough to hold a null-terminated string of this length. 
 	char buf[1024];
@@ -23,6 +205,9 @@
 {
 	if(domain == nil) return nil;
 	
+	NSString *result = nil;
+	if (XMPPStringPrepFastPath(domain, YES, NO, &result)) return result;
+	
 	// Each allowable portion of a JID MUST NOT be more than 1023 bytes in length.
 	// We make the buffer just big enough to hold a null-terminated string of this length. 
 	char buf[1024];
@@ -38,6 +223,9 @@
 {
 	if(resource == nil) return nil;
 	
+	NSString *result = nil;
+	if (XMPPStringPrepFastPath(resource, NO, NO, &result)) return result;
+	
 	// Each allowable portion of a JID MUST NOT be more than 1023 bytes in length.
 	// We make the buffer just big enough to hold a null-terminated string of this length. 
 	char buf[1024];
@@ -0,0 +1,41 @@
+#import <Foundation/Foundation.h>
+
+extern NSString *const XMPPZlibCompressionErrorDomain;
+
+/**
+ * This class is a simple wrapper around a pair of zlib streams,
+ * and implements the "zlib" method of XEP-0138: Stream Compression.
+ *
+ * Outgoing data is deflated, and every call is completed with a sync flush (Z_SYNC_FLUSH).
+ * This ensures the remote side can fully decompress each chunk as soon as it arrives,
+ * without having to wait for additional data.
+ *
+ * Incoming data is inflated.
+ * Since the remote side also uses sync flushes, every chunk read from the socket may be decompressed immediately.
+ *
+ * This class is not thread-safe.
+ * It is designed to be used by XMPPStream, within its xmppQueue.
+**/
+@interface XMPPZlibCompression : NSObject
+
+/**
+ * Creates a new compression context.
+ * Returns nil if the underlying zlib streams could not be initialized.
+**/
+- (instancetype)init;
+
+/**
+ * Compresses the given data, completing the output with a sync flush.
+ * Returns nil if an error occurs.
+**/
+- (NSData *)compressData:(NSData *)data;
+
+/**
+ * Decompresses the given data.
+ * Returns nil, and sets the error parameter, if the data is corrupt.
+ *
+ * The errPtr parameter is optional - you may pass nil.
+**/
+- (NSData *)decompressData:(NSData *)data error:(NSError **)errPtr;
+
+@end
@@ -0,0 +1,141 @@
+#import "XMPPZlibCompression.h"
+#import "XMPPLogging.h"
+#import <zlib.h>
+
+#if ! __has_feature(objc_arc)
+#warning This file must be compiled with ARC. Use -fobjc-arc flag (or convert project to ARC).
+#endif
+
+// Log levels: off, error, warn, info, verbose
+// Log flags: trace
+#if DEBUG
+  static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN;
+#else
+  static const int xmppLogLevel = XMPP_LOG_LEVEL_WARN;
+#endif
+
+#define ZLIB_CHUNK_SIZE 4096
+
+NSString *const XMPPZlibCompressionErrorDomain = @"XMPPZlibCompressionErrorDomain";
+
+@implementation XMPPZlibCompression
+{
+	z_stream deflateStream;
+	z_stream inflateStream;
+}
+
+- (instancetype)init
+{
+	if ((self = [super init]))
+	{
+		memset(&deflateStream, 0, sizeof(z_stream));
+		memset(&inflateStream, 0, sizeof(z_stream));
+		
+		if (deflateInit(&deflateStream, Z_DEFAULT_COMPRESSION) != Z_OK)
+		{
+			XMPPLogError(@"%@: Unable to initialize deflate stream: %s", THIS_FILE, deflateStream.msg);
+			return nil;
+		}
+		
+		if (inflateInit(&inflateStream) != Z_OK)
+		{
+			XMPPLogError(@"%@: Unable to initialize inflate stream: %s", THIS_FILE, inflateStream.msg);
+			
+			deflateEnd(&deflateStream);
+			return nil;
+		}
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	deflateEnd(&deflateStream);
+	inflateEnd(&inflateStream);
+}
+
+- (NSData *)compressData:(NSData *)data
+{
+	NSUInteger inLength = [data length];
+	if (inLength == 0) return data;
+	
+	// deflateBound doesn't account for the sync flush marker, so leave a little extra room.
+	NSMutableData *result = [NSMutableData dataWithLength:(deflateBound(&deflateStream, (uLong)inLength) + 16)];
+	NSUInteger outLength = 0;
+	
+	deflateStream.next_in = (Bytef *)[data bytes];
+	deflateStream.avail_in = (uInt)inLength;
+	
+	do
+	{
+		if (outLength == [result length])
+		{
+			[result increaseLengthBy:ZLIB_CHUNK_SIZE];
+		}
+		
+		deflateStream.next_out = (Bytef *)[result mutableBytes] + outLength;
+		deflateStream.avail_out = (uInt)([result length] - outLength);
+		
+		int status = deflate(&deflateStream, Z_SYNC_FLUSH);
+		if (status != Z_OK && status != Z_BUF_ERROR)
+		{
+			XMPPLogError(@"%@: deflate error (%i): %s", THIS_FILE, status, deflateStream.msg);
+			return nil;
+		}
+		
+		outLength = [result length] - deflateStream.avail_out;
+		
+	} while (deflateStream.avail_out == 0);
+	
+	[result setLength:outLength];
+	return result;
+}
+
+- (NSData *)decompressData:(NSData *)data error:(NSError **)errPtr
+{
+	NSUInteger inLength = [data length];
+	if (inLength == 0) return data;
+	
+	// XMPP traffic typically compresses quite well, so start with a generous buffer.
+	NSMutableData *result = [NSMutableData dataWithLength:MAX(inLength * 4, ZLIB_CHUNK_SIZE)];
+	NSUInteger outLength = 0;
+	
+	inflateStream.next_in = (Bytef *)[data bytes];
+	inflateStream.avail_in = (uInt)inLength;
+	
+	do
+	{
+		if (outLength == [result length])
+		{
+			[result increaseLengthBy:MAX(inLength, ZLIB_CHUNK_SIZE)];
+		}
+		
+		inflateStream.next_out = (Bytef *)[result mutableBytes] + outLength;
+		inflateStream.avail_out = (uInt)([result length] - outLength);
+		
+		int status = inflate(&inflateStream, Z_SYNC_FLUSH);
+		if (status != Z_OK && status != Z_BUF_ERROR && status != Z_STREAM_END)
+		{
+			XMPPLogError(@"%@: inflate error (%i): %s", THIS_FILE, status, inflateStream.msg);
+			
+			if (errPtr)
+			{
+				NSString *errMsg = inflateStream.msg ? @(inflateStream.msg) : @"Unable to decompress incoming data";
+				NSDictionary *info = @{NSLocalizedDescriptionKey : errMsg};
+				
+				*errPtr = [NSError errorWithDomain:XMPPZlibCompressionErrorDomain code:status userInfo:info];
+			}
+			return nil;
+		}
+		
+		outLength = [result length] - inflateStream.avail_out;
+		
+		if (status == Z_STREAM_END || status == Z_BUF_ERROR) break;
+		
+	} while (inflateStream.avail_in > 0 || inflateStream.avail_out == 0);
+	
+	[result setLength:outLength];
+	return result;
+}
+
+@end
@@ -0,0 +1,257 @@
+//
+//  XMPPIncomingFileTransferTest.m
+//  XMPPFrameworkTests
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import <CommonCrypto/CommonDigest.h>
+#import <fcntl.h>
+#import "XMPPIncomingFileTransfer.h"
+#import "XMPPConstants.h"
+#import "NSData+XMPP.h"
+
+@interface XMPPIncomingFileTransferTest : XCTestCase <XMPPIncomingFileTransferDelegate>
+
+@property (strong) XMPPStream *stream;
+@property (strong) XMPPIncomingFileTransfer *transfer;
+
+@property (strong) XCTestExpectation *expectation;
+@property (strong) NSError *error;
+@property (strong) NSData *succeededData;
+@property (strong) NSMutableData *chunks;
+@property (assign) unsigned long long progress;
+
+@end
+
+@implementation XMPPIncomingFileTransferTest
+
+- (void)setUp
+{
+    [super setUp];
+
+    self.stream = [[XMPPStream alloc] init];
+
+    self.transfer = [[XMPPIncomingFileTransfer alloc] initWithDispatchQueue:NULL];
+    self.transfer.disableSOCKS5 = YES;
+    [self.transfer addDelegate:self delegateQueue:dispatch_get_main_queue()];
+    [self.transfer activate:self.stream];
+
+    self.chunks = [NSMutableData data];
+    self.progress = 0;
+}
+
+- (void)tearDown
+{
+    [self.transfer removeDelegate:self];
+    [self.transfer deactivate];
+    self.transfer = nil;
+    self.stream = nil;
+
+    [super tearDown];
+}
+
+- (NSData *)randomDataOfLength:(NSUInteger)length
+{
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    arc4random_buf([data mutableBytes], length);
+    return data;
+}
+
+- (NSString *)md5OfData:(NSData *)data
+{
+    unsigned char digest[CC_MD5_DIGEST_LENGTH];
+    CC_MD5([data bytes], (CC_LONG)[data length], digest);
+
+    return [[NSData dataWithBytes:digest length:CC_MD5_DIGEST_LENGTH] xmpp_hexStringValue];
+}
+
+- (XMPPIQ *)offerForData:(NSData *)data hash:(NSString *)hash
+{
+    NSXMLElement *file = [NSXMLElement elementWithName:@"file" xmlns:XMPPSIProfileFileTransferNamespace];
+    [file addAttributeWithName:@"name" stringValue:@"file.bin"];
+    [file addAttributeWithName:@"size" stringValue:[NSString stringWithFormat:@"%lu", (unsigned long)[data length]]];
+    if (hash) {
+        [file addAttributeWithName:@"hash" stringValue:hash];
+    }
+
+    NSXMLElement *feature = [NSXMLElement elementWithName:@"feature" xmlns:XMPPFeatureNegNamespace];
+
+    NSXMLElement *si = [NSXMLElement elementWithName:@"si" xmlns:XMPPSINamespace];
+    [si addAttributeWithName:@"id" stringValue:@"sid1"];
+    [si addAttributeWithName:@"profile" stringValue:XMPPSIProfileFileTransferNamespace];
+    [si addChild:file];
+    [si addChild:feature];
+
+    XMPPIQ *offer = [XMPPIQ iqWithType:@"set" elementID:@"offer1" child:si];
+    [offer addAttributeWithName:@"from" stringValue:@"sender@example.com/phone"];
+
+    return offer;
+}
+
+- (void)receiveIQ:(XMPPIQ *)iq
+{
+    dispatch_sync(self.transfer.moduleQueue, ^{
+        [self.transfer xmppStream:self.stream didReceiveIQ:iq];
+    });
+}
+
+/**
+ * Plays the part of the sender, sending the data in IBB blocks of the given size.
+**/
+- (void)sendData:(NSData *)data blockSize:(NSUInteger)blockSize
+{
+    NSXMLElement *open = [NSXMLElement elementWithName:@"open" xmlns:XMPPIBBNamespace];
+    [open addAttributeWithName:@"sid" stringValue:@"sid1"];
+    [open addAttributeWithName:@"block-size" stringValue:[NSString stringWithFormat:@"%lu", (unsigned long)blockSize]];
+
+    XMPPIQ *openIQ = [XMPPIQ iqWithType:@"set" elementID:@"open1" child:open];
+    [openIQ addAttributeWithName:@"from" stringValue:@"sender@example.com/phone"];
+    [self receiveIQ:openIQ];
+
+    NSUInteger seq = 0;
+    for (NSUInteger offset = 0; offset < [data length]; offset += blockSize)
+    {
+        NSData *block = [data subdataWithRange:NSMakeRange(offset, MIN(blockSize, [data length] - offset))];
+
+        NSXMLElement *dataElem = [NSXMLElement elementWithName:@"data" xmlns:XMPPIBBNamespace];
+        [dataElem addAttributeWithName:@"sid" stringValue:@"sid1"];
+        [dataElem addAttributeWithName:@"seq" stringValue:[NSString stringWithFormat:@"%lu", (unsigned long)seq]];
+        [dataElem setStringValue:[block base64EncodedStringWithOptions:0]];
+
+        XMPPIQ *dataIQ = [XMPPIQ iqWithType:@"set" elementID:[NSString stringWithFormat:@"data%lu", (unsigned long)seq] child:dataElem];
+        [dataIQ addAttributeWithName:@"from" stringValue:@"sender@example.com/phone"];
+        [self receiveIQ:dataIQ];
+
+        seq++;
+    }
+}
+
+- (void)xmppIncomingFileTransfer:(XMPPIncomingFileTransfer *)sender didReceiveDataChunk:(NSData *)chunk
+{
+    [self.chunks appendData:chunk];
+}
+
+- (void)xmppIncomingFileTransfer:(XMPPIncomingFileTransfer *)sender
+          didReceiveDataWithSize:(unsigned long long)receivedSize
+                       totalSize:(unsigned long long)totalSize
+{
+    XCTAssertTrue(receivedSize > self.progress);
+    XCTAssertTrue(receivedSize <= totalSize);
+    self.progress = receivedSize;
+}
+
+- (void)xmppIncomingFileTransfer:(XMPPIncomingFileTransfer *)sender
+              didSucceedWithData:(NSData *)data
+                           named:(NSString *)name
+                          sender:(NSString *)senderJID
+{
+    self.succeededData = data;
+    [self.expectation fulfill];
+}
+
+- (void)xmppIncomingFileTransfer:(XMPPIncomingFileTransfer *)sender didFailWithError:(NSError *)error
+{
+    self.error = error;
+    [self.expectation fulfill];
+}
+
+- (void)testReceiveIntoMemory
+{
+    NSData *data = [self randomDataOfLength:10000];
+    XMPPIQ *offer = [self offerForData:data hash:[self md5OfData:data]];
+
+    self.expectation = [self expectationWithDescription:@"transfer"];
+
+    [self receiveIQ:offer];
+    [self.transfer acceptSIOffer:offer];
+    [self sendData:data blockSize:3072];
+
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    XCTAssertNil(self.error);
+    XCTAssertEqualObjects(self.succeededData, data);
+    XCTAssertEqual(self.progress, (unsigned long long)[data length]);
+}
+
+- (void)testDeliverDataIncrementally
+{
+    NSData *data = [self randomDataOfLength:10000];
+    XMPPIQ *offer = [self offerForData:data hash:nil];
+
+    self.transfer.deliverDataIncrementally = YES;
+    self.expectation = [self expectationWithDescription:@"transfer"];
+
+    [self receiveIQ:offer];
+    [self.transfer acceptSIOffer:offer];
+    [self sendData:data blockSize:1024];
+
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    XCTAssertNil(self.error);
+    XCTAssertNil(self.succeededData);
+    XCTAssertEqualObjects(self.chunks, data);
+}
+
+- (void)testReceiveIntoFileDescriptor
+{
+    NSData *data = [self randomDataOfLength:100000];
+    XMPPIQ *offer = [self offerForData:data hash:[[self md5OfData:data] uppercaseString]];
+
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    int fd = open([path fileSystemRepresentation], O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    XCTAssertTrue(fd >= 0);
+
+    self.expectation = [self expectationWithDescription:@"transfer"];
+
+    [self receiveIQ:offer];
+    [self.transfer acceptSIOffer:offer fileDescriptor:fd];
+    [self sendData:data blockSize:4096];
+
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    close(fd);
+
+    XCTAssertNil(self.error);
+    XCTAssertNil(self.succeededData);
+    XCTAssertEqualObjects([NSData dataWithContentsOfFile:path], data);
+
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testReceiveIntoOutputStream
+{
+    NSData *data = [self randomDataOfLength:20000];
+    XMPPIQ *offer = [self offerForData:data hash:[self md5OfData:data]];
+
+    NSOutputStream *outputStream = [NSOutputStream outputStreamToMemory];
+
+    self.expectation = [self expectationWithDescription:@"transfer"];
+
+    [self receiveIQ:offer];
+    [self.transfer acceptSIOffer:offer outputStream:outputStream];
+    [self sendData:data blockSize:4096];
+
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    XCTAssertNil(self.error);
+    XCTAssertEqualObjects([outputStream propertyForKey:NSStreamDataWrittenToMemoryStreamKey], data);
+}
+
+- (void)testHashMismatchFails
+{
+    NSData *data = [self randomDataOfLength:5000];
+    XMPPIQ *offer = [self offerForData:data hash:[self md5OfData:[self randomDataOfLength:5000]]];
+
+    self.expectation = [self expectationWithDescription:@"transfer"];
+
+    [self receiveIQ:offer];
+    [self.transfer acceptSIOffer:offer];
+    [self sendData:data blockSize:4096];
+
+    [self waitForExpectationsWithTimeout:5.0 handler:nil];
+
+    XCTAssertNotNil(self.error);
+    XCTAssertNil(self.succeededData);
+}
+
+@end
@@ -0,0 +1,379 @@
+//
+//  XMPPOutgoingFileTransferTest.m
+//  XMPPFrameworkTests
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "XMPPOutgoingFileTransfer.h"
+#import "XMPPConstants.h"
+
+/**
+ * A stream that never touches the network. It plays the part of the recipient of an IBB file transfer,
+ * answering every IQ the transfer sends after the simulated round trip time.
+**/
+@interface XMPPIBBLoopbackStream : XMPPStream
+
+@property (strong) XMPPJID *recipientJID;
+@property (weak) XMPPOutgoingFileTransfer *transfer;
+@property (assign) NSTimeInterval roundTripTime;
+
+@property (strong, readonly) NSMutableData *receivedData;
+@property (assign, readonly) BOOL receivedOutOfSequence;
+@property (assign, readonly) NSUInteger maxBlocksInFlight;
+@property (assign, readonly) NSTimeInterval firstBlockTime;
+@property (assign, readonly) NSTimeInterval lastBlockTime;
+
+@end
+
+@implementation XMPPIBBLoopbackStream
+{
+    dispatch_queue_t deliveryQueue;
+    uint16_t nextSeq;
+    NSUInteger blocksInFlight;
+}
+
+- (id)init
+{
+    if ((self = [super init]))
+    {
+        deliveryQueue = dispatch_queue_create("XMPPIBBLoopbackStream", NULL);
+        _receivedData = [NSMutableData data];
+    }
+    return self;
+}
+
+- (BOOL)isConnected
+{
+    return YES;
+}
+
+- (XMPPJID *)myJID
+{
+    return [XMPPJID jidWithString:@"sender@example.com/phone"];
+}
+
+- (void)deliverIQ:(XMPPIQ *)iq afterDelay:(NSTimeInterval)delay acknowledgingBlock:(BOOL)acknowledgingBlock
+{
+    XMPPOutgoingFileTransfer *transfer = self.transfer;
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), deliveryQueue, ^{
+        dispatch_async(transfer.moduleQueue, ^{
+            if (acknowledgingBlock)
+            {
+                @synchronized (self) {
+                    blocksInFlight--;
+                }
+            }
+            [transfer xmppStream:self didReceiveIQ:iq];
+        });
+    });
+}
+
+- (void)receiveData:(NSXMLElement *)data
+{
+    @synchronized (self)
+    {
+        if ([data attributeUnsignedIntegerValueForName:@"seq"] != nextSeq)
+        {
+            _receivedOutOfSequence = YES;
+        }
+        nextSeq++;
+
+        NSData *decoded = [[NSData alloc] initWithBase64EncodedString:[data stringValue] options:0];
+        [_receivedData appendData:decoded];
+
+        NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+        if (_firstBlockTime == 0) _firstBlockTime = now;
+        _lastBlockTime = now;
+    }
+}
+
+- (void)sendElement:(NSXMLElement *)element
+{
+    if ([element isKindOfClass:[XMPPMessage class]])
+    {
+        [self receiveData:[element elementForName:@"data" xmlns:XMPPIBBNamespace]];
+
+        // Tell the transfer the message has been sent, as the real stream would
+        XMPPOutgoingFileTransfer *transfer = self.transfer;
+        XMPPMessage *message = (XMPPMessage *)element;
+        dispatch_async(transfer.moduleQueue, ^{
+            [transfer xmppStream:self didSendMessage:message];
+        });
+        return;
+    }
+
+    XMPPIQ *iq = [XMPPIQ iqFromElement:element];
+    if (![iq isGetIQ] && ![iq isSetIQ]) return;
+
+    XMPPIQ *result = [XMPPIQ iqWithType:@"result" elementID:[iq elementID]];
+    [result addAttributeWithName:@"from" stringValue:[self.recipientJID full]];
+
+    NSXMLElement *child = [iq childElement];
+
+    if ([[child xmlns] isEqualToString:XMPPDiscoInfoNamespace])
+    {
+        NSXMLElement *query = [NSXMLElement elementWithName:@"query" xmlns:XMPPDiscoInfoNamespace];
+        for (NSString *var in @[XMPPSINamespace, XMPPSIProfileFileTransferNamespace,
+                                XMPPBytestreamsNamespace, XMPPIBBNamespace])
+        {
+            NSXMLElement *feature = [NSXMLElement elementWithName:@"feature"];
+            [feature addAttributeWithName:@"var" stringValue:var];
+            [query addChild:feature];
+        }
+        [result addChild:query];
+    }
+    else if ([[child name] isEqualToString:@"si"])
+    {
+        NSXMLElement *value = [NSXMLElement elementWithName:@"value" stringValue:XMPPIBBNamespace];
+        NSXMLElement *field = [NSXMLElement elementWithName:@"field"];
+        [field addAttributeWithName:@"var" stringValue:@"stream-method"];
+        [field addChild:value];
+        NSXMLElement *x = [NSXMLElement elementWithName:@"x" xmlns:@"jabber:x:data"];
+        [x addAttributeWithName:@"type" stringValue:@"submit"];
+        [x addChild:field];
+        NSXMLElement *feature = [NSXMLElement elementWithName:@"feature" xmlns:XMPPFeatureNegNamespace];
+        [feature addChild:x];
+        NSXMLElement *si = [NSXMLElement elementWithName:@"si" xmlns:XMPPSINamespace];
+        [si addChild:feature];
+        [result addChild:si];
+    }
+    else if ([[child name] isEqualToString:@"data"])
+    {
+        [self receiveData:child];
+
+        @synchronized (self)
+        {
+            blocksInFlight++;
+            _maxBlocksInFlight = MAX(_maxBlocksInFlight, blocksInFlight);
+        }
+
+        [self deliverIQ:result afterDelay:self.roundTripTime acknowledgingBlock:YES];
+        return;
+    }
+
+    [self deliverIQ:result afterDelay:0 acknowledgingBlock:NO];
+}
+
+@end
+
+#pragma mark -
+
+@interface XMPPOutgoingFileTransferTest : XCTestCase <XMPPOutgoingFileTransferDelegate>
+
+@property (strong) XCTestExpectation *expectation;
+@property (strong) NSError *error;
+
+@end
+
+@implementation XMPPOutgoingFileTransferTest
+
+- (NSData *)randomDataOfLength:(NSUInteger)length
+{
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    arc4random_buf([data mutableBytes], length);
+    return data;
+}
+
+/**
+ * Runs a transfer (started by the given block) to completion over a loopback stream.
+ * The outcome is left in self.error.
+**/
+- (XMPPIBBLoopbackStream *)transferWithWindowSize:(NSUInteger)windowSize
+                                         messages:(BOOL)messages
+                                    roundTripTime:(NSTimeInterval)roundTripTime
+                                            start:(BOOL (^)(XMPPOutgoingFileTransfer *transfer, XMPPJID *recipient, NSError **errPtr))start
+{
+    XMPPIBBLoopbackStream *stream = [[XMPPIBBLoopbackStream alloc] init];
+    stream.recipientJID = [XMPPJID jidWithString:@"recipient@example.com/laptop"];
+    stream.roundTripTime = roundTripTime;
+
+    XMPPOutgoingFileTransfer *transfer = [[XMPPOutgoingFileTransfer alloc] initWithDispatchQueue:NULL];
+    transfer.disableSOCKS5 = YES;
+    transfer.ibbWindowSize = windowSize;
+    transfer.shouldUseMessageStanzasForIBB = messages;
+    [transfer addDelegate:self delegateQueue:dispatch_get_main_queue()];
+    [transfer activate:stream];
+    stream.transfer = transfer;
+
+    self.error = nil;
+    self.expectation = [self expectationWithDescription:@"transfer"];
+
+    NSError *error = nil;
+    XCTAssertTrue(start(transfer, stream.recipientJID, &error));
+    XCTAssertNil(error);
+
+    [self waitForExpectationsWithTimeout:60.0 handler:nil];
+
+    [transfer removeDelegate:self];
+    [transfer deactivate];
+
+    return stream;
+}
+
+- (XMPPIBBLoopbackStream *)sendData:(NSData *)data
+                         windowSize:(NSUInteger)windowSize
+                           messages:(BOOL)messages
+                      roundTripTime:(NSTimeInterval)roundTripTime
+{
+    XMPPIBBLoopbackStream *stream =
+        [self transferWithWindowSize:windowSize messages:messages roundTripTime:roundTripTime
+                               start:^BOOL(XMPPOutgoingFileTransfer *transfer, XMPPJID *recipient, NSError **errPtr) {
+        return [transfer sendData:data named:@"file.bin" toRecipient:recipient description:nil error:errPtr];
+    }];
+
+    XCTAssertNil(self.error);
+    XCTAssertEqualObjects(stream.receivedData, data);
+    XCTAssertFalse(stream.receivedOutOfSequence);
+
+    return stream;
+}
+
+- (XMPPIBBLoopbackStream *)sendStreamWithData:(NSData *)data length:(unsigned long long)length
+{
+    return [self transferWithWindowSize:4 messages:NO roundTripTime:0
+                                  start:^BOOL(XMPPOutgoingFileTransfer *transfer, XMPPJID *recipient, NSError **errPtr) {
+        return [transfer sendStream:[NSInputStream inputStreamWithData:data]
+                             length:length
+                              named:@"file.bin"
+                        toRecipient:recipient
+                        description:nil
+                              error:errPtr];
+    }];
+}
+
+- (void)xmppOutgoingFileTransferDidSucceed:(XMPPOutgoingFileTransfer *)sender
+{
+    [self.expectation fulfill];
+}
+
+- (void)xmppOutgoingFileTransfer:(XMPPOutgoingFileTransfer *)sender didFailWithError:(NSError *)error
+{
+    self.error = error;
+    [self.expectation fulfill];
+}
+
+- (void)testStopAndWait
+{
+    XMPPIBBLoopbackStream *stream = [self sendData:[self randomDataOfLength:20000] windowSize:1 messages:NO roundTripTime:0.001];
+
+    XCTAssertEqual(stream.maxBlocksInFlight, 1);
+}
+
+- (void)testWindowedTransfer
+{
+    XMPPIBBLoopbackStream *stream = [self sendData:[self randomDataOfLength:100000] windowSize:8 messages:NO roundTripTime:0.01];
+
+    XCTAssertTrue(stream.maxBlocksInFlight > 1);
+    XCTAssertTrue(stream.maxBlocksInFlight <= 8);
+}
+
+- (void)testMessageStanzas
+{
+    [self sendData:[self randomDataOfLength:100000] windowSize:4 messages:YES roundTripTime:0];
+}
+
+- (void)testEmptyFile
+{
+    [self sendData:[NSData data] windowSize:4 messages:NO roundTripTime:0];
+}
+
+- (void)testFileAtPath
+{
+    NSData *data = [self randomDataOfLength:50000];
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    XCTAssertTrue([data writeToFile:path atomically:YES]);
+
+    XMPPIBBLoopbackStream *stream =
+        [self transferWithWindowSize:4 messages:NO roundTripTime:0
+                               start:^BOOL(XMPPOutgoingFileTransfer *transfer, XMPPJID *recipient, NSError **errPtr) {
+        return [transfer sendFileAtPath:path named:nil toRecipient:recipient description:nil error:errPtr];
+    }];
+
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+
+    XCTAssertNil(self.error);
+    XCTAssertEqualObjects(stream.receivedData, data);
+}
+
+- (void)testMissingFile
+{
+    XMPPOutgoingFileTransfer *transfer = [[XMPPOutgoingFileTransfer alloc] initWithDispatchQueue:NULL];
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+
+    NSError *error = nil;
+    XCTAssertFalse([transfer sendFileAtPath:path
+                                      named:nil
+                                toRecipient:[XMPPJID jidWithString:@"recipient@example.com/laptop"]
+                                description:nil
+                                      error:&error]);
+    XCTAssertNotNil(error);
+}
+
+- (void)testStream
+{
+    NSData *data = [self randomDataOfLength:50000];
+    XMPPIBBLoopbackStream *stream = [self sendStreamWithData:data length:[data length]];
+
+    XCTAssertNil(self.error);
+    XCTAssertEqualObjects(stream.receivedData, data);
+}
+
+- (void)testStreamShorterThanDeclared
+{
+    NSData *data = [self randomDataOfLength:50000];
+    XMPPIBBLoopbackStream *stream = [self sendStreamWithData:data length:[data length] + 1];
+
+    XCTAssertNotNil(self.error);
+    XCTAssertTrue([stream.receivedData length] <= [data length]);
+}
+
+- (void)testStreamLongerThanDeclared
+{
+    NSData *data = [self randomDataOfLength:50000];
+    XMPPIBBLoopbackStream *stream = [self sendStreamWithData:data length:[data length] - 1];
+
+    XCTAssertNotNil(self.error);
+    XCTAssertTrue([stream.receivedData length] < [data length]);
+}
+
+- (void)testThroughputBenchmark
+{
+    // 16 full blocks at the default block-size (4096 base64 characters, or 3072 bytes)
+    NSData *data = [self randomDataOfLength:16 * 3072];
+
+    for (NSNumber *rtt in @[@0.05, @0.2, @0.5])
+    {
+        double stopAndWait = 0;
+
+        for (NSNumber *window in @[@1, @4, @16])
+        {
+            XMPPIBBLoopbackStream *stream = [self sendData:data
+                                                windowSize:[window unsignedIntegerValue]
+                                                  messages:NO
+                                             roundTripTime:[rtt doubleValue]];
+
+            // The last block is acknowledged a round trip after it was sent
+            NSTimeInterval elapsed = stream.lastBlockTime - stream.firstBlockTime + [rtt doubleValue];
+            double throughput = [data length] / elapsed / (1024.0 * 1024.0);
+
+            NSLog(@"IBB (iq) window %2lu, RTT %3.0f ms: %.3f MB/s",
+                  (unsigned long)[window unsignedIntegerValue], [rtt doubleValue] * 1000, throughput);
+
+            if ([window unsignedIntegerValue] == 1)
+                stopAndWait = throughput;
+            else
+                XCTAssertTrue(throughput > stopAndWait * 2);
+        }
+    }
+
+    // Message stanzas aren't acknowledged, so the round trip time doesn't apply
+    NSTimeInterval start = [NSDate timeIntervalSinceReferenceDate];
+    [self sendData:data windowSize:16 messages:YES roundTripTime:0];
+    NSTimeInterval elapsed = [NSDate timeIntervalSinceReferenceDate] - start;
+
+    NSLog(@"IBB (message) window 16: %.3f MB/s", [data length] / elapsed / (1024.0 * 1024.0));
+}
+
+@end
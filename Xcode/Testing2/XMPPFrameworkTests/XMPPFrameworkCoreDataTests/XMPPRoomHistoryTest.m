@@ -0,0 +1,244 @@
+//
+//  XMPPRoomHistoryTest.m
+//  XMPPFrameworkTests
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "XMPPRoom.h"
+
+/**
+ * A storage that records what the room passes to it, in order.
+ * E.g. @[@"history:2", @"message:live"]
+**/
+@interface XMPPRoomHistoryTestStorage : NSObject <XMPPRoomStorage>
+@property (strong) NSMutableArray *events;
+@end
+
+@implementation XMPPRoomHistoryTestStorage
+
+- (id)init
+{
+    if ((self = [super init])) {
+        _events = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (BOOL)configureWithParent:(XMPPRoom *)aParent queue:(dispatch_queue_t)queue
+{
+    return YES;
+}
+
+- (void)handlePresence:(XMPPPresence *)presence room:(XMPPRoom *)room
+{
+}
+
+- (void)handleIncomingMessage:(XMPPMessage *)message room:(XMPPRoom *)room
+{
+    [self.events addObject:[NSString stringWithFormat:@"message:%@", [message body]]];
+}
+
+- (void)handleIncomingMessages:(NSArray *)messages room:(XMPPRoom *)room
+{
+    [self.events addObject:[NSString stringWithFormat:@"history:%lu", (unsigned long)[messages count]]];
+}
+
+- (void)handleOutgoingMessage:(XMPPMessage *)message room:(XMPPRoom *)room
+{
+}
+
+- (void)handleDidLeaveRoom:(XMPPRoom *)room
+{
+}
+
+@end
+
+@interface XMPPRoomHistoryTest : XCTestCase <XMPPRoomDelegate>
+
+@property (strong) XMPPStream *stream;
+@property (strong) XMPPRoom *room;
+@property (strong) XMPPRoomHistoryTestStorage *storage;
+
+@property (strong) dispatch_queue_t delegateQueue;
+@property (strong) NSMutableArray *historyBatches;
+@property (assign) NSUInteger messageCount;
+
+@end
+
+@implementation XMPPRoomHistoryTest
+
+- (void)setUp
+{
+    [super setUp];
+
+    self.stream = [[XMPPStream alloc] init];
+    self.storage = [[XMPPRoomHistoryTestStorage alloc] init];
+
+    self.room = [[XMPPRoom alloc] initWithRoomStorage:self.storage jid:[XMPPJID jidWithString:@"room@muc.example.com"]];
+    [self.room activate:self.stream];
+
+    self.delegateQueue = dispatch_queue_create("XMPPRoomHistoryTest", DISPATCH_QUEUE_SERIAL);
+    [self.room addDelegate:self delegateQueue:self.delegateQueue];
+
+    self.historyBatches = [NSMutableArray array];
+    self.messageCount = 0;
+
+    [self.room joinRoomUsingNickname:@"me" history:nil];
+    [self receivePresence:@"<presence from='room@muc.example.com/me'>"
+                          @"<x xmlns='http://jabber.org/protocol/muc#user'>"
+                          @"<item affiliation='member' role='participant'/><status code='110'/>"
+                          @"</x></presence>"];
+}
+
+- (void)tearDown
+{
+    [self.room removeDelegate:self];
+    [self.room deactivate];
+    self.room = nil;
+    self.storage = nil;
+    self.stream = nil;
+
+    [super tearDown];
+}
+
+- (void)receivePresence:(NSString *)presenceStr
+{
+    XMPPPresence *presence = [XMPPPresence presenceFromElement:[[NSXMLElement alloc] initWithXMLString:presenceStr error:nil]];
+
+    dispatch_sync(self.room.moduleQueue, ^{
+        [self.room xmppStream:self.stream didReceivePresence:presence];
+    });
+}
+
+- (void)receiveMessage:(NSString *)body delayed:(BOOL)delayed
+{
+    XMPPMessage *message = [XMPPMessage messageWithType:@"groupchat"];
+    [message addAttributeWithName:@"from" stringValue:@"room@muc.example.com/alice"];
+    [message addBody:body];
+
+    if (delayed) {
+        NSXMLElement *delay = [NSXMLElement elementWithName:@"delay" xmlns:@"urn:xmpp:delay"];
+        [delay addAttributeWithName:@"stamp" stringValue:@"2015-01-01T00:00:00Z"];
+        [message addChild:delay];
+    }
+
+    dispatch_sync(self.room.moduleQueue, ^{
+        [self.room xmppStream:self.stream didReceiveMessage:message];
+    });
+}
+
+- (void)receiveHistory
+{
+    [self receiveMessage:@"one" delayed:YES];
+    [self receiveMessage:@"two" delayed:YES];
+    [self receiveMessage:@"three" delayed:YES];
+}
+
+/**
+ * Waits for the room and its delegate to process everything queued so far.
+**/
+- (void)flushQueues
+{
+    dispatch_sync(self.room.moduleQueue, ^{});
+    dispatch_sync(self.delegateQueue, ^{});
+}
+
+- (void)xmppRoom:(XMPPRoom *)sender didReceiveMessage:(XMPPMessage *)message fromOccupant:(XMPPJID *)occupantJID
+{
+    self.messageCount++;
+}
+
+- (void)xmppRoom:(XMPPRoom *)sender didReceiveHistoryMessages:(NSArray *)messages
+{
+    [self.historyBatches addObject:messages];
+}
+
+- (void)assertHistoryFlushedOnce
+{
+    XCTAssertEqual(self.historyBatches.count, 1);
+    XCTAssertEqual([self.historyBatches.firstObject count], 3);
+    XCTAssertEqualObjects([[self.historyBatches.firstObject firstObject] body], @"one");
+    XCTAssertEqualObjects([[self.historyBatches.firstObject lastObject] body], @"three");
+}
+
+- (void)testHistoryIsBuffered
+{
+    [self receiveHistory];
+    [self flushQueues];
+
+    // Every message is reported as it arrives, but none is stored yet
+    XCTAssertEqual(self.messageCount, 3);
+    XCTAssertEqual(self.storage.events.count, 0);
+    XCTAssertEqual(self.historyBatches.count, 0);
+}
+
+- (void)testSubjectEndsHistory
+{
+    [self receiveHistory];
+
+    XMPPMessage *subject = [XMPPMessage messageWithType:@"groupchat"];
+    [subject addAttributeWithName:@"from" stringValue:@"room@muc.example.com"];
+    [subject addSubject:@"Topic"];
+
+    dispatch_sync(self.room.moduleQueue, ^{
+        [self.room xmppStream:self.stream didReceiveMessage:subject];
+    });
+
+    [self receiveMessage:@"live" delayed:NO];
+    [self flushQueues];
+
+    XCTAssertEqualObjects(self.storage.events, (@[@"history:3", @"message:live"]));
+    [self assertHistoryFlushedOnce];
+}
+
+- (void)testLiveMessageEndsHistory
+{
+    [self receiveHistory];
+    [self receiveMessage:@"live" delayed:NO];
+
+    // Once the history is over, delayed messages (e.g. offline messages) are stored one at a time
+    [self receiveMessage:@"late" delayed:YES];
+    [self flushQueues];
+
+    XCTAssertEqualObjects(self.storage.events, (@[@"history:3", @"message:live", @"message:late"]));
+    [self assertHistoryFlushedOnce];
+}
+
+- (void)testTimeoutEndsHistory
+{
+    [self receiveHistory];
+
+    [NSThread sleepForTimeInterval:1.5];
+    [self flushQueues];
+
+    XCTAssertEqualObjects(self.storage.events, (@[@"history:3"]));
+    [self assertHistoryFlushedOnce];
+
+    [self receiveMessage:@"late" delayed:YES];
+    [self flushQueues];
+
+    XCTAssertEqualObjects(self.storage.events, (@[@"history:3", @"message:late"]));
+    XCTAssertEqual(self.historyBatches.count, 1);
+}
+
+- (void)testLeaveEndsHistory
+{
+    [self receiveHistory];
+    [self receivePresence:@"<presence from='room@muc.example.com/me' type='unavailable'>"
+                          @"<x xmlns='http://jabber.org/protocol/muc#user'>"
+                          @"<item affiliation='member' role='none'/><status code='110'/>"
+                          @"</x></presence>"];
+    [self flushQueues];
+
+    XCTAssertEqualObjects(self.storage.events, (@[@"history:3"]));
+    [self assertHistoryFlushedOnce];
+
+    // Nothing left to flush when the room is deactivated
+    [self.room deactivate];
+    [self flushQueues];
+
+    XCTAssertEqual(self.historyBatches.count, 1);
+}
+
+@end
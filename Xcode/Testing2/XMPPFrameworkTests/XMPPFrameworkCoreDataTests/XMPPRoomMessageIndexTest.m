@@ -0,0 +1,255 @@
+//
+//  XMPPRoomMessageIndexTest.m
+//  XMPPFrameworkTests
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import <CoreData/CoreData.h>
+#import "XMPPRoomMessageIndex.h"
+#import "XMPPMessage.h"
+#import "XMPPJID.h"
+
+@interface XMPPRoomMessageIndexTest : XCTestCase
+@end
+
+@implementation XMPPRoomMessageIndexTest
+
+- (NSDictionary *)messageWithJID:(NSString *)jidStr
+                            body:(NSString *)body
+                  localTimestamp:(NSDate *)localTimestamp
+                 remoteTimestamp:(NSDate *)remoteTimestamp
+                        stanzaID:(NSString *)stanzaID
+{
+    NSMutableDictionary *message = [NSMutableDictionary dictionary];
+    message[@"jidStr"] = jidStr;
+    message[@"localTimestamp"] = localTimestamp;
+    if (body) message[@"body"] = body;
+    if (remoteTimestamp) message[@"remoteTimestamp"] = remoteTimestamp;
+    if (stanzaID) message[@"stanzaID"] = stanzaID;
+
+    return message;
+}
+
+- (void)testDelayedMessageMatchesRemoteTimestamp
+{
+    XMPPRoomMessageIndex *index = [[XMPPRoomMessageIndex alloc] init];
+    NSDate *stamp = [NSDate dateWithTimeIntervalSinceReferenceDate:400000000];
+
+    [index addMessage:[self messageWithJID:@"room@muc.example.com/alice" body:@"hi"
+                            localTimestamp:stamp remoteTimestamp:stamp stanzaID:nil]];
+
+    XCTAssertEqual(index.count, 1);
+    XCTAssertTrue([index containsMessageWithJID:@"room@muc.example.com/alice" body:@"hi"
+                                remoteTimestamp:stamp stanzaID:nil]);
+
+    // Remote timestamps must match exactly, as with "remoteTimestamp == %@"
+    XCTAssertFalse([index containsMessageWithJID:@"room@muc.example.com/alice" body:@"hi"
+                                 remoteTimestamp:[stamp dateByAddingTimeInterval:0.2] stanzaID:nil]);
+    XCTAssertFalse([index containsMessageWithJID:@"room@muc.example.com/alice" body:@"hi"
+                                 remoteTimestamp:[stamp dateByAddingTimeInterval:30] stanzaID:nil]);
+    XCTAssertFalse([index containsMessageWithJID:@"room@muc.example.com/bob" body:@"hi"
+                                 remoteTimestamp:stamp stanzaID:nil]);
+    XCTAssertFalse([index containsMessageWithJID:@"room@muc.example.com/alice" body:@"hi!"
+                                 remoteTimestamp:stamp stanzaID:nil]);
+    XCTAssertFalse([index containsMessageWithJID:@"room@muc.example.com/alice" body:@"hi"
+                                 remoteTimestamp:nil stanzaID:nil]);
+}
+
+- (void)testLiveMessageMatchesWithinTolerance
+{
+    XMPPRoomMessageIndex *index = [[XMPPRoomMessageIndex alloc] init];
+    NSDate *local = [NSDate dateWithTimeIntervalSinceReferenceDate:400000000];
+
+    [index addMessage:[self messageWithJID:@"room@muc.example.com/alice" body:@"hi"
+                            localTimestamp:local remoteTimestamp:nil stanzaID:nil]];
+
+    XCTAssertTrue([index containsMessageWithJID:@"room@muc.example.com/alice" body:@"hi"
+                                remoteTimestamp:[local dateByAddingTimeInterval:-59] stanzaID:nil]);
+    XCTAssertTrue([index containsMessageWithJID:@"room@muc.example.com/alice" body:@"hi"
+                                remoteTimestamp:[local dateByAddingTimeInterval:60] stanzaID:nil]);
+    XCTAssertFalse([index containsMessageWithJID:@"room@muc.example.com/alice" body:@"hi"
+                                 remoteTimestamp:[local dateByAddingTimeInterval:61] stanzaID:nil]);
+}
+
+- (void)testMessageWithoutBody
+{
+    XMPPRoomMessageIndex *index = [[XMPPRoomMessageIndex alloc] init];
+    NSDate *stamp = [NSDate dateWithTimeIntervalSinceReferenceDate:400000000];
+
+    [index addMessage:[self messageWithJID:@"room@muc.example.com/alice" body:nil
+                            localTimestamp:stamp remoteTimestamp:stamp stanzaID:nil]];
+
+    XCTAssertTrue([index containsMessageWithJID:@"room@muc.example.com/alice" body:nil
+                                remoteTimestamp:stamp stanzaID:nil]);
+
+    // A missing body is not the same as an empty one, as with "body == %@"
+    XCTAssertFalse([index containsMessageWithJID:@"room@muc.example.com/alice" body:@""
+                                 remoteTimestamp:stamp stanzaID:nil]);
+
+    [index addMessage:[self messageWithJID:@"room@muc.example.com/bob" body:@""
+                            localTimestamp:stamp remoteTimestamp:nil stanzaID:nil]];
+
+    XCTAssertTrue([index containsMessageWithJID:@"room@muc.example.com/bob" body:@""
+                                remoteTimestamp:stamp stanzaID:nil]);
+    XCTAssertFalse([index containsMessageWithJID:@"room@muc.example.com/bob" body:nil
+                                 remoteTimestamp:stamp stanzaID:nil]);
+}
+
+- (void)testStanzaID
+{
+    NSString *messageStr = @"<message from='room@muc.example.com/alice' type='groupchat'>"
+                           @"<body>hi</body>"
+                           @"<stanza-id xmlns='urn:xmpp:sid:0' id='spoofed' by='room@muc.example.com/alice'/>"
+                           @"<stanza-id xmlns='urn:xmpp:sid:0' id='abc' by='room@muc.example.com'/>"
+                           @"</message>";
+
+    XMPPMessage *message = [[XMPPMessage alloc] initWithXMLString:messageStr error:nil];
+    XMPPJID *roomJID = [XMPPJID jidWithString:@"room@muc.example.com"];
+
+    XCTAssertEqualObjects([XMPPRoomMessageIndex stanzaIDForMessage:message roomJID:roomJID], @"abc");
+
+    XMPPRoomMessageIndex *index = [[XMPPRoomMessageIndex alloc] init];
+    NSDate *local = [NSDate dateWithTimeIntervalSinceReferenceDate:400000000];
+
+    [index addMessage:[self messageWithJID:@"room@muc.example.com/alice" body:@"hi"
+                            localTimestamp:local remoteTimestamp:nil stanzaID:@"abc"]];
+
+    // Matches by id, even though the timestamp is way off
+    XCTAssertTrue([index containsMessageWithJID:@"room@muc.example.com/alice" body:@"hi"
+                                remoteTimestamp:[local dateByAddingTimeInterval:3600] stanzaID:@"abc"]);
+    XCTAssertFalse([index containsMessageWithJID:@"room@muc.example.com/alice" body:@"hi"
+                                 remoteTimestamp:[local dateByAddingTimeInterval:3600] stanzaID:@"spoofed"]);
+}
+
+- (void)testLoadFromContext
+{
+    // The index is loaded from the stored columns, including the stanzaID, without parsing messageStr
+
+    NSEntityDescription *entity = [[NSEntityDescription alloc] init];
+    entity.name = @"RoomMessage";
+
+    NSMutableArray *properties = [NSMutableArray array];
+    NSDictionary *attributeTypes = @{ @"jidStr"          : @(NSStringAttributeType),
+                                      @"body"            : @(NSStringAttributeType),
+                                      @"localTimestamp"  : @(NSDateAttributeType),
+                                      @"remoteTimestamp" : @(NSDateAttributeType),
+                                      @"messageStr"      : @(NSStringAttributeType),
+                                      @"stanzaID"        : @(NSStringAttributeType),
+                                      @"roomJIDStr"      : @(NSStringAttributeType) };
+    for (NSString *name in attributeTypes)
+    {
+        NSAttributeDescription *attribute = [[NSAttributeDescription alloc] init];
+        attribute.name = name;
+        attribute.attributeType = [attributeTypes[name] unsignedIntegerValue];
+        attribute.optional = YES;
+        [properties addObject:attribute];
+    }
+    entity.properties = properties;
+
+    NSManagedObjectModel *model = [[NSManagedObjectModel alloc] init];
+    model.entities = @[entity];
+
+    NSPersistentStoreCoordinator *psc = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:model];
+    XCTAssertNotNil([psc addPersistentStoreWithType:NSInMemoryStoreType configuration:nil URL:nil options:nil error:nil]);
+
+    NSManagedObjectContext *moc = [[NSManagedObjectContext alloc] init];
+    moc.persistentStoreCoordinator = psc;
+
+    NSDate *stamp = [NSDate dateWithTimeIntervalSinceReferenceDate:400000000];
+
+    NSManagedObject *saved = [[NSManagedObject alloc] initWithEntity:entity insertIntoManagedObjectContext:moc];
+    [saved setValue:@"room@muc.example.com/alice" forKey:@"jidStr"];
+    [saved setValue:@"hi" forKey:@"body"];
+    [saved setValue:stamp forKey:@"localTimestamp"];
+    [saved setValue:stamp forKey:@"remoteTimestamp"];
+    [saved setValue:@"<message/>" forKey:@"messageStr"];
+    [saved setValue:@"abc" forKey:@"stanzaID"];
+    [saved setValue:@"room@muc.example.com" forKey:@"roomJIDStr"];
+
+    NSManagedObject *otherRoom = [[NSManagedObject alloc] initWithEntity:entity insertIntoManagedObjectContext:moc];
+    [otherRoom setValue:@"elsewhere@muc.example.com/alice" forKey:@"jidStr"];
+    [otherRoom setValue:stamp forKey:@"localTimestamp"];
+    [otherRoom setValue:@"def" forKey:@"stanzaID"];
+    [otherRoom setValue:@"elsewhere@muc.example.com" forKey:@"roomJIDStr"];
+
+    XCTAssertTrue([moc save:nil]);
+
+    // An unsaved insert is picked up too
+    NSManagedObject *unsaved = [[NSManagedObject alloc] initWithEntity:entity insertIntoManagedObjectContext:moc];
+    [unsaved setValue:@"room@muc.example.com/bob" forKey:@"jidStr"];
+    [unsaved setValue:@"yo" forKey:@"body"];
+    [unsaved setValue:stamp forKey:@"localTimestamp"];
+    [unsaved setValue:@"room@muc.example.com" forKey:@"roomJIDStr"];
+
+    NSPredicate *predicate = [NSPredicate predicateWithFormat:@"roomJIDStr == %@", @"room@muc.example.com"];
+    XMPPRoomMessageIndex *index = [XMPPRoomMessageIndex indexWithMessagesMatchingPredicate:predicate
+                                                                                    entity:entity
+                                                                                 inContext:moc];
+
+    XCTAssertEqual(index.count, 2);
+    XCTAssertTrue([index containsMessageWithJID:@"room@muc.example.com/alice" body:@"hi"
+                                remoteTimestamp:stamp stanzaID:nil]);
+    XCTAssertTrue([index containsMessageWithJID:@"room@muc.example.com/carol" body:@"other"
+                                remoteTimestamp:stamp stanzaID:@"abc"]);
+    XCTAssertFalse([index containsMessageWithJID:@"room@muc.example.com/carol" body:@"other"
+                                 remoteTimestamp:stamp stanzaID:@"def"]);
+    XCTAssertTrue([index containsMessageWithJID:@"room@muc.example.com/bob" body:@"yo"
+                                remoteTimestamp:stamp stanzaID:nil]);
+}
+
+- (void)testRemoveMessage
+{
+    XMPPRoomMessageIndex *index = [[XMPPRoomMessageIndex alloc] init];
+    NSDate *stamp = [NSDate dateWithTimeIntervalSinceReferenceDate:400000000];
+
+    NSDictionary *delayed = [self messageWithJID:@"room@muc.example.com/alice" body:@"hi"
+                                  localTimestamp:stamp remoteTimestamp:stamp stanzaID:nil];
+    NSDictionary *live = [self messageWithJID:@"room@muc.example.com/bob" body:@"yo"
+                               localTimestamp:stamp remoteTimestamp:nil stanzaID:nil];
+
+    // The same message twice, so removing one still leaves the other
+    [index addMessage:delayed];
+    [index addMessage:delayed];
+    [index addMessage:live];
+
+    [index removeMessage:delayed];
+    [index removeMessage:live];
+    [index removeMessage:live];
+
+    XCTAssertEqual(index.count, 1);
+    XCTAssertTrue([index containsMessageWithJID:@"room@muc.example.com/alice" body:@"hi"
+                                remoteTimestamp:stamp stanzaID:nil]);
+    XCTAssertFalse([index containsMessageWithJID:@"room@muc.example.com/bob" body:@"yo"
+                                 remoteTimestamp:stamp stanzaID:nil]);
+}
+
+- (void)testLookupPerformance
+{
+    // Mimics joining a room with a week's worth of messages stored, and 100 history messages replayed
+
+    XMPPRoomMessageIndex *index = [[XMPPRoomMessageIndex alloc] init];
+
+    for (NSUInteger i = 0; i < 10000; i++)
+    {
+        NSDate *stamp = [NSDate dateWithTimeIntervalSinceReferenceDate:400000000 + (i * 60)];
+        NSString *jidStr = [NSString stringWithFormat:@"room@muc.example.com/user%lu", (unsigned long)(i % 20)];
+        NSString *body = [NSString stringWithFormat:@"message %lu", (unsigned long)i];
+
+        [index addMessage:[self messageWithJID:jidStr body:body
+                                localTimestamp:stamp remoteTimestamp:stamp stanzaID:nil]];
+    }
+
+    [self measureBlock:^{
+        for (NSUInteger i = 9900; i < 10000; i++)
+        {
+            NSDate *stamp = [NSDate dateWithTimeIntervalSinceReferenceDate:400000000 + (i * 60)];
+            NSString *jidStr = [NSString stringWithFormat:@"room@muc.example.com/user%lu", (unsigned long)(i % 20)];
+            NSString *body = [NSString stringWithFormat:@"message %lu", (unsigned long)i];
+
+            XCTAssertTrue([index containsMessageWithJID:jidStr body:body remoteTimestamp:stamp stanzaID:nil]);
+        }
+    }];
+}
+
+@end
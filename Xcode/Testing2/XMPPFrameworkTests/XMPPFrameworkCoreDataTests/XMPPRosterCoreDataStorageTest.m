@@ -0,0 +1,177 @@
+//
+//  XMPPRosterCoreDataStorageTest.m
+//  XMPPFrameworkTests
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "XMPP.h"
+#import "XMPPRosterCoreDataStorage.h"
+
+#define LARGE_ROSTER_SIZE 20000
+
+@interface XMPPRosterCoreDataStorageTest : XCTestCase
+
+@property (strong) XMPPStream *stream;
+@property (strong) XMPPRosterCoreDataStorage *storage;
+
+@end
+
+@implementation XMPPRosterCoreDataStorageTest
+
+- (void)setUp
+{
+    [super setUp];
+
+    self.stream = [[XMPPStream alloc] init];
+    self.stream.myJID = [XMPPJID jidWithString:@"user@example.com/test"];
+
+    self.storage = [[XMPPRosterCoreDataStorage alloc] initWithDatabaseFilename:@"XMPPRosterCoreDataStorageTest.sqlite"
+                                                                 storeOptions:nil];
+    self.storage.autoRemovePreviousDatabaseFile = YES;
+}
+
+- (void)tearDown
+{
+    self.storage = nil;
+    self.stream = nil;
+
+    [super tearDown];
+}
+
+- (NSArray *)rosterItemsWithCount:(NSUInteger)count group:(NSString *)group
+{
+    NSMutableArray *items = [NSMutableArray arrayWithCapacity:count];
+
+    for (NSUInteger i = 0; i < count; i++)
+    {
+        NSXMLElement *item = [NSXMLElement elementWithName:@"item"];
+        [item addAttributeWithName:@"jid" stringValue:[NSString stringWithFormat:@"contact%lu@example.com", (unsigned long)i]];
+        [item addAttributeWithName:@"name" stringValue:[NSString stringWithFormat:@"Contact %lu", (unsigned long)i]];
+        [item addAttributeWithName:@"subscription" stringValue:@"both"];
+        [item addChild:[NSXMLElement elementWithName:@"group" stringValue:group]];
+
+        [items addObject:item];
+    }
+
+    return items;
+}
+
+- (void)populateRosterWithItems:(NSArray *)items
+{
+    [self.storage beginRosterPopulationForXMPPStream:self.stream withVersion:nil];
+    [self.storage handleRosterItems:items xmppStream:self.stream];
+    [self.storage endRosterPopulationForXMPPStream:self.stream];
+
+    // The storage methods are asynchronous.
+    // This synchronous call waits for them to complete (and for the resulting save).
+    [self.storage jidsForXMPPStream:self.stream];
+}
+
+- (unsigned long long)storeFileSize
+{
+    // Without direct access to SQLite, the growth of the database (and its write-ahead log)
+    // serves as a proxy for the number of pages written.
+
+    NSPersistentStore *store = [[self.storage.persistentStoreCoordinator persistentStores] firstObject];
+    NSString *storePath = [[store URL] path];
+
+    unsigned long long size = 0;
+    for (NSString *suffix in @[@"", @"-wal"])
+    {
+        NSString *path = [storePath stringByAppendingString:suffix];
+        size += [[[NSFileManager defaultManager] attributesOfItemAtPath:path error:nil] fileSize];
+    }
+
+    return size;
+}
+
+- (void)testPopulationReconcilesExistingUsers
+{
+    [self populateRosterWithItems:[self rosterItemsWithCount:3 group:@"Friends"]];
+
+    NSXMLElement *updated = [NSXMLElement elementWithName:@"item"];
+    [updated addAttributeWithName:@"jid" stringValue:@"contact1@example.com"];
+    [updated addAttributeWithName:@"name" stringValue:@"Renamed"];
+    [updated addAttributeWithName:@"subscription" stringValue:@"to"];
+
+    NSXMLElement *added = [NSXMLElement elementWithName:@"item"];
+    [added addAttributeWithName:@"jid" stringValue:@"new@example.com"];
+    [added addAttributeWithName:@"subscription" stringValue:@"both"];
+
+    NSArray *items = @[[self rosterItemsWithCount:1 group:@"Friends"][0], updated, added];
+    [self populateRosterWithItems:items];
+
+    NSArray *jids = [[self.storage jidsForXMPPStream:self.stream] valueForKey:@"bare"];
+    NSSet *expected = [NSSet setWithObjects:@"contact0@example.com", @"contact1@example.com", @"new@example.com", nil];
+    XCTAssertEqualObjects([NSSet setWithArray:jids], expected);
+
+    NSString *subscription = nil;
+    NSString *nickname = nil;
+    NSArray *groups = nil;
+    [self.storage getSubscription:&subscription
+                              ask:NULL
+                         nickname:&nickname
+                           groups:&groups
+                           forJID:[XMPPJID jidWithString:@"contact1@example.com"]
+                       xmppStream:self.stream];
+
+    XCTAssertEqualObjects(subscription, @"to");
+    XCTAssertEqualObjects(nickname, @"Renamed");
+    XCTAssertEqual([groups count], 0);
+}
+
+- (void)testRosterPushRemovesUser
+{
+    [self populateRosterWithItems:[self rosterItemsWithCount:2 group:@"Friends"]];
+
+    NSXMLElement *removed = [NSXMLElement elementWithName:@"item"];
+    [removed addAttributeWithName:@"jid" stringValue:@"contact0@example.com"];
+    [removed addAttributeWithName:@"subscription" stringValue:@"remove"];
+
+    [self.storage handleRosterItems:@[removed] xmppStream:self.stream];
+
+    NSArray *jids = [[self.storage jidsForXMPPStream:self.stream] valueForKey:@"bare"];
+    XCTAssertEqualObjects(jids, @[@"contact1@example.com"]);
+}
+
+- (void)testLargeRosterPopulationPerformance
+{
+    NSArray *items = [self rosterItemsWithCount:LARGE_ROSTER_SIZE group:@"Friends"];
+
+    __block NSUInteger saveCount = 0;
+    id observer = [[NSNotificationCenter defaultCenter] addObserverForName:NSManagedObjectContextDidSaveNotification
+                                                                    object:nil
+                                                                     queue:nil
+                                                                usingBlock:^(NSNotification *note) {
+        NSManagedObjectContext *moc = note.object;
+        if (moc.persistentStoreCoordinator == self.storage.persistentStoreCoordinator) {
+            saveCount++;
+        }
+    }];
+
+    // The first iteration populates an empty store (all inserts),
+    // subsequent iterations repopulate an unchanged roster (no writes at all).
+
+    [self measureMetrics:[[self class] defaultPerformanceMetrics] automaticallyStartMeasuring:NO forBlock:^{
+
+        saveCount = 0;
+        unsigned long long sizeBefore = [self storeFileSize];
+
+        [self startMeasuring];
+        [self populateRosterWithItems:items];
+        [self stopMeasuring];
+
+        unsigned long long sizeAfter = [self storeFileSize];
+        unsigned long long growth = (sizeAfter > sizeBefore) ? (sizeAfter - sizeBefore) : 0;
+
+        NSLog(@"Populated %d roster items: %lu save(s), store grew by %llu bytes",
+              LARGE_ROSTER_SIZE, (unsigned long)saveCount, growth);
+    }];
+
+    [[NSNotificationCenter defaultCenter] removeObserver:observer];
+
+    XCTAssertEqual([[self.storage jidsForXMPPStream:self.stream] count], LARGE_ROSTER_SIZE);
+}
+
+@end
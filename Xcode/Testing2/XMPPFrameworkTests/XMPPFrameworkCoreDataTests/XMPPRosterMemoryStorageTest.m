@@ -0,0 +1,236 @@
+//
+//  XMPPRosterMemoryStorageTest.m
+//  XMPPFrameworkTests
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "XMPP.h"
+#import "XMPPRoster.h"
+#import "XMPPRosterMemoryStorage.h"
+
+@interface XMPPRosterMemoryStorageTest : XCTestCase <XMPPRosterMemoryStorageDelegate>
+
+@property (strong) XMPPRosterMemoryStorage *storage;
+@property (strong) XMPPRoster *roster;
+
+@property (strong) NSMutableArray *coalescedChanges;
+@property (strong) XCTestExpectation *coalescedChangeExpectation;
+@property (assign) NSUInteger userDelegateInvocations;
+
+#if !OS_OBJECT_USE_OBJC
+@property (assign) dispatch_queue_t queue;
+#else
+@property (strong) dispatch_queue_t queue;
+#endif
+
+@end
+
+@implementation XMPPRosterMemoryStorageTest
+
+- (void)setUp
+{
+    [super setUp];
+
+    self.queue = dispatch_queue_create("XMPPRosterMemoryStorageTest", NULL);
+    self.storage = [[XMPPRosterMemoryStorage alloc] init];
+    self.roster = [[XMPPRoster alloc] initWithRosterStorage:self.storage dispatchQueue:self.queue];
+}
+
+- (void)tearDown
+{
+    self.roster = nil;
+    self.storage = nil;
+
+#if !OS_OBJECT_USE_OBJC
+    dispatch_release(self.queue);
+#endif
+
+    [super tearDown];
+}
+
+- (NSXMLElement *)itemWithJID:(NSString *)jid name:(NSString *)name subscription:(NSString *)subscription
+{
+    NSXMLElement *item = [NSXMLElement elementWithName:@"item"];
+    [item addAttributeWithName:@"jid" stringValue:jid];
+    if (name) {
+        [item addAttributeWithName:@"name" stringValue:name];
+    }
+    [item addAttributeWithName:@"subscription" stringValue:subscription];
+
+    return item;
+}
+
+- (XMPPPresence *)presenceFrom:(NSString *)jid type:(NSString *)type
+{
+    NSXMLElement *element = [NSXMLElement elementWithName:@"presence"];
+    [element addAttributeWithName:@"from" stringValue:jid];
+    if (type) {
+        [element addAttributeWithName:@"type" stringValue:type];
+    }
+
+    return [XMPPPresence presenceFromElement:element];
+}
+
+- (void)assertIndexesMatchFullSort
+{
+    NSArray *users = [self.storage unsortedUsers];
+
+    NSArray *byName = [[self.storage sortedUsersByName] valueForKey:@"jid"];
+    NSArray *byAvailabilityName = [[self.storage sortedUsersByAvailabilityName] valueForKey:@"jid"];
+    NSArray *available = [[self.storage sortedAvailableUsersByName] valueForKey:@"jid"];
+    NSArray *unavailable = [[self.storage sortedUnavailableUsersByName] valueForKey:@"jid"];
+
+    // Names are unique within these tests, so the expected order is fully determined.
+
+    XCTAssertEqualObjects(byName, [[users sortedArrayUsingSelector:@selector(compareByName:)] valueForKey:@"jid"]);
+    XCTAssertEqualObjects(byAvailabilityName,
+                          [[users sortedArrayUsingSelector:@selector(compareByAvailabilityName:)] valueForKey:@"jid"]);
+    XCTAssertEqualObjects(available,
+                          [[[self.storage unsortedAvailableUsers] sortedArrayUsingSelector:@selector(compareByName:)] valueForKey:@"jid"]);
+    XCTAssertEqualObjects(unavailable,
+                          [[[self.storage unsortedUnavailableUsers] sortedArrayUsingSelector:@selector(compareByName:)] valueForKey:@"jid"]);
+}
+
+- (void)testIndexesFollowRosterAndPresenceChanges
+{
+    dispatch_sync(self.queue, ^{
+        [self.storage beginRosterPopulationForXMPPStream:nil withVersion:nil];
+        [self.storage handleRosterItem:[self itemWithJID:@"carol@example.com" name:@"Carol" subscription:@"both"] xmppStream:nil];
+        [self.storage handleRosterItem:[self itemWithJID:@"alice@example.com" name:@"Alice" subscription:@"both"] xmppStream:nil];
+        [self.storage handleRosterItem:[self itemWithJID:@"bob@example.com" name:@"Bob" subscription:@"both"] xmppStream:nil];
+        [self.storage endRosterPopulationForXMPPStream:nil];
+    });
+
+    [self assertIndexesMatchFullSort];
+    XCTAssertEqual([[self.storage sortedAvailableUsersByName] count], 0);
+
+    dispatch_sync(self.queue, ^{
+        [self.storage handlePresence:[self presenceFrom:@"carol@example.com/phone" type:nil] xmppStream:nil];
+        [self.storage handlePresence:[self presenceFrom:@"bob@example.com/laptop" type:nil] xmppStream:nil];
+    });
+
+    [self assertIndexesMatchFullSort];
+    XCTAssertEqual([[self.storage sortedAvailableUsersByName] count], 2);
+
+    dispatch_sync(self.queue, ^{
+        // Rename (moves within the name indexes), add, remove, and go offline
+        [self.storage handleRosterItem:[self itemWithJID:@"bob@example.com" name:@"Zed" subscription:@"both"] xmppStream:nil];
+        [self.storage handleRosterItem:[self itemWithJID:@"dave@example.com" name:nil subscription:@"to"] xmppStream:nil];
+        [self.storage handleRosterItem:[self itemWithJID:@"alice@example.com" name:nil subscription:@"remove"] xmppStream:nil];
+        [self.storage handlePresence:[self presenceFrom:@"carol@example.com/phone" type:@"unavailable"] xmppStream:nil];
+    });
+
+    [self assertIndexesMatchFullSort];
+    XCTAssertEqual([[self.storage sortedUsersByName] count], 3);
+    XCTAssertEqual([[self.storage sortedAvailableUsersByName] count], 1);
+
+    dispatch_sync(self.queue, ^{
+        [self.storage clearAllResourcesForXMPPStream:nil];
+    });
+
+    [self assertIndexesMatchFullSort];
+    XCTAssertEqual([[self.storage sortedAvailableUsersByName] count], 0);
+}
+
+- (void)xmppRoster:(XMPPRosterMemoryStorage *)sender didChangeWithAddedUsers:(NSSet *)addedUsers
+                                                                updatedUsers:(NSSet *)updatedUsers
+                                                                removedUsers:(NSSet *)removedUsers
+{
+    [self.coalescedChanges addObject:@[[addedUsers valueForKeyPath:@"jid.bare"],
+                                       [updatedUsers valueForKeyPath:@"jid.bare"],
+                                       [removedUsers valueForKeyPath:@"jid.bare"]]];
+    [self.coalescedChangeExpectation fulfill];
+}
+
+- (void)xmppRoster:(XMPPRosterMemoryStorage *)sender didAddUser:(XMPPUserMemoryStorageObject *)user
+{
+    self.userDelegateInvocations++;
+}
+
+- (void)xmppRoster:(XMPPRosterMemoryStorage *)sender didUpdateUser:(XMPPUserMemoryStorageObject *)user
+{
+    self.userDelegateInvocations++;
+}
+
+- (void)xmppRoster:(XMPPRosterMemoryStorage *)sender
+    didAddResource:(XMPPResourceMemoryStorageObject *)resource
+          withUser:(XMPPUserMemoryStorageObject *)user
+{
+    self.userDelegateInvocations++;
+}
+
+- (void)testCoalescedChangeNotifications
+{
+    dispatch_sync(self.queue, ^{
+        [self.storage beginRosterPopulationForXMPPStream:nil withVersion:nil];
+        [self.storage handleRosterItem:[self itemWithJID:@"alice@example.com" name:@"Alice" subscription:@"both"] xmppStream:nil];
+        [self.storage handleRosterItem:[self itemWithJID:@"bob@example.com" name:@"Bob" subscription:@"both"] xmppStream:nil];
+        [self.storage endRosterPopulationForXMPPStream:nil];
+    });
+
+    self.coalescedChanges = [NSMutableArray array];
+    self.coalescedChangeExpectation = [self expectationWithDescription:@"coalesced change"];
+    self.storage.enableChangeCoalescing = YES;
+
+    [self.roster addDelegate:self delegateQueue:dispatch_get_main_queue()];
+
+    dispatch_async(self.queue, ^{
+        [self.storage handlePresence:[self presenceFrom:@"alice@example.com/phone" type:nil] xmppStream:nil];
+        [self.storage handlePresence:[self presenceFrom:@"alice@example.com/laptop" type:nil] xmppStream:nil];
+        [self.storage handleRosterItem:[self itemWithJID:@"carol@example.com" name:@"Carol" subscription:@"both"] xmppStream:nil];
+        [self.storage handleRosterItem:[self itemWithJID:@"carol@example.com" name:@"Caroline" subscription:@"both"] xmppStream:nil];
+        [self.storage handleRosterItem:[self itemWithJID:@"dave@example.com" name:@"Dave" subscription:@"both"] xmppStream:nil];
+        [self.storage handleRosterItem:[self itemWithJID:@"dave@example.com" name:nil subscription:@"remove"] xmppStream:nil];
+        [self.storage handleRosterItem:[self itemWithJID:@"bob@example.com" name:nil subscription:@"remove"] xmppStream:nil];
+    });
+
+    [self waitForExpectationsWithTimeout:2.0 handler:nil];
+
+    [self.roster removeDelegate:self];
+
+    XCTAssertEqual([self.coalescedChanges count], 1);
+    XCTAssertEqual(self.userDelegateInvocations, 0);
+
+    NSArray *change = [self.coalescedChanges firstObject];
+    XCTAssertEqualObjects(change[0], [NSSet setWithObject:@"carol@example.com"]);
+    XCTAssertEqualObjects(change[1], [NSSet setWithObject:@"alice@example.com"]);
+    XCTAssertEqualObjects(change[2], [NSSet setWithObject:@"bob@example.com"]);
+}
+
+- (void)testPresencePerformance
+{
+    const NSUInteger rosterSize = 5000;
+
+    dispatch_sync(self.queue, ^{
+        [self.storage beginRosterPopulationForXMPPStream:nil withVersion:nil];
+        for (NSUInteger i = 0; i < rosterSize; i++)
+        {
+            NSString *jid = [NSString stringWithFormat:@"contact%lu@example.com", (unsigned long)i];
+            [self.storage handleRosterItem:[self itemWithJID:jid name:nil subscription:@"both"] xmppStream:nil];
+        }
+        [self.storage endRosterPopulationForXMPPStream:nil];
+    });
+
+    NSMutableArray *presences = [NSMutableArray arrayWithCapacity:200];
+    for (NSUInteger i = 0; i < 100; i++)
+    {
+        NSString *jid = [NSString stringWithFormat:@"contact%lu@example.com/res", (unsigned long)(i * 37 % rosterSize)];
+        [presences addObject:[self presenceFrom:jid type:nil]];
+        [presences addObject:[self presenceFrom:jid type:@"unavailable"]];
+    }
+
+    // Mimics a UI that reloads its sorted list after every change
+
+    [self measureBlock:^{
+        dispatch_sync(self.queue, ^{
+            for (XMPPPresence *presence in presences)
+            {
+                [self.storage handlePresence:presence xmppStream:nil];
+                [self.storage sortedUsersByAvailabilityName];
+            }
+        });
+    }];
+}
+
+@end
@@ -0,0 +1,184 @@
+//
+//  XMPPRosterVersioningTest.m
+//  XMPPFrameworkTests
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "XMPPInternal.h"
+#import "XMPPRoster.h"
+#import "XMPPRosterMemoryStorage.h"
+
+/**
+ * Records the roster requests sent on the stream.
+**/
+@interface XMPPRosterVersioningTestObserver : NSObject
+@property (strong) NSMutableArray *sentRosterRequests;
+@end
+
+@implementation XMPPRosterVersioningTestObserver
+
+- (id)init
+{
+    if ((self = [super init])) {
+        _sentRosterRequests = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (void)xmppStream:(XMPPStream *)sender didSendIQ:(XMPPIQ *)iq
+{
+    if ([iq isGetIQ] && [iq elementForName:@"query" xmlns:@"jabber:iq:roster"]) {
+        [self.sentRosterRequests addObject:iq];
+    }
+}
+
+@end
+
+@interface XMPPRosterVersioningTest : XCTestCase <XMPPRosterDelegate>
+
+@property (strong) XMPPStream *stream;
+@property (strong) XMPPRoster *roster;
+@property (strong) XMPPRosterVersioningTestObserver *observer;
+@property (strong) dispatch_queue_t delegateQueue;
+
+@property (strong) NSMutableArray *events;
+
+@end
+
+@implementation XMPPRosterVersioningTest
+
+- (void)setUp
+{
+    [super setUp];
+
+    self.stream = [[XMPPStream alloc] init];
+
+    // Pretend we're connected, so the stream accepts injected elements.
+    // Anything we send goes to the (nil) socket.
+    dispatch_sync(self.stream.xmppQueue, ^{
+        [self.stream setValue:@(STATE_XMPP_CONNECTED) forKey:@"state"];
+    });
+
+    self.delegateQueue = dispatch_queue_create("XMPPRosterVersioningTest", DISPATCH_QUEUE_SERIAL);
+    self.events = [NSMutableArray array];
+
+    self.observer = [[XMPPRosterVersioningTestObserver alloc] init];
+    [self.stream addDelegate:self.observer delegateQueue:self.delegateQueue];
+
+    self.roster = [[XMPPRoster alloc] initWithRosterStorage:[[XMPPRosterMemoryStorage alloc] init]];
+    self.roster.autoFetchRoster = NO;
+    [self.roster activate:self.stream];
+    [self.roster addDelegate:self delegateQueue:self.delegateQueue];
+}
+
+- (void)tearDown
+{
+    [self.roster removeDelegate:self];
+    [self.roster deactivate];
+    [self.stream removeDelegate:self.observer];
+
+    dispatch_sync(self.stream.xmppQueue, ^{
+        [self.stream setValue:@(STATE_XMPP_DISCONNECTED) forKey:@"state"];
+    });
+
+    self.roster = nil;
+    self.observer = nil;
+    self.stream = nil;
+
+    [super tearDown];
+}
+
+/**
+ * Waits for the stream, the roster and the delegates to process everything queued so far.
+**/
+- (void)flushQueues
+{
+    for (NSUInteger i = 0; i < 3; i++)
+    {
+        dispatch_sync(self.stream.xmppQueue, ^{});
+        dispatch_sync(self.roster.moduleQueue, ^{});
+        dispatch_sync(self.delegateQueue, ^{});
+    }
+}
+
+- (NSString *)fetchRosterVersion:(NSString *)version
+{
+    [self.roster fetchRosterVersion:version];
+    [self flushQueues];
+
+    return [self.observer.sentRosterRequests.lastObject elementID];
+}
+
+- (void)receiveXMLString:(NSString *)xmlString
+{
+    [self.stream injectElement:[[NSXMLElement alloc] initWithXMLString:xmlString error:nil]];
+    [self flushQueues];
+}
+
+- (void)xmppRosterDidBeginPopulating:(XMPPRoster *)sender withVersion:(NSString *)version
+{
+    [self.events addObject:[NSString stringWithFormat:@"begin:%@", version ?: @""]];
+}
+
+- (void)xmppRosterDidEndPopulating:(XMPPRoster *)sender
+{
+    [self.events addObject:@"end"];
+}
+
+- (void)xmppRoster:(XMPPRoster *)sender didNotReceiveRosterDueToError:(XMPPIQ *)iq
+{
+    [self.events addObject:[NSString stringWithFormat:@"failed:%@", [iq type] ?: @"timeout"]];
+}
+
+- (void)testEmptyResultMeansUnchanged
+{
+    NSString *elementID = [self fetchRosterVersion:@"ver14"];
+    [self receiveXMLString:[NSString stringWithFormat:@"<iq type='result' id='%@'/>", elementID]];
+
+    XCTAssertTrue(self.roster.hasRoster);
+    XCTAssertEqualObjects(self.events, (@[@"begin:ver14", @"end"]));
+}
+
+- (void)testEmptyResultWithoutVersionIsAnEmptyRoster
+{
+    // We didn't send a version, so the server can't be telling us our stored roster is up-to-date
+    NSString *elementID = [self fetchRosterVersion:nil];
+    [self receiveXMLString:[NSString stringWithFormat:@"<iq type='result' id='%@'/>", elementID]];
+
+    XCTAssertTrue(self.roster.hasRoster);
+    XCTAssertEqualObjects(self.events, (@[@"begin:", @"end"]));
+}
+
+- (void)testErrorIsNotAnUnchangedRoster
+{
+    NSString *elementID = [self fetchRosterVersion:@"ver14"];
+    [self receiveXMLString:[NSString stringWithFormat:@"<iq type='error' id='%@'>"
+                                                      @"<error type='wait'>"
+                                                      @"<resource-constraint xmlns='urn:ietf:params:xml:ns:xmpp-stanzas'/>"
+                                                      @"</error></iq>", elementID]];
+
+    XCTAssertFalse(self.roster.hasRoster);
+    XCTAssertEqualObjects(self.events, (@[@"failed:error"]));
+
+    // The roster can be requested again
+    NSString *retryElementID = [self fetchRosterVersion:@"ver14"];
+
+    XCTAssertEqual(self.observer.sentRosterRequests.count, 2);
+    XCTAssertNotEqualObjects(retryElementID, elementID);
+}
+
+- (void)testErrorWithQueryIsNotAnUnchangedRoster
+{
+    NSString *elementID = [self fetchRosterVersion:@"ver14"];
+    [self receiveXMLString:[NSString stringWithFormat:@"<iq type='error' id='%@'>"
+                                                      @"<query xmlns='jabber:iq:roster' ver='ver14'/>"
+                                                      @"<error type='cancel'>"
+                                                      @"<service-unavailable xmlns='urn:ietf:params:xml:ns:xmpp-stanzas'/>"
+                                                      @"</error></iq>", elementID]];
+
+    XCTAssertFalse(self.roster.hasRoster);
+    XCTAssertEqualObjects(self.events, (@[@"failed:error"]));
+}
+
+@end
@@ -0,0 +1,289 @@
+//
+//  XMPPStreamIQRoutingTest.m
+//  XMPPFrameworkTests
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "XMPPInternal.h"
+#import "XMPPStreamManagement.h"
+#import "XMPPStreamManagementMemoryStorage.h"
+
+/**
+ * A module that records the IQs delivered to it.
+**/
+@interface XMPPIQRoutingTestModule : XMPPModule
+@property (strong) NSMutableArray *receivedIQs;
+@end
+
+@implementation XMPPIQRoutingTestModule
+
+- (id)initWithDispatchQueue:(dispatch_queue_t)queue
+{
+    if ((self = [super initWithDispatchQueue:queue])) {
+        _receivedIQs = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (BOOL)xmppStream:(XMPPStream *)sender didReceiveIQ:(XMPPIQ *)iq
+{
+    [self.receivedIQs addObject:iq];
+    return NO;
+}
+
+@end
+
+/**
+ * A plain stream delegate, standing in for every other module on the stream.
+**/
+@interface XMPPIQRoutingTestObserver : NSObject
+@property (strong) NSMutableArray *receivedIQs;
+@property (strong) NSMutableArray *sentCustomElements;
+@property (assign) NSUInteger filteredCount;
+@end
+
+@implementation XMPPIQRoutingTestObserver
+
+- (id)init
+{
+    if ((self = [super init])) {
+        _receivedIQs = [NSMutableArray array];
+        _sentCustomElements = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (BOOL)xmppStream:(XMPPStream *)sender didReceiveIQ:(XMPPIQ *)iq
+{
+    [self.receivedIQs addObject:iq];
+    return NO;
+}
+
+- (void)xmppStreamDidFilterStanza:(XMPPStream *)sender
+{
+    self.filteredCount++;
+}
+
+- (void)xmppStream:(XMPPStream *)sender didSendCustomElement:(NSXMLElement *)element
+{
+    [self.sentCustomElements addObject:element];
+}
+
+@end
+
+@interface XMPPStreamIQRoutingTest : XCTestCase
+
+@property (strong) XMPPStream *stream;
+@property (strong) XMPPIQRoutingTestModule *module;
+@property (strong) XMPPIQRoutingTestObserver *observer;
+@property (strong) dispatch_queue_t observerQueue;
+
+@end
+
+@implementation XMPPStreamIQRoutingTest
+
+- (void)setUp
+{
+    [super setUp];
+
+    self.stream = [[XMPPStream alloc] init];
+
+    // Pretend we're connected, so the stream accepts injected elements.
+    // Anything we send goes to the (nil) socket.
+    dispatch_sync(self.stream.xmppQueue, ^{
+        [self.stream setValue:@(STATE_XMPP_CONNECTED) forKey:@"state"];
+    });
+
+    self.module = [[XMPPIQRoutingTestModule alloc] initWithDispatchQueue:NULL];
+    [self.module activate:self.stream];
+
+    self.observer = [[XMPPIQRoutingTestObserver alloc] init];
+    self.observerQueue = dispatch_queue_create("XMPPStreamIQRoutingTest", DISPATCH_QUEUE_SERIAL);
+    [self.stream addDelegate:self.observer delegateQueue:self.observerQueue];
+}
+
+- (void)tearDown
+{
+    [self.stream removeDelegate:self.observer];
+    [self.module deactivate];
+
+    dispatch_sync(self.stream.xmppQueue, ^{
+        [self.stream setValue:@(STATE_XMPP_DISCONNECTED) forKey:@"state"];
+    });
+
+    self.module = nil;
+    self.observer = nil;
+    self.stream = nil;
+
+    [super tearDown];
+}
+
+/**
+ * Waits for the stream, the modules and the observer to process everything queued so far.
+ * A few rounds, as handling one element may queue work on another queue (e.g. sending an ack).
+**/
+- (void)flushQueues:(NSArray *)moduleQueues
+{
+    for (NSUInteger i = 0; i < 3; i++)
+    {
+        dispatch_sync(self.stream.xmppQueue, ^{});
+        for (dispatch_queue_t moduleQueue in moduleQueues) {
+            dispatch_sync(moduleQueue, ^{});
+        }
+        dispatch_sync(self.observerQueue, ^{});
+    }
+}
+
+- (void)flushQueues
+{
+    [self flushQueues:@[self.module.moduleQueue]];
+}
+
+- (XMPPIQ *)requestWithID:(NSString *)elementID
+{
+    NSXMLElement *ping = [NSXMLElement elementWithName:@"ping" xmlns:@"urn:xmpp:ping"];
+    return [XMPPIQ iqWithType:@"get" to:[XMPPJID jidWithString:@"example.com"] elementID:elementID child:ping];
+}
+
+- (void)injectResponseWithID:(NSString *)elementID from:(NSString *)from
+{
+    XMPPIQ *response = [XMPPIQ iqWithType:@"result" elementID:elementID];
+    [response addAttributeWithName:@"from" stringValue:from];
+
+    [self.stream injectElement:response];
+}
+
+- (void)testMatchedResponseGoesToModule
+{
+    [self.stream routeResponseToIQ:[self requestWithID:@"ping1"] toModule:self.module];
+    [self injectResponseWithID:@"ping1" from:@"example.com"];
+    [self flushQueues];
+
+    XCTAssertEqual(self.module.receivedIQs.count, 1);
+    XCTAssertEqualObjects([self.module.receivedIQs.firstObject elementID], @"ping1");
+
+    // The other delegates don't see it, but are told something was received
+    XCTAssertEqual(self.observer.receivedIQs.count, 0);
+    XCTAssertEqual(self.observer.filteredCount, 1);
+
+    // The route is gone, so a second response is broadcast
+    [self injectResponseWithID:@"ping1" from:@"example.com"];
+    [self flushQueues];
+
+    XCTAssertEqual(self.observer.receivedIQs.count, 1);
+}
+
+- (void)testSpoofedResponseIsBroadcast
+{
+    [self.stream routeResponseToIQ:[self requestWithID:@"ping1"] toModule:self.module];
+    [self injectResponseWithID:@"ping1" from:@"mallory@example.com"];
+    [self flushQueues];
+
+    XCTAssertEqual(self.observer.receivedIQs.count, 1);
+    XCTAssertEqual(self.observer.filteredCount, 0);
+
+    // The module gets the broadcast like everyone else (as it's a delegate of the stream)
+    XCTAssertEqual(self.module.receivedIQs.count, 1);
+
+    // The genuine response is still routed
+    [self injectResponseWithID:@"ping1" from:@"example.com"];
+    [self flushQueues];
+
+    XCTAssertEqual(self.observer.receivedIQs.count, 1);
+    XCTAssertEqual(self.observer.filteredCount, 1);
+    XCTAssertEqual(self.module.receivedIQs.count, 2);
+}
+
+- (void)testTimeoutRemovesRoute
+{
+    [self.stream routeResponseToIQ:[self requestWithID:@"ping1"] toModule:self.module timeout:0.1];
+
+    [NSThread sleepForTimeInterval:0.3];
+    [self flushQueues];
+
+    // The timeout isn't reported to the module (it has its own timeout handling)
+    XCTAssertEqual(self.module.receivedIQs.count, 0);
+
+    // A late response is broadcast as usual
+    [self injectResponseWithID:@"ping1" from:@"example.com"];
+    [self flushQueues];
+
+    XCTAssertEqual(self.observer.receivedIQs.count, 1);
+    XCTAssertEqual(self.observer.filteredCount, 0);
+}
+
+- (void)testDeallocatedModule
+{
+    __weak XMPPIQRoutingTestModule *weakModule = nil;
+
+    @autoreleasepool {
+        XMPPIQRoutingTestModule *module = [[XMPPIQRoutingTestModule alloc] initWithDispatchQueue:NULL];
+        [module activate:self.stream];
+
+        [self.stream routeResponseToIQ:[self requestWithID:@"ping1"] toModule:module];
+
+        [module deactivate];
+        weakModule = module;
+    }
+
+    XCTAssertNil(weakModule);
+
+    [self injectResponseWithID:@"ping1" from:@"example.com"];
+    [self flushQueues];
+
+    XCTAssertEqual(self.observer.filteredCount, 1);
+    XCTAssertEqual(self.module.receivedIQs.count, 0);
+}
+
+- (void)testModuleWithoutDidReceiveIQ
+{
+    XMPPModule *module = [[XMPPModule alloc] initWithDispatchQueue:NULL];
+    [module activate:self.stream];
+
+    // Not registered, as the response would be lost
+    [self.stream routeResponseToIQ:[self requestWithID:@"ping1"] toModule:module];
+    [self injectResponseWithID:@"ping1" from:@"example.com"];
+    [self flushQueues:@[self.module.moduleQueue, module.moduleQueue]];
+
+    XCTAssertEqual(self.observer.receivedIQs.count, 1);
+    XCTAssertEqual(self.observer.filteredCount, 0);
+
+    [module deactivate];
+}
+
+- (void)testRoutedResponseIsCountedByStreamManagement
+{
+    XMPPStreamManagementMemoryStorage *storage = [[XMPPStreamManagementMemoryStorage alloc] init];
+    XMPPStreamManagement *streamManagement = [[XMPPStreamManagement alloc] initWithStorage:storage];
+    [streamManagement activate:self.stream];
+
+    NSArray *moduleQueues = @[self.module.moduleQueue, streamManagement.moduleQueue];
+
+    [streamManagement enableStreamManagementWithResumption:YES maxTimeout:0];
+    [self flushQueues:moduleQueues];
+
+    NSXMLElement *enabled = [NSXMLElement elementWithName:@"enabled" xmlns:@"urn:xmpp:sm:3"];
+    [enabled addAttributeWithName:@"id" stringValue:@"sm1"];
+    [enabled addAttributeWithName:@"resume" stringValue:@"true"];
+    [self.stream injectElement:enabled];
+    [self flushQueues:moduleQueues];
+
+    [self.stream routeResponseToIQ:[self requestWithID:@"ping1"] toModule:self.module];
+    [self injectResponseWithID:@"ping1" from:@"example.com"];
+    [self flushQueues:moduleQueues];
+
+    XCTAssertEqual(self.module.receivedIQs.count, 1);
+
+    // The server asks how many stanzas we've handled
+    [self.stream injectElement:[NSXMLElement elementWithName:@"r" xmlns:@"urn:xmpp:sm:3"]];
+    [self flushQueues:moduleQueues];
+
+    NSXMLElement *ack = self.observer.sentCustomElements.lastObject;
+    XCTAssertEqualObjects([ack name], @"a");
+    XCTAssertEqual([ack attributeUInt32ValueForName:@"h"], 1);
+
+    [streamManagement deactivate];
+}
+
+@end
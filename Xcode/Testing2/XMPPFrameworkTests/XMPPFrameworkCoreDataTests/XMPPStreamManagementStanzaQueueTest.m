@@ -0,0 +1,111 @@
+//
+//  XMPPStreamManagementStanzaQueueTest.m
+//  XMPPFrameworkTests
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "XMPPStreamManagementStanzaQueue.h"
+
+@interface XMPPStreamManagementStanzaQueueTest : XCTestCase
+@end
+
+@implementation XMPPStreamManagementStanzaQueueTest
+
+- (void)testMatchesArrayAcrossWrapAround
+{
+    XMPPStreamManagementStanzaQueue *queue = [[XMPPStreamManagementStanzaQueue alloc] initWithCapacity:4];
+    NSMutableArray *expected = [NSMutableArray array];
+
+    NSUInteger next = 0;
+    srandom(42);
+
+    for (NSUInteger round = 0; round < 1000; round++)
+    {
+        NSUInteger adds = random() % 8;
+        for (NSUInteger i = 0; i < adds; i++)
+        {
+            uint64_t sequence = [queue addObject:@(next)];
+            XCTAssertEqual(sequence, (uint64_t)next);
+
+            [expected addObject:@(next)];
+            next++;
+        }
+
+        NSUInteger removes = random() % 8;
+        [queue removeFirstObjects:removes];
+        [expected removeObjectsInRange:NSMakeRange(0, MIN(removes, [expected count]))];
+
+        XCTAssertEqual([queue count], [expected count]);
+        XCTAssertEqual([queue firstSequence], (uint64_t)(next - [expected count]));
+        XCTAssertEqualObjects([queue allObjects], expected);
+
+        NSMutableArray *enumerated = [NSMutableArray array];
+        for (id object in queue)
+        {
+            [enumerated addObject:object];
+        }
+        XCTAssertEqualObjects(enumerated, expected);
+
+        if ([expected count] > 0)
+        {
+            XCTAssertEqualObjects(queue[[expected count] - 1], [expected lastObject]);
+            XCTAssertEqualObjects([queue objectWithSequence:[queue firstSequence]], expected[0]);
+        }
+    }
+}
+
+- (void)testObjectWithSequence
+{
+    XMPPStreamManagementStanzaQueue *queue = [[XMPPStreamManagementStanzaQueue alloc] init];
+
+    uint64_t a = [queue addObject:@"a"];
+    uint64_t b = [queue addObject:@"b"];
+    [queue removeFirstObjects:1];
+    uint64_t c = [queue addObject:@"c"];
+
+    XCTAssertNil([queue objectWithSequence:a]);
+    XCTAssertEqualObjects([queue objectWithSequence:b], @"b");
+    XCTAssertEqualObjects([queue objectWithSequence:c], @"c");
+    XCTAssertNil([queue objectWithSequence:c + 1]);
+
+    [queue removeAllObjects];
+    XCTAssertEqual([queue count], 0);
+    XCTAssertEqual([queue firstSequence], c + 1);
+}
+
+- (void)testRemovedObjectsAreReleased
+{
+    XMPPStreamManagementStanzaQueue *queue = [[XMPPStreamManagementStanzaQueue alloc] init];
+
+    __weak id weakObject = nil;
+    @autoreleasepool {
+        id object = [[NSObject alloc] init];
+        weakObject = object;
+        [queue addObject:object];
+    }
+
+    XCTAssertNotNil(weakObject);
+    [queue removeFirstObjects:1];
+    XCTAssertNil(weakObject);
+}
+
+- (void)testAckPerformance
+{
+    // Mimics a flaky connection: thousands of unacked stanzas, acked a few at a time
+
+    [self measureBlock:^{
+        XMPPStreamManagementStanzaQueue *queue = [[XMPPStreamManagementStanzaQueue alloc] init];
+
+        for (NSUInteger i = 0; i < 20000; i++)
+        {
+            [queue addObject:@(i)];
+        }
+        while ([queue count] > 0)
+        {
+            [queue removeFirstObjects:3];
+        }
+    }];
+}
+
+@end
@@ -0,0 +1,368 @@
+//
+//  XMPPStreamManagementTest.m
+//  XMPPFrameworkTests
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "XMPPInternal.h"
+#import "XMPPStreamManagement.h"
+#import "XMPPStreamManagementMemoryStorage.h"
+#import "XMPPStreamManagementStanzas.h"
+
+/**
+ * Memory storage that counts how the extension updates the pending outgoing stanzas,
+ * and that can pretend not to implement the incremental methods.
+**/
+@interface XMPPStreamManagementTestStorage : XMPPStreamManagementMemoryStorage
+
+- (instancetype)initWithIncrementalUpdates:(BOOL)incrementalUpdates;
+
+@property (assign) NSUInteger fullSaveCount;
+@property (assign) NSUInteger appendCount;
+@property (assign) NSUInteger removeCount;
+@property (assign) NSUInteger replaceCount;
+
+@end
+
+@implementation XMPPStreamManagementTestStorage
+{
+    BOOL supportsIncrementalUpdates;
+}
+
+- (instancetype)initWithIncrementalUpdates:(BOOL)incrementalUpdates
+{
+    if ((self = [super init])) {
+        supportsIncrementalUpdates = incrementalUpdates;
+    }
+    return self;
+}
+
+- (BOOL)respondsToSelector:(SEL)aSelector
+{
+    if (!supportsIncrementalUpdates)
+    {
+        if (aSelector == @selector(setLastDisconnect:lastHandledByServer:appendPendingOutgoingStanzas:forStream:) ||
+            aSelector == @selector(setLastDisconnect:lastHandledByServer:removeFirstPendingOutgoingStanzas:forStream:) ||
+            aSelector == @selector(replacePendingOutgoingStanzaAtIndex:withStanza:forStream:))
+        {
+            return NO;
+        }
+    }
+
+    return [super respondsToSelector:aSelector];
+}
+
+- (void)setLastDisconnect:(NSDate *)date
+      lastHandledByServer:(uint32_t)lastHandledByServer
+   pendingOutgoingStanzas:(NSArray *)pendingOutgoingStanzas
+                forStream:(XMPPStream *)stream
+{
+    self.fullSaveCount++;
+    [super setLastDisconnect:date lastHandledByServer:lastHandledByServer pendingOutgoingStanzas:pendingOutgoingStanzas forStream:stream];
+}
+
+- (void)setLastDisconnect:(NSDate *)date
+      lastHandledByServer:(uint32_t)lastHandledByServer
+    appendPendingOutgoingStanzas:(NSArray *)pendingOutgoingStanzas
+                forStream:(XMPPStream *)stream
+{
+    self.appendCount++;
+    [super setLastDisconnect:date lastHandledByServer:lastHandledByServer appendPendingOutgoingStanzas:pendingOutgoingStanzas forStream:stream];
+}
+
+- (void)setLastDisconnect:(NSDate *)date
+      lastHandledByServer:(uint32_t)lastHandledByServer
+    removeFirstPendingOutgoingStanzas:(NSUInteger)count
+                forStream:(XMPPStream *)stream
+{
+    self.removeCount++;
+    [super setLastDisconnect:date lastHandledByServer:lastHandledByServer removeFirstPendingOutgoingStanzas:count forStream:stream];
+}
+
+- (void)replacePendingOutgoingStanzaAtIndex:(NSUInteger)index
+                                 withStanza:(XMPPStreamManagementOutgoingStanza *)stanza
+                                  forStream:(XMPPStream *)stream
+{
+    self.replaceCount++;
+    [super replacePendingOutgoingStanzaAtIndex:index withStanza:stanza forStream:stream];
+}
+
+@end
+
+/**
+ * Assigns each sent element a stanzaId of its own, like an app mapping messages to database keys would.
+ * The lookup for the element with the heldElementID is held until released.
+**/
+@interface XMPPStreamManagementTestStanzaIds : NSObject
+@property (copy) NSString *heldElementID;
+@property (strong) dispatch_semaphore_t releaseSemaphore;
+@end
+
+@implementation XMPPStreamManagementTestStanzaIds
+
+- (id)xmppStreamManagement:(XMPPStreamManagement *)sender stanzaIdForSentElement:(XMPPElement *)element
+{
+    if ([[element elementID] isEqualToString:self.heldElementID]) {
+        dispatch_semaphore_wait(self.releaseSemaphore, DISPATCH_TIME_FOREVER);
+    }
+
+    return [@"db-" stringByAppendingString:[element elementID]];
+}
+
+@end
+
+@interface XMPPStreamManagementTest : XCTestCase
+
+@property (strong) XMPPStream *stream;
+@property (strong) XMPPStreamManagement *streamManagement;
+@property (strong) XMPPStreamManagementTestStorage *storage;
+
+@end
+
+@implementation XMPPStreamManagementTest
+
+- (void)setUp
+{
+    [super setUp];
+
+    self.stream = [[XMPPStream alloc] init];
+
+    // Pretend we're connected, so the stream accepts injected elements.
+    // Anything we send goes to the (nil) socket.
+    dispatch_sync(self.stream.xmppQueue, ^{
+        [self.stream setValue:@(STATE_XMPP_CONNECTED) forKey:@"state"];
+    });
+}
+
+- (void)tearDown
+{
+    [self.streamManagement deactivate];
+
+    dispatch_sync(self.stream.xmppQueue, ^{
+        [self.stream setValue:@(STATE_XMPP_DISCONNECTED) forKey:@"state"];
+    });
+
+    self.streamManagement = nil;
+    self.storage = nil;
+    self.stream = nil;
+
+    [super tearDown];
+}
+
+- (void)startWithIncrementalUpdates:(BOOL)incrementalUpdates
+{
+    self.storage = [[XMPPStreamManagementTestStorage alloc] initWithIncrementalUpdates:incrementalUpdates];
+    self.streamManagement = [[XMPPStreamManagement alloc] initWithStorage:self.storage];
+    [self.streamManagement activate:self.stream];
+
+    [self.streamManagement enableStreamManagementWithResumption:YES maxTimeout:600];
+    [self flushQueues];
+
+    [self receiveXMLString:@"<enabled xmlns='urn:xmpp:sm:3' id='sm1' resume='true' max='600'/>"];
+}
+
+/**
+ * Waits for the stream and the extension to process everything queued so far.
+ * A few rounds, as handling one element may queue work on the other queue.
+**/
+- (void)flushQueues
+{
+    for (NSUInteger i = 0; i < 3; i++)
+    {
+        dispatch_sync(self.stream.xmppQueue, ^{});
+        dispatch_sync(self.streamManagement.moduleQueue, ^{});
+    }
+}
+
+- (void)receiveXMLString:(NSString *)xmlString
+{
+    [self.stream injectElement:[[NSXMLElement alloc] initWithXMLString:xmlString error:nil]];
+    [self flushQueues];
+}
+
+- (void)sendMessageWithID:(NSString *)elementID
+{
+    XMPPMessage *message = [XMPPMessage messageWithType:@"chat" to:[XMPPJID jidWithString:@"bob@example.com"] elementID:elementID];
+    [message addBody:elementID];
+
+    [self.stream sendElement:message];
+    [self flushQueues];
+}
+
+/**
+ * Returns the stored pending outgoing stanzaIds, with @"?" for those still awaiting a stanzaId.
+**/
+- (NSArray *)storedPendingStanzaIds
+{
+    NSMutableArray *stanzaIds = [NSMutableArray array];
+
+    dispatch_sync(self.streamManagement.moduleQueue, ^{
+        NSArray *pending = nil;
+        [self.storage getLastHandledByClient:NULL lastHandledByServer:NULL pendingOutgoingStanzas:&pending forStream:self.stream];
+
+        for (XMPPStreamManagementOutgoingStanza *stanza in pending) {
+            [stanzaIds addObject:(stanza.awaitingStanzaId ? @"?" : (stanza.stanzaId ?: [NSNull null]))];
+        }
+    });
+
+    return stanzaIds;
+}
+
+- (uint32_t)storedLastHandledByServer
+{
+    __block uint32_t lastHandledByServer = 0;
+
+    dispatch_sync(self.streamManagement.moduleQueue, ^{
+        [self.storage getLastHandledByClient:NULL lastHandledByServer:&lastHandledByServer pendingOutgoingStanzas:NULL forStream:self.stream];
+    });
+
+    return lastHandledByServer;
+}
+
+/**
+ * Waits until the stored pending stanzaIds equal the expected ones (stanzaIds are assigned asynchronously).
+**/
+- (BOOL)waitForStoredPendingStanzaIds:(NSArray *)expected
+{
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:2.0];
+
+    while (![[self storedPendingStanzaIds] isEqualToArray:expected])
+    {
+        if ([deadline timeIntervalSinceNow] < 0) return NO;
+        [NSThread sleepForTimeInterval:0.01];
+    }
+    return YES;
+}
+
+- (void)disconnectAndResumeWithH:(uint32_t)h
+{
+    dispatch_sync(self.streamManagement.moduleQueue, ^{
+        [self.streamManagement xmppStreamDidDisconnect:self.stream withError:nil];
+    });
+
+    XCTAssertTrue([self.streamManagement canResumeStream]);
+
+    dispatch_sync(self.streamManagement.moduleQueue, ^{
+        NSError *error = nil;
+        XCTAssertEqual([self.streamManagement start:&error], XMPP_BIND_CONTINUE);
+
+        NSString *resumed = [NSString stringWithFormat:@"<resumed xmlns='urn:xmpp:sm:3' previd='sm1' h='%u'/>", h];
+        [self.streamManagement handleBind:[[NSXMLElement alloc] initWithXMLString:resumed error:nil] withError:&error];
+    });
+    [self flushQueues];
+}
+
+- (void)testIncrementalUpdates
+{
+    [self startWithIncrementalUpdates:YES];
+
+    [self sendMessageWithID:@"m1"];
+    [self sendMessageWithID:@"m2"];
+    [self sendMessageWithID:@"m3"];
+
+    XCTAssertEqualObjects([self storedPendingStanzaIds], (@[@"m1", @"m2", @"m3"]));
+    XCTAssertEqual(self.storage.appendCount, 3);
+
+    // Partial ack
+    [self receiveXMLString:@"<a xmlns='urn:xmpp:sm:3' h='2'/>"];
+
+    XCTAssertEqualObjects([self storedPendingStanzaIds], (@[@"m3"]));
+    XCTAssertEqual([self storedLastHandledByServer], 2);
+    XCTAssertEqual(self.storage.removeCount, 1);
+
+    // Sending and acking never rewrote the whole array (only <enabled/> sets the baseline)
+    XCTAssertEqual(self.storage.fullSaveCount, 0);
+
+    // The server got m3 before we lost the connection
+    [self disconnectAndResumeWithH:3];
+
+    NSArray *ackedStanzaIds = nil;
+    XCTAssertTrue([self.streamManagement didResumeWithAckedStanzaIds:&ackedStanzaIds serverResponse:NULL]);
+    XCTAssertEqualObjects(ackedStanzaIds, (@[@"m3"]));
+
+    XCTAssertEqualObjects([self storedPendingStanzaIds], (@[]));
+    XCTAssertEqual([self storedLastHandledByServer], 3);
+
+    // After resuming, storage is in sync again, so updates are incremental again
+    NSUInteger fullSaveCount = self.storage.fullSaveCount;
+
+    [self sendMessageWithID:@"m4"];
+    [self sendMessageWithID:@"m5"];
+
+    XCTAssertEqualObjects([self storedPendingStanzaIds], (@[@"m4", @"m5"]));
+
+    [self receiveXMLString:@"<a xmlns='urn:xmpp:sm:3' h='4'/>"];
+
+    XCTAssertEqualObjects([self storedPendingStanzaIds], (@[@"m5"]));
+    XCTAssertEqual([self storedLastHandledByServer], 4);
+    XCTAssertEqual(self.storage.fullSaveCount, fullSaveCount);
+}
+
+- (void)testWholeArrayFallback
+{
+    [self startWithIncrementalUpdates:NO];
+
+    [self sendMessageWithID:@"m1"];
+    [self sendMessageWithID:@"m2"];
+    [self sendMessageWithID:@"m3"];
+
+    XCTAssertEqualObjects([self storedPendingStanzaIds], (@[@"m1", @"m2", @"m3"]));
+    XCTAssertEqual(self.storage.fullSaveCount, 3);
+
+    [self receiveXMLString:@"<a xmlns='urn:xmpp:sm:3' h='2'/>"];
+
+    XCTAssertEqualObjects([self storedPendingStanzaIds], (@[@"m3"]));
+    XCTAssertEqual([self storedLastHandledByServer], 2);
+    XCTAssertEqual(self.storage.fullSaveCount, 4);
+
+    [self disconnectAndResumeWithH:3];
+
+    XCTAssertEqualObjects([self storedPendingStanzaIds], (@[]));
+    XCTAssertEqual([self storedLastHandledByServer], 3);
+
+    [self sendMessageWithID:@"m4"];
+
+    XCTAssertEqualObjects([self storedPendingStanzaIds], (@[@"m4"]));
+
+    XCTAssertEqual(self.storage.appendCount, 0);
+    XCTAssertEqual(self.storage.removeCount, 0);
+    XCTAssertEqual(self.storage.replaceCount, 0);
+}
+
+- (void)testStoredIndexesFollowAcks
+{
+    XMPPStreamManagementTestStanzaIds *stanzaIds = [[XMPPStreamManagementTestStanzaIds alloc] init];
+    stanzaIds.heldElementID = @"m2";
+    stanzaIds.releaseSemaphore = dispatch_semaphore_create(0);
+
+    [self startWithIncrementalUpdates:YES];
+    [self.streamManagement addDelegate:stanzaIds delegateQueue:dispatch_get_main_queue()];
+
+    [self sendMessageWithID:@"m1"];
+    [self sendMessageWithID:@"m2"];
+    [self sendMessageWithID:@"m3"];
+
+    // Placeholders are stored right away, and filled in as the stanzaIds come in
+    XCTAssertTrue([self waitForStoredPendingStanzaIds:@[@"db-m1", @"?", @"db-m3"]]);
+
+    // The server acks m1 while m2 is still awaiting its stanzaId
+    [self receiveXMLString:@"<a xmlns='urn:xmpp:sm:3' h='1'/>"];
+
+    XCTAssertEqualObjects([self storedPendingStanzaIds], (@[@"?", @"db-m3"]));
+
+    // m2 is now at index 0 of the stored array (not 1, where it was when it was sent)
+    dispatch_semaphore_signal(stanzaIds.releaseSemaphore);
+
+    XCTAssertTrue([self waitForStoredPendingStanzaIds:@[@"db-m2", @"db-m3"]]);
+    XCTAssertEqual(self.storage.replaceCount, 3);
+    XCTAssertEqual(self.storage.fullSaveCount, 0);
+
+    [self receiveXMLString:@"<a xmlns='urn:xmpp:sm:3' h='3'/>"];
+
+    XCTAssertEqualObjects([self storedPendingStanzaIds], (@[]));
+
+    [self.streamManagement removeDelegate:stanzaIds];
+}
+
+@end
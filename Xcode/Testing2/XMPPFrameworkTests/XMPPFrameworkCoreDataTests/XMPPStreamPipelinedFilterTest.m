@@ -0,0 +1,335 @@
+//
+//  XMPPStreamPipelinedFilterTest.m
+//  XMPPFrameworkTests
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "XMPPInternal.h"
+
+/**
+ * A willReceive filter that records the stanzas it sees.
+ * It can drop a stanza, and hold a stanza (blocking its delegate queue) until released.
+**/
+@interface XMPPPipelinedFilterTestFilter : NSObject
+
+- (instancetype)initWithName:(NSString *)name filtersMessagesOnly:(BOOL)messagesOnly;
+
+@property (strong, readonly) dispatch_queue_t queue;
+@property (assign, readonly) BOOL filtersMessagesOnly;
+
+@property (copy) NSString *droppedElementID;
+@property (copy) NSString *heldElementID;
+@property (strong) dispatch_semaphore_t releaseSemaphore;
+
+/** Only access on the queue (or once the queue is idle). **/
+@property (strong, readonly) NSMutableArray *seenElementIDs;
+
+@end
+
+@implementation XMPPPipelinedFilterTestFilter
+
+- (instancetype)initWithName:(NSString *)name filtersMessagesOnly:(BOOL)messagesOnly
+{
+    if ((self = [super init])) {
+        _queue = dispatch_queue_create([name UTF8String], DISPATCH_QUEUE_SERIAL);
+        _filtersMessagesOnly = messagesOnly;
+        _seenElementIDs = [NSMutableArray array];
+        _releaseSemaphore = dispatch_semaphore_create(0);
+    }
+    return self;
+}
+
+- (BOOL)respondsToSelector:(SEL)aSelector
+{
+    if (self.filtersMessagesOnly)
+    {
+        if (aSelector == @selector(xmppStream:willReceiveIQ:) ||
+            aSelector == @selector(xmppStream:willReceivePresence:))
+        {
+            return NO;
+        }
+    }
+
+    return [super respondsToSelector:aSelector];
+}
+
+- (id)filterElement:(XMPPElement *)element
+{
+    NSString *elementID = [element elementID];
+    [self.seenElementIDs addObject:elementID];
+
+    if ([elementID isEqualToString:self.heldElementID]) {
+        dispatch_semaphore_wait(self.releaseSemaphore, DISPATCH_TIME_FOREVER);
+    }
+
+    if ([elementID isEqualToString:self.droppedElementID]) {
+        return nil;
+    }
+    return element;
+}
+
+- (XMPPIQ *)xmppStream:(XMPPStream *)sender willReceiveIQ:(XMPPIQ *)iq
+{
+    return [self filterElement:iq];
+}
+
+- (XMPPMessage *)xmppStream:(XMPPStream *)sender willReceiveMessage:(XMPPMessage *)message
+{
+    return [self filterElement:message];
+}
+
+- (XMPPPresence *)xmppStream:(XMPPStream *)sender willReceivePresence:(XMPPPresence *)presence
+{
+    return [self filterElement:presence];
+}
+
+@end
+
+/**
+ * Records what the stream delivers, in order.
+ * Filtered stanzas are recorded as @"filtered".
+**/
+@interface XMPPPipelinedFilterTestObserver : NSObject
+@property (strong) NSMutableArray *events;
+@end
+
+@implementation XMPPPipelinedFilterTestObserver
+
+- (id)init
+{
+    if ((self = [super init])) {
+        _events = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (BOOL)xmppStream:(XMPPStream *)sender didReceiveIQ:(XMPPIQ *)iq
+{
+    [self.events addObject:[iq elementID]];
+    return NO;
+}
+
+- (void)xmppStream:(XMPPStream *)sender didReceiveMessage:(XMPPMessage *)message
+{
+    [self.events addObject:[message elementID]];
+}
+
+- (void)xmppStream:(XMPPStream *)sender didReceivePresence:(XMPPPresence *)presence
+{
+    [self.events addObject:[presence elementID]];
+}
+
+- (void)xmppStreamDidFilterStanza:(XMPPStream *)sender
+{
+    [self.events addObject:@"filtered"];
+}
+
+@end
+
+@interface XMPPStreamPipelinedFilterTest : XCTestCase
+
+@property (strong) XMPPStream *stream;
+@property (strong) XMPPPipelinedFilterTestFilter *firstFilter;
+@property (strong) XMPPPipelinedFilterTestFilter *secondFilter;
+@property (strong) XMPPPipelinedFilterTestObserver *observer;
+@property (strong) dispatch_queue_t observerQueue;
+
+@end
+
+@implementation XMPPStreamPipelinedFilterTest
+
+- (void)setUp
+{
+    [super setUp];
+
+    self.stream = [[XMPPStream alloc] init];
+    self.stream.enablePipelinedReceiveFilters = YES;
+
+    // Pretend we're connected, so the stream accepts injected elements.
+    dispatch_sync(self.stream.xmppQueue, ^{
+        [self.stream setValue:@(STATE_XMPP_CONNECTED) forKey:@"state"];
+    });
+
+    self.observer = [[XMPPPipelinedFilterTestObserver alloc] init];
+    self.observerQueue = dispatch_queue_create("XMPPStreamPipelinedFilterTest", DISPATCH_QUEUE_SERIAL);
+    [self.stream addDelegate:self.observer delegateQueue:self.observerQueue];
+}
+
+- (void)tearDown
+{
+    [self.stream removeDelegate:self.observer];
+    if (self.firstFilter) [self.stream removeDelegate:self.firstFilter];
+    if (self.secondFilter) [self.stream removeDelegate:self.secondFilter];
+
+    dispatch_sync(self.stream.xmppQueue, ^{
+        [self.stream setValue:@(STATE_XMPP_DISCONNECTED) forKey:@"state"];
+    });
+
+    self.firstFilter = nil;
+    self.secondFilter = nil;
+    self.observer = nil;
+    self.stream = nil;
+
+    [super tearDown];
+}
+
+- (void)addFiltersWithSecondFilteringMessagesOnly:(BOOL)messagesOnly
+{
+    self.firstFilter = [[XMPPPipelinedFilterTestFilter alloc] initWithName:@"first" filtersMessagesOnly:NO];
+    self.secondFilter = [[XMPPPipelinedFilterTestFilter alloc] initWithName:@"second" filtersMessagesOnly:messagesOnly];
+
+    [self.stream addDelegate:self.firstFilter delegateQueue:self.firstFilter.queue];
+    [self.stream addDelegate:self.secondFilter delegateQueue:self.secondFilter.queue];
+}
+
+/**
+ * Waits for the stream, the filters and the observer to process everything queued so far.
+ * A few rounds, as each stanza hops from the stream to the filters and back.
+**/
+- (void)flushQueues
+{
+    for (NSUInteger i = 0; i < 4; i++)
+    {
+        dispatch_sync(self.stream.xmppQueue, ^{});
+        if (self.firstFilter) dispatch_sync(self.firstFilter.queue, ^{});
+        if (self.secondFilter) dispatch_sync(self.secondFilter.queue, ^{});
+        dispatch_sync(self.observerQueue, ^{});
+    }
+}
+
+- (NSArray *)events
+{
+    __block NSArray *events = nil;
+    dispatch_sync(self.observerQueue, ^{
+        events = [self.observer.events copy];
+    });
+    return events;
+}
+
+- (void)injectMessageWithID:(NSString *)elementID
+{
+    XMPPMessage *message = [XMPPMessage messageWithType:@"chat" to:nil elementID:elementID];
+    [message addAttributeWithName:@"from" stringValue:@"alice@example.com/phone"];
+    [message addBody:elementID];
+
+    [self.stream injectElement:message];
+}
+
+- (void)injectIQWithID:(NSString *)elementID
+{
+    XMPPIQ *iq = [XMPPIQ iqWithType:@"result" elementID:elementID];
+    [iq addAttributeWithName:@"from" stringValue:@"example.com"];
+
+    [self.stream injectElement:iq];
+}
+
+- (void)injectPresenceWithID:(NSString *)elementID
+{
+    XMPPPresence *presence = [XMPPPresence presence];
+    [presence addAttributeWithName:@"from" stringValue:@"alice@example.com/phone"];
+    [presence addAttributeWithName:@"id" stringValue:elementID];
+
+    [self.stream injectElement:presence];
+}
+
+- (void)testStanzasAreDeliveredInArrivalOrder
+{
+    [self addFiltersWithSecondFilteringMessagesOnly:NO];
+    self.secondFilter.heldElementID = @"m1";
+
+    for (NSUInteger i = 1; i <= 5; i++) {
+        [self injectMessageWithID:[NSString stringWithFormat:@"m%lu", (unsigned long)i]];
+    }
+
+    // The first filter gets through every stanza while the second one is still busy with m1
+    dispatch_sync(self.stream.xmppQueue, ^{});
+    dispatch_sync(self.firstFilter.queue, ^{});
+
+    XCTAssertEqualObjects(self.firstFilter.seenElementIDs, (@[@"m1", @"m2", @"m3", @"m4", @"m5"]));
+    XCTAssertEqualObjects([self events], (@[]));
+
+    dispatch_semaphore_signal(self.secondFilter.releaseSemaphore);
+    [self flushQueues];
+
+    XCTAssertEqualObjects(self.secondFilter.seenElementIDs, (@[@"m1", @"m2", @"m3", @"m4", @"m5"]));
+    XCTAssertEqualObjects([self events], (@[@"m1", @"m2", @"m3", @"m4", @"m5"]));
+}
+
+- (void)testFilteredStanzaIsReportedInOrder
+{
+    [self addFiltersWithSecondFilteringMessagesOnly:NO];
+    self.firstFilter.droppedElementID = @"m2";
+    self.secondFilter.heldElementID = @"m1";
+
+    [self injectMessageWithID:@"m1"];
+    [self injectMessageWithID:@"m2"];
+    [self injectMessageWithID:@"m3"];
+
+    // m2 is dropped by the first filter (in the middle of the chain) while m1 is still held by the second
+    dispatch_sync(self.stream.xmppQueue, ^{});
+    dispatch_sync(self.firstFilter.queue, ^{});
+    dispatch_sync(self.stream.xmppQueue, ^{});
+
+    XCTAssertEqualObjects([self events], (@[]));
+
+    dispatch_semaphore_signal(self.secondFilter.releaseSemaphore);
+    [self flushQueues];
+
+    XCTAssertEqualObjects(self.secondFilter.seenElementIDs, (@[@"m1", @"m3"]));
+    XCTAssertEqualObjects([self events], (@[@"m1", @"filtered", @"m3"]));
+}
+
+- (void)testMixedStanzasKeepTheirOrder
+{
+    // The second filter only filters messages, so the IQ and presence finish before the held message
+    [self addFiltersWithSecondFilteringMessagesOnly:YES];
+    self.secondFilter.heldElementID = @"m1";
+
+    [self injectMessageWithID:@"m1"];
+    [self injectIQWithID:@"i1"];
+    [self injectPresenceWithID:@"p1"];
+    [self injectMessageWithID:@"m2"];
+    [self injectIQWithID:@"i2"];
+
+    dispatch_sync(self.stream.xmppQueue, ^{});
+    dispatch_sync(self.firstFilter.queue, ^{});
+    dispatch_sync(self.stream.xmppQueue, ^{});
+    dispatch_sync(self.observerQueue, ^{});
+
+    XCTAssertEqualObjects(self.firstFilter.seenElementIDs, (@[@"m1", @"i1", @"p1", @"m2", @"i2"]));
+    XCTAssertEqualObjects([self events], (@[]));
+
+    dispatch_semaphore_signal(self.secondFilter.releaseSemaphore);
+    [self flushQueues];
+
+    XCTAssertEqualObjects(self.secondFilter.seenElementIDs, (@[@"m1", @"m2"]));
+    XCTAssertEqualObjects([self events], (@[@"m1", @"i1", @"p1", @"m2", @"i2"]));
+}
+
+- (void)testStanzaFromPreviousConnectionIsDropped
+{
+    [self addFiltersWithSecondFilteringMessagesOnly:NO];
+    self.secondFilter.heldElementID = @"m1";
+
+    [self injectMessageWithID:@"m1"];
+
+    dispatch_sync(self.stream.xmppQueue, ^{});
+    dispatch_sync(self.firstFilter.queue, ^{});
+
+    // Disconnect while m1 is still in the second filter, then reconnect
+    dispatch_sync(self.stream.xmppQueue, ^{
+        [self.stream socketDidDisconnect:nil withError:nil];
+        [self.stream setValue:@(STATE_XMPP_CONNECTED) forKey:@"state"];
+    });
+
+    [self injectMessageWithID:@"m2"];
+
+    dispatch_semaphore_signal(self.secondFilter.releaseSemaphore);
+    [self flushQueues];
+
+    XCTAssertEqualObjects(self.secondFilter.seenElementIDs, (@[@"m1", @"m2"]));
+    XCTAssertEqualObjects([self events], (@[@"m2"]));
+}
+
+@end
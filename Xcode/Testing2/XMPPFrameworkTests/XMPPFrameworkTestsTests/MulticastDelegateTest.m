@@ -161,6 +161,62 @@
     XCTAssertTrue(del3Seen);
 }
 
+- (void)testInvokeSelector
+{
+    OCMExpect([self.del1 foundString:@"The lucky number is" andNumber:@15]);
+    OCMExpect([self.del2 foundString:@"The lucky number is" andNumber:@15]);
+    OCMExpect([self.del3 foundString:@"The lucky number is" andNumber:@15]);
+    
+    [self.multicastDelegate invokeSelector:@selector(foundString:andNumber:)
+                                withObject:@"The lucky number is"
+                                withObject:@15];
+    
+    OCMVerifyAllWithDelay(self.del1, 0.05);
+    OCMVerifyAll(self.del2);
+    OCMVerifyAll(self.del3);
+}
+
+- (void)testRespondsToSelectorAfterAddAndRemove
+{
+    XCTAssertTrue([self.multicastDelegate hasDelegateThatRespondsToSelector:@selector(didSomething)]);
+    XCTAssertFalse([self.multicastDelegate hasDelegateThatRespondsToSelector:@selector(stringValue)]);
+    XCTAssertEqual([self.multicastDelegate countForSelector:@selector(didSomething)], 3);
+    
+    [self.multicastDelegate removeDelegate:self.del1];
+    [self.multicastDelegate removeDelegate:self.del2];
+    
+    XCTAssertEqual([self.multicastDelegate countForSelector:@selector(didSomething)], 1);
+    
+    [self.multicastDelegate removeDelegate:self.del3];
+    
+    XCTAssertFalse([self.multicastDelegate hasDelegateThatRespondsToSelector:@selector(didSomething)]);
+    
+    id other = @"I like cheese";
+    [self.multicastDelegate addDelegate:other delegateQueue:self.queue1];
+    
+    XCTAssertTrue([self.multicastDelegate hasDelegateThatRespondsToSelector:@selector(stringValue)]);
+    XCTAssertEqual([self.multicastDelegate countForSelector:@selector(stringValue)], 1);
+    XCTAssertEqual([self.multicastDelegate countForSelector:@selector(didSomething)], 0);
+}
+
+- (void)testDelegateEnumeratorForSelectorAfterRemove
+{
+    XCTAssertEqual([[self.multicastDelegate delegateEnumeratorForSelector:@selector(didSomething)] count], 3);
+    
+    [self.multicastDelegate removeDelegate:self.del2];
+    
+    GCDMulticastDelegateEnumerator *delegateEnum =
+        [self.multicastDelegate delegateEnumeratorForSelector:@selector(didSomething)];
+    
+    XCTAssertEqual([delegateEnum count], 2);
+    
+    id del;
+    while ([delegateEnum getNextDelegate:&del delegateQueue:NULL])
+    {
+        XCTAssertNotEqual(del, self.del2);
+    }
+}
+
 @end
 
 // NSProxy doesn't work correctly with weak references, so this test needs a different approach.
@@ -206,4 +262,117 @@
     XCTAssertEqual([self.multicastDelegate countForSelector:@selector(description)], 2);
 }
 
+- (void)testThatInvokeSelectorSkipsReleasedDelegates
+{
+    XCTAssertEqual([[self.multicastDelegate delegateEnumeratorForSelector:@selector(foundString:andNumber:)] count], 3);
+    
+    self.del1 = nil;
+    
+    [self.multicastDelegate invokeSelector:@selector(foundString:andNumber:) withObject:@"cheese" withObject:@15];
+    
+    XCTAssertEqual([self.multicastDelegate count], 2);
+    XCTAssertEqual([[self.multicastDelegate delegateEnumeratorForSelector:@selector(foundString:andNumber:)] count], 2);
+}
+
+@end
+
+// Compares NSInvocation forwarding with the direct invocation fast path,
+// using a delegate list comparable to an xmpp stream with 20 registered modules.
+
+@interface MulticastDelegatePerformanceTest : MulticastDelegateTestBase
+@property (strong) NSMutableArray *delegates;
+@end
+
+@implementation MulticastDelegatePerformanceTest
+
+static const NSUInteger kNumDelegates = 20;
+static const NSUInteger kNumInvocations = 5000;
+
+- (void)setUp {
+    [super setUp];
+    
+    self.queue1 = dispatch_queue_create("(perf)", NULL);
+    self.delegates = [NSMutableArray arrayWithCapacity:kNumDelegates];
+    
+    for (NSUInteger i = 0; i < kNumDelegates; i++)
+    {
+        MyMock *del = [[MyMock alloc] init];
+        
+        [self.delegates addObject:del];
+        [self.multicastDelegate addDelegate:del delegateQueue:self.queue1];
+    }
+}
+
+- (void)tearDown
+{
+#if !OS_OBJECT_USE_OBJC
+    dispatch_release(self.queue1);
+#endif
+}
+
+- (void)testForwardInvocationPerformance
+{
+    NSString *str = @"I like cheese";
+    NSNumber *num = @15;
+    
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < kNumInvocations; i++)
+        {
+            [self.multicastDelegate foundString:str andNumber:num];
+        }
+        dispatch_sync(self.queue1, ^{});
+    }];
+}
+
+- (void)testInvokeSelectorPerformance
+{
+    NSString *str = @"I like cheese";
+    NSNumber *num = @15;
+    
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < kNumInvocations; i++)
+        {
+            [self.multicastDelegate invokeSelector:@selector(foundString:andNumber:) withObject:str withObject:num];
+        }
+        dispatch_sync(self.queue1, ^{});
+    }];
+}
+
+/**
+ * Times both paths in the same run, and logs them side by side.
+ * The forwardInvocation: path is the one every delegate method went through before invokeSelector: existed,
+ * so this gives the before/after numbers without having to build the previous version.
+**/
+- (void)testInvokeSelectorVersusForwardInvocation
+{
+    NSString *str = @"I like cheese";
+    NSNumber *num = @15;
+
+    // Warm up (builds the responder cache, faults in the method signatures)
+    [self.multicastDelegate foundString:str andNumber:num];
+    [self.multicastDelegate invokeSelector:@selector(foundString:andNumber:) withObject:str withObject:num];
+    dispatch_sync(self.queue1, ^{});
+
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    for (NSUInteger i = 0; i < kNumInvocations; i++)
+    {
+        [self.multicastDelegate foundString:str andNumber:num];
+    }
+    dispatch_sync(self.queue1, ^{});
+    CFAbsoluteTime forwardInvocationTime = CFAbsoluteTimeGetCurrent() - start;
+
+    start = CFAbsoluteTimeGetCurrent();
+    for (NSUInteger i = 0; i < kNumInvocations; i++)
+    {
+        [self.multicastDelegate invokeSelector:@selector(foundString:andNumber:) withObject:str withObject:num];
+    }
+    dispatch_sync(self.queue1, ^{});
+    CFAbsoluteTime invokeSelectorTime = CFAbsoluteTimeGetCurrent() - start;
+
+    NSLog(@"%lu delegates, %lu invocations: forwardInvocation: %.1f ms, invokeSelector: %.1f ms (%.1fx)",
+          (unsigned long)kNumDelegates, (unsigned long)kNumInvocations,
+          forwardInvocationTime * 1000.0, invokeSelectorTime * 1000.0,
+          forwardInvocationTime / invokeSelectorTime);
+}
+
 @end
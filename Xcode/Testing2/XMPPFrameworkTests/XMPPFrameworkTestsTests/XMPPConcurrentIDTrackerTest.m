@@ -0,0 +1,167 @@
+//
+//  XMPPConcurrentIDTrackerTest.m
+//  XMPPFrameworkTests
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import <libkern/OSAtomic.h>
+#import "XMPPIDTracker.h"
+
+static char XMPPConcurrentIDTrackerTestQueueKey;
+
+@interface XMPPConcurrentIDTrackerTest : XCTestCase
+
+@property (strong) XMPPConcurrentIDTracker *tracker;
+
+#if !OS_OBJECT_USE_OBJC
+@property (assign) dispatch_queue_t queue;
+#else
+@property (strong) dispatch_queue_t queue;
+#endif
+
+@end
+
+@implementation XMPPConcurrentIDTrackerTest
+
+- (void)setUp
+{
+    [super setUp];
+
+    self.queue = dispatch_queue_create("XMPPConcurrentIDTrackerTest", NULL);
+    dispatch_queue_set_specific(self.queue, &XMPPConcurrentIDTrackerTestQueueKey, &XMPPConcurrentIDTrackerTestQueueKey, NULL);
+
+    self.tracker = [[XMPPConcurrentIDTracker alloc] initWithDispatchQueue:self.queue];
+}
+
+- (void)tearDown
+{
+    [self.tracker removeAllIDs];
+    self.tracker = nil;
+
+#if !OS_OBJECT_USE_OBJC
+    dispatch_release(self.queue);
+#endif
+
+    [super tearDown];
+}
+
+- (void)testInvokeFromAnotherQueue
+{
+    XCTestExpectation *expectation = [self expectationWithDescription:@"invoke"];
+
+    [self.tracker addID:@"abc" block:^(id obj, id <XMPPTrackingInfo> info) {
+
+        XCTAssertEqualObjects(obj, @"response");
+        XCTAssertEqualObjects(info.elementID, @"abc");
+        XCTAssertTrue(dispatch_get_specific(&XMPPConcurrentIDTrackerTestQueueKey) != NULL);
+        [expectation fulfill];
+
+    } timeout:0.0];
+
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        XCTAssertTrue([self.tracker invokeForID:@"abc" withObject:@"response"]);
+        XCTAssertFalse([self.tracker invokeForID:@"abc" withObject:@"response"]);
+    });
+
+    [self waitForExpectationsWithTimeout:2.0 handler:nil];
+
+    XCTAssertEqual([self.tracker numberOfIDs], 0);
+}
+
+- (void)testTimeoutFires
+{
+    XCTestExpectation *expectation = [self expectationWithDescription:@"timeout"];
+
+    [self.tracker addID:@"abc" block:^(id obj, id <XMPPTrackingInfo> info) {
+
+        XCTAssertNil(obj);
+        [expectation fulfill];
+
+    } timeout:0.2];
+
+    [self waitForExpectationsWithTimeout:2.0 handler:nil];
+
+    XCTAssertFalse([self.tracker isTrackingID:@"abc"]);
+}
+
+- (void)testRemoveCancelsTimeout
+{
+    __block BOOL fired = NO;
+
+    [self.tracker addID:@"abc" block:^(id obj, id <XMPPTrackingInfo> info) { fired = YES; } timeout:0.2];
+    [self.tracker removeID:@"abc"];
+
+    // Re-adding the same ID must not be claimed by the stale timeout of the removed one
+    [self.tracker addID:@"abc" block:^(id obj, id <XMPPTrackingInfo> info) { fired = YES; } timeout:30.0];
+
+    [NSThread sleepForTimeInterval:0.5];
+
+    dispatch_sync(self.queue, ^{
+        XCTAssertFalse(fired);
+    });
+    XCTAssertTrue([self.tracker isTrackingID:@"abc"]);
+}
+
+- (void)testEachIDIsClaimedExactlyOnce
+{
+    const NSUInteger count = 10000;
+
+    __block int32_t invocations = 0;
+    __block int32_t claims = 0;
+
+    dispatch_apply(4, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t iteration) {
+        for (NSUInteger i = iteration; i < count; i += 4)
+        {
+            [self.tracker addID:[NSString stringWithFormat:@"%lu", (unsigned long)i]
+                          block:^(id obj, id <XMPPTrackingInfo> info) { OSAtomicIncrement32(&invocations); }
+                        timeout:0.05];
+        }
+    });
+
+    // Race several invokers against each other (and against the timeouts)
+
+    dispatch_apply(8, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t iteration) {
+        for (NSUInteger i = 0; i < count; i++)
+        {
+            if ([self.tracker invokeForID:[NSString stringWithFormat:@"%lu", (unsigned long)i] withObject:nil]) {
+                OSAtomicIncrement32(&claims);
+            }
+        }
+    });
+
+    [NSThread sleepForTimeInterval:0.5];
+
+    dispatch_sync(self.queue, ^{
+        XCTAssertEqual(invocations, (int32_t)count);
+    });
+    XCTAssertTrue(claims <= (int32_t)count);
+    XCTAssertEqual([self.tracker numberOfIDs], 0);
+}
+
+- (void)testConcurrentInvokePerformance
+{
+    NSMutableArray *elementIDs = [NSMutableArray arrayWithCapacity:5000];
+    for (NSUInteger i = 0; i < 5000; i++)
+    {
+        [elementIDs addObject:[[NSUUID UUID] UUIDString]];
+    }
+
+    [self measureBlock:^{
+        for (NSString *elementID in elementIDs)
+        {
+            [self.tracker addID:elementID block:^(id obj, id <XMPPTrackingInfo> info) {} timeout:30.0];
+        }
+
+        dispatch_apply(4, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t iteration) {
+            for (NSUInteger i = iteration; i < [elementIDs count]; i += 4)
+            {
+                [self.tracker invokeForID:elementIDs[i] withObject:nil];
+            }
+        });
+
+        dispatch_sync(self.queue, ^{});
+    }];
+}
+
+@end
@@ -0,0 +1,127 @@
+//
+//  XMPPElementSerializerTest.m
+//  XMPPFrameworkTests
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "XMPPElementSerializer.h"
+#import "XMPPMessage.h"
+#import "XMPPPresence.h"
+#import "XMPPJID.h"
+#import "NSXMLElement+XMPP.h"
+
+#define BENCHMARK_ITERATIONS 10000
+
+@interface XMPPElementSerializerTest : XCTestCase
+
+@property (strong) XMPPElementSerializer *serializer;
+@property (strong) XMPPMessage *message;
+
+@end
+
+@implementation XMPPElementSerializerTest
+
+- (void)setUp {
+    [super setUp];
+    
+    self.serializer = [[XMPPElementSerializer alloc] init];
+    
+    XMPPJID *to = [XMPPJID jidWithString:@"romeo@montague.net/orchard"];
+    self.message = [XMPPMessage messageWithType:@"chat" to:to elementID:@"msg-1"];
+    [self.message addBody:@"Wherefore art thou, Romeo? <3 & \"more\" é漢"];
+    [self.message addChild:[NSXMLElement elementWithName:@"active" xmlns:@"http://jabber.org/protocol/chatstates"]];
+}
+
+- (void)tearDown {
+    self.serializer = nil;
+    self.message = nil;
+    [super tearDown];
+}
+
+- (void)assertSerializationMatchesCompactXMLString:(NSXMLElement *)element
+{
+    NSData *expected = [[element compactXMLString] dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *actual = [self.serializer dataForElement:element];
+    
+    XCTAssertEqualObjects(actual, expected, @"Serialized data differs from compactXMLString: %@", [element compactXMLString]);
+}
+
+- (void)testMessage
+{
+    [self assertSerializationMatchesCompactXMLString:self.message];
+}
+
+- (void)testEmptyElements
+{
+    XMPPPresence *presence = [XMPPPresence presence];
+    [self assertSerializationMatchesCompactXMLString:presence];
+    
+    NSXMLElement *ping = [NSXMLElement elementWithName:@"ping" xmlns:@"urn:xmpp:ping"];
+    [self assertSerializationMatchesCompactXMLString:ping];
+}
+
+- (void)testAttributeEscaping
+{
+    NSXMLElement *element = [NSXMLElement elementWithName:@"query" xmlns:@"jabber:iq:roster"];
+    NSXMLElement *item = [NSXMLElement elementWithName:@"item"];
+    [item addAttributeWithName:@"jid" stringValue:@"juliet@example.com"];
+    [item addAttributeWithName:@"name" stringValue:@"Juliet <\"Capulet\"> & co"];
+    [element addChild:item];
+    
+    [self assertSerializationMatchesCompactXMLString:element];
+}
+
+- (void)testBufferReuse
+{
+    // Serialize a large element, followed by a small one,
+    // to ensure no data from a previous stanza leaks into the next.
+    
+    NSMutableString *largeBody = [NSMutableString string];
+    for (int i = 0; i < 10000; i++) {
+        [largeBody appendString:@"0123456789"];
+    }
+    
+    XMPPMessage *largeMessage = [XMPPMessage messageWithType:@"chat"];
+    [largeMessage addBody:largeBody];
+    
+    [self assertSerializationMatchesCompactXMLString:largeMessage];
+    [self assertSerializationMatchesCompactXMLString:self.message];
+    [self assertSerializationMatchesCompactXMLString:largeMessage];
+}
+
+#pragma mark Benchmarks
+
+- (void)testPerformanceCompactXMLString
+{
+    XMPPMessage *message = self.message;
+    
+    [self measureBlock:^{
+        for (int i = 0; i < BENCHMARK_ITERATIONS; i++)
+        {
+            @autoreleasepool {
+                NSString *str = [message compactXMLString];
+                NSData *data = [str dataUsingEncoding:NSUTF8StringEncoding];
+                (void)data;
+            }
+        }
+    }];
+}
+
+- (void)testPerformanceSerializer
+{
+    XMPPMessage *message = self.message;
+    XMPPElementSerializer *serializer = self.serializer;
+    
+    [self measureBlock:^{
+        for (int i = 0; i < BENCHMARK_ITERATIONS; i++)
+        {
+            @autoreleasepool {
+                NSData *data = [serializer dataForElement:message];
+                (void)data;
+            }
+        }
+    }];
+}
+
+@end
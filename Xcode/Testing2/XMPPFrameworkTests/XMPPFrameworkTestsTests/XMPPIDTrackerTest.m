@@ -0,0 +1,157 @@
+//
+//  XMPPIDTrackerTest.m
+//  XMPPFrameworkTests
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "XMPPIDTracker.h"
+
+@interface XMPPIDTrackerTest : XCTestCase
+
+@property (strong) XMPPIDTracker *tracker;
+
+#if !OS_OBJECT_USE_OBJC
+@property (assign) dispatch_queue_t queue;
+#else
+@property (strong) dispatch_queue_t queue;
+#endif
+
+@end
+
+@implementation XMPPIDTrackerTest
+
+- (void)setUp
+{
+    [super setUp];
+
+    self.queue = dispatch_queue_create("XMPPIDTrackerTest", NULL);
+    self.tracker = [[XMPPIDTracker alloc] initWithDispatchQueue:self.queue];
+}
+
+- (void)tearDown
+{
+    dispatch_sync(self.queue, ^{
+        [self.tracker removeAllIDs];
+    });
+    self.tracker = nil;
+
+#if !OS_OBJECT_USE_OBJC
+    dispatch_release(self.queue);
+#endif
+
+    [super tearDown];
+}
+
+- (void)testTimeoutFires
+{
+    XCTestExpectation *expectation = [self expectationWithDescription:@"timeout"];
+
+    dispatch_async(self.queue, ^{
+        [self.tracker addID:@"abc" block:^(id obj, id <XMPPTrackingInfo> info) {
+
+            XCTAssertNil(obj);
+            XCTAssertEqualObjects(info.elementID, @"abc");
+            [expectation fulfill];
+
+        } timeout:0.2];
+    });
+
+    [self waitForExpectationsWithTimeout:2.0 handler:nil];
+}
+
+- (void)testTimeoutsFireInOrder
+{
+    XCTestExpectation *expectation = [self expectationWithDescription:@"timeouts"];
+
+    NSMutableArray *fired = [NSMutableArray array];
+
+    dispatch_async(self.queue, ^{
+        for (NSString *elementID in @[@"3", @"1", @"2"])
+        {
+            [self.tracker addID:elementID block:^(id obj, id <XMPPTrackingInfo> info) {
+
+                [fired addObject:info.elementID];
+                if ([fired count] == 3) {
+                    [expectation fulfill];
+                }
+
+            } timeout:(0.2 * [elementID intValue])];
+        }
+    });
+
+    [self waitForExpectationsWithTimeout:3.0 handler:nil];
+
+    NSArray *expected = @[@"1", @"2", @"3"];
+    XCTAssertEqualObjects(fired, expected);
+}
+
+- (void)testInvokeCancelsTimeout
+{
+    __block NSUInteger invocations = 0;
+
+    dispatch_sync(self.queue, ^{
+        [self.tracker addID:@"abc" block:^(id obj, id <XMPPTrackingInfo> info) {
+
+            XCTAssertEqualObjects(obj, @"response");
+            invocations++;
+
+        } timeout:0.2];
+
+        XCTAssertTrue([self.tracker invokeForID:@"abc" withObject:@"response"]);
+        XCTAssertEqual([self.tracker numberOfIDs], 0);
+    });
+
+    [NSThread sleepForTimeInterval:0.5];
+
+    dispatch_sync(self.queue, ^{
+        XCTAssertEqual(invocations, 1);
+    });
+}
+
+- (void)testRemoveCancelsTimeout
+{
+    __block BOOL fired = NO;
+
+    dispatch_sync(self.queue, ^{
+        for (NSUInteger i = 0; i < 100; i++)
+        {
+            [self.tracker addID:[NSString stringWithFormat:@"%lu", (unsigned long)i]
+                          block:^(id obj, id <XMPPTrackingInfo> info) { fired = YES; }
+                        timeout:0.2];
+        }
+
+        [self.tracker removeID:@"50"];
+        [self.tracker removeAllIDs];
+    });
+
+    [NSThread sleepForTimeInterval:0.5];
+
+    dispatch_sync(self.queue, ^{
+        XCTAssertFalse(fired);
+    });
+}
+
+- (void)testAddRemovePerformance
+{
+    NSMutableArray *elementIDs = [NSMutableArray arrayWithCapacity:5000];
+    for (NSUInteger i = 0; i < 5000; i++)
+    {
+        [elementIDs addObject:[[NSUUID UUID] UUIDString]];
+    }
+
+    [self measureBlock:^{
+        dispatch_sync(self.queue, ^{
+            for (NSString *elementID in elementIDs)
+            {
+                [self.tracker addID:elementID block:^(id obj, id <XMPPTrackingInfo> info) {} timeout:30.0];
+            }
+            for (NSString *elementID in elementIDs)
+            {
+                [self.tracker invokeForID:elementID withObject:nil];
+            }
+        });
+    }];
+}
+
+@end
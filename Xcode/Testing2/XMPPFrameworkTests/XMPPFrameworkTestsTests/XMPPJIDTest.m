@@ -0,0 +1,192 @@
+//
+//  XMPPJIDTest.m
+//  XMPPFrameworkTests
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "XMPPJID.h"
+
+@interface XMPPJIDTest : XCTestCase
+@end
+
+@implementation XMPPJIDTest
+
+- (void)setUp
+{
+    [super setUp];
+
+    [XMPPJID setJIDCacheCapacity:1024];
+}
+
+- (void)tearDown
+{
+    [XMPPJID setJIDCacheCapacity:1024];
+
+    [super tearDown];
+}
+
+- (void)testCachedJIDIsReused
+{
+    XMPPJID *jid1 = [XMPPJID jidWithString:@"User@Example.com/Phone"];
+    XMPPJID *jid2 = [XMPPJID jidWithString:@"User@Example.com/Phone"];
+
+    XCTAssertEqualObjects([jid1 full], @"user@example.com/Phone");
+    XCTAssertTrue(jid1 == jid2);
+
+    XCTAssertEqual([XMPPJID jidCacheMissCount], 1);
+    XCTAssertEqual([XMPPJID jidCacheHitCount], 1);
+}
+
+- (void)testMutableKeyIsCopied
+{
+    NSMutableString *jidStr = [NSMutableString stringWithString:@"alice@example.com"];
+    XMPPJID *jid = [XMPPJID jidWithString:jidStr];
+
+    [jidStr setString:@"bob@example.com"];
+
+    XCTAssertEqualObjects([[XMPPJID jidWithString:@"alice@example.com"] bare], @"alice@example.com");
+    XCTAssertEqualObjects([[XMPPJID jidWithString:jidStr] bare], @"bob@example.com");
+    XCTAssertTrue([XMPPJID jidWithString:@"alice@example.com"] == jid);
+}
+
+- (void)testInvalidJIDIsNotCached
+{
+    XCTAssertNil([XMPPJID jidWithString:@"user@"]);
+    XCTAssertNil([XMPPJID jidWithString:@"user@"]);
+
+    XCTAssertEqual([XMPPJID jidCacheHitCount], 0);
+}
+
+- (void)testEvictionKeepsReferencedEntries
+{
+    [XMPPJID setJIDCacheCapacity:4];
+
+    XMPPJID *hot = [XMPPJID jidWithString:@"hot@example.com"];
+
+    for (NSUInteger i = 0; i < 100; i++)
+    {
+        [XMPPJID jidWithString:[NSString stringWithFormat:@"cold%lu@example.com", (unsigned long)i]];
+        XCTAssertTrue([XMPPJID jidWithString:@"hot@example.com"] == hot);
+    }
+
+    XCTAssertEqual([XMPPJID jidCacheHitCount], 100);
+}
+
+- (void)testDisabledCache
+{
+    [XMPPJID setJIDCacheCapacity:0];
+
+    XMPPJID *jid1 = [XMPPJID jidWithString:@"user@example.com"];
+    XMPPJID *jid2 = [XMPPJID jidWithString:@"user@example.com"];
+
+    XCTAssertEqualObjects(jid1, jid2);
+    XCTAssertFalse(jid1 == jid2);
+    XCTAssertEqual([XMPPJID jidCacheHitCount], 0);
+}
+
+- (void)testHashIsStable
+{
+    XMPPJID *jid = [XMPPJID jidWithUser:@"user" domain:@"example.com" resource:@"phone"];
+    XMPPJID *same = [XMPPJID jidWithString:@"user@example.com/phone"];
+
+    XCTAssertEqual([jid hash], [jid hash]);
+    XCTAssertEqual([jid hash], [same hash]);
+    XCTAssertEqualObjects(jid, same);
+}
+
+- (void)testParts
+{
+    XMPPJID *full = [XMPPJID jidWithString:@"user@example.com/phone/1"];
+    XCTAssertEqualObjects([full user], @"user");
+    XCTAssertEqualObjects([full domain], @"example.com");
+    XCTAssertEqualObjects([full resource], @"phone/1");
+    XCTAssertEqualObjects([full bare], @"user@example.com");
+    XCTAssertEqualObjects([full full], @"user@example.com/phone/1");
+    XCTAssertTrue([full isFullWithUser]);
+
+    XMPPJID *server = [XMPPJID jidWithString:@"example.com/admin"];
+    XCTAssertNil([server user]);
+    XCTAssertEqualObjects([server domain], @"example.com");
+    XCTAssertEqualObjects([server resource], @"admin");
+    XCTAssertEqualObjects([server bare], @"example.com");
+    XCTAssertTrue([server isServer]);
+
+    XMPPJID *bare = [full bareJID];
+    XCTAssertTrue([bare isBareWithUser]);
+    XCTAssertTrue([full bareJID] == bare);
+    XCTAssertTrue([bare bareJID] == bare);
+
+    XCTAssertEqualObjects([[full domainJID] full], @"example.com");
+    XCTAssertEqualObjects([[full jidWithNewResource:@"laptop"] full], @"user@example.com/laptop");
+}
+
+- (void)testCompareOptions
+{
+    XMPPJID *jid1 = [XMPPJID jidWithString:@"user@example.com/phone"];
+    XMPPJID *jid2 = [XMPPJID jidWithString:@"user@example.com/laptop"];
+    XMPPJID *jid3 = [XMPPJID jidWithString:@"other@example.com/phone"];
+    XMPPJID *jid4 = [XMPPJID jidWithString:@"example.com/phone"];
+
+    XCTAssertFalse([jid1 isEqualToJID:jid2]);
+    XCTAssertTrue([jid1 isEqualToJID:jid2 options:XMPPJIDCompareBare]);
+    XCTAssertTrue([jid1 isEqualToJID:[jid1 bareJID] options:XMPPJIDCompareBare]);
+    XCTAssertFalse([jid1 isEqualToJID:jid3 options:XMPPJIDCompareBare]);
+
+    XCTAssertTrue([jid1 isEqualToJID:jid3 options:XMPPJIDCompareDomain]);
+    XCTAssertTrue([jid1 isEqualToJID:jid4 options:XMPPJIDCompareDomain]);
+    XCTAssertTrue([jid1 isEqualToJID:jid3 options:XMPPJIDCompareResource]);
+    XCTAssertTrue([jid1 isEqualToJID:jid4 options:(XMPPJIDCompareDomain | XMPPJIDCompareResource)]);
+    XCTAssertFalse([jid1 isEqualToJID:jid4 options:XMPPJIDCompareUser]);
+    XCTAssertFalse([jid1 isEqualToJID:jid2 options:XMPPJIDCompareResource]);
+
+    XCTAssertEqualObjects(jid1, [XMPPJID jidWithUser:@"user" domain:@"example.com" resource:@"phone"]);
+}
+
+- (void)testCoding
+{
+    XMPPJID *jid = [XMPPJID jidWithString:@"user@example.com/phone"];
+
+    XMPPJID *decoded = [NSKeyedUnarchiver unarchiveObjectWithData:[NSKeyedArchiver archivedDataWithRootObject:jid]];
+
+    XCTAssertEqualObjects(decoded, jid);
+    XCTAssertEqualObjects([decoded resource], @"phone");
+}
+
+- (void)testConcurrentAccess
+{
+    [XMPPJID setJIDCacheCapacity:16];
+
+    dispatch_apply(8, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t iteration) {
+        for (NSUInteger i = 0; i < 1000; i++)
+        {
+            NSString *jidStr = [NSString stringWithFormat:@"user%lu@example.com/%zu", (unsigned long)(i % 32), iteration];
+            XCTAssertEqualObjects([[XMPPJID jidWithString:jidStr] full], jidStr);
+        }
+    });
+
+    XCTAssertEqual([XMPPJID jidCacheHitCount] + [XMPPJID jidCacheMissCount], 8000);
+}
+
+- (void)testParsePerformance
+{
+    NSMutableArray *jidStrs = [NSMutableArray arrayWithCapacity:300];
+    for (NSUInteger i = 0; i < 300; i++)
+    {
+        [jidStrs addObject:[NSString stringWithFormat:@"contact%lu@example.com/resource", (unsigned long)i]];
+    }
+
+    // Mimics a presence storm, where the same few hundred JIDs are parsed over and over again
+
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 100; i++)
+        {
+            for (NSString *jidStr in jidStrs)
+            {
+                [XMPPJID jidWithString:jidStr];
+            }
+        }
+    }];
+}
+
+@end
@@ -0,0 +1,174 @@
+//
+//  XMPPParserTest.m
+//  XMPPFrameworkTests
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "XMPPParser.h"
+
+#define PRESENCE_COUNT 500
+
+/**
+ * Delegate that receives elements one at a time.
+**/
+@interface XMPPParserTestDelegate : NSObject <XMPPParserDelegate>
+
+@property (strong) NSMutableArray *elements;
+@property (strong) NSMutableArray *infos;
+#if !OS_OBJECT_USE_OBJC
+@property (assign) dispatch_semaphore_t semaphore;
+#else
+@property (strong) dispatch_semaphore_t semaphore;
+#endif
+
+@end
+
+@implementation XMPPParserTestDelegate
+
+- (id)init
+{
+    if ((self = [super init]))
+    {
+        _elements = [NSMutableArray array];
+        _infos = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (void)xmppParser:(XMPPParser *)sender didReadElement:(NSXMLElement *)element info:(XMPPParserElementInfo *)info
+{
+    [self.elements addObject:element];
+    [self.infos addObject:info];
+}
+
+- (void)xmppParserDidParseData:(XMPPParser *)sender
+{
+    dispatch_semaphore_signal(self.semaphore);
+}
+
+@end
+
+/**
+ * Delegate that receives all the elements from a chunk of data in a single batch.
+**/
+@interface XMPPParserBatchTestDelegate : XMPPParserTestDelegate
+@end
+
+@implementation XMPPParserBatchTestDelegate
+
+- (void)xmppParser:(XMPPParser *)sender didReadElements:(NSArray *)elements info:(NSArray *)infoArray
+{
+    [self.elements addObjectsFromArray:elements];
+    [self.infos addObjectsFromArray:infoArray];
+}
+
+@end
+
+@interface XMPPParserTest : XCTestCase
+
+@property (strong) NSData *header;
+@property (strong) NSData *chunk;
+
+@end
+
+@implementation XMPPParserTest
+
+- (void)setUp {
+    [super setUp];
+    
+    NSString *header = @"<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams' version='1.0'>";
+    self.header = [header dataUsingEncoding:NSUTF8StringEncoding];
+    
+    NSMutableString *chunk = [NSMutableString string];
+    [chunk appendString:@"<iq type='result' id='bind_1' to='romeo@montague.net/orchard'/>"];
+    for (int i = 0; i < PRESENCE_COUNT; i++)
+    {
+        [chunk appendFormat:@"<presence from='contact%d@example.com/res' to='romeo@montague.net/orchard'>"
+                            @"<show>away</show><status>Busy &amp; away</status><priority>%d</priority></presence>", i, i % 10];
+    }
+    [chunk appendString:@"<message type='chat' id='m1' from='juliet@capulet.com/balcony'><body>Hi</body></message>"];
+    
+    self.chunk = [chunk dataUsingEncoding:NSUTF8StringEncoding];
+}
+
+- (void)parseWithDelegate:(XMPPParserTestDelegate *)delegate
+{
+    dispatch_queue_t delegateQueue = dispatch_queue_create("XMPPParserTest", NULL);
+    
+    delegate.semaphore = dispatch_semaphore_create(0);
+    
+    XMPPParser *parser = [[XMPPParser alloc] initWithDelegate:delegate delegateQueue:delegateQueue];
+    
+    [parser parseData:self.header];
+    [parser parseData:self.chunk];
+    
+    dispatch_semaphore_wait(delegate.semaphore, DISPATCH_TIME_FOREVER);
+    dispatch_semaphore_wait(delegate.semaphore, DISPATCH_TIME_FOREVER);
+    
+    [parser setDelegate:nil delegateQueue:NULL];
+    
+#if !OS_OBJECT_USE_OBJC
+    dispatch_release(delegate.semaphore);
+    dispatch_release(delegateQueue);
+#endif
+}
+
+- (void)verifyDelegate:(XMPPParserTestDelegate *)delegate
+{
+    XCTAssertEqual([delegate.elements count], (NSUInteger)(PRESENCE_COUNT + 2));
+    XCTAssertEqual([delegate.infos count], (NSUInteger)(PRESENCE_COUNT + 2));
+    
+    XMPPParserElementInfo *iqInfo = delegate.infos[0];
+    XCTAssertEqual(iqInfo.kind, XMPPParserElementKindIQ);
+    XCTAssertEqualObjects(iqInfo.type, @"result");
+    XCTAssertEqualObjects(iqInfo.elementID, @"bind_1");
+    XCTAssertEqualObjects(iqInfo.toStr, @"romeo@montague.net/orchard");
+    XCTAssertNil(iqInfo.fromStr);
+    
+    XMPPParserElementInfo *presenceInfo = delegate.infos[1];
+    XCTAssertEqual(presenceInfo.kind, XMPPParserElementKindPresence);
+    XCTAssertEqualObjects(presenceInfo.fromStr, @"contact0@example.com/res");
+    XCTAssertNil(presenceInfo.type);
+    
+    NSXMLElement *presence = delegate.elements[1];
+    XCTAssertEqualObjects([[presence elementForName:@"status"] stringValue], @"Busy & away");
+    
+    XMPPParserElementInfo *messageInfo = [delegate.infos lastObject];
+    XCTAssertEqual(messageInfo.kind, XMPPParserElementKindMessage);
+    XCTAssertEqualObjects(messageInfo.elementID, @"m1");
+}
+
+- (void)testElementDelivery
+{
+    XMPPParserTestDelegate *delegate = [[XMPPParserTestDelegate alloc] init];
+    [self parseWithDelegate:delegate];
+    [self verifyDelegate:delegate];
+}
+
+- (void)testBatchElementDelivery
+{
+    XMPPParserBatchTestDelegate *delegate = [[XMPPParserBatchTestDelegate alloc] init];
+    [self parseWithDelegate:delegate];
+    [self verifyDelegate:delegate];
+}
+
+#pragma mark Benchmarks
+
+- (void)testPerformanceElementDelivery
+{
+    [self measureBlock:^{
+        XMPPParserTestDelegate *delegate = [[XMPPParserTestDelegate alloc] init];
+        [self parseWithDelegate:delegate];
+    }];
+}
+
+- (void)testPerformanceBatchElementDelivery
+{
+    [self measureBlock:^{
+        XMPPParserBatchTestDelegate *delegate = [[XMPPParserBatchTestDelegate alloc] init];
+        [self parseWithDelegate:delegate];
+    }];
+}
+
+@end
@@ -0,0 +1,109 @@
+//
+//  XMPPStringPrepTest.m
+//  XMPPFrameworkTests
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "XMPPStringPrep.h"
+#import "stringprep.h"
+
+typedef int (*XMPPStringPrepTestFunction)(char *buf, size_t size);
+
+static int XMPPStringPrepTestNodeprep(char *buf, size_t size)     { return stringprep_xmpp_nodeprep(buf, size); }
+static int XMPPStringPrepTestNameprep(char *buf, size_t size)     { return stringprep_nameprep(buf, size); }
+static int XMPPStringPrepTestResourceprep(char *buf, size_t size) { return stringprep_xmpp_resourceprep(buf, size); }
+
+@interface XMPPStringPrepTest : XCTestCase
+@end
+
+@implementation XMPPStringPrepTest
+
+/**
+ * Preps the string directly with libidn (the way XMPPStringPrep always used to).
+**/
+- (NSString *)libidnPrep:(NSString *)str function:(XMPPStringPrepTestFunction)function
+{
+    char buf[1024];
+    strncpy(buf, [str UTF8String], sizeof(buf));
+
+    if (function(buf, sizeof(buf)) != 0) return nil;
+
+    return [NSString stringWithUTF8String:buf];
+}
+
+- (NSArray *)corpus
+{
+    NSMutableArray *corpus = [NSMutableArray array];
+
+    [corpus addObjectsFromArray:@[@"", @"user", @"User", @"USER", @"example.com", @"Example.COM", @"Phone",
+                                  @"user name", @"us\"er", @"us&er", @"us'er", @"us/er", @"us:er", @"us<er", @"us>er",
+                                  @"us@er", @"tab\there", @"del\x7f", @"résumé", @"STRASSE", @"Straße",
+                                  @"İstanbul", @"­soft", @"אב", @"ﬁ", @"日本語", @"abcdefghijklmnopqrstuvwxyz0123456789",
+                                  @"ABCDEFGHIJKLMNOPQRSTUVWXYZ-._~!$()*+,;=[]{}|^`?#%"]];
+
+    // Random strings, mostly printable ASCII, with the occasional space, control, or non-ASCII character.
+    // Lengths straddle the 16 byte blocks of the vectorized scan.
+
+    srandom(1234);
+
+    for (NSUInteger i = 0; i < 20000; i++)
+    {
+        NSUInteger length = random() % 48;
+        NSMutableString *str = [NSMutableString stringWithCapacity:length];
+
+        for (NSUInteger j = 0; j < length; j++)
+        {
+            long r = random() % 100;
+            unichar c;
+
+            if (r < 97)
+                c = (unichar)(0x21 + (random() % (0x7F - 0x21)));
+            else if (r < 99)
+                c = (unichar)(random() % 0x21);
+            else
+                c = (unichar)(0x80 + (random() % 0x200));
+
+            [str appendFormat:@"%C", c];
+        }
+
+        [corpus addObject:str];
+    }
+
+    return corpus;
+}
+
+- (void)testMatchesLibidn
+{
+    for (NSString *str in [self corpus])
+    {
+        XCTAssertEqualObjects([XMPPStringPrep prepNode:str],
+                              [self libidnPrep:str function:XMPPStringPrepTestNodeprep], @"nodeprep: %@", str);
+
+        XCTAssertEqualObjects([XMPPStringPrep prepDomain:str],
+                              [self libidnPrep:str function:XMPPStringPrepTestNameprep], @"nameprep: %@", str);
+
+        XCTAssertEqualObjects([XMPPStringPrep prepResource:str],
+                              [self libidnPrep:str function:XMPPStringPrepTestResourceprep], @"resourceprep: %@", str);
+    }
+}
+
+- (void)testPrepPerformance
+{
+    NSMutableArray *nodes = [NSMutableArray arrayWithCapacity:1000];
+    for (NSUInteger i = 0; i < 1000; i++)
+    {
+        [nodes addObject:[NSString stringWithFormat:@"contact%lu", (unsigned long)i]];
+    }
+
+    [self measureBlock:^{
+        for (NSString *node in nodes)
+        {
+            [XMPPStringPrep prepNode:node];
+            [XMPPStringPrep prepDomain:@"conference.example.com"];
+            [XMPPStringPrep prepResource:@"Phone-5A3F"];
+        }
+    }];
+}
+
+@end